@@ -0,0 +1,190 @@
+/* c-basic-offset: 4 */
+
+/*
+ * Measure the throughput of Limba's SHA-256 implementations, to compare
+ * the portable backend with the SHA-NI one:
+ *
+ *   make checksum-bench
+ *   ./contrib/tools/checksum-bench [SIZE_MB] [FILES] [ROUNDS]
+ *
+ * The input files are generated from a fixed seed, so every run hashes the
+ * same data. One file of SIZE_MB is hashed on its own, and the same amount
+ * of data split into FILES files is hashed one after another and using the
+ * threaded li_checksum_compute_for_files().
+ * The files are read from the page cache, so this measures the CPU cost
+ * of hashing, not the disk. The best of ROUNDS runs is reported, and the
+ * digests of all backends are checked to be identical.
+ *
+ * Backends not supported by the CPU are skipped. The backend is switched
+ * at runtime, so LIMBA_SHA256_BACKEND has no effect here.
+ */
+
+#define LI_COMPILATION
+#include <stdio.h>
+#include <stdlib.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "li-checksum.h"
+
+#define SEED 20160214
+
+static const char *backends[] = { "generic", "sha-ni", NULL };
+
+static char *write_file(const char *dir, const char *name, GRand *rand, gsize size)
+{
+    char *fname;
+    guint32 *data;
+    gsize i;
+    GError *error = NULL;
+
+    data = g_malloc(size + sizeof(guint32));
+    for (i = 0; i < size / sizeof(guint32) + 1; i++)
+	data[i] = g_rand_int(rand);
+
+    fname = g_build_filename(dir, name, NULL);
+    if (!g_file_set_contents(fname, (const char *) data, size, &error)) {
+	fprintf(stderr, "checksum-bench: unable to write %s: %s\n", fname, error->message);
+	exit(2);
+    }
+    g_free(data);
+
+    return fname;
+}
+
+static double now_ns(void)
+{
+    return g_get_monotonic_time() * 1e3;
+}
+
+static double mb_per_sec(gsize size, double ns)
+{
+    return (size / (1024.0 * 1024.0)) / (ns / 1e9);
+}
+
+/* check the digests against the ones of the first backend */
+static void check_digest(char **ref, const char *digest, const char *what)
+{
+    if (digest == NULL) {
+	fprintf(stderr, "checksum-bench: unable to hash %s\n", what);
+	exit(3);
+    }
+    if (*ref == NULL) {
+	*ref = g_strdup(digest);
+    } else if (g_strcmp0(*ref, digest) != 0) {
+	fprintf(stderr, "checksum-bench: digest mismatch for %s: %s != %s\n", what, digest, *ref);
+	exit(3);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int size_mb = 256;
+    int n_files = 64;
+    int rounds = 5;
+    int b, r;
+    guint i;
+    gsize size;
+    char *tmp_dir;
+    char *big_file;
+    char *ref_big = NULL;
+    char **ref_files;
+    GPtrArray *files;
+    GRand *rand;
+    GError *error = NULL;
+
+    if (argc >= 2)
+	size_mb = atoi(argv[1]);
+    if (argc >= 3)
+	n_files = atoi(argv[2]);
+    if (argc >= 4)
+	rounds = atoi(argv[3]);
+    if (size_mb <= 0 || n_files <= 0 || rounds <= 0) {
+	fprintf(stderr, "Usage: checksum-bench [SIZE_MB] [FILES] [ROUNDS]\n");
+	return 1;
+    }
+    size = (gsize) size_mb * 1024 * 1024;
+
+    tmp_dir = g_dir_make_tmp("checksum-bench-XXXXXX", &error);
+    if (tmp_dir == NULL) {
+	fprintf(stderr, "checksum-bench: unable to create temporary directory: %s\n", error->message);
+	return 2;
+    }
+
+    rand = g_rand_new_with_seed(SEED);
+    big_file = write_file(tmp_dir, "single.bin", rand, size);
+    files = g_ptr_array_new_with_free_func(g_free);
+    for (i = 0; i < (guint) n_files; i++) {
+	char name[32];
+
+	g_snprintf(name, sizeof(name), "part-%04u.bin", i);
+	g_ptr_array_add(files, write_file(tmp_dir, name, rand, size / n_files));
+    }
+    g_rand_free(rand);
+    ref_files = g_new0(char *, n_files);
+
+    printf("%d MiB, %d files, %d rounds, %u threads\n",
+	   size_mb, n_files, rounds, g_get_num_processors());
+
+    for (b = 0; backends[b] != NULL; b++) {
+	double single_ns = 0, serial_ns = 0, threaded_ns = 0;
+
+	if (!li_checksum_set_backend(backends[b])) {
+	    printf("%-8s  not supported by this CPU\n", backends[b]);
+	    continue;
+	}
+
+	for (r = 0; r < rounds; r++) {
+	    double start, t;
+	    char *digest;
+	    GPtrArray *digests;
+
+	    start = now_ns();
+	    digest = li_checksum_compute_for_file(big_file);
+	    t = now_ns() - start;
+	    if (r == 0 || t < single_ns)
+		single_ns = t;
+	    check_digest(&ref_big, digest, big_file);
+	    g_free(digest);
+
+	    start = now_ns();
+	    for (i = 0; i < files->len; i++) {
+		digest = li_checksum_compute_for_file(g_ptr_array_index(files, i));
+		check_digest(&ref_files[i], digest, g_ptr_array_index(files, i));
+		g_free(digest);
+	    }
+	    t = now_ns() - start;
+	    if (r == 0 || t < serial_ns)
+		serial_ns = t;
+
+	    start = now_ns();
+	    digests = li_checksum_compute_for_files(files);
+	    t = now_ns() - start;
+	    if (r == 0 || t < threaded_ns)
+		threaded_ns = t;
+	    for (i = 0; i < files->len; i++)
+		check_digest(&ref_files[i], g_ptr_array_index(digests, i), g_ptr_array_index(files, i));
+	    g_ptr_array_unref(digests);
+	}
+
+	printf("%-8s  single file: %8.1f MiB/s  serial: %8.1f MiB/s  threaded: %8.1f MiB/s\n",
+	       backends[b],
+	       mb_per_sec(size, single_ns),
+	       mb_per_sec((size / n_files) * n_files, serial_ns),
+	       mb_per_sec((size / n_files) * n_files, threaded_ns));
+    }
+
+    g_unlink(big_file);
+    for (i = 0; i < files->len; i++) {
+	g_unlink(g_ptr_array_index(files, i));
+	g_free(ref_files[i]);
+    }
+    g_rmdir(tmp_dir);
+
+    g_free(ref_files);
+    g_free(ref_big);
+    g_free(big_file);
+    g_free(tmp_dir);
+    g_ptr_array_unref(files);
+
+    return 0;
+}
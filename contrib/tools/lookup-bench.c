@@ -0,0 +1,91 @@
+/* c-basic-offset: 4 */
+
+/*
+ * Measure the cost of path lookups in a directory tree, e.g. the /app
+ * directory of a Limba application environment, to compare stacked and
+ * flattened runtimes:
+ *
+ *   runapp foo/1.0:sh -c "lookup-bench /app"
+ *   LIMBA_FLAT_RUNTIME=0 runapp foo/1.0:sh -c "lookup-bench /app"
+ *
+ * Both successful lookups (open() of existing files) and failed lookups
+ * (like the dynamic linker probing library paths) are timed.
+ */
+
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <time.h>
+
+#define MAX_FILES 20000
+
+static char *files[MAX_FILES];
+static int n_files = 0;
+
+static int collect(const char *path, const struct stat *sb, int type, struct FTW *ftw)
+{
+    if (type == FTW_F && n_files < MAX_FILES)
+        files[n_files++] = strdup(path);
+    return 0;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+    int rounds = 10;
+    int i, r;
+    double start, hit_ns, miss_ns;
+    char missing[4096];
+
+    if (argc < 2) {
+	fprintf(stderr, "Usage: lookup-bench DIRECTORY [ROUNDS]\n");
+	return 1;
+    }
+    if (argc >= 3)
+	rounds = atoi(argv[2]);
+
+    if (nftw(argv[1], collect, 32, FTW_PHYS) != 0) {
+	fprintf(stderr, "lookup-bench: unable to scan %s\n", argv[1]);
+	return 2;
+    }
+    if (n_files == 0) {
+	fprintf(stderr, "lookup-bench: no files found in %s\n", argv[1]);
+	return 2;
+    }
+
+    start = now_ns();
+    for (r = 0; r < rounds; r++) {
+	for (i = 0; i < n_files; i++) {
+	    int fd = open(files[i], O_RDONLY | O_CLOEXEC);
+	    if (fd >= 0)
+		close(fd);
+	}
+    }
+    hit_ns = (now_ns() - start) / ((double) rounds * n_files);
+
+    start = now_ns();
+    for (r = 0; r < rounds; r++) {
+	for (i = 0; i < n_files; i++) {
+	    snprintf(missing, sizeof(missing), "%s.missing", files[i]);
+	    int fd = open(missing, O_RDONLY | O_CLOEXEC);
+	    if (fd >= 0)
+		close(fd);
+	}
+    }
+    miss_ns = (now_ns() - start) / ((double) rounds * n_files);
+
+    printf("files: %d  rounds: %d\n", n_files, rounds);
+    printf("open (existing): %10.0f ns\n", hit_ns);
+    printf("open (missing):  %10.0f ns\n", miss_ns);
+
+    return 0;
+}
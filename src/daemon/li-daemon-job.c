@@ -26,27 +26,23 @@
 #include "config.h"
 #include "li-daemon-job.h"
 
-typedef enum {
-	LI_JOB_KIND_NONE,
-	LI_JOB_KIND_REFRESH_CACHE,
-	LI_JOB_KIND_INSTALL,
-	LI_JOB_KIND_INSTALL_LOCAL,
-	LI_JOB_KIND_REMOVE,
-	LI_JOB_KIND_UPDATE,
-	LI_JOB_KIND_UPDATE_ALL,
-	/*< private >*/
-	LI_JOB_KIND_LAST
-} LiJobKind;
+#include "li-progress.h"
 
 typedef struct
 {
 	LiProxyManager *mgr_bus;
 	GThread *thread;
-	LiJobKind kind;
+	LiDaemonJobKind kind;
+	guint id;
 	gboolean running;
 
 	gchar *pkid;
 	gchar *local_fname;
+
+	LiDaemonJobDoneFunc done_func;
+	gpointer done_data;
+
+	LiProgressAggregator *progress;
 } LiDaemonJobPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (LiDaemonJob, li_daemon_job, G_TYPE_OBJECT)
@@ -67,10 +63,30 @@ li_daemon_job_finalize (GObject *object)
 		g_free (priv->pkid);
 	if (priv->local_fname != NULL)
 		g_free (priv->local_fname);
+	li_progress_aggregator_free (priv->progress);
 
 	G_OBJECT_CLASS (li_daemon_job_parent_class)->finalize (object);
 }
 
+/**
+ * li_daemon_job_progress_emit_cb:
+ *
+ * Called by the progress aggregator with coalesced updates.
+ */
+static void
+li_daemon_job_progress_emit_cb (const gchar *id, guint percentage, guint64 bytes_done, guint64 bytes_total, guint64 rate, gpointer user_data)
+{
+	LiDaemonJob *job = LI_DAEMON_JOB (user_data);
+	LiDaemonJobPrivate *priv = GET_PRIVATE (job);
+
+	if (id == NULL)
+		id = "";
+	li_proxy_manager_emit_job_progress (priv->mgr_bus, priv->id, id, percentage);
+
+	/* compatibility with clients which only know about a single job */
+	li_proxy_manager_emit_progress (priv->mgr_bus, id, percentage);
+}
+
 /**
  * li_daemon_job_init:
  **/
@@ -80,18 +96,44 @@ li_daemon_job_init (LiDaemonJob *job)
 	LiDaemonJobPrivate *priv = GET_PRIVATE (job);
 
 	priv->running = FALSE;
-	priv->kind = LI_JOB_KIND_NONE;
+	priv->kind = LI_DAEMON_JOB_KIND_NONE;
+	priv->progress = li_progress_aggregator_new (LI_PROGRESS_DEFAULT_INTERVAL_MS,
+							li_daemon_job_progress_emit_cb,
+							job);
 }
 
 /**
  * li_daemon_job_progress_proxy_cb:
+ *
+ * Progress is reported at a much higher rate than any client wants to
+ * see it on the bus, so we feed it through an aggregator which only emits
+ * the most recent state of every item once per time window.
  */
 static void
-li_daemon_job_progress_proxy_cb (LiManager *mgr, guint percentage, const gchar *id, LiProxyManager *mgr_bus)
+li_daemon_job_progress_proxy_cb (GObject *source, guint percentage, const gchar *id, LiDaemonJob *job)
 {
-	if (id == NULL)
-		id = "";
-	li_proxy_manager_emit_progress (mgr_bus, id, percentage);
+	LiDaemonJobPrivate *priv = GET_PRIVATE (job);
+
+	li_progress_aggregator_update (priv->progress, id, percentage, 0, 0);
+}
+
+/**
+ * li_daemon_job_progress_details_cb:
+ *
+ * The installer rate-limits these updates already.
+ */
+static void
+li_daemon_job_progress_details_cb (GObject *source, guint percentage, guint64 bytes_done, guint64 bytes_total, guint64 rate, guint eta, LiDaemonJob *job)
+{
+	LiDaemonJobPrivate *priv = GET_PRIVATE (job);
+
+	li_proxy_manager_emit_job_progress_details (priv->mgr_bus,
+						    priv->id,
+						    percentage,
+						    bytes_done,
+						    bytes_total,
+						    rate,
+						    eta);
 }
 
 /**
@@ -105,6 +147,12 @@ li_daemon_job_emit_error (LiDaemonJob *job, GError *error)
 	if (error == NULL)
 		return;
 
+	li_progress_aggregator_flush (priv->progress);
+	li_proxy_manager_emit_job_error (priv->mgr_bus,
+					 priv->id,
+					 error->domain,
+					 error->code,
+					 error->message);
 	li_proxy_manager_emit_error (priv->mgr_bus,
 					error->domain,
 					error->code,
@@ -119,6 +167,11 @@ static void
 li_daemon_job_emit_finished (LiDaemonJob *job, gboolean success)
 {
 	LiDaemonJobPrivate *priv = GET_PRIVATE (job);
+
+	/* make sure clients see the final state of every item */
+	li_progress_aggregator_flush (priv->progress);
+
+	li_proxy_manager_emit_job_finished (priv->mgr_bus, priv->id, success);
 	li_proxy_manager_emit_finished (priv->mgr_bus, success);
 }
 
@@ -131,11 +184,10 @@ li_daemon_job_execute_refresh_cache (LiDaemonJob *job)
 	g_autoptr(LiManager) mgr = NULL;
 	GError *error = NULL;
 	gboolean ret = FALSE;
-	LiDaemonJobPrivate *priv = GET_PRIVATE (job);
 
 	mgr = li_manager_new ();
 	g_signal_connect (mgr, "progress",
-			G_CALLBACK (li_daemon_job_progress_proxy_cb), priv->mgr_bus);
+			G_CALLBACK (li_daemon_job_progress_proxy_cb), job);
 
 	li_manager_refresh_cache (mgr, &error);
 	if (error != NULL) {
@@ -162,7 +214,7 @@ li_daemon_job_execute_remove (LiDaemonJob *job)
 
 	mgr = li_manager_new ();
 	g_signal_connect (mgr, "progress",
-			G_CALLBACK (li_daemon_job_progress_proxy_cb), priv->mgr_bus);
+			G_CALLBACK (li_daemon_job_progress_proxy_cb), job);
 
 	li_manager_remove_software (mgr, priv->pkid, &error);
 	if (error != NULL) {
@@ -192,7 +244,9 @@ li_daemon_job_execute_install (LiDaemonJob *job)
 
 	inst = li_installer_new ();
 	g_signal_connect (inst, "progress",
-				G_CALLBACK (li_daemon_job_progress_proxy_cb), priv->mgr_bus);
+				G_CALLBACK (li_daemon_job_progress_proxy_cb), job);
+	g_signal_connect (inst, "progress-details",
+				G_CALLBACK (li_daemon_job_progress_details_cb), job);
 
 	li_installer_open_remote (inst, priv->pkid, &error);
 	if (error != NULL) {
@@ -229,7 +283,9 @@ li_daemon_job_execute_install_local (LiDaemonJob *job)
 
 	inst = li_installer_new ();
 	g_signal_connect (inst, "progress",
-			G_CALLBACK (li_daemon_job_progress_proxy_cb), priv->mgr_bus);
+			G_CALLBACK (li_daemon_job_progress_proxy_cb), job);
+	g_signal_connect (inst, "progress-details",
+			G_CALLBACK (li_daemon_job_progress_details_cb), job);
 
 	li_installer_open_file (inst, priv->local_fname, &error);
 	if (error != NULL) {
@@ -263,8 +319,9 @@ li_daemon_job_execute_update (LiDaemonJob *job)
 
 	mgr = li_manager_new ();
 	g_signal_connect (mgr, "progress",
-			G_CALLBACK (li_daemon_job_progress_proxy_cb), priv->mgr_bus);
-
+			G_CALLBACK (li_daemon_job_progress_proxy_cb), job);
+	g_signal_connect (mgr, "progress-details",
+			G_CALLBACK (li_daemon_job_progress_details_cb), job);
 
 	uitem = li_manager_get_update_for_id (mgr,
 					      priv->pkid,
@@ -306,12 +363,12 @@ li_daemon_job_execute_update_all (LiDaemonJob *job)
 	g_autoptr(LiManager) mgr = NULL;
 	GError *error = NULL;
 	gboolean ret = FALSE;
-	LiDaemonJobPrivate *priv = GET_PRIVATE (job);
 
 	mgr = li_manager_new ();
 	g_signal_connect (mgr, "progress",
-			G_CALLBACK (li_daemon_job_progress_proxy_cb), priv->mgr_bus);
-
+			G_CALLBACK (li_daemon_job_progress_proxy_cb), job);
+	g_signal_connect (mgr, "progress-details",
+			G_CALLBACK (li_daemon_job_progress_details_cb), job);
 
 	li_manager_update_all (mgr, &error);
 	if (error != NULL) {
@@ -334,19 +391,17 @@ li_daemon_job_thread_func (gpointer thread_data)
 	LiDaemonJob *job = LI_DAEMON_JOB (thread_data);
 	LiDaemonJobPrivate *priv = GET_PRIVATE (job);
 
-	priv->running = TRUE;
-
-	if (priv->kind == LI_JOB_KIND_REFRESH_CACHE) {
+	if (priv->kind == LI_DAEMON_JOB_KIND_REFRESH_CACHE) {
 		li_daemon_job_execute_refresh_cache (job);
-	} else if (priv->kind == LI_JOB_KIND_REMOVE) {
+	} else if (priv->kind == LI_DAEMON_JOB_KIND_REMOVE) {
 		li_daemon_job_execute_remove (job);
-	} else if (priv->kind == LI_JOB_KIND_INSTALL) {
+	} else if (priv->kind == LI_DAEMON_JOB_KIND_INSTALL) {
 		li_daemon_job_execute_install (job);
-	} else if (priv->kind == LI_JOB_KIND_INSTALL_LOCAL) {
+	} else if (priv->kind == LI_DAEMON_JOB_KIND_INSTALL_LOCAL) {
 		li_daemon_job_execute_install_local (job);
-	} else if (priv->kind == LI_JOB_KIND_UPDATE_ALL) {
+	} else if (priv->kind == LI_DAEMON_JOB_KIND_UPDATE_ALL) {
 		li_daemon_job_execute_update_all (job);
-	} else if (priv->kind == LI_JOB_KIND_UPDATE) {
+	} else if (priv->kind == LI_DAEMON_JOB_KIND_UPDATE) {
 		li_daemon_job_execute_update (job);
 	} else {
 		g_warning ("Job with unknown purpose: %i", (int) priv->kind);
@@ -357,147 +412,98 @@ li_daemon_job_thread_func (gpointer thread_data)
 	g_thread_unref (priv->thread);
 
 	priv->running = FALSE;
+	if (priv->done_func != NULL)
+		priv->done_func (job, priv->done_data);
 
-	return NULL;
-}
+	/* drop the reference we took when starting the thread */
+	g_object_unref (job);
 
-/**
- * li_daemon_job_run_refresh_cache:
- */
-void
-li_daemon_job_run_refresh_cache (LiDaemonJob *job)
-{
-	LiDaemonJobPrivate *priv = GET_PRIVATE (job);
-
-	priv->kind = LI_JOB_KIND_REFRESH_CACHE;
-
-	/* create & run thread */
-	priv->thread = g_thread_new ("LI-DaemonJob",
-					  li_daemon_job_thread_func,
-					  job);
+	return NULL;
 }
 
 /**
- * li_daemon_job_run_remove_package:
+ * li_daemon_job_run:
+ * @job: An instance of #LiDaemonJob
+ * @mgr_bus: The D-Bus interface to emit signals on
+ * @done_func: Function called from the job thread when the job is complete
+ * @user_data: Data for @done_func
+ *
+ * Run the job in a new thread.
  */
 void
-li_daemon_job_run_remove_package (LiDaemonJob *job, const gchar *pkid)
+li_daemon_job_run (LiDaemonJob *job, LiProxyManager *mgr_bus, LiDaemonJobDoneFunc done_func, gpointer user_data)
 {
 	LiDaemonJobPrivate *priv = GET_PRIVATE (job);
 
-	if (priv->pkid != NULL)
-		g_free (priv->pkid);
-	priv->pkid = g_strdup (pkid);
+	g_return_if_fail (!priv->running);
 
-	priv->kind = LI_JOB_KIND_REMOVE;
+	if (priv->mgr_bus != NULL)
+		g_object_unref (priv->mgr_bus);
+	priv->mgr_bus = g_object_ref (mgr_bus);
+	priv->done_func = done_func;
+	priv->done_data = user_data;
+	priv->running = TRUE;
 
 	/* create & run thread */
 	priv->thread = g_thread_new ("LI-DaemonJob",
 					  li_daemon_job_thread_func,
-					  job);
+					  g_object_ref (job));
 }
 
 /**
- * li_daemon_job_run_install:
+ * li_daemon_job_is_running:
  */
-void
-li_daemon_job_run_install (LiDaemonJob *job, const gchar *pkid)
+gboolean
+li_daemon_job_is_running (LiDaemonJob *job)
 {
 	LiDaemonJobPrivate *priv = GET_PRIVATE (job);
-
-	if (priv->pkid != NULL)
-		g_free (priv->pkid);
-	priv->pkid = g_strdup (pkid);
-
-	priv->kind = LI_JOB_KIND_INSTALL;
-
-	priv->thread = g_thread_new ("LI-DaemonJob",
-					  li_daemon_job_thread_func,
-					  job);
+	return priv->running;
 }
 
 /**
- * li_daemon_job_run_install_local:
+ * li_daemon_job_get_id:
  */
-void
-li_daemon_job_run_install_local (LiDaemonJob *job, const gchar *fname)
+guint
+li_daemon_job_get_id (LiDaemonJob *job)
 {
 	LiDaemonJobPrivate *priv = GET_PRIVATE (job);
-
-	if (priv->local_fname != NULL)
-		g_free (priv->local_fname);
-	priv->local_fname = g_strdup (fname);
-
-	priv->kind = LI_JOB_KIND_INSTALL_LOCAL;
-
-	priv->thread = g_thread_new ("LI-DaemonJob",
-					  li_daemon_job_thread_func,
-					  job);
+	return priv->id;
 }
 
 /**
- * li_daemon_job_run_update_all:
+ * li_daemon_job_set_id:
  */
 void
-li_daemon_job_run_update_all (LiDaemonJob *job)
+li_daemon_job_set_id (LiDaemonJob *job, guint job_id)
 {
 	LiDaemonJobPrivate *priv = GET_PRIVATE (job);
-
-	priv->kind = LI_JOB_KIND_UPDATE_ALL;
-
-	/* create & run thread */
-	priv->thread = g_thread_new ("LI-DaemonJob",
-					  li_daemon_job_thread_func,
-					  job);
+	priv->id = job_id;
 }
 
 /**
- * li_daemon_job_run_update:
+ * li_daemon_job_get_kind:
  */
-void
-li_daemon_job_run_update (LiDaemonJob *job, const gchar *pkid)
+LiDaemonJobKind
+li_daemon_job_get_kind (LiDaemonJob *job)
 {
 	LiDaemonJobPrivate *priv = GET_PRIVATE (job);
-
-	if (priv->pkid != NULL)
-		g_free (priv->pkid);
-	priv->pkid = g_strdup (pkid);
-
-	priv->kind = LI_JOB_KIND_UPDATE;
-
-	/* create & run thread */
-	priv->thread = g_thread_new ("LI-DaemonJob",
-					  li_daemon_job_thread_func,
-					  job);
+	return priv->kind;
 }
 
 /**
- * li_daemon_job_prepare:
+ * li_daemon_job_needs_write_lock:
+ *
+ * Returns: %TRUE if the job modifies the installed software, and must
+ * therefore not run at the same time as any other job doing that.
  */
 gboolean
-li_daemon_job_prepare (LiDaemonJob *job, LiProxyManager *mgr_bus)
+li_daemon_job_needs_write_lock (LiDaemonJob *job)
 {
 	LiDaemonJobPrivate *priv = GET_PRIVATE (job);
 
-	/* if we are running, we can't initialize another job */
-	if (priv->running)
-		return FALSE;
-
-	if (priv->mgr_bus != NULL)
-		g_object_unref (priv->mgr_bus);
-	priv->mgr_bus = g_object_ref (mgr_bus);
-
-	return TRUE;
-}
-
-/**
- * li_daemon_job_is_running:
- */
-gboolean
-li_daemon_job_is_running (LiDaemonJob *job)
-{
-	LiDaemonJobPrivate *priv = GET_PRIVATE (job);
-	return priv->running;
+	/* refreshing the cache only touches the package cache, which is
+	 * replaced atomically, everything else changes LI_SOFTWARE_ROOT */
+	return priv->kind != LI_DAEMON_JOB_KIND_REFRESH_CACHE;
 }
 
 /**
@@ -513,15 +519,28 @@ li_daemon_job_class_init (LiDaemonJobClass *klass)
 /**
  * li_daemon_job_new:
  *
+ * @kind: What the job should do
+ * @argument: The package ID or file name the job works on, or %NULL
+ *
  * Creates a new #LiDaemonJob.
  *
  * Returns: (transfer full): a #LiDaemonJob
  *
  **/
 LiDaemonJob *
-li_daemon_job_new (void)
+li_daemon_job_new (LiDaemonJobKind kind, const gchar *argument)
 {
 	LiDaemonJob *job;
+	LiDaemonJobPrivate *priv;
+
 	job = g_object_new (LI_TYPE_DAEMON_JOB, NULL);
+	priv = GET_PRIVATE (job);
+
+	priv->kind = kind;
+	if (kind == LI_DAEMON_JOB_KIND_INSTALL_LOCAL)
+		priv->local_fname = g_strdup (argument);
+	else
+		priv->pkid = g_strdup (argument);
+
 	return LI_DAEMON_JOB (job);
 }
@@ -49,29 +49,48 @@ struct _LiDaemonJobClass
 	void (*_as_reserved8)	(void);
 };
 
-GType			li_daemon_job_get_type	(void);
-LiDaemonJob		*li_daemon_job_new	(void);
-
-gboolean		li_daemon_job_prepare (LiDaemonJob *job,
-						LiProxyManager *mgr_bus);
-
-void			li_daemon_job_run_refresh_cache (LiDaemonJob *job);
-
-void			li_daemon_job_run_remove_package (LiDaemonJob *job,
-						const gchar *pkid);
-
-void			li_daemon_job_run_install (LiDaemonJob *job,
-						const gchar *pkid);
-void			li_daemon_job_run_install_local (LiDaemonJob *job,
-						const gchar *fname);
+/**
+ * LiDaemonJobKind:
+ * @LI_DAEMON_JOB_KIND_NONE:		Job without a purpose
+ * @LI_DAEMON_JOB_KIND_REFRESH_CACHE:	Refresh the package cache
+ * @LI_DAEMON_JOB_KIND_INSTALL:		Install a package from a repository
+ * @LI_DAEMON_JOB_KIND_INSTALL_LOCAL:	Install a local package file
+ * @LI_DAEMON_JOB_KIND_REMOVE:		Remove a package
+ * @LI_DAEMON_JOB_KIND_UPDATE:		Update a single package
+ * @LI_DAEMON_JOB_KIND_UPDATE_ALL:	Update all packages
+ *
+ * The different things a #LiDaemonJob can do.
+ **/
+typedef enum {
+	LI_DAEMON_JOB_KIND_NONE,
+	LI_DAEMON_JOB_KIND_REFRESH_CACHE,
+	LI_DAEMON_JOB_KIND_INSTALL,
+	LI_DAEMON_JOB_KIND_INSTALL_LOCAL,
+	LI_DAEMON_JOB_KIND_REMOVE,
+	LI_DAEMON_JOB_KIND_UPDATE,
+	LI_DAEMON_JOB_KIND_UPDATE_ALL,
+	/*< private >*/
+	LI_DAEMON_JOB_KIND_LAST
+} LiDaemonJobKind;
 
-void			li_daemon_job_run_update_all (LiDaemonJob *job);
-void			li_daemon_job_run_update (LiDaemonJob *job,
-						  const gchar *pkid);
+typedef void (*LiDaemonJobDoneFunc) (LiDaemonJob *job, gpointer user_data);
 
+GType			li_daemon_job_get_type	(void);
+LiDaemonJob		*li_daemon_job_new	(LiDaemonJobKind kind,
+						 const gchar *argument);
+
+guint			li_daemon_job_get_id (LiDaemonJob *job);
+void			li_daemon_job_set_id (LiDaemonJob *job,
+						guint job_id);
+LiDaemonJobKind		li_daemon_job_get_kind (LiDaemonJob *job);
+gboolean		li_daemon_job_needs_write_lock (LiDaemonJob *job);
+
+void			li_daemon_job_run (LiDaemonJob *job,
+						LiProxyManager *mgr_bus,
+						LiDaemonJobDoneFunc done_func,
+						gpointer user_data);
 gboolean		li_daemon_job_is_running (LiDaemonJob *job);
 
-
 G_END_DECLS
 
 #endif /* __LI_DAEMON_JOB_H */
@@ -0,0 +1,597 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2016 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2.1 of the license, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * SECTION:li-daemon-model
+ * @short_description: In-memory view on the installed and available software
+ *
+ * The daemon keeps snapshots of the software lists around, so clients
+ * querying them via D-Bus don't all have to scan the software root and
+ * parse the package cache themselves.
+ * The snapshots are loaded in a worker thread, so the daemon keeps answering
+ * other requests in the meantime. They are loaded from a long-lived, monitored
+ * #LiManager, which only reloads what has changed on disk, and only the lists
+ * affected by a change are rebuilt.
+ * Only one worker uses the manager at a time, its change notifications
+ * are delivered in the thread which created this object.
+ * This object must only be used from the thread which created it.
+ */
+
+#include "config.h"
+#include "li-daemon-model.h"
+
+#include "limba.h"
+
+typedef struct
+{
+	/* sorted snapshots of the software lists */
+	GPtrArray *installed;	/* of LiPkgInfo */
+	GPtrArray *available;	/* of LiPkgInfo */
+	GPtrArray *updates;	/* of LiUpdateItem */
+	GPtrArray *runtimes;	/* of LiRuntime */
+} LiDaemonModelSnapshot;
+
+typedef struct
+{
+	LiManager *mgr;
+
+	LiDaemonModelSnapshot *snapshot;
+	guint stale; /* LiManagerChanges the snapshot does not reflect yet */
+	guint generation;
+
+	gboolean loading;
+	GPtrArray *waiters;	/* of GTask */
+} LiDaemonModelPrivate;
+
+G_DEFINE_TYPE_WITH_PRIVATE (LiDaemonModel, li_daemon_model, G_TYPE_OBJECT)
+#define GET_PRIVATE(o) (li_daemon_model_get_instance_private (o))
+
+/**
+ * li_daemon_model_snapshot_free:
+ */
+static void
+li_daemon_model_snapshot_free (LiDaemonModelSnapshot *snap)
+{
+	g_clear_pointer (&snap->installed, g_ptr_array_unref);
+	g_clear_pointer (&snap->available, g_ptr_array_unref);
+	g_clear_pointer (&snap->updates, g_ptr_array_unref);
+	g_clear_pointer (&snap->runtimes, g_ptr_array_unref);
+	g_free (snap);
+}
+
+/**
+ * li_daemon_model_snapshot_copy:
+ *
+ * Returns: A snapshot sharing the (immutable) lists of @snap.
+ */
+static LiDaemonModelSnapshot*
+li_daemon_model_snapshot_copy (LiDaemonModelSnapshot *snap)
+{
+	LiDaemonModelSnapshot *copy;
+
+	copy = g_new0 (LiDaemonModelSnapshot, 1);
+	if (snap == NULL)
+		return copy;
+	copy->installed = g_ptr_array_ref (snap->installed);
+	copy->available = g_ptr_array_ref (snap->available);
+	copy->updates = g_ptr_array_ref (snap->updates);
+	copy->runtimes = g_ptr_array_ref (snap->runtimes);
+
+	return copy;
+}
+
+/**
+ * li_daemon_model_manager_changed_cb:
+ */
+static void
+li_daemon_model_manager_changed_cb (LiManager *mgr, guint changes, LiDaemonModel *model)
+{
+	LiDaemonModelPrivate *priv = GET_PRIVATE (model);
+
+	g_debug ("Software changed, marking cached query results as outdated.");
+	priv->stale |= changes;
+
+	/* snapshots which are still being loaded are outdated as well */
+	priv->generation++;
+}
+
+/**
+ * li_daemon_model_finalize:
+ **/
+static void
+li_daemon_model_finalize (GObject *object)
+{
+	LiDaemonModel *model = LI_DAEMON_MODEL (object);
+	LiDaemonModelPrivate *priv = GET_PRIVATE (model);
+
+	g_clear_pointer (&priv->snapshot, li_daemon_model_snapshot_free);
+	g_object_unref (priv->mgr);
+	g_ptr_array_unref (priv->waiters);
+
+	G_OBJECT_CLASS (li_daemon_model_parent_class)->finalize (object);
+}
+
+/**
+ * li_daemon_model_init:
+ **/
+static void
+li_daemon_model_init (LiDaemonModel *model)
+{
+	LiDaemonModelPrivate *priv = GET_PRIVATE (model);
+
+	priv->waiters = g_ptr_array_new_with_free_func (g_object_unref);
+	priv->stale = LI_MANAGER_CHANGE_INSTALLED | LI_MANAGER_CHANGE_AVAILABLE | LI_MANAGER_CHANGE_RUNTIMES;
+	priv->mgr = li_manager_new ();
+	li_manager_set_monitor_changes (priv->mgr, TRUE);
+	g_signal_connect (priv->mgr, "changed",
+			  G_CALLBACK (li_daemon_model_manager_changed_cb), model);
+}
+
+/**
+ * li_daemon_model_pkg_cmp:
+ */
+static gint
+li_daemon_model_pkg_cmp (gconstpointer a, gconstpointer b)
+{
+	LiPkgInfo *pki1 = *((LiPkgInfo**) a);
+	LiPkgInfo *pki2 = *((LiPkgInfo**) b);
+
+	return g_strcmp0 (li_pkg_info_get_id (pki1), li_pkg_info_get_id (pki2));
+}
+
+/**
+ * li_daemon_model_uitem_cmp:
+ */
+static gint
+li_daemon_model_uitem_cmp (gconstpointer a, gconstpointer b)
+{
+	LiUpdateItem *uitem1 = *((LiUpdateItem**) a);
+	LiUpdateItem *uitem2 = *((LiUpdateItem**) b);
+
+	return g_strcmp0 (li_pkg_info_get_id (li_update_item_get_installed_pkg (uitem1)),
+			  li_pkg_info_get_id (li_update_item_get_installed_pkg (uitem2)));
+}
+
+/**
+ * li_daemon_model_rt_cmp:
+ */
+static gint
+li_daemon_model_rt_cmp (gconstpointer a, gconstpointer b)
+{
+	LiRuntime *rt1 = *((LiRuntime**) a);
+	LiRuntime *rt2 = *((LiRuntime**) b);
+
+	return g_strcmp0 (li_runtime_get_uuid (rt1), li_runtime_get_uuid (rt2));
+}
+
+/**
+ * li_str_or_empty:
+ *
+ * D-Bus strings must not be %NULL.
+ */
+static inline const gchar*
+li_str_or_empty (const gchar *str)
+{
+	return (str == NULL)? "" : str;
+}
+
+typedef struct
+{
+	LiManager *mgr;
+	LiDaemonModelSnapshot *snapshot; /* the lists which are still valid */
+	guint stale; /* LiManagerChanges to load */
+} LiDaemonModelLoadData;
+
+/**
+ * li_daemon_model_load_data_free:
+ */
+static void
+li_daemon_model_load_data_free (LiDaemonModelLoadData *data)
+{
+	g_object_unref (data->mgr);
+	if (data->snapshot != NULL)
+		li_daemon_model_snapshot_free (data->snapshot);
+	g_free (data);
+}
+
+/**
+ * li_daemon_model_load_thread:
+ *
+ * Load a new snapshot of the software lists, rebuilding only the
+ * lists affected by the changes since the last snapshot.
+ * This must not touch the model, it runs in a worker thread. Apart
+ * from delivering change notifications, nobody else uses the manager
+ * while we are running.
+ */
+static void
+li_daemon_model_load_thread (GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+	guint i;
+	GList *l;
+	LiDaemonModelLoadData *data = (LiDaemonModelLoadData*) task_data;
+	LiManager *mgr = data->mgr;
+	LiDaemonModelSnapshot *snap;
+	g_autoptr(GList) updlist = NULL;
+	GError *tmp_error = NULL;
+
+	snap = data->snapshot;
+	if (data->stale & (LI_MANAGER_CHANGE_INSTALLED | LI_MANAGER_CHANGE_AVAILABLE)) {
+		g_autoptr(GPtrArray) sw = NULL;
+
+		sw = li_manager_get_software_list (mgr, &tmp_error);
+		if (tmp_error != NULL) {
+			g_task_return_error (task, tmp_error);
+			return;
+		}
+
+		g_clear_pointer (&snap->installed, g_ptr_array_unref);
+		g_clear_pointer (&snap->available, g_ptr_array_unref);
+		snap->installed = g_ptr_array_new_with_free_func (g_object_unref);
+		snap->available = g_ptr_array_new_with_free_func (g_object_unref);
+		for (i = 0; i < sw->len; i++) {
+			LiPkgInfo *pki = LI_PKG_INFO (g_ptr_array_index (sw, i));
+
+			if (li_pkg_info_has_flag (pki, LI_PACKAGE_FLAG_INSTALLED))
+				g_ptr_array_add (snap->installed, g_object_ref (pki));
+			if (li_pkg_info_has_flag (pki, LI_PACKAGE_FLAG_AVAILABLE))
+				g_ptr_array_add (snap->available, g_object_ref (pki));
+		}
+
+		/* a stable order, so clients can page through the results */
+		g_ptr_array_sort (snap->installed, li_daemon_model_pkg_cmp);
+		g_ptr_array_sort (snap->available, li_daemon_model_pkg_cmp);
+	}
+
+	if (data->stale & LI_MANAGER_CHANGE_RUNTIMES) {
+		GPtrArray *rts;
+
+		rts = li_manager_get_installed_runtimes (mgr);
+		g_clear_pointer (&snap->runtimes, g_ptr_array_unref);
+		snap->runtimes = g_ptr_array_new_with_free_func (g_object_unref);
+		for (i = 0; i < rts->len; i++)
+			g_ptr_array_add (snap->runtimes, g_object_ref (g_ptr_array_index (rts, i)));
+		g_ptr_array_sort (snap->runtimes, li_daemon_model_rt_cmp);
+	}
+
+	/* updates depend on all of the above. The manager keeps them
+	 * around as well, so this is cheap if nothing relevant changed */
+	updlist = li_manager_get_update_list (mgr, &tmp_error);
+	if (tmp_error != NULL) {
+		g_task_return_error (task, tmp_error);
+		return;
+	}
+	g_clear_pointer (&snap->updates, g_ptr_array_unref);
+	snap->updates = g_ptr_array_new_with_free_func (g_object_unref);
+	for (l = updlist; l != NULL; l = l->next)
+		g_ptr_array_add (snap->updates, g_object_ref (l->data));
+	g_ptr_array_sort (snap->updates, li_daemon_model_uitem_cmp);
+
+	/* the snapshot belongs to the result now */
+	data->snapshot = NULL;
+	g_task_return_pointer (task, snap, (GDestroyNotify) li_daemon_model_snapshot_free);
+}
+
+static void li_daemon_model_start_loading (LiDaemonModel *model);
+
+/**
+ * li_daemon_model_load_done_cb:
+ */
+static void
+li_daemon_model_load_done_cb (LiDaemonModel *model, GAsyncResult *res, gpointer user_data)
+{
+	guint i;
+	guint generation = GPOINTER_TO_UINT (user_data);
+	g_autoptr(GPtrArray) waiters = NULL;
+	LiDaemonModelSnapshot *snap;
+	GError *tmp_error = NULL;
+	LiDaemonModelPrivate *priv = GET_PRIVATE (model);
+
+	priv->loading = FALSE;
+	snap = g_task_propagate_pointer (G_TASK (res), &tmp_error);
+
+	/* the software changed while we were loading, so try again */
+	if ((snap != NULL) && (generation != priv->generation)) {
+		li_daemon_model_snapshot_free (snap);
+		li_daemon_model_start_loading (model);
+		return;
+	}
+
+	if (snap != NULL) {
+		g_clear_pointer (&priv->snapshot, li_daemon_model_snapshot_free);
+		priv->snapshot = snap;
+		priv->stale = LI_MANAGER_CHANGE_NONE;
+	}
+
+	waiters = priv->waiters;
+	priv->waiters = g_ptr_array_new_with_free_func (g_object_unref);
+	for (i = 0; i < waiters->len; i++) {
+		GTask *task = G_TASK (g_ptr_array_index (waiters, i));
+
+		if (tmp_error != NULL)
+			g_task_return_error (task, g_error_copy (tmp_error));
+		else
+			g_task_return_boolean (task, TRUE);
+	}
+	g_clear_error (&tmp_error);
+}
+
+/**
+ * li_daemon_model_start_loading:
+ */
+static void
+li_daemon_model_start_loading (LiDaemonModel *model)
+{
+	g_autoptr(GTask) task = NULL;
+	LiDaemonModelLoadData *data;
+	LiDaemonModelPrivate *priv = GET_PRIVATE (model);
+
+	/* the lists which did not change are shared with the current snapshot */
+	data = g_new0 (LiDaemonModelLoadData, 1);
+	data->mgr = g_object_ref (priv->mgr);
+	data->snapshot = li_daemon_model_snapshot_copy (priv->snapshot);
+	data->stale = priv->stale;
+
+	priv->loading = TRUE;
+	task = g_task_new (model, NULL,
+			   (GAsyncReadyCallback) li_daemon_model_load_done_cb,
+			   GUINT_TO_POINTER (priv->generation));
+	g_task_set_task_data (task, data, (GDestroyNotify) li_daemon_model_load_data_free);
+	g_task_run_in_thread (task, li_daemon_model_load_thread);
+}
+
+/**
+ * li_daemon_model_load_async:
+ * @model: An instance of #LiDaemonModel
+ *
+ * Make sure a snapshot of the software lists is available, loading
+ * it in a worker thread if necessary.
+ * Requests which arrive while a snapshot is loaded wait for the same snapshot.
+ */
+void
+li_daemon_model_load_async (LiDaemonModel *model, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+	g_autoptr(GTask) task = NULL;
+	LiDaemonModelPrivate *priv = GET_PRIVATE (model);
+
+	task = g_task_new (model, cancellable, callback, user_data);
+	if ((priv->snapshot != NULL) && (priv->stale == LI_MANAGER_CHANGE_NONE)) {
+		g_task_return_boolean (task, TRUE);
+		return;
+	}
+
+	g_ptr_array_add (priv->waiters, g_object_ref (task));
+	if (!priv->loading)
+		li_daemon_model_start_loading (model);
+}
+
+/**
+ * li_daemon_model_load_finish:
+ *
+ * Returns: %TRUE if the software lists can be queried now.
+ */
+gboolean
+li_daemon_model_load_finish (LiDaemonModel *model, GAsyncResult *res, GError **error)
+{
+	return g_task_propagate_boolean (G_TASK (res), error);
+}
+
+/**
+ * li_daemon_model_ensure_loaded:
+ */
+static gboolean
+li_daemon_model_ensure_loaded (LiDaemonModel *model, GError **error)
+{
+	LiDaemonModelPrivate *priv = GET_PRIVATE (model);
+
+	/* the software might have changed since the caller loaded the snapshot */
+	if ((priv->snapshot == NULL) || (priv->stale != LI_MANAGER_CHANGE_NONE)) {
+		g_set_error (error,
+				G_IO_ERROR,
+				G_IO_ERROR_BUSY,
+				"The software lists have changed, please try again.");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * li_daemon_model_pkg_matches:
+ */
+static gboolean
+li_daemon_model_pkg_matches (LiPkgInfo *pki, const gchar *filter)
+{
+	if ((filter == NULL) || (filter[0] == '\0'))
+		return TRUE;
+	if (g_strstr_len (li_pkg_info_get_id (pki), -1, filter) != NULL)
+		return TRUE;
+	if ((li_pkg_info_get_name (pki) != NULL) && (g_strstr_len (li_pkg_info_get_name (pki), -1, filter) != NULL))
+		return TRUE;
+	return FALSE;
+}
+
+/**
+ * li_daemon_model_in_page:
+ */
+static inline gboolean
+li_daemon_model_in_page (guint index, guint offset, guint limit)
+{
+	if (index < offset)
+		return FALSE;
+	return (limit == 0) || (index - offset < limit);
+}
+
+/**
+ * li_daemon_model_get_software:
+ * @model: An instance of #LiDaemonModel
+ * @installed: %TRUE for installed software, %FALSE for available software
+ * @filter: Text the ID or name of the software has to contain, or %NULL
+ * @offset: Index of the first matching package to return
+ * @limit: Maximum number of packages to return, or 0 for no limit
+ * @total: (out): Number of all matching packages
+ *
+ * Query the software lists, which need to be loaded with
+ * li_daemon_model_load_async() first.
+ *
+ * Returns: (transfer floating): A #GVariant of type a(ssssu)
+ */
+GVariant*
+li_daemon_model_get_software (LiDaemonModel *model, gboolean installed, const gchar *filter,
+			      guint offset, guint limit, guint *total, GError **error)
+{
+	guint i;
+	guint matches = 0;
+	GPtrArray *pkgs;
+	GVariantBuilder builder;
+	LiDaemonModelPrivate *priv = GET_PRIVATE (model);
+
+	if (!li_daemon_model_ensure_loaded (model, error))
+		return NULL;
+	pkgs = installed? priv->snapshot->installed : priv->snapshot->available;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ssssu)"));
+	for (i = 0; i < pkgs->len; i++) {
+		LiPkgInfo *pki = LI_PKG_INFO (g_ptr_array_index (pkgs, i));
+
+		if (!li_daemon_model_pkg_matches (pki, filter))
+			continue;
+		if (li_daemon_model_in_page (matches, offset, limit))
+			g_variant_builder_add (&builder, "(ssssu)",
+					       li_pkg_info_get_id (pki),
+					       li_str_or_empty (li_pkg_info_get_name (pki)),
+					       li_str_or_empty (li_pkg_info_get_version (pki)),
+					       li_str_or_empty (li_pkg_info_get_appname (pki)),
+					       (guint32) li_pkg_info_get_flags (pki));
+		matches++;
+	}
+
+	*total = matches;
+	return g_variant_builder_end (&builder);
+}
+
+/**
+ * li_daemon_model_get_updates:
+ * @model: An instance of #LiDaemonModel
+ * @offset: Index of the first update to return
+ * @limit: Maximum number of updates to return, or 0 for no limit
+ * @total: (out): Number of all updates
+ *
+ * Returns: (transfer floating): A #GVariant of type a(sss)
+ */
+GVariant*
+li_daemon_model_get_updates (LiDaemonModel *model, guint offset, guint limit, guint *total, GError **error)
+{
+	guint i;
+	GPtrArray *updates;
+	GVariantBuilder builder;
+	LiDaemonModelPrivate *priv = GET_PRIVATE (model);
+
+	if (!li_daemon_model_ensure_loaded (model, error))
+		return NULL;
+	updates = priv->snapshot->updates;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sss)"));
+	for (i = 0; i < updates->len; i++) {
+		LiPkgInfo *apki;
+		LiUpdateItem *uitem = LI_UPDATE_ITEM (g_ptr_array_index (updates, i));
+
+		if (!li_daemon_model_in_page (i, offset, limit))
+			continue;
+		apki = li_update_item_get_available_pkg (uitem);
+		g_variant_builder_add (&builder, "(sss)",
+				       li_pkg_info_get_id (li_update_item_get_installed_pkg (uitem)),
+				       li_pkg_info_get_id (apki),
+				       li_str_or_empty (li_pkg_info_get_version (apki)));
+	}
+
+	*total = updates->len;
+	return g_variant_builder_end (&builder);
+}
+
+/**
+ * li_daemon_model_get_runtimes:
+ * @model: An instance of #LiDaemonModel
+ * @offset: Index of the first runtime to return
+ * @limit: Maximum number of runtimes to return, or 0 for no limit
+ * @total: (out): Number of all installed runtimes
+ *
+ * Returns: (transfer floating): A #GVariant of type a(sas)
+ */
+GVariant*
+li_daemon_model_get_runtimes (LiDaemonModel *model, guint offset, guint limit, guint *total, GError **error)
+{
+	guint i;
+	GPtrArray *rts;
+	GVariantBuilder builder;
+	LiDaemonModelPrivate *priv = GET_PRIVATE (model);
+
+	if (!li_daemon_model_ensure_loaded (model, error))
+		return NULL;
+	rts = priv->snapshot->runtimes;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sas)"));
+	for (i = 0; i < rts->len; i++) {
+		g_auto(GStrv) members = NULL;
+		GVariantBuilder mbuilder;
+		guint j;
+		LiRuntime *rt = LI_RUNTIME (g_ptr_array_index (rts, i));
+
+		if (!li_daemon_model_in_page (i, offset, limit))
+			continue;
+
+		members = li_runtime_dup_member_ids (rt);
+		g_variant_builder_init (&mbuilder, G_VARIANT_TYPE ("as"));
+		for (j = 0; members[j] != NULL; j++)
+			g_variant_builder_add (&mbuilder, "s", members[j]);
+
+		g_variant_builder_add (&builder, "(sas)",
+				       li_runtime_get_uuid (rt),
+				       &mbuilder);
+	}
+
+	*total = rts->len;
+	return g_variant_builder_end (&builder);
+}
+
+/**
+ * li_daemon_model_class_init:
+ **/
+static void
+li_daemon_model_class_init (LiDaemonModelClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	object_class->finalize = li_daemon_model_finalize;
+}
+
+/**
+ * li_daemon_model_new:
+ *
+ * Creates a new #LiDaemonModel.
+ *
+ * Returns: (transfer full): a #LiDaemonModel
+ *
+ **/
+LiDaemonModel *
+li_daemon_model_new (void)
+{
+	LiDaemonModel *model;
+	model = g_object_new (LI_TYPE_DAEMON_MODEL, NULL);
+	return LI_DAEMON_MODEL (model);
+}
@@ -0,0 +1,276 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2016 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2.1 of the license, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * SECTION:li-daemon-queue
+ * @short_description: Schedules the jobs of the Limba helper daemon
+ *
+ * Jobs are run in the order they were submitted in. Jobs which modify the
+ * installed software hold a write lock, so only one of them can run at a time,
+ * while jobs which don't (refreshing the package cache) may run alongside them.
+ */
+
+#include "config.h"
+#include "li-daemon-queue.h"
+
+typedef struct
+{
+	GMutex mutex;
+	GQueue *pending;	/* of LiDaemonJob, with the bus to emit signals on */
+	GPtrArray *running;	/* of LiDaemonJob */
+	guint last_id;
+	gboolean write_locked;
+	gboolean cache_busy;
+} LiDaemonQueuePrivate;
+
+typedef struct
+{
+	LiDaemonJob *job;
+	LiProxyManager *mgr_bus;
+} LiQueuedJob;
+
+G_DEFINE_TYPE_WITH_PRIVATE (LiDaemonQueue, li_daemon_queue, G_TYPE_OBJECT)
+#define GET_PRIVATE(o) (li_daemon_queue_get_instance_private (o))
+
+static void li_daemon_queue_schedule_unlocked (LiDaemonQueue *queue);
+
+/**
+ * li_queued_job_free:
+ */
+static void
+li_queued_job_free (LiQueuedJob *qjob)
+{
+	g_object_unref (qjob->job);
+	g_object_unref (qjob->mgr_bus);
+	g_free (qjob);
+}
+
+/**
+ * li_daemon_queue_finalize:
+ **/
+static void
+li_daemon_queue_finalize (GObject *object)
+{
+	LiDaemonQueue *queue = LI_DAEMON_QUEUE (object);
+	LiDaemonQueuePrivate *priv = GET_PRIVATE (queue);
+
+	g_queue_free_full (priv->pending, (GDestroyNotify) li_queued_job_free);
+	g_ptr_array_unref (priv->running);
+	g_mutex_clear (&priv->mutex);
+
+	G_OBJECT_CLASS (li_daemon_queue_parent_class)->finalize (object);
+}
+
+/**
+ * li_daemon_queue_init:
+ **/
+static void
+li_daemon_queue_init (LiDaemonQueue *queue)
+{
+	LiDaemonQueuePrivate *priv = GET_PRIVATE (queue);
+
+	g_mutex_init (&priv->mutex);
+	priv->pending = g_queue_new ();
+	priv->running = g_ptr_array_new_with_free_func (g_object_unref);
+}
+
+/**
+ * li_daemon_queue_job_uses_cache_slot:
+ *
+ * Refreshing the cache rewrites the cache files, so only one of these
+ * jobs may run at a time.
+ */
+static gboolean
+li_daemon_queue_job_uses_cache_slot (LiDaemonJob *job)
+{
+	return li_daemon_job_get_kind (job) == LI_DAEMON_JOB_KIND_REFRESH_CACHE;
+}
+
+/**
+ * li_daemon_queue_job_done_cb:
+ *
+ * Called from the thread of a job once it has completed.
+ */
+static void
+li_daemon_queue_job_done_cb (LiDaemonJob *job, LiDaemonQueue *queue)
+{
+	LiDaemonQueuePrivate *priv = GET_PRIVATE (queue);
+
+	g_mutex_lock (&priv->mutex);
+	if (li_daemon_job_needs_write_lock (job))
+		priv->write_locked = FALSE;
+	if (li_daemon_queue_job_uses_cache_slot (job))
+		priv->cache_busy = FALSE;
+	g_debug ("Job %u finished.", li_daemon_job_get_id (job));
+	g_ptr_array_remove (priv->running, job);
+
+	li_daemon_queue_schedule_unlocked (queue);
+	g_mutex_unlock (&priv->mutex);
+}
+
+/**
+ * li_daemon_queue_schedule_unlocked:
+ *
+ * Start all pending jobs whose resources are available. A job never
+ * overtakes an earlier one which waits for the same resource.
+ */
+static void
+li_daemon_queue_schedule_unlocked (LiDaemonQueue *queue)
+{
+	GList *l;
+	gboolean writer_waiting = FALSE;
+	gboolean cache_waiting = FALSE;
+	LiDaemonQueuePrivate *priv = GET_PRIVATE (queue);
+
+	l = priv->pending->head;
+	while (l != NULL) {
+		GList *next = l->next;
+		LiQueuedJob *qjob = (LiQueuedJob*) l->data;
+		gboolean writer = li_daemon_job_needs_write_lock (qjob->job);
+		gboolean cache = li_daemon_queue_job_uses_cache_slot (qjob->job);
+		gboolean blocked;
+
+		blocked = (writer && (priv->write_locked || writer_waiting)) ||
+			  (cache && (priv->cache_busy || cache_waiting));
+		if (blocked) {
+			writer_waiting = writer_waiting || writer;
+			cache_waiting = cache_waiting || cache;
+			l = next;
+			continue;
+		}
+
+		if (writer)
+			priv->write_locked = TRUE;
+		if (cache)
+			priv->cache_busy = TRUE;
+
+		g_queue_delete_link (priv->pending, l);
+		g_ptr_array_add (priv->running, g_object_ref (qjob->job));
+
+		g_debug ("Starting job %u.", li_daemon_job_get_id (qjob->job));
+		li_daemon_job_run (qjob->job,
+				   qjob->mgr_bus,
+				   (LiDaemonJobDoneFunc) li_daemon_queue_job_done_cb,
+				   queue);
+		li_queued_job_free (qjob);
+
+		l = next;
+	}
+}
+
+/**
+ * li_daemon_queue_schedule_idle_cb:
+ */
+static gboolean
+li_daemon_queue_schedule_idle_cb (LiDaemonQueue *queue)
+{
+	LiDaemonQueuePrivate *priv = GET_PRIVATE (queue);
+
+	g_mutex_lock (&priv->mutex);
+	li_daemon_queue_schedule_unlocked (queue);
+	g_mutex_unlock (&priv->mutex);
+
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * li_daemon_queue_submit:
+ * @queue: An instance of #LiDaemonQueue
+ * @job: The job to run
+ * @mgr_bus: The D-Bus interface the job emits its signals on
+ *
+ * Add a new job to the queue. It is started from the main loop as soon as
+ * the resources it needs are available, so the caller can tell the client
+ * about the job ID before any of its signals are emitted.
+ *
+ * Returns: The ID of the new job.
+ */
+guint
+li_daemon_queue_submit (LiDaemonQueue *queue, LiDaemonJob *job, LiProxyManager *mgr_bus)
+{
+	LiQueuedJob *qjob;
+	guint job_id;
+	LiDaemonQueuePrivate *priv = GET_PRIVATE (queue);
+
+	g_mutex_lock (&priv->mutex);
+	/* zero is never a valid job ID */
+	if (++priv->last_id == 0)
+		priv->last_id = 1;
+	job_id = priv->last_id;
+	li_daemon_job_set_id (job, job_id);
+
+	qjob = g_new0 (LiQueuedJob, 1);
+	qjob->job = g_object_ref (job);
+	qjob->mgr_bus = g_object_ref (mgr_bus);
+	g_queue_push_tail (priv->pending, qjob);
+	g_debug ("Queued job %u.", job_id);
+	g_mutex_unlock (&priv->mutex);
+
+	g_idle_add_full (G_PRIORITY_DEFAULT_IDLE,
+			 (GSourceFunc) li_daemon_queue_schedule_idle_cb,
+			 g_object_ref (queue),
+			 g_object_unref);
+
+	return job_id;
+}
+
+/**
+ * li_daemon_queue_is_busy:
+ *
+ * Returns: %TRUE if jobs are running or waiting to be run.
+ */
+gboolean
+li_daemon_queue_is_busy (LiDaemonQueue *queue)
+{
+	gboolean ret;
+	LiDaemonQueuePrivate *priv = GET_PRIVATE (queue);
+
+	g_mutex_lock (&priv->mutex);
+	ret = (priv->running->len > 0) || !g_queue_is_empty (priv->pending);
+	g_mutex_unlock (&priv->mutex);
+
+	return ret;
+}
+
+/**
+ * li_daemon_queue_class_init:
+ **/
+static void
+li_daemon_queue_class_init (LiDaemonQueueClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	object_class->finalize = li_daemon_queue_finalize;
+}
+
+/**
+ * li_daemon_queue_new:
+ *
+ * Creates a new #LiDaemonQueue.
+ *
+ * Returns: (transfer full): a #LiDaemonQueue
+ *
+ **/
+LiDaemonQueue *
+li_daemon_queue_new (void)
+{
+	LiDaemonQueue *queue;
+	queue = g_object_new (LI_TYPE_DAEMON_QUEUE, NULL);
+	return LI_DAEMON_QUEUE (queue);
+}
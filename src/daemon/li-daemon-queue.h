@@ -0,0 +1,62 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2016 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2.1 of the license, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined (__LIMBA_H) && !defined (LI_COMPILATION)
+#error "Only <limba.h> can be included directly."
+#endif
+
+#ifndef __LI_DAEMON_QUEUE_H
+#define __LI_DAEMON_QUEUE_H
+
+#include <glib-object.h>
+
+#include "li-dbus-interface.h"
+#include "li-daemon-job.h"
+
+G_BEGIN_DECLS
+
+#define LI_TYPE_DAEMON_QUEUE		(li_daemon_queue_get_type())
+G_DECLARE_DERIVABLE_TYPE (LiDaemonQueue, li_daemon_queue, LI, DAEMON_QUEUE, GObject)
+
+struct _LiDaemonQueueClass
+{
+	GObjectClass		parent_class;
+	/*< private >*/
+	void (*_as_reserved1)	(void);
+	void (*_as_reserved2)	(void);
+	void (*_as_reserved3)	(void);
+	void (*_as_reserved4)	(void);
+	void (*_as_reserved5)	(void);
+	void (*_as_reserved6)	(void);
+	void (*_as_reserved7)	(void);
+	void (*_as_reserved8)	(void);
+};
+
+GType			li_daemon_queue_get_type (void);
+LiDaemonQueue		*li_daemon_queue_new (void);
+
+guint			li_daemon_queue_submit (LiDaemonQueue *queue,
+						LiDaemonJob *job,
+						LiProxyManager *mgr_bus);
+gboolean		li_daemon_queue_is_busy (LiDaemonQueue *queue);
+
+G_END_DECLS
+
+#endif /* __LI_DAEMON_QUEUE_H */
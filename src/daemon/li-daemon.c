@@ -23,17 +23,23 @@
 
 #include "li-dbus-interface.h"
 #include "li-daemon-job.h"
+#include "li-daemon-queue.h"
+#include "li-daemon-model.h"
 
 typedef struct {
 	GMainLoop *loop;
 
 	GDBusObjectManagerServer *obj_manager;
 	PolkitAuthority *authority;
+	GHashTable *auth_cache; /* unique bus name -> set of authorized action IDs */
+	guint pending_auths;
+	guint pending_queries;
 
 	GTimer *timer;
 	guint exit_idle_time;
 	guint timer_id;
-	LiDaemonJob *job;
+	LiDaemonQueue *queue;
+	LiDaemonModel *model;
 } LiHelperDaemon;
 
 /**
@@ -46,129 +52,223 @@ li_daemon_reset_timer (LiHelperDaemon *helper)
 }
 
 /**
- * li_daemon_init_job:
+ * li_daemon_submit_job:
+ *
+ * Queue a new job.
+ *
+ * Returns: The ID of the job, which its signals are tagged with.
  */
-gboolean
-li_daemon_init_job (LiHelperDaemon *helper, LiProxyManager *mgr_bus, GDBusMethodInvocation *context)
+static guint
+li_daemon_submit_job (LiHelperDaemon *helper, LiProxyManager *mgr_bus, LiDaemonJobKind kind, const gchar *argument)
 {
-	gboolean ret;
+	g_autoptr(LiDaemonJob) job = NULL;
 
-	/* we don't have a job queue, so we error out in case someone tries to start
-	 * multiple jobs at the same time */
-	if (li_daemon_job_is_running (helper->job)) {
-		g_dbus_method_invocation_return_dbus_error (context, "org.freedesktop.Limba.Manager.Error.Failed",
-							"Another job is running at time, Please wait for it to complete.");
-		return FALSE;
-	}
+	job = li_daemon_job_new (kind, argument);
+	return li_daemon_queue_submit (helper->queue, job, mgr_bus);
+}
 
-	ret = li_daemon_job_prepare (helper->job, mgr_bus);
-	return ret;
+/* all Queue* methods complete with the job ID. The deprecated methods
+ * which don't return it have no complete function. */
+typedef void (*LiDaemonCompleteFunc) (LiProxyManager *mgr_bus, GDBusMethodInvocation *context, guint job_id);
+
+typedef struct {
+	LiHelperDaemon *helper;
+	LiProxyManager *mgr_bus;
+	GDBusMethodInvocation *context;
+	gchar *sender;
+	gchar *action_id;
+	LiDaemonJobKind kind;
+	gchar *argument;
+	LiDaemonCompleteFunc complete_func;
+} LiAuthRequest;
+
+/**
+ * li_auth_request_free:
+ */
+static void
+li_auth_request_free (LiAuthRequest *req)
+{
+	g_object_unref (req->mgr_bus);
+	g_object_unref (req->context);
+	g_free (req->sender);
+	g_free (req->action_id);
+	g_free (req->argument);
+	g_free (req);
 }
 
 /**
- * bus_manager_refresh_cache_cb:
+ * li_daemon_start_authorized_job:
  */
-static gboolean
-bus_manager_refresh_cache_cb (LiProxyManager *mgr_bus, GDBusMethodInvocation *context, LiHelperDaemon *helper)
+static void
+li_daemon_start_authorized_job (LiAuthRequest *req)
 {
-	GError *error = NULL;
-	PolkitAuthorizationResult *pres = NULL;
-	PolkitSubject *subject;
-	const gchar *sender;
+	guint job_id;
+
+	/* queue the job, it is started as soon as nothing conflicting is running anymore */
+	job_id = li_daemon_submit_job (req->helper, req->mgr_bus, req->kind, req->argument);
+	if (req->complete_func != NULL)
+		req->complete_func (req->mgr_bus, req->context, job_id);
+	else
+		g_dbus_method_invocation_return_value (req->context, NULL);
+}
 
-	sender = g_dbus_method_invocation_get_sender (context);
+/**
+ * li_daemon_check_auth_cb:
+ */
+static void
+li_daemon_check_auth_cb (PolkitAuthority *authority, GAsyncResult *res, LiAuthRequest *req)
+{
+	PolkitAuthorizationResult *pres = NULL;
+	LiHelperDaemon *helper = req->helper;
+	GHashTable *actions;
+	GError *error = NULL;
 
-	subject = polkit_system_bus_name_new (sender);
-	pres = polkit_authority_check_authorization_sync (helper->authority,
-							subject,
-							"org.freedesktop.limba.refresh-cache",
-							NULL,
-							POLKIT_CHECK_AUTHORIZATION_FLAGS_ALLOW_USER_INTERACTION,
-							NULL,
-							&error);
-	g_object_unref (subject);
+	helper->pending_auths--;
 
+	pres = polkit_authority_check_authorization_finish (authority, res, &error);
 	if (error != NULL) {
-		g_dbus_method_invocation_take_error (context, error);
+		g_dbus_method_invocation_take_error (req->context, error);
 		goto out;
 	}
 
 	if (!polkit_authorization_result_get_is_authorized (pres)) {
-		g_dbus_method_invocation_return_dbus_error (context, "org.freedesktop.Limba.Manager.Error.NotAuthorized",
+		const gchar *error_name = "org.freedesktop.Limba.Manager.Error.NotAuthorized";
+
+		if ((req->kind == LI_DAEMON_JOB_KIND_INSTALL) || (req->kind == LI_DAEMON_JOB_KIND_INSTALL_LOCAL))
+			error_name = "org.freedesktop.Limba.Installer.Error.NotAuthorized";
+		g_dbus_method_invocation_return_dbus_error (req->context, error_name,
 								"Authorization failed.");
 		goto out;
 	}
 
-	/* initialize our job, in case it is idling */
-	if (!li_daemon_init_job (helper, mgr_bus, context))
-		goto out;
-
-	/* do the thing */
-	li_daemon_job_run_refresh_cache (helper->job);
+	/* don't ask polkit again for the next requests of this client for the same
+	 * action, for as long as it stays connected */
+	actions = g_hash_table_lookup (helper->auth_cache, req->sender);
+	if (actions == NULL) {
+		actions = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+		g_hash_table_insert (helper->auth_cache, g_strdup (req->sender), actions);
+	}
+	g_hash_table_add (actions, g_strdup (req->action_id));
 
-	li_proxy_manager_complete_refresh_cache (mgr_bus, context);
+	li_daemon_start_authorized_job (req);
 
 out:
 	if (pres != NULL)
 		g_object_unref (pres);
-
 	li_daemon_reset_timer (helper);
-
-	return TRUE;
+	li_auth_request_free (req);
 }
 
 /**
- * bus_installer_install_local_cb:
+ * li_daemon_authorize_job:
+ * @action_id: The polkit action the caller needs to be authorized for
+ * @kind: The job to run if the caller is authorized
+ * @argument: Argument of the job
+ * @complete_func: (nullable): Function completing the D-Bus method call with the job ID,
+ * or %NULL for deprecated methods which don't return it
+ *
+ * Check asynchronously whether the caller is allowed to perform the
+ * requested action, and queue the job if that is the case.
+ * Positive results are remembered per action for the unique bus name of
+ * the caller until it disconnects (unique names are never reused), so
+ * clients which queue many jobs are only checked once.
  */
-static gboolean
-bus_installer_install_local_cb (LiProxyManager *mgr_bus, GDBusMethodInvocation *context, const gchar *fname, LiHelperDaemon *helper)
+static void
+li_daemon_authorize_job (LiHelperDaemon *helper,
+			 LiProxyManager *mgr_bus,
+			 GDBusMethodInvocation *context,
+			 const gchar *action_id,
+			 LiDaemonJobKind kind,
+			 const gchar *argument,
+			 LiDaemonCompleteFunc complete_func)
 {
-	GError *error = NULL;
-	LiInstaller *inst = NULL;
-	PolkitAuthorizationResult *pres = NULL;
 	PolkitSubject *subject;
+	LiAuthRequest *req;
+	GHashTable *actions;
 	const gchar *sender;
 
+	li_daemon_reset_timer (helper);
 	sender = g_dbus_method_invocation_get_sender (context);
 
-	subject = polkit_system_bus_name_new (sender);
-	pres = polkit_authority_check_authorization_sync (helper->authority,
-								subject,
-								"org.freedesktop.limba.install-software-local",
-								NULL,
-								POLKIT_CHECK_AUTHORIZATION_FLAGS_ALLOW_USER_INTERACTION,
-								NULL,
-								&error);
-	g_object_unref (subject);
-
-	if (error != NULL) {
-		g_dbus_method_invocation_take_error (context, error);
-		goto out;
+	req = g_new0 (LiAuthRequest, 1);
+	req->helper = helper;
+	req->mgr_bus = g_object_ref (mgr_bus);
+	req->context = g_object_ref (context);
+	req->sender = g_strdup (sender);
+	req->action_id = g_strdup (action_id);
+	req->kind = kind;
+	req->argument = g_strdup (argument);
+	req->complete_func = complete_func;
+
+	actions = g_hash_table_lookup (helper->auth_cache, sender);
+	if ((actions != NULL) && g_hash_table_contains (actions, action_id)) {
+		li_daemon_start_authorized_job (req);
+		li_auth_request_free (req);
+		return;
 	}
 
-	if (!polkit_authorization_result_get_is_authorized (pres)) {
-		g_dbus_method_invocation_return_dbus_error (context, "org.freedesktop.Limba.Installer.Error.NotAuthorized",
-							"Authorization failed.");
-		goto out;
-	}
-
-	/* initialize our job, in case it is idling */
-	if (!li_daemon_init_job (helper, mgr_bus, context))
-		goto out;
-
-	/* do the thing */
-	li_daemon_job_run_install_local (helper->job, fname);
+	subject = polkit_system_bus_name_new (sender);
+	helper->pending_auths++;
+	polkit_authority_check_authorization (helper->authority,
+					      subject,
+					      action_id,
+					      NULL,
+					      POLKIT_CHECK_AUTHORIZATION_FLAGS_ALLOW_USER_INTERACTION,
+					      NULL,
+					      (GAsyncReadyCallback) li_daemon_check_auth_cb,
+					      req);
+	g_object_unref (subject);
+}
 
-	li_proxy_manager_complete_install_local (mgr_bus, context);
+/**
+ * bus_manager_refresh_cache_cb:
+ */
+static gboolean
+bus_manager_refresh_cache_cb (LiProxyManager *mgr_bus, GDBusMethodInvocation *context, LiHelperDaemon *helper)
+{
+	li_daemon_authorize_job (helper, mgr_bus, context,
+				 "org.freedesktop.limba.refresh-cache",
+				 LI_DAEMON_JOB_KIND_REFRESH_CACHE, NULL,
+				 NULL);
+	return TRUE;
+}
 
- out:
-	if (inst != NULL)
-		g_object_unref (inst);
-	if (pres != NULL)
-		g_object_unref (pres);
+/**
+ * bus_manager_queue_refresh_cache_cb:
+ */
+static gboolean
+bus_manager_queue_refresh_cache_cb (LiProxyManager *mgr_bus, GDBusMethodInvocation *context, LiHelperDaemon *helper)
+{
+	li_daemon_authorize_job (helper, mgr_bus, context,
+				 "org.freedesktop.limba.refresh-cache",
+				 LI_DAEMON_JOB_KIND_REFRESH_CACHE, NULL,
+				 li_proxy_manager_complete_queue_refresh_cache);
+	return TRUE;
+}
 
-	li_daemon_reset_timer (helper);
+/**
+ * bus_installer_install_local_cb:
+ */
+static gboolean
+bus_installer_install_local_cb (LiProxyManager *mgr_bus, GDBusMethodInvocation *context, const gchar *fname, LiHelperDaemon *helper)
+{
+	li_daemon_authorize_job (helper, mgr_bus, context,
+				 "org.freedesktop.limba.install-software-local",
+				 LI_DAEMON_JOB_KIND_INSTALL_LOCAL, fname,
+				 NULL);
+	return TRUE;
+}
 
+/**
+ * bus_installer_queue_install_local_cb:
+ */
+static gboolean
+bus_installer_queue_install_local_cb (LiProxyManager *mgr_bus, GDBusMethodInvocation *context, const gchar *fname, LiHelperDaemon *helper)
+{
+	li_daemon_authorize_job (helper, mgr_bus, context,
+				 "org.freedesktop.limba.install-software-local",
+				 LI_DAEMON_JOB_KIND_INSTALL_LOCAL, fname,
+				 li_proxy_manager_complete_queue_install_local);
 	return TRUE;
 }
 
@@ -178,49 +278,23 @@ bus_installer_install_local_cb (LiProxyManager *mgr_bus, GDBusMethodInvocation *
 static gboolean
 bus_installer_install_cb (LiProxyManager *mgr_bus, GDBusMethodInvocation *context, const gchar *pkid, LiHelperDaemon *helper)
 {
-	GError *error = NULL;
-	PolkitAuthorizationResult *pres = NULL;
-	PolkitSubject *subject;
-	const gchar *sender;
-
-	sender = g_dbus_method_invocation_get_sender (context);
-
-	subject = polkit_system_bus_name_new (sender);
-	pres = polkit_authority_check_authorization_sync (helper->authority,
-							subject,
-							"org.freedesktop.limba.install-software",
-							NULL,
-							POLKIT_CHECK_AUTHORIZATION_FLAGS_ALLOW_USER_INTERACTION,
-							NULL,
-							&error);
-	g_object_unref (subject);
-
-	if (error != NULL) {
-		g_dbus_method_invocation_take_error (context, error);
-		goto out;
-	}
-
-	if (!polkit_authorization_result_get_is_authorized (pres)) {
-		g_dbus_method_invocation_return_dbus_error (context, "org.freedesktop.Limba.Installer.Error.NotAuthorized",
-							"Authorization failed.");
-		goto out;
-	}
-
-	/* initialize our job, in case it is idling */
-	if (!li_daemon_init_job (helper, mgr_bus, context))
-		goto out;
-
-	/* do the thing */
-	li_daemon_job_run_install (helper->job, pkid);
-
-	li_proxy_manager_complete_install (mgr_bus, context);
-
-out:
-	if (pres != NULL)
-		g_object_unref (pres);
-
-	li_daemon_reset_timer (helper);
+	li_daemon_authorize_job (helper, mgr_bus, context,
+				 "org.freedesktop.limba.install-software",
+				 LI_DAEMON_JOB_KIND_INSTALL, pkid,
+				 NULL);
+	return TRUE;
+}
 
+/**
+ * bus_installer_queue_install_cb:
+ */
+static gboolean
+bus_installer_queue_install_cb (LiProxyManager *mgr_bus, GDBusMethodInvocation *context, const gchar *pkid, LiHelperDaemon *helper)
+{
+	li_daemon_authorize_job (helper, mgr_bus, context,
+				 "org.freedesktop.limba.install-software",
+				 LI_DAEMON_JOB_KIND_INSTALL, pkid,
+				 li_proxy_manager_complete_queue_install);
 	return TRUE;
 }
 
@@ -230,49 +304,23 @@ out:
 static gboolean
 bus_manager_remove_software_cb (LiProxyManager *mgr_bus, GDBusMethodInvocation *context, const gchar *pkid, LiHelperDaemon *helper)
 {
-	GError *error = NULL;
-	PolkitAuthorizationResult *pres = NULL;
-	PolkitSubject *subject;
-	const gchar *sender;
-
-	sender = g_dbus_method_invocation_get_sender (context);
-
-	subject = polkit_system_bus_name_new (sender);
-	pres = polkit_authority_check_authorization_sync (helper->authority,
-							subject,
-							"org.freedesktop.limba.remove-software",
-							NULL,
-							POLKIT_CHECK_AUTHORIZATION_FLAGS_ALLOW_USER_INTERACTION,
-							NULL,
-							&error);
-	g_object_unref (subject);
-
-	if (error != NULL) {
-		g_dbus_method_invocation_take_error (context, error);
-		goto out;
-	}
-
-	if (!polkit_authorization_result_get_is_authorized (pres)) {
-		g_dbus_method_invocation_return_dbus_error (context, "org.freedesktop.Limba.Manager.Error.NotAuthorized",
-								"Authorization failed.");
-		goto out;
-	}
-
-	/* initialize our job, in case it is idling */
-	if (!li_daemon_init_job (helper, mgr_bus, context))
-		goto out;
-
-	/* do the thing */
-	li_daemon_job_run_remove_package (helper->job, pkid);
-
-	li_proxy_manager_complete_remove (mgr_bus, context);
-
-out:
-	if (pres != NULL)
-		g_object_unref (pres);
-
-	li_daemon_reset_timer (helper);
+	li_daemon_authorize_job (helper, mgr_bus, context,
+				 "org.freedesktop.limba.remove-software",
+				 LI_DAEMON_JOB_KIND_REMOVE, pkid,
+				 NULL);
+	return TRUE;
+}
 
+/**
+ * bus_manager_queue_remove_software_cb:
+ */
+static gboolean
+bus_manager_queue_remove_software_cb (LiProxyManager *mgr_bus, GDBusMethodInvocation *context, const gchar *pkid, LiHelperDaemon *helper)
+{
+	li_daemon_authorize_job (helper, mgr_bus, context,
+				 "org.freedesktop.limba.remove-software",
+				 LI_DAEMON_JOB_KIND_REMOVE, pkid,
+				 li_proxy_manager_complete_queue_remove);
 	return TRUE;
 }
 
@@ -282,102 +330,243 @@ out:
 static gboolean
 bus_manager_update_cb (LiProxyManager *mgr_bus, GDBusMethodInvocation *context, const gchar *pkid, LiHelperDaemon *helper)
 {
-	GError *error = NULL;
-	PolkitAuthorizationResult *pres = NULL;
-	PolkitSubject *subject;
-	const gchar *sender;
+	li_daemon_authorize_job (helper, mgr_bus, context,
+				 "org.freedesktop.limba.update-software",
+				 LI_DAEMON_JOB_KIND_UPDATE, pkid,
+				 NULL);
+	return TRUE;
+}
 
-	sender = g_dbus_method_invocation_get_sender (context);
+/**
+ * bus_manager_queue_update_cb:
+ */
+static gboolean
+bus_manager_queue_update_cb (LiProxyManager *mgr_bus, GDBusMethodInvocation *context, const gchar *pkid, LiHelperDaemon *helper)
+{
+	li_daemon_authorize_job (helper, mgr_bus, context,
+				 "org.freedesktop.limba.update-software",
+				 LI_DAEMON_JOB_KIND_UPDATE, pkid,
+				 li_proxy_manager_complete_queue_update);
+	return TRUE;
+}
 
-	subject = polkit_system_bus_name_new (sender);
-	pres = polkit_authority_check_authorization_sync (helper->authority,
-							subject,
-							"org.freedesktop.limba.update-software",
-							NULL,
-							POLKIT_CHECK_AUTHORIZATION_FLAGS_ALLOW_USER_INTERACTION,
-							NULL,
-							&error);
-	g_object_unref (subject);
+/**
+ * bus_manager_update_all_cb:
+ */
+static gboolean
+bus_manager_update_all_cb (LiProxyManager *mgr_bus, GDBusMethodInvocation *context, LiHelperDaemon *helper)
+{
+	li_daemon_authorize_job (helper, mgr_bus, context,
+				 "org.freedesktop.limba.update-software",
+				 LI_DAEMON_JOB_KIND_UPDATE_ALL, NULL,
+				 NULL);
+	return TRUE;
+}
 
-	if (error != NULL) {
-		g_dbus_method_invocation_take_error (context, error);
-		goto out;
-	}
+/**
+ * bus_manager_queue_update_all_cb:
+ */
+static gboolean
+bus_manager_queue_update_all_cb (LiProxyManager *mgr_bus, GDBusMethodInvocation *context, LiHelperDaemon *helper)
+{
+	li_daemon_authorize_job (helper, mgr_bus, context,
+				 "org.freedesktop.limba.update-software",
+				 LI_DAEMON_JOB_KIND_UPDATE_ALL, NULL,
+				 li_proxy_manager_complete_queue_update_all);
+	return TRUE;
+}
 
-	if (!polkit_authorization_result_get_is_authorized (pres)) {
-		g_dbus_method_invocation_return_dbus_error (context, "org.freedesktop.Limba.Manager.Error.NotAuthorized",
-								"Authorization failed.");
-		goto out;
-	}
+typedef enum {
+	LI_QUERY_KIND_INSTALLED,
+	LI_QUERY_KIND_AVAILABLE,
+	LI_QUERY_KIND_UPDATES,
+	LI_QUERY_KIND_RUNTIMES
+} LiQueryKind;
 
-	/* initialize our job, in case it is idling */
-	if (!li_daemon_init_job (helper, mgr_bus, context))
-		goto out;
+typedef struct {
+	LiHelperDaemon *helper;
+	LiProxyManager *mgr_bus;
+	GDBusMethodInvocation *context;
+	LiQueryKind kind;
+	gchar *filter;
+	guint offset;
+	guint limit;
+} LiQueryRequest;
 
-	/* do the thing */
-	li_daemon_job_run_update (helper->job, pkid);
+/**
+ * li_query_request_free:
+ */
+static void
+li_query_request_free (LiQueryRequest *req)
+{
+	g_object_unref (req->mgr_bus);
+	g_object_unref (req->context);
+	g_free (req->filter);
+	g_free (req);
+}
 
-	li_proxy_manager_complete_update (mgr_bus, context);
+static void li_daemon_query_loaded_cb (LiDaemonModel *model, GAsyncResult *res, LiQueryRequest *req);
 
-out:
-	if (pres != NULL)
-		g_object_unref (pres);
+/**
+ * li_daemon_query:
+ *
+ * Answer a query for the software lists, once the daemon model
+ * has loaded them.
+ */
+static void
+li_daemon_query (LiHelperDaemon *helper,
+		 LiProxyManager *mgr_bus,
+		 GDBusMethodInvocation *context,
+		 LiQueryKind kind,
+		 const gchar *filter,
+		 guint offset,
+		 guint limit)
+{
+	LiQueryRequest *req;
 
 	li_daemon_reset_timer (helper);
 
-	return TRUE;
+	req = g_new0 (LiQueryRequest, 1);
+	req->helper = helper;
+	req->mgr_bus = g_object_ref (mgr_bus);
+	req->context = g_object_ref (context);
+	req->kind = kind;
+	req->filter = g_strdup (filter);
+	req->offset = offset;
+	req->limit = limit;
+
+	/* loading the lists can take a while, so we don't block the main loop for it */
+	helper->pending_queries++;
+	li_daemon_model_load_async (helper->model, NULL,
+				    (GAsyncReadyCallback) li_daemon_query_loaded_cb,
+				    req);
 }
 
 /**
- * bus_manager_update_all_cb:
+ * li_daemon_query_loaded_cb:
  */
-static gboolean
-bus_manager_update_all_cb (LiProxyManager *mgr_bus, GDBusMethodInvocation *context, LiHelperDaemon *helper)
+static void
+li_daemon_query_loaded_cb (LiDaemonModel *model, GAsyncResult *res, LiQueryRequest *req)
 {
+	GVariant *result = NULL;
+	guint total = 0;
 	GError *error = NULL;
-	PolkitAuthorizationResult *pres = NULL;
-	PolkitSubject *subject;
-	const gchar *sender;
+	LiHelperDaemon *helper = req->helper;
 
-	sender = g_dbus_method_invocation_get_sender (context);
+	helper->pending_queries--;
+	li_daemon_reset_timer (helper);
 
-	subject = polkit_system_bus_name_new (sender);
-	pres = polkit_authority_check_authorization_sync (helper->authority,
-							subject,
-							"org.freedesktop.limba.update-software",
-							NULL,
-							POLKIT_CHECK_AUTHORIZATION_FLAGS_ALLOW_USER_INTERACTION,
-							NULL,
-							&error);
-	g_object_unref (subject);
+	if (!li_daemon_model_load_finish (model, res, &error)) {
+		g_dbus_method_invocation_take_error (req->context, error);
+		li_query_request_free (req);
+		return;
+	}
+
+	switch (req->kind) {
+		case LI_QUERY_KIND_INSTALLED:
+		case LI_QUERY_KIND_AVAILABLE:
+			result = li_daemon_model_get_software (model, req->kind == LI_QUERY_KIND_INSTALLED, req->filter,
+								req->offset, req->limit, &total, &error);
+			break;
+		case LI_QUERY_KIND_UPDATES:
+			result = li_daemon_model_get_updates (model, req->offset, req->limit, &total, &error);
+			break;
+		case LI_QUERY_KIND_RUNTIMES:
+			result = li_daemon_model_get_runtimes (model, req->offset, req->limit, &total, &error);
+			break;
+	}
 
+	/* the software changed right after the lists were loaded, load them again */
+	if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_BUSY)) {
+		g_error_free (error);
+		li_daemon_query (helper, req->mgr_bus, req->context, req->kind, req->filter, req->offset, req->limit);
+		li_query_request_free (req);
+		return;
+	}
 	if (error != NULL) {
-		g_dbus_method_invocation_take_error (context, error);
-		goto out;
+		g_dbus_method_invocation_take_error (req->context, error);
+		li_query_request_free (req);
+		return;
 	}
 
-	if (!polkit_authorization_result_get_is_authorized (pres)) {
-		g_dbus_method_invocation_return_dbus_error (context, "org.freedesktop.Limba.Manager.Error.NotAuthorized",
-								"Authorization failed.");
-		goto out;
+	switch (req->kind) {
+		case LI_QUERY_KIND_INSTALLED:
+			li_proxy_manager_complete_get_installed (req->mgr_bus, req->context, result, total);
+			break;
+		case LI_QUERY_KIND_AVAILABLE:
+			li_proxy_manager_complete_get_available (req->mgr_bus, req->context, result, total);
+			break;
+		case LI_QUERY_KIND_UPDATES:
+			li_proxy_manager_complete_get_updates (req->mgr_bus, req->context, result, total);
+			break;
+		case LI_QUERY_KIND_RUNTIMES:
+			li_proxy_manager_complete_get_runtimes (req->mgr_bus, req->context, result, total);
+			break;
 	}
+	li_query_request_free (req);
+}
 
-	/* initialize our job, in case it is idling */
-	if (!li_daemon_init_job (helper, mgr_bus, context))
-		goto out;
+/**
+ * bus_manager_get_installed_cb:
+ */
+static gboolean
+bus_manager_get_installed_cb (LiProxyManager *mgr_bus, GDBusMethodInvocation *context, const gchar *filter, guint offset, guint limit, LiHelperDaemon *helper)
+{
+	li_daemon_query (helper, mgr_bus, context, LI_QUERY_KIND_INSTALLED, filter, offset, limit);
+	return TRUE;
+}
 
-	/* do the thing */
-	li_daemon_job_run_update_all (helper->job);
+/**
+ * bus_manager_get_available_cb:
+ */
+static gboolean
+bus_manager_get_available_cb (LiProxyManager *mgr_bus, GDBusMethodInvocation *context, const gchar *filter, guint offset, guint limit, LiHelperDaemon *helper)
+{
+	li_daemon_query (helper, mgr_bus, context, LI_QUERY_KIND_AVAILABLE, filter, offset, limit);
+	return TRUE;
+}
 
-	li_proxy_manager_complete_update_all (mgr_bus, context);
+/**
+ * bus_manager_get_updates_cb:
+ */
+static gboolean
+bus_manager_get_updates_cb (LiProxyManager *mgr_bus, GDBusMethodInvocation *context, guint offset, guint limit, LiHelperDaemon *helper)
+{
+	li_daemon_query (helper, mgr_bus, context, LI_QUERY_KIND_UPDATES, NULL, offset, limit);
+	return TRUE;
+}
 
-out:
-	if (pres != NULL)
-		g_object_unref (pres);
+/**
+ * bus_manager_get_runtimes_cb:
+ */
+static gboolean
+bus_manager_get_runtimes_cb (LiProxyManager *mgr_bus, GDBusMethodInvocation *context, guint offset, guint limit, LiHelperDaemon *helper)
+{
+	li_daemon_query (helper, mgr_bus, context, LI_QUERY_KIND_RUNTIMES, NULL, offset, limit);
+	return TRUE;
+}
 
-	li_daemon_reset_timer (helper);
+/**
+ * li_daemon_name_owner_changed_cb:
+ *
+ * Forget the authorizations of clients which have disconnected.
+ */
+static void
+li_daemon_name_owner_changed_cb (GDBusConnection *connection,
+				 const gchar *sender_name,
+				 const gchar *object_path,
+				 const gchar *interface_name,
+				 const gchar *signal_name,
+				 GVariant *parameters,
+				 LiHelperDaemon *helper)
+{
+	const gchar *name;
+	const gchar *old_owner;
+	const gchar *new_owner;
 
-	return TRUE;
+	g_variant_get (parameters, "(&s&s&s)", &name, &old_owner, &new_owner);
+	if ((name[0] == ':') && (new_owner[0] == '\0'))
+		g_hash_table_remove (helper->auth_cache, name);
 }
 
 /**
@@ -397,6 +586,18 @@ on_bus_acquired (GDBusConnection *connection, const gchar *name, LiHelperDaemon
 
 	helper->obj_manager = g_dbus_object_manager_server_new ("/org/freedesktop/Limba");
 
+	/* remembered authorizations are only valid while the client is connected */
+	g_dbus_connection_signal_subscribe (connection,
+					    "org.freedesktop.DBus",
+					    "org.freedesktop.DBus",
+					    "NameOwnerChanged",
+					    "/org/freedesktop/DBus",
+					    NULL,
+					    G_DBUS_SIGNAL_FLAGS_NONE,
+					    (GDBusSignalCallback) li_daemon_name_owner_changed_cb,
+					    helper,
+					    NULL);
+
 	/* create the Manager object */
 	object = li_proxy_object_skeleton_new ("/org/freedesktop/Limba/Manager");
 
@@ -409,31 +610,81 @@ on_bus_acquired (GDBusConnection *connection, const gchar *name, LiHelperDaemon
 			G_CALLBACK (bus_manager_refresh_cache_cb),
 			helper);
 
+	g_signal_connect (mgr_bus,
+			"handle-queue-refresh-cache",
+			G_CALLBACK (bus_manager_queue_refresh_cache_cb),
+			helper);
+
 	g_signal_connect (mgr_bus,
 			"handle-remove",
 			G_CALLBACK (bus_manager_remove_software_cb),
 			helper);
 
+	g_signal_connect (mgr_bus,
+			"handle-queue-remove",
+			G_CALLBACK (bus_manager_queue_remove_software_cb),
+			helper);
+
 	g_signal_connect (mgr_bus,
 			"handle-install",
 			G_CALLBACK (bus_installer_install_cb),
 			helper);
 
+	g_signal_connect (mgr_bus,
+			"handle-queue-install",
+			G_CALLBACK (bus_installer_queue_install_cb),
+			helper);
+
 	g_signal_connect (mgr_bus,
 			"handle-install-local",
 			G_CALLBACK (bus_installer_install_local_cb),
 			helper);
 
+	g_signal_connect (mgr_bus,
+			"handle-queue-install-local",
+			G_CALLBACK (bus_installer_queue_install_local_cb),
+			helper);
+
 	g_signal_connect (mgr_bus,
 			"handle-update",
 			G_CALLBACK (bus_manager_update_cb),
 			helper);
 
+	g_signal_connect (mgr_bus,
+			"handle-queue-update",
+			G_CALLBACK (bus_manager_queue_update_cb),
+			helper);
+
 	g_signal_connect (mgr_bus,
 			"handle-update-all",
 			G_CALLBACK (bus_manager_update_all_cb),
 			helper);
 
+	g_signal_connect (mgr_bus,
+			"handle-queue-update-all",
+			G_CALLBACK (bus_manager_queue_update_all_cb),
+			helper);
+
+	g_signal_connect (mgr_bus,
+			"handle-get-installed",
+			G_CALLBACK (bus_manager_get_installed_cb),
+			helper);
+
+	g_signal_connect (mgr_bus,
+			"handle-get-available",
+			G_CALLBACK (bus_manager_get_available_cb),
+			helper);
+
+	g_signal_connect (mgr_bus,
+			"handle-get-updates",
+			G_CALLBACK (bus_manager_get_updates_cb),
+			helper);
+
+	g_signal_connect (mgr_bus,
+			"handle-get-runtimes",
+			G_CALLBACK (bus_manager_get_runtimes_cb),
+			helper);
+
 	/* export the object */
 	g_dbus_object_manager_server_export (helper->obj_manager, G_DBUS_OBJECT_SKELETON (object));
 	g_object_unref (object);
@@ -471,8 +722,8 @@ li_daemon_timeout_check_cb (LiHelperDaemon *helper)
 {
 	guint idle;
 
-	/* we don't do anything when a job is running */
-	if (li_daemon_job_is_running (helper->job)) {
+	/* we don't do anything while jobs are queued or running, or clients wait for authorization or query results */
+	if (li_daemon_queue_is_busy (helper->queue) || (helper->pending_auths > 0) || (helper->pending_queries > 0)) {
 		li_daemon_reset_timer (helper);
 		return TRUE;
 	}
@@ -541,7 +792,12 @@ main (gint argc, gchar *argv[])
 	helper.loop = g_main_loop_new (NULL, FALSE);
 	helper.exit_idle_time = 30;
 	helper.timer = g_timer_new ();
-	helper.job = li_daemon_job_new ();
+	helper.queue = li_daemon_queue_new ();
+	helper.model = li_daemon_model_new ();
+	helper.authority = NULL;
+	helper.auth_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_hash_table_unref);
+	helper.pending_auths = 0;
+	helper.pending_queries = 0;
 
 	id = g_bus_own_name (G_BUS_TYPE_SYSTEM,
 				"org.freedesktop.Limba",
@@ -561,7 +817,9 @@ main (gint argc, gchar *argv[])
 	g_bus_unown_name (id);
 	g_timer_destroy (helper.timer);
 	g_main_loop_unref (helper.loop);
-	g_object_unref (helper.job);
+	g_object_unref (helper.queue);
+	g_object_unref (helper.model);
+	g_hash_table_unref (helper.auth_cache);
 
 	if (helper.timer_id > 0)
 		g_source_remove (helper.timer_id);
@@ -0,0 +1,614 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2016 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2.1 of the license, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * SECTION:li-checksum
+ * @short_description: Fast SHA-256 checksums of files
+ *
+ * Packages can be several gigabytes large, so hashing them should be limited
+ * by the speed of the disk, not the CPU. Files are read in large chunks
+ * instead of small ones, and on CPUs with the SHA extensions the hardware
+ * instructions are used, which are selected at runtime. Many files can be
+ * hashed concurrently.
+ *
+ * Files are deliberately not mapped into memory: a file which is truncated
+ * while we hash it would otherwise kill the process with SIGBUS.
+ *
+ * Setting the environment variable LIMBA_SHA256_BACKEND to "generic" forces
+ * the portable implementation.
+ */
+
+#include "config.h"
+#include "li-checksum.h"
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LI_CHECKSUM_HAVE_SHA_NI 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+/* size of the chunks files are read in */
+#define LI_CHECKSUM_READ_SIZE (8 * 1024 * 1024)
+
+typedef void (*LiSha256TransformFunc) (guint32 *state, const guint8 *data, gsize blocks);
+
+static const guint32 sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/**
+ * li_sha256_transform_generic:
+ *
+ * Process @blocks blocks of 64 bytes, portable version.
+ */
+static void
+li_sha256_transform_generic (guint32 *state, const guint8 *data, gsize blocks)
+{
+	guint32 w[64];
+	guint32 a, b, c, d, e, f, g, h;
+	guint i;
+
+	while (blocks-- > 0) {
+		for (i = 0; i < 16; i++)
+			w[i] = ((guint32) data[i * 4] << 24) |
+				((guint32) data[i * 4 + 1] << 16) |
+				((guint32) data[i * 4 + 2] << 8) |
+				((guint32) data[i * 4 + 3]);
+		for (i = 16; i < 64; i++) {
+			guint32 s0 = ROTR32 (w[i - 15], 7) ^ ROTR32 (w[i - 15], 18) ^ (w[i - 15] >> 3);
+			guint32 s1 = ROTR32 (w[i - 2], 17) ^ ROTR32 (w[i - 2], 19) ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+
+		a = state[0];
+		b = state[1];
+		c = state[2];
+		d = state[3];
+		e = state[4];
+		f = state[5];
+		g = state[6];
+		h = state[7];
+
+		for (i = 0; i < 64; i++) {
+			guint32 t1 = h + (ROTR32 (e, 6) ^ ROTR32 (e, 11) ^ ROTR32 (e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+			guint32 t2 = (ROTR32 (a, 2) ^ ROTR32 (a, 13) ^ ROTR32 (a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
+
+		data += 64;
+	}
+}
+
+#ifdef LI_CHECKSUM_HAVE_SHA_NI
+
+/* four rounds, using the message words in M */
+#define SHA_NI_ROUNDS(group, M) \
+	msg = _mm_add_epi32 (M, _mm_loadu_si128 ((const __m128i*) &sha256_k[(group) * 4])); \
+	state1 = _mm_sha256rnds2_epu32 (state1, state0, msg); \
+	msg = _mm_shuffle_epi32 (msg, 0x0E); \
+	state0 = _mm_sha256rnds2_epu32 (state0, state1, msg)
+
+/* complete the message words in NEXT, using the ones of the current and previous group */
+#define SHA_NI_SCHEDULE2(M, PREV, NEXT) \
+	tmp = _mm_alignr_epi8 (M, PREV, 4); \
+	NEXT = _mm_add_epi32 (NEXT, tmp); \
+	NEXT = _mm_sha256msg2_epu32 (NEXT, M)
+
+/* start computing the message words four groups ahead */
+#define SHA_NI_SCHEDULE1(PREV, M) \
+	PREV = _mm_sha256msg1_epu32 (PREV, M)
+
+#define SHA_NI_LOAD(M, offset) \
+	M = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i*) (data + (offset))), mask)
+
+/**
+ * li_sha256_transform_sha_ni:
+ *
+ * Process @blocks blocks of 64 bytes, using the Intel SHA extensions.
+ */
+__attribute__((target ("sha,sse4.1,ssse3")))
+static void
+li_sha256_transform_sha_ni (guint32 *state, const guint8 *data, gsize blocks)
+{
+	__m128i state0, state1, msg, tmp;
+	__m128i m0, m1, m2, m3;
+	__m128i abef_save, cdgh_save;
+	const __m128i mask = _mm_set_epi64x (0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+	/* the instructions expect the state as ABEF and CDGH */
+	tmp = _mm_loadu_si128 ((const __m128i*) &state[0]);
+	state1 = _mm_loadu_si128 ((const __m128i*) &state[4]);
+	tmp = _mm_shuffle_epi32 (tmp, 0xB1);
+	state1 = _mm_shuffle_epi32 (state1, 0x1B);
+	state0 = _mm_alignr_epi8 (tmp, state1, 8);
+	state1 = _mm_blend_epi16 (state1, tmp, 0xF0);
+
+	while (blocks-- > 0) {
+		abef_save = state0;
+		cdgh_save = state1;
+
+		SHA_NI_LOAD (m0, 0);
+		SHA_NI_ROUNDS (0, m0);
+
+		SHA_NI_LOAD (m1, 16);
+		SHA_NI_ROUNDS (1, m1);
+		SHA_NI_SCHEDULE1 (m0, m1);
+
+		SHA_NI_LOAD (m2, 32);
+		SHA_NI_ROUNDS (2, m2);
+		SHA_NI_SCHEDULE1 (m1, m2);
+
+		SHA_NI_LOAD (m3, 48);
+		SHA_NI_ROUNDS (3, m3);
+		SHA_NI_SCHEDULE2 (m3, m2, m0);
+		SHA_NI_SCHEDULE1 (m2, m3);
+
+		SHA_NI_ROUNDS (4, m0);
+		SHA_NI_SCHEDULE2 (m0, m3, m1);
+		SHA_NI_SCHEDULE1 (m3, m0);
+
+		SHA_NI_ROUNDS (5, m1);
+		SHA_NI_SCHEDULE2 (m1, m0, m2);
+		SHA_NI_SCHEDULE1 (m0, m1);
+
+		SHA_NI_ROUNDS (6, m2);
+		SHA_NI_SCHEDULE2 (m2, m1, m3);
+		SHA_NI_SCHEDULE1 (m1, m2);
+
+		SHA_NI_ROUNDS (7, m3);
+		SHA_NI_SCHEDULE2 (m3, m2, m0);
+		SHA_NI_SCHEDULE1 (m2, m3);
+
+		SHA_NI_ROUNDS (8, m0);
+		SHA_NI_SCHEDULE2 (m0, m3, m1);
+		SHA_NI_SCHEDULE1 (m3, m0);
+
+		SHA_NI_ROUNDS (9, m1);
+		SHA_NI_SCHEDULE2 (m1, m0, m2);
+		SHA_NI_SCHEDULE1 (m0, m1);
+
+		SHA_NI_ROUNDS (10, m2);
+		SHA_NI_SCHEDULE2 (m2, m1, m3);
+		SHA_NI_SCHEDULE1 (m1, m2);
+
+		SHA_NI_ROUNDS (11, m3);
+		SHA_NI_SCHEDULE2 (m3, m2, m0);
+		SHA_NI_SCHEDULE1 (m2, m3);
+
+		SHA_NI_ROUNDS (12, m0);
+		SHA_NI_SCHEDULE2 (m0, m3, m1);
+		SHA_NI_SCHEDULE1 (m3, m0);
+
+		SHA_NI_ROUNDS (13, m1);
+		SHA_NI_SCHEDULE2 (m1, m0, m2);
+
+		SHA_NI_ROUNDS (14, m2);
+		SHA_NI_SCHEDULE2 (m2, m1, m3);
+
+		SHA_NI_ROUNDS (15, m3);
+
+		state0 = _mm_add_epi32 (state0, abef_save);
+		state1 = _mm_add_epi32 (state1, cdgh_save);
+
+		data += 64;
+	}
+
+	/* back to ABCD and EFGH */
+	tmp = _mm_shuffle_epi32 (state0, 0x1B);
+	state1 = _mm_shuffle_epi32 (state1, 0xB1);
+	state0 = _mm_blend_epi16 (tmp, state1, 0xF0);
+	state1 = _mm_alignr_epi8 (state1, tmp, 8);
+	_mm_storeu_si128 ((__m128i*) &state[0], state0);
+	_mm_storeu_si128 ((__m128i*) &state[4], state1);
+}
+
+/**
+ * li_checksum_cpu_has_sha_ni:
+ */
+static gboolean
+li_checksum_cpu_has_sha_ni (void)
+{
+	guint eax, ebx, ecx, edx;
+
+	if (__get_cpuid_max (0, NULL) < 7)
+		return FALSE;
+
+	/* SSSE3 and SSE4.1 */
+	__cpuid (1, eax, ebx, ecx, edx);
+	if (((ecx & (1 << 9)) == 0) || ((ecx & (1 << 19)) == 0))
+		return FALSE;
+
+	/* SHA */
+	__cpuid_count (7, 0, eax, ebx, ecx, edx);
+	return (ebx & (1 << 29)) != 0;
+}
+
+#endif /* LI_CHECKSUM_HAVE_SHA_NI */
+
+static LiSha256TransformFunc sha256_transform = NULL;
+static const gchar *sha256_backend_name = NULL;
+
+/**
+ * li_checksum_use_backend:
+ *
+ * Returns: %TRUE if the backend is known and supported by this CPU.
+ */
+static gboolean
+li_checksum_use_backend (const gchar *name)
+{
+	if (g_strcmp0 (name, "generic") == 0) {
+		sha256_transform = li_sha256_transform_generic;
+		sha256_backend_name = "generic";
+		return TRUE;
+	}
+
+#ifdef LI_CHECKSUM_HAVE_SHA_NI
+	if ((g_strcmp0 (name, "sha-ni") == 0) && li_checksum_cpu_has_sha_ni ()) {
+		sha256_transform = li_sha256_transform_sha_ni;
+		sha256_backend_name = "sha-ni";
+		return TRUE;
+	}
+#endif
+
+	return FALSE;
+}
+
+/**
+ * li_checksum_select_backend:
+ */
+static gpointer
+li_checksum_select_backend (gpointer data)
+{
+	const gchar *forced;
+
+	forced = g_getenv ("LIMBA_SHA256_BACKEND");
+	if ((forced != NULL) && li_checksum_use_backend (forced)) {
+		g_debug ("Using %s SHA-256 implementation, as requested.", sha256_backend_name);
+		return NULL;
+	}
+
+	if (!li_checksum_use_backend ("sha-ni"))
+		li_checksum_use_backend ("generic");
+
+	g_debug ("Using %s SHA-256 implementation.", sha256_backend_name);
+	return NULL;
+}
+
+/**
+ * li_checksum_ensure_backend:
+ */
+static void
+li_checksum_ensure_backend (void)
+{
+	static GOnce once = G_ONCE_INIT;
+	g_once (&once, li_checksum_select_backend, NULL);
+}
+
+/**
+ * li_checksum_get_backend_name:
+ *
+ * Returns: The name of the SHA-256 implementation in use.
+ */
+const gchar*
+li_checksum_get_backend_name (void)
+{
+	li_checksum_ensure_backend ();
+	return sha256_backend_name;
+}
+
+/**
+ * li_checksum_set_backend:
+ * @name: The SHA-256 implementation to use, "generic" or "sha-ni"
+ *
+ * Override the automatically selected SHA-256 implementation.
+ * This must not be called while checksums are computed.
+ *
+ * Returns: %TRUE if the implementation is available on this machine.
+ */
+gboolean
+li_checksum_set_backend (const gchar *name)
+{
+	li_checksum_ensure_backend ();
+	return li_checksum_use_backend (name);
+}
+
+/**
+ * li_sha256_init:
+ */
+void
+li_sha256_init (LiSha256 *ctx)
+{
+	static const guint32 initial_state[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+
+	li_checksum_ensure_backend ();
+
+	memcpy (ctx->state, initial_state, sizeof (initial_state));
+	ctx->length = 0;
+	ctx->buf_len = 0;
+}
+
+/**
+ * li_sha256_update:
+ */
+void
+li_sha256_update (LiSha256 *ctx, const guint8 *data, gsize len)
+{
+	gsize blocks;
+
+	ctx->length += len;
+
+	/* complete a block we already started */
+	if (ctx->buf_len > 0) {
+		gsize n = MIN (len, sizeof (ctx->buf) - ctx->buf_len);
+
+		memcpy (ctx->buf + ctx->buf_len, data, n);
+		ctx->buf_len += n;
+		data += n;
+		len -= n;
+
+		if (ctx->buf_len < sizeof (ctx->buf))
+			return;
+		sha256_transform (ctx->state, ctx->buf, 1);
+		ctx->buf_len = 0;
+	}
+
+	/* hash full blocks directly from the input */
+	blocks = len / 64;
+	if (blocks > 0) {
+		sha256_transform (ctx->state, data, blocks);
+		data += blocks * 64;
+		len -= blocks * 64;
+	}
+
+	memcpy (ctx->buf, data, len);
+	ctx->buf_len = len;
+}
+
+/**
+ * li_sha256_finish:
+ *
+ * Returns: The checksum as hexadecimal string.
+ */
+gchar*
+li_sha256_finish (LiSha256 *ctx)
+{
+	guint i;
+	guint64 bits;
+	gchar *res;
+
+	bits = ctx->length * 8;
+
+	/* pad with 0x80 and zeros, and append the length in bits */
+	ctx->buf[ctx->buf_len++] = 0x80;
+	if (ctx->buf_len > 56) {
+		memset (ctx->buf + ctx->buf_len, 0, sizeof (ctx->buf) - ctx->buf_len);
+		sha256_transform (ctx->state, ctx->buf, 1);
+		ctx->buf_len = 0;
+	}
+	memset (ctx->buf + ctx->buf_len, 0, 56 - ctx->buf_len);
+	for (i = 0; i < 8; i++)
+		ctx->buf[56 + i] = (guint8) (bits >> (56 - i * 8));
+	sha256_transform (ctx->state, ctx->buf, 1);
+
+	res = g_malloc (65);
+	for (i = 0; i < 8; i++)
+		g_snprintf (res + i * 8, 9, "%08x", ctx->state[i]);
+
+	return res;
+}
+
+/**
+ * li_checksum_compute_for_data:
+ *
+ * Returns: The SHA-256 checksum of @data.
+ */
+gchar*
+li_checksum_compute_for_data (const guint8 *data, gsize len)
+{
+	LiSha256 ctx;
+
+	li_sha256_init (&ctx);
+	li_sha256_update (&ctx, data, len);
+	return li_sha256_finish (&ctx);
+}
+
+/**
+ * li_checksum_update_from_fd:
+ * @seekable: %TRUE if we can use pread() on @fd
+ *
+ * Hash the contents of @fd, reading them in large chunks until
+ * the end of the file.
+ */
+static gboolean
+li_checksum_update_from_fd (LiSha256 *ctx, gint fd, gboolean seekable, LiChecksumProgressFunc progress_func, gpointer user_data)
+{
+	g_autofree guint8 *buf = NULL;
+	off_t offset = 0;
+	gssize len;
+
+	buf = g_malloc (LI_CHECKSUM_READ_SIZE);
+	for (;;) {
+		if (seekable)
+			len = pread (fd, buf, LI_CHECKSUM_READ_SIZE, offset);
+		else
+			len = read (fd, buf, LI_CHECKSUM_READ_SIZE);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			return FALSE;
+		}
+		if (len == 0)
+			break;
+		li_sha256_update (ctx, buf, (gsize) len);
+		offset += len;
+
+		if (progress_func != NULL)
+			progress_func ((guint64) offset, user_data);
+	}
+
+	return TRUE;
+}
+
+/**
+ * li_checksum_compute_for_file_full:
+ * @fname: The file to hash
+ * @progress_func: (allow-none): Function to call after every chunk which was hashed
+ * @user_data: Data for @progress_func
+ *
+ * Create a SHA-256 checksum for the given file, reporting the number
+ * of bytes hashed so far.
+ *
+ * Returns: The checksum, or %NULL if the file could not be read.
+ */
+gchar*
+li_checksum_compute_for_file_full (const gchar *fname, LiChecksumProgressFunc progress_func, gpointer user_data)
+{
+	LiSha256 ctx;
+	struct stat st;
+	gboolean ret;
+	gint fd;
+
+	fd = open (fname, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	if (fstat (fd, &st) != 0) {
+		close (fd);
+		return NULL;
+	}
+
+	li_sha256_init (&ctx);
+
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	ret = li_checksum_update_from_fd (&ctx, fd, S_ISREG (st.st_mode), progress_func, user_data);
+	close (fd);
+
+	if (!ret)
+		return NULL;
+
+	return li_sha256_finish (&ctx);
+}
+
+/**
+ * li_checksum_compute_for_file:
+ *
+ * Create a SHA-256 checksum for the given file.
+ *
+ * Returns: The checksum, or %NULL if the file could not be read.
+ */
+gchar*
+li_checksum_compute_for_file (const gchar *fname)
+{
+	return li_checksum_compute_for_file_full (fname, NULL, NULL);
+}
+
+/**
+ * li_checksum_file_worker:
+ */
+static void
+li_checksum_file_worker (gpointer data, gpointer user_data)
+{
+	guint idx = GPOINTER_TO_UINT (data) - 1;
+	GPtrArray *fnames = ((GPtrArray**) user_data)[0];
+	GPtrArray *checksums = ((GPtrArray**) user_data)[1];
+
+	/* every worker only writes its own slot */
+	checksums->pdata[idx] = li_checksum_compute_for_file ((const gchar*) g_ptr_array_index (fnames, idx));
+}
+
+/**
+ * li_checksum_compute_for_files:
+ * @fnames: (element-type utf8): Files to hash
+ *
+ * Create SHA-256 checksums for many files, hashing them in parallel.
+ *
+ * Returns: (transfer full) (element-type utf8): The checksums, in the same
+ * order as @fnames. Files which could not be read have a %NULL checksum.
+ */
+GPtrArray*
+li_checksum_compute_for_files (GPtrArray *fnames)
+{
+	guint i;
+	GThreadPool *pool;
+	GPtrArray *checksums;
+	GPtrArray *batch[2];
+
+	checksums = g_ptr_array_new_with_free_func (g_free);
+	g_ptr_array_set_size (checksums, fnames->len);
+	if (fnames->len == 0)
+		return checksums;
+
+	batch[0] = fnames;
+	batch[1] = checksums;
+
+	pool = g_thread_pool_new (li_checksum_file_worker,
+				  batch,
+				  MIN (g_get_num_processors (), fnames->len),
+				  TRUE,
+				  NULL);
+	if (pool == NULL) {
+		/* hash them one after another */
+		for (i = 0; i < fnames->len; i++)
+			li_checksum_file_worker (GUINT_TO_POINTER (i + 1), batch);
+		return checksums;
+	}
+
+	for (i = 0; i < fnames->len; i++)
+		g_thread_pool_push (pool, GUINT_TO_POINTER (i + 1), NULL);
+	/* wait for all files to be hashed */
+	g_thread_pool_free (pool, FALSE, TRUE);
+
+	return checksums;
+}
@@ -0,0 +1,73 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2016 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2.1 of the license, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined (__LIMBA_H) && !defined (LI_COMPILATION)
+#error "Only <limba.h> can be included directly."
+#endif
+
+#ifndef __LI_CHECKSUM_H
+#define __LI_CHECKSUM_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * LiSha256:
+ *
+ * State of a running SHA-256 computation.
+ */
+typedef struct {
+	guint32 state[8];
+	guint64 length;
+	guint8 buf[64];
+	gsize buf_len;
+} LiSha256;
+
+void			li_sha256_init (LiSha256 *ctx);
+void			li_sha256_update (LiSha256 *ctx,
+						const guint8 *data,
+						gsize len);
+gchar			*li_sha256_finish (LiSha256 *ctx);
+
+/**
+ * LiChecksumProgressFunc:
+ * @bytes_done: Number of bytes hashed so far
+ * @user_data: User data
+ *
+ * Called while a file is being hashed.
+ */
+typedef void (*LiChecksumProgressFunc) (guint64 bytes_done,
+					gpointer user_data);
+
+const gchar		*li_checksum_get_backend_name (void);
+gboolean		li_checksum_set_backend (const gchar *name);
+
+gchar			*li_checksum_compute_for_data (const guint8 *data,
+							gsize len);
+gchar			*li_checksum_compute_for_file (const gchar *fname);
+gchar			*li_checksum_compute_for_file_full (const gchar *fname,
+							LiChecksumProgressFunc progress_func,
+							gpointer user_data);
+GPtrArray		*li_checksum_compute_for_files (GPtrArray *fnames);
+
+G_END_DECLS
+
+#endif /* __LI_CHECKSUM_H */
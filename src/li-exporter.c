@@ -27,14 +27,30 @@
 #include "li-exporter.h"
 
 #include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <glib/gstdio.h>
 #include <glib/gi18n-lib.h>
 #include "li-utils-private.h"
+#include "li-checksum.h"
+
+typedef enum {
+	LI_EXPORT_METHOD_COPY,
+	LI_EXPORT_METHOD_REFLINK,
+	LI_EXPORT_METHOD_HARDLINK
+} LiExportMethod;
+
+typedef struct {
+	gchar *dest;
+	gchar *source;
+	LiExportMethod method;
+} LiExportedFile;
 
 typedef struct _LiExporterPrivate	LiExporterPrivate;
 struct _LiExporterPrivate
 {
-	GPtrArray *external_files;
+	GPtrArray *external_files; /* of LiExportedFile */
 	gboolean override;
 
 	LiPkgInfo *pki;
@@ -43,6 +59,54 @@ struct _LiExporterPrivate
 G_DEFINE_TYPE_WITH_PRIVATE (LiExporter, li_exporter, G_TYPE_OBJECT)
 #define GET_PRIVATE(o) (li_exporter_get_instance_private (o))
 
+#define LI_EXPORT_APPS_DIR "/usr/local/share/applications"
+#define LI_EXPORT_ICONS_DIR "/usr/local/share/icons"
+
+/* desktop integration triggers which still need to run */
+typedef struct {
+	guint depth;
+	GHashTable *icon_themes;
+	gboolean desktop_db;
+} LiExportTriggers;
+
+static void li_export_triggers_free (LiExportTriggers *trig);
+
+/* transactions are per thread, so jobs running in parallel don't share them */
+static GPrivate export_triggers = G_PRIVATE_INIT ((GDestroyNotify) li_export_triggers_free);
+
+static LiExportTriggers *li_export_triggers_get (void);
+static void li_export_triggers_add_path (LiExportTriggers *trig, const gchar *fname);
+static void li_export_triggers_run (LiExportTriggers *trig);
+
+/**
+ * li_exported_file_free:
+ */
+static void
+li_exported_file_free (LiExportedFile *efile)
+{
+	g_free (efile->dest);
+	g_free (efile->source);
+	g_free (efile);
+}
+
+/**
+ * li_exporter_register_file:
+ *
+ * Register installation of a new external file.
+ */
+static void
+li_exporter_register_file (LiExporter *exp, const gchar *dest, const gchar *source, LiExportMethod method)
+{
+	LiExportedFile *efile;
+	LiExporterPrivate *priv = GET_PRIVATE (exp);
+
+	efile = g_new0 (LiExportedFile, 1);
+	efile->dest = g_strdup (dest);
+	efile->source = g_strdup (source);
+	efile->method = method;
+	g_ptr_array_add (priv->external_files, efile);
+}
+
 /**
  * li_exporter_finalize:
  **/
@@ -52,6 +116,20 @@ li_exporter_finalize (GObject *object)
 	LiExporter *exp = LI_EXPORTER (object);
 	LiExporterPrivate *priv = GET_PRIVATE (exp);
 
+	/* integrate the files we exported with the desktop, right away unless
+	 * this happens within a transaction */
+	if (priv->external_files->len > 0) {
+		guint i;
+		LiExportTriggers *trig = li_export_triggers_get ();
+
+		for (i = 0; i < priv->external_files->len; i++) {
+			LiExportedFile *efile = (LiExportedFile*) g_ptr_array_index (priv->external_files, i);
+			li_export_triggers_add_path (trig, efile->dest);
+		}
+		if (trig->depth == 0)
+			li_export_triggers_run (trig);
+	}
+
 	g_ptr_array_unref (priv->external_files);
 	if (priv->pki != NULL)
 		g_object_unref (priv->pki);
@@ -68,7 +146,7 @@ li_exporter_init (LiExporter *exp)
 	LiExporterPrivate *priv = GET_PRIVATE (exp);
 
 	priv->override = FALSE;
-	priv->external_files = g_ptr_array_new_with_free_func (g_free);
+	priv->external_files = g_ptr_array_new_with_free_func ((GDestroyNotify) li_exported_file_free);
 }
 
 /**
@@ -106,6 +184,49 @@ li_exporter_copy_file (LiExporter *exp, const gchar *source, const gchar *destin
 	}
 }
 
+/**
+ * li_exporter_link_file:
+ *
+ * Export a file which is not modified afterwards. We prefer cloning the
+ * file, then hardlinking it, and only copy it if both fail (e.g. because
+ * source and destination are on different filesystems).
+ *
+ * Returns: The method which was used to export the file.
+ */
+static LiExportMethod
+li_exporter_link_file (LiExporter *exp, const gchar *source, const gchar *destination, GError **error)
+{
+	g_autofree gchar *tmp_dest = NULL;
+	LiExporterPrivate *priv = GET_PRIVATE (exp);
+
+	if ((!priv->override) && (g_file_test (destination, G_FILE_TEST_EXISTS))) {
+		g_set_error (error,
+				G_FILE_ERROR,
+				G_FILE_ERROR_EXIST,
+				_("File '%s' already exists."), destination);
+		return LI_EXPORT_METHOD_COPY;
+	}
+
+	/* create the new file next to the destination, so we can atomically replace an existing one */
+	tmp_dest = g_strdup_printf ("%s.limba-tmp", destination);
+	g_remove (tmp_dest);
+
+	if (li_reflink_file (source, tmp_dest)) {
+		if (g_rename (tmp_dest, destination) == 0)
+			return LI_EXPORT_METHOD_REFLINK;
+		g_remove (tmp_dest);
+	}
+
+	if (link (source, tmp_dest) == 0) {
+		if (g_rename (tmp_dest, destination) == 0)
+			return LI_EXPORT_METHOD_HARDLINK;
+		g_remove (tmp_dest);
+	}
+
+	li_exporter_copy_file (exp, source, destination, error);
+	return LI_EXPORT_METHOD_COPY;
+}
+
 /**
  * li_exporter_process_desktop_file:
  */
@@ -125,7 +246,7 @@ li_exporter_process_desktop_file (LiExporter *exp, const gchar *disk_location, G
 		return FALSE;
 
 	tmp = g_path_get_basename (disk_location);
-	dest = g_build_filename ("/usr/local/share/applications", tmp, NULL);
+	dest = g_build_filename (LI_EXPORT_APPS_DIR, tmp, NULL);
 	g_free (tmp);
 
 	if (g_mkdir_with_parents ("/usr/local/share/applications", 0755) != 0) {
@@ -202,7 +323,7 @@ li_exporter_process_desktop_file (LiExporter *exp, const gchar *disk_location, G
 
 out:
 	/* register installation of new external file */
-	g_ptr_array_add (priv->external_files, g_strdup (dest));
+	li_exporter_register_file (exp, dest, NULL, LI_EXPORT_METHOD_COPY);
 
 	if (kfile != NULL)
 		g_key_file_unref (kfile);
@@ -259,7 +380,7 @@ li_exporter_process_binary (LiExporter *exp, const gchar *disk_location, GError
 	g_chmod (dest, 0755);
 
 	/* register installation of new external file */
-	g_ptr_array_add (priv->external_files, g_strdup (dest));
+	li_exporter_register_file (exp, dest, NULL, LI_EXPORT_METHOD_COPY);
 	return TRUE;
 }
 
@@ -271,16 +392,15 @@ li_exporter_process_icon (LiExporter *exp, const gchar *disk_location, GError **
 {
 	g_autofree gchar *dest = NULL;
 	gchar *tmp;
+	LiExportMethod method;
 	GError *tmp_error = NULL;
-	LiExporterPrivate *priv = GET_PRIVATE (exp);
-
 
 	tmp = g_strrstr (disk_location, "icons/hicolor/");
 	if (tmp == NULL)
 		return TRUE;
 	tmp = g_strdup (tmp + 14);
 
-	dest = g_build_filename ("/usr/local/share/icons/hicolor", tmp, NULL);
+	dest = g_build_filename (LI_EXPORT_ICONS_DIR, "hicolor", tmp, NULL);
 	g_free (tmp);
 
 	/* create destination directory */
@@ -295,14 +415,15 @@ li_exporter_process_icon (LiExporter *exp, const gchar *disk_location, GError **
 	}
 	g_free (tmp);
 
-	li_exporter_copy_file (exp, disk_location, dest, &tmp_error);
+	/* icons are never modified, so we don't need a full copy */
+	method = li_exporter_link_file (exp, disk_location, dest, &tmp_error);
 	if (tmp_error != NULL) {
 		g_propagate_error (error, tmp_error);
 		return FALSE;
 	}
 
 	/* register installation of new external file */
-	g_ptr_array_add (priv->external_files, g_strdup (dest));
+	li_exporter_register_file (exp, dest, disk_location, method);
 	return TRUE;
 }
 
@@ -335,24 +456,43 @@ li_exporter_process_file (LiExporter *exp, const gchar *filename, const gchar *d
 
 /**
  * li_exporter_get_exported_files_index:
+ *
+ * Get the index of exported files. Every line contains the checksum and
+ * the name of an exported file, separated by tabs. Files which share their
+ * data with a file of the package additionally list the export method
+ * ("reflink" or "hardlink") and the name of the package file.
  */
 gchar*
 li_exporter_get_exported_files_index (LiExporter *exp)
 {
 	guint i;
 	GString *res;
+	g_autoptr(GPtrArray) fnames = NULL;
+	g_autoptr(GPtrArray) checksums = NULL;
 	LiExporterPrivate *priv = GET_PRIVATE (exp);
 
+	/* hash all exported files in parallel */
+	fnames = g_ptr_array_new ();
+	for (i = 0; i < priv->external_files->len; i++) {
+		LiExportedFile *efile = (LiExportedFile*) g_ptr_array_index (priv->external_files, i);
+		g_ptr_array_add (fnames, efile->dest);
+	}
+	checksums = li_checksum_compute_for_files (fnames);
+
 	res = g_string_new ("");
 	for (i = 0; i < priv->external_files->len; i++) {
-		gchar *checksum;
-		const gchar *fname = (const gchar *) g_ptr_array_index (priv->external_files, i);
+		const gchar *checksum;
+		LiExportedFile *efile = (LiExportedFile*) g_ptr_array_index (priv->external_files, i);
 
-		checksum = li_compute_checksum_for_file (fname);
+		checksum = (const gchar*) g_ptr_array_index (checksums, i);
 		if (checksum == NULL)
-			checksum = g_strdup ("ERROR");
-		g_string_append_printf (res, "%s\t%s\n", checksum, fname);
-		g_free (checksum);
+			checksum = "ERROR";
+		g_string_append_printf (res, "%s\t%s", checksum, efile->dest);
+		if (efile->method == LI_EXPORT_METHOD_REFLINK)
+			g_string_append_printf (res, "\treflink\t%s", efile->source);
+		else if (efile->method == LI_EXPORT_METHOD_HARDLINK)
+			g_string_append_printf (res, "\thardlink\t%s", efile->source);
+		g_string_append_c (res, '\n');
 	}
 
 	return g_string_free (res, FALSE);
@@ -402,6 +542,175 @@ li_exporter_set_override_allowed (LiExporter *exp, gboolean override)
 	priv->override = override;
 }
 
+/**
+ * li_export_triggers_free:
+ */
+static void
+li_export_triggers_free (LiExportTriggers *trig)
+{
+	if (trig->icon_themes != NULL)
+		g_hash_table_unref (trig->icon_themes);
+	g_free (trig);
+}
+
+/**
+ * li_export_triggers_get:
+ *
+ * Get the pending triggers of the current thread.
+ */
+static LiExportTriggers*
+li_export_triggers_get (void)
+{
+	LiExportTriggers *trig;
+
+	trig = (LiExportTriggers*) g_private_get (&export_triggers);
+	if (trig == NULL) {
+		trig = g_new0 (LiExportTriggers, 1);
+		g_private_set (&export_triggers, trig);
+	}
+
+	return trig;
+}
+
+/**
+ * li_export_triggers_add_path:
+ */
+static void
+li_export_triggers_add_path (LiExportTriggers *trig, const gchar *fname)
+{
+	if (g_str_has_prefix (fname, LI_EXPORT_APPS_DIR "/")) {
+		trig->desktop_db = TRUE;
+	} else if (g_str_has_prefix (fname, LI_EXPORT_ICONS_DIR "/")) {
+		const gchar *theme_start;
+		const gchar *theme_end;
+
+		theme_start = fname + strlen (LI_EXPORT_ICONS_DIR "/");
+		theme_end = strchr (theme_start, '/');
+		if (theme_end != NULL) {
+			if (trig->icon_themes == NULL)
+				trig->icon_themes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+			g_hash_table_add (trig->icon_themes, g_strndup (fname, theme_end - fname));
+		}
+	}
+}
+
+/**
+ * li_exporter_run_trigger:
+ */
+static void
+li_exporter_run_trigger (const gchar *prog, const gchar *arg, const gchar *dir)
+{
+	const gchar *argv[4];
+	gint exit_status;
+	g_autoptr(GError) tmp_error = NULL;
+
+	argv[0] = prog;
+	argv[1] = arg;
+	argv[2] = dir;
+	argv[3] = NULL;
+
+	g_debug ("Running %s on %s", prog, dir);
+	if (!g_spawn_sync (NULL, (gchar**) argv, NULL,
+			   G_SPAWN_SEARCH_PATH | G_SPAWN_STDOUT_TO_DEV_NULL | G_SPAWN_STDERR_TO_DEV_NULL,
+			   NULL, NULL, NULL, NULL, &exit_status, &tmp_error)) {
+		/* the tool is optional, not every system has it */
+		g_debug ("Unable to run %s: %s", prog, tmp_error->message);
+		return;
+	}
+	if (exit_status != 0)
+		g_debug ("%s failed for '%s' (status %i)", prog, dir, exit_status);
+}
+
+/**
+ * li_export_triggers_run:
+ *
+ * Run all pending desktop integration triggers.
+ */
+static void
+li_export_triggers_run (LiExportTriggers *trig)
+{
+	g_autoptr(GHashTable) icon_themes = NULL;
+	gboolean desktop_db;
+	GHashTableIter iter;
+	gpointer key;
+
+	icon_themes = trig->icon_themes;
+	trig->icon_themes = NULL;
+	desktop_db = trig->desktop_db;
+	trig->desktop_db = FALSE;
+
+	if (desktop_db)
+		li_exporter_run_trigger ("update-desktop-database", "-q", LI_EXPORT_APPS_DIR);
+
+	if (icon_themes == NULL)
+		return;
+	g_hash_table_iter_init (&iter, icon_themes);
+	while (g_hash_table_iter_next (&iter, &key, NULL)) {
+		const gchar *theme_dir = (const gchar*) key;
+
+		if (!g_file_test (theme_dir, G_FILE_TEST_IS_DIR))
+			continue;
+		li_exporter_run_trigger ("gtk-update-icon-cache", "-qtf", theme_dir);
+	}
+}
+
+/**
+ * li_exporter_transaction_add_path:
+ * @fname: An exported file which was added or removed.
+ *
+ * Note that an exported file has changed, so the desktop integration
+ * triggers which depend on it are run when the current transaction
+ * is committed. Outside of a transaction, they are run right away.
+ */
+void
+li_exporter_transaction_add_path (const gchar *fname)
+{
+	LiExportTriggers *trig = li_export_triggers_get ();
+
+	li_export_triggers_add_path (trig, fname);
+	if (trig->depth == 0)
+		li_export_triggers_run (trig);
+}
+
+/**
+ * li_exporter_transaction_begin:
+ *
+ * Start an export transaction. Until the matching call to
+ * li_exporter_transaction_commit(), the desktop integration triggers
+ * (icon caches, desktop file database) are not run, so installing or
+ * updating many packages only rebuilds each cache once.
+ * Transactions may be nested. They only cover exports and removals
+ * which happen in the calling thread.
+ */
+void
+li_exporter_transaction_begin (void)
+{
+	LiExportTriggers *trig = li_export_triggers_get ();
+	trig->depth++;
+}
+
+/**
+ * li_exporter_transaction_commit:
+ *
+ * Finish an export transaction. If this was the outermost transaction,
+ * all triggers for the files which were exported or removed in the
+ * meantime are run now.
+ */
+void
+li_exporter_transaction_commit (void)
+{
+	LiExportTriggers *trig = li_export_triggers_get ();
+
+	if (trig->depth == 0) {
+		g_critical ("Tried to commit an export transaction which was never started.");
+		return;
+	}
+
+	trig->depth--;
+	if (trig->depth == 0)
+		li_export_triggers_run (trig);
+}
+
 /**
  * li_exporter_class_init:
  **/
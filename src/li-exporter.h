@@ -64,6 +64,10 @@ void			li_exporter_set_pkg_info (LiExporter *exp,
 
 gchar			*li_exporter_get_exported_files_index (LiExporter *exp);
 
+void			li_exporter_transaction_begin (void);
+void			li_exporter_transaction_commit (void);
+void			li_exporter_transaction_add_path (const gchar *fname);
+
 G_END_DECLS
 
 #endif /* __LI_EXPORTER_H */
@@ -0,0 +1,767 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014-2016 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2.1 of the license, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * SECTION:li-installed-db
+ * @short_description: Persistent database of installed software
+ *
+ * The installed-software database caches the metadata of all packages
+ * installed into the software root in a single binary file, so we do not
+ * need to walk the whole directory tree and parse every control file when
+ * querying the list of installed software.
+ *
+ * The database is validated against the modification times of the
+ * directories it was built from, and is rebuilt transparently in case
+ * anything changed behind our back.
+ *
+ * Only root writes the database, as only root can modify the software
+ * root. Processes of other users validate it the same way and rescan
+ * the software root in memory if it is outdated, without saving the result.
+ * Each committed change loads, updates and rewrites the whole file, which
+ * is cheap compared to installing or removing a package. Writers hold an
+ * exclusive lock on a file next to the database while doing so, so
+ * concurrent changes (e.g. by the daemon and the command-line tool) do
+ * not overwrite each other.
+ */
+
+#include "config.h"
+#include "li-installed-db.h"
+
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "li-utils-private.h"
+
+#define LI_INSTALLED_DB_LOCK_FNAME LI_INSTALLED_DB_DIR "/installed.lock"
+
+/* bump this when changing the on-disk format */
+#define LI_INSTALLED_DB_VERSION 2
+
+/* format-version, name, appname, version, arch, deps, sdk-deps, build-deps, runtime-uuid, cpt-kind, abi-breaks, kind, flags */
+#define LI_INSTALLED_DB_PKG_TYPE "(msmsmsmsmsmsmsmsmsmsmsuu)"
+#define LI_INSTALLED_DB_PKG_FORMAT "(m&sm&sm&sm&sm&sm&sm&sm&sm&sm&sm&suu)"
+#define LI_INSTALLED_DB_TYPE "(ua{st}a{s" LI_INSTALLED_DB_PKG_TYPE "})"
+
+typedef struct _LiInstalledDbPrivate	LiInstalledDbPrivate;
+struct _LiInstalledDbPrivate
+{
+	GHashTable *pkgs; /* key:utf8;value:LiPkgInfo */
+	GHashTable *stamps; /* key:utf8 (path relative to the software root);value:guint64 */
+};
+
+G_DEFINE_TYPE_WITH_PRIVATE (LiInstalledDb, li_installed_db, G_TYPE_OBJECT)
+#define GET_PRIVATE(o) (li_installed_db_get_instance_private (o))
+
+/**
+ * li_installed_db_finalize:
+ **/
+static void
+li_installed_db_finalize (GObject *object)
+{
+	LiInstalledDb *db = LI_INSTALLED_DB (object);
+	LiInstalledDbPrivate *priv = GET_PRIVATE (db);
+
+	g_hash_table_unref (priv->pkgs);
+	g_hash_table_unref (priv->stamps);
+
+	G_OBJECT_CLASS (li_installed_db_parent_class)->finalize (object);
+}
+
+/**
+ * li_installed_db_init:
+ **/
+static void
+li_installed_db_init (LiInstalledDb *db)
+{
+	LiInstalledDbPrivate *priv = GET_PRIVATE (db);
+
+	priv->pkgs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+	priv->stamps = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+}
+
+/**
+ * li_installed_db_clear:
+ */
+static void
+li_installed_db_clear (LiInstalledDb *db)
+{
+	LiInstalledDbPrivate *priv = GET_PRIVATE (db);
+
+	g_hash_table_remove_all (priv->pkgs);
+	g_hash_table_remove_all (priv->stamps);
+}
+
+/**
+ * li_installed_db_get_mtime:
+ *
+ * Returns: The modification time of @relpath in nanoseconds,
+ * or 0 in case the path does not exist.
+ */
+static guint64
+li_installed_db_get_mtime (const gchar *relpath)
+{
+	GStatBuf sbuf;
+	g_autofree gchar *path = NULL;
+
+	path = g_build_filename (LI_SOFTWARE_ROOT, relpath, NULL);
+	if (g_stat (path, &sbuf) != 0)
+		return 0;
+
+	return ((guint64) sbuf.st_mtim.tv_sec * G_GUINT64_CONSTANT (1000000000)) + (guint64) sbuf.st_mtim.tv_nsec;
+}
+
+/**
+ * li_installed_db_stamp:
+ *
+ * Record the current modification time of @relpath, or drop
+ * it from the list of stamps if the path does not exist anymore.
+ */
+static void
+li_installed_db_stamp (LiInstalledDb *db, const gchar *relpath)
+{
+	guint64 *mtime;
+	LiInstalledDbPrivate *priv = GET_PRIVATE (db);
+
+	mtime = g_new (guint64, 1);
+	*mtime = li_installed_db_get_mtime (relpath);
+	if (*mtime == 0) {
+		g_free (mtime);
+		g_hash_table_remove (priv->stamps, relpath);
+		return;
+	}
+
+	g_hash_table_insert (priv->stamps, g_strdup (relpath), mtime);
+}
+
+/**
+ * li_installed_db_listing_valid:
+ *
+ * Check that a directory does not contain any entries we do not know about.
+ */
+static gboolean
+li_installed_db_listing_valid (LiInstalledDb *db, const gchar *relpath, const gchar *skip)
+{
+	GDir *dir;
+	const gchar *name;
+	gboolean ret = TRUE;
+	g_autofree gchar *path = NULL;
+	LiInstalledDbPrivate *priv = GET_PRIVATE (db);
+
+	path = g_build_filename (LI_SOFTWARE_ROOT, relpath, NULL);
+	dir = g_dir_open (path, 0, NULL);
+	if (dir == NULL)
+		return TRUE;
+
+	while ((name = g_dir_read_name (dir)) != NULL) {
+		g_autofree gchar *child = NULL;
+
+		if (g_str_has_prefix (name, "."))
+			continue;
+		/* the runtimes directory does not contain packages */
+		if ((relpath[0] == '\0') && (g_strcmp0 (name, "runtimes") == 0))
+			continue;
+
+		child = g_build_filename (relpath, name, NULL);
+		if (g_strcmp0 (child, skip) == 0)
+			continue;
+
+		if (!g_hash_table_contains (priv->stamps, child)) {
+			ret = FALSE;
+			break;
+		}
+	}
+	g_dir_close (dir);
+
+	return ret;
+}
+
+/**
+ * li_installed_db_stamps_valid:
+ * @skip_pkid: Package ID whose directories should not be checked, or %NULL
+ *
+ * Test whether the software root was modified since the database was
+ * written. If @skip_pkid is set, changes to the directories belonging to
+ * that package are ignored, and we only check that nothing else appeared
+ * next to them.
+ */
+static gboolean
+li_installed_db_stamps_valid (LiInstalledDb *db, const gchar *skip_pkid)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	g_autofree gchar *skip_name = NULL;
+	LiInstalledDbPrivate *priv = GET_PRIVATE (db);
+
+	/* no root stamp means we never scanned anything */
+	if (!g_hash_table_contains (priv->stamps, ""))
+		return FALSE;
+
+	if (skip_pkid != NULL)
+		skip_name = g_path_get_dirname (skip_pkid);
+
+	g_hash_table_iter_init (&iter, priv->stamps);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		const gchar *relpath = (const gchar*) key;
+
+		if (skip_pkid != NULL) {
+			if ((relpath[0] == '\0') ||
+			    (g_strcmp0 (relpath, skip_name) == 0) ||
+			    (g_strcmp0 (relpath, skip_pkid) == 0))
+				continue;
+		}
+
+		if (li_installed_db_get_mtime (relpath) != *((guint64*) value)) {
+			g_debug ("Installed-software database is outdated (%s changed).", relpath);
+			return FALSE;
+		}
+	}
+
+	if (skip_pkid != NULL) {
+		if (!li_installed_db_listing_valid (db, "", skip_name))
+			return FALSE;
+		if (!li_installed_db_listing_valid (db, skip_name, skip_pkid))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * li_installed_db_pkg_info_from_variant:
+ */
+static LiPkgInfo*
+li_installed_db_pkg_info_from_variant (const gchar *pkid, GVariant *variant)
+{
+	LiPkgInfo *pki;
+	const gchar *format_version = NULL;
+	const gchar *name = NULL;
+	const gchar *appname = NULL;
+	const gchar *version = NULL;
+	const gchar *arch = NULL;
+	const gchar *deps = NULL;
+	const gchar *sdk_deps = NULL;
+	const gchar *build_deps = NULL;
+	const gchar *rt_uuid = NULL;
+	const gchar *cpt_kind = NULL;
+	const gchar *abi_breaks = NULL;
+	guint32 kind;
+	guint32 flags;
+
+	g_variant_get (variant, LI_INSTALLED_DB_PKG_FORMAT,
+			&format_version,
+			&name,
+			&appname,
+			&version,
+			&arch,
+			&deps,
+			&sdk_deps,
+			&build_deps,
+			&rt_uuid,
+			&cpt_kind,
+			&abi_breaks,
+			&kind,
+			&flags);
+
+	pki = li_pkg_info_new ();
+	if (format_version != NULL)
+		li_pkg_info_set_format_version (pki, format_version);
+	li_pkg_info_set_name (pki, name);
+	li_pkg_info_set_appname (pki, appname);
+	li_pkg_info_set_version (pki, version);
+	if (arch != NULL)
+		li_pkg_info_set_architecture (pki, arch);
+	li_pkg_info_set_dependencies (pki, deps);
+	li_pkg_info_set_sdk_dependencies (pki, sdk_deps);
+	li_pkg_info_set_build_dependencies (pki, build_deps);
+	li_pkg_info_set_runtime_dependency (pki, rt_uuid);
+	li_pkg_info_set_component_kind (pki, cpt_kind);
+	li_pkg_info_set_abi_break_versions (pki, abi_breaks);
+	li_pkg_info_set_kind (pki, (LiPackageKind) kind);
+	li_pkg_info_set_flags (pki, (LiPackageFlags) flags);
+	/* the ID is the name of the directory the package was installed to */
+	li_pkg_info_set_id (pki, pkid);
+
+	/* do not list as installed if the software is faded */
+	if (!li_pkg_info_has_flag (pki, LI_PACKAGE_FLAG_FADED))
+		li_pkg_info_add_flag (pki, LI_PACKAGE_FLAG_INSTALLED);
+
+	return pki;
+}
+
+/**
+ * li_installed_db_load:
+ *
+ * Load the database file, without validating it.
+ */
+static gboolean
+li_installed_db_load (LiInstalledDb *db)
+{
+	gchar *data = NULL;
+	gsize len;
+	guint32 version = 0;
+	const gchar *str;
+	guint64 mtime;
+	GVariant *pkgv;
+	g_autoptr(GBytes) bytes = NULL;
+	g_autoptr(GVariant) variant = NULL;
+	g_autoptr(GVariantIter) stamps_iter = NULL;
+	g_autoptr(GVariantIter) pkgs_iter = NULL;
+	LiInstalledDbPrivate *priv = GET_PRIVATE (db);
+
+	li_installed_db_clear (db);
+
+	if (!g_file_get_contents (LI_INSTALLED_DB_FNAME, &data, &len, NULL))
+		return FALSE;
+	bytes = g_bytes_new_take (data, len);
+
+	variant = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (LI_INSTALLED_DB_TYPE), bytes, FALSE));
+	g_variant_get_child (variant, 0, "u", &version);
+	if (version != LI_INSTALLED_DB_VERSION) {
+		g_debug ("Ignoring installed-software database with unknown version %u", version);
+		return FALSE;
+	}
+
+	g_variant_get (variant, LI_INSTALLED_DB_TYPE, NULL, &stamps_iter, &pkgs_iter);
+
+	while (g_variant_iter_next (stamps_iter, "{&st}", &str, &mtime)) {
+		guint64 *value = g_new (guint64, 1);
+		*value = mtime;
+		g_hash_table_insert (priv->stamps, g_strdup (str), value);
+	}
+
+	while (g_variant_iter_next (pkgs_iter, "{&s@" LI_INSTALLED_DB_PKG_TYPE "}", &str, &pkgv)) {
+		LiPkgInfo *pki;
+
+		pki = li_installed_db_pkg_info_from_variant (str, pkgv);
+		g_variant_unref (pkgv);
+
+		g_hash_table_insert (priv->pkgs, g_strdup (str), pki);
+	}
+
+	return TRUE;
+}
+
+/**
+ * li_installed_db_lock:
+ *
+ * Get an exclusive lock on the database, waiting for other writers
+ * to finish their changes.
+ *
+ * Returns: A file descriptor to close to release the lock, or -1
+ */
+static gint
+li_installed_db_lock (void)
+{
+	gint fd;
+
+	if (g_mkdir_with_parents (LI_INSTALLED_DB_DIR, 0755) != 0)
+		return -1;
+
+	fd = open (LI_INSTALLED_DB_LOCK_FNAME, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -1;
+
+	while (flock (fd, LOCK_EX) != 0) {
+		if (errno != EINTR) {
+			close (fd);
+			return -1;
+		}
+	}
+
+	return fd;
+}
+
+/**
+ * li_installed_db_rescan:
+ *
+ * Drop all cached data and search the software root for
+ * installed packages.
+ */
+gboolean
+li_installed_db_rescan (LiInstalledDb *db, GError **error)
+{
+	GError *error_local = NULL;
+	g_autoptr(GFile) fdir = NULL;
+	g_autoptr(GFileEnumerator) enumerator = NULL;
+	GFileInfo *file_info;
+	LiInstalledDbPrivate *priv = GET_PRIVATE (db);
+
+	li_installed_db_clear (db);
+
+	if (!g_file_test (LI_SOFTWARE_ROOT, G_FILE_TEST_IS_DIR)) {
+		/* directory not found, no software to be searched for */
+		return TRUE;
+	}
+
+	/* record the stamp first, so we notice changes which happen while we scan */
+	li_installed_db_stamp (db, "");
+
+	/* get stuff in the software directory */
+	fdir = g_file_new_for_path (LI_SOFTWARE_ROOT);
+	enumerator = g_file_enumerate_children (fdir, G_FILE_ATTRIBUTE_STANDARD_NAME, 0, NULL, &error_local);
+	if (error_local != NULL)
+		goto out;
+
+	while ((file_info = g_file_enumerator_next_file (enumerator, NULL, &error_local)) != NULL) {
+		g_autoptr(GFile) fsdir = NULL;
+		g_autoptr(GFileEnumerator) senum = NULL;
+		g_autofree gchar *mpath = NULL;
+		const gchar *name;
+		GFileInfo *s_finfo;
+
+		if (error_local != NULL)
+			goto out;
+		if (g_file_info_get_is_hidden (file_info))
+			continue;
+		name = g_file_info_get_name (file_info);
+		/* ignore the runtimes directory */
+		if (g_strcmp0 (name, "runtimes") == 0)
+			continue;
+
+		li_installed_db_stamp (db, name);
+		mpath = g_build_filename (LI_SOFTWARE_ROOT, name, NULL);
+
+		fsdir = g_file_new_for_path (mpath);
+		senum = g_file_enumerate_children (fsdir, G_FILE_ATTRIBUTE_STANDARD_NAME, 0, NULL, &error_local);
+		if (error_local != NULL)
+			goto out;
+
+		while ((s_finfo = g_file_enumerator_next_file (senum, NULL, &error_local)) != NULL) {
+			g_autofree gchar *relpath = NULL;
+			g_autofree gchar *cpath = NULL;
+
+			if (error_local != NULL)
+				goto out;
+			if (g_file_info_get_is_hidden (s_finfo))
+				continue;
+
+			relpath = g_build_filename (name, g_file_info_get_name (s_finfo), NULL);
+			li_installed_db_stamp (db, relpath);
+
+			cpath = g_build_filename (LI_SOFTWARE_ROOT,
+						relpath,
+						"control",
+						NULL);
+
+			if (g_file_test (cpath, G_FILE_TEST_IS_REGULAR)) {
+				g_autoptr(GFile) ctlfile = NULL;
+				LiPkgInfo *pki;
+
+				ctlfile = g_file_new_for_path (cpath);
+
+				/* create new LiPkgInfo for an installed package */
+				pki = li_pkg_info_new ();
+
+				li_pkg_info_load_file (pki, ctlfile, &error_local);
+				if (error_local != NULL) {
+					g_object_unref (pki);
+					goto out;
+				}
+
+				/* do not list as installed if the software is faded */
+				if (!li_pkg_info_has_flag (pki, LI_PACKAGE_FLAG_FADED)) {
+					li_pkg_info_add_flag (pki, LI_PACKAGE_FLAG_INSTALLED);
+				}
+
+				g_hash_table_insert (priv->pkgs,
+							g_strdup (li_pkg_info_get_id (pki)),
+							pki);
+			}
+		}
+	}
+
+out:
+	if (error_local != NULL) {
+		g_propagate_error (error, error_local);
+		li_installed_db_clear (db);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * li_installed_db_save:
+ *
+ * Write the database to disk. The file is replaced atomically.
+ */
+gboolean
+li_installed_db_save (LiInstalledDb *db, GError **error)
+{
+	GVariantBuilder stamps_b;
+	GVariantBuilder pkgs_b;
+	GHashTableIter iter;
+	gpointer key, value;
+	g_autoptr(GVariant) variant = NULL;
+	LiInstalledDbPrivate *priv = GET_PRIVATE (db);
+
+	if (!g_file_test (LI_INSTALLED_DB_DIR, G_FILE_TEST_IS_DIR)) {
+		g_mkdir_with_parents (LI_INSTALLED_DB_DIR, 0755);
+		/* creating the directory has modified the software root */
+		li_installed_db_stamp (db, "");
+	}
+
+	g_variant_builder_init (&stamps_b, G_VARIANT_TYPE ("a{st}"));
+	g_hash_table_iter_init (&iter, priv->stamps);
+	while (g_hash_table_iter_next (&iter, &key, &value))
+		g_variant_builder_add (&stamps_b, "{st}", (const gchar*) key, *((guint64*) value));
+
+	g_variant_builder_init (&pkgs_b, G_VARIANT_TYPE ("a{s" LI_INSTALLED_DB_PKG_TYPE "}"));
+	g_hash_table_iter_init (&iter, priv->pkgs);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		LiPkgInfo *pki = LI_PKG_INFO (value);
+
+		g_variant_builder_add (&pkgs_b, "{s" LI_INSTALLED_DB_PKG_TYPE "}",
+					(const gchar*) key,
+					li_pkg_info_get_format_version (pki),
+					li_pkg_info_get_name (pki),
+					li_pkg_info_get_appname (pki),
+					li_pkg_info_get_version (pki),
+					li_pkg_info_get_architecture (pki),
+					li_pkg_info_get_dependencies (pki),
+					li_pkg_info_get_sdk_dependencies (pki),
+					li_pkg_info_get_build_dependencies (pki),
+					li_pkg_info_get_runtime_dependency (pki),
+					li_pkg_info_get_component_kind (pki),
+					li_pkg_info_get_abi_break_versions (pki),
+					(guint32) li_pkg_info_get_kind (pki),
+					/* only persist the flags which are stored in the control file */
+					(guint32) (li_pkg_info_get_flags (pki) & (LI_PACKAGE_FLAG_AUTOMATIC | LI_PACKAGE_FLAG_FADED)));
+	}
+
+	variant = g_variant_ref_sink (g_variant_new ("(ua{st}a{s" LI_INSTALLED_DB_PKG_TYPE "})",
+							LI_INSTALLED_DB_VERSION,
+							&stamps_b,
+							&pkgs_b));
+
+	return g_file_set_contents (LI_INSTALLED_DB_FNAME,
+				    g_variant_get_data (variant),
+				    g_variant_get_size (variant),
+				    error);
+}
+
+/**
+ * li_installed_db_open:
+ *
+ * Load the list of installed software. If the database on disk is
+ * missing or outdated, the software root is scanned again and, if we
+ * are allowed to, the database is rewritten.
+ */
+gboolean
+li_installed_db_open (LiInstalledDb *db, GError **error)
+{
+	gint lock_fd = -1;
+	GError *error_local = NULL;
+
+	if (li_installed_db_load (db) && li_installed_db_stamps_valid (db, NULL))
+		return TRUE;
+
+	/* don't let a concurrent change get lost when we write the rebuilt database */
+	if (li_utils_is_root () && g_file_test (LI_SOFTWARE_ROOT, G_FILE_TEST_IS_DIR))
+		lock_fd = li_installed_db_lock ();
+
+	g_debug ("Rebuilding installed-software database.");
+	li_installed_db_rescan (db, &error_local);
+	if (error_local != NULL) {
+		if (lock_fd >= 0)
+			close (lock_fd);
+		g_propagate_error (error, error_local);
+		return FALSE;
+	}
+
+	if (lock_fd >= 0) {
+		li_installed_db_save (db, &error_local);
+		if (error_local != NULL) {
+			/* not fatal, we will just scan again next time */
+			g_debug ("Unable to save installed-software database: %s", error_local->message);
+			g_error_free (error_local);
+		}
+		close (lock_fd);
+	}
+
+	return TRUE;
+}
+
+/**
+ * li_installed_db_get_packages:
+ *
+ * Returns: (transfer none): Hash table of package-id to #LiPkgInfo.
+ */
+GHashTable*
+li_installed_db_get_packages (LiInstalledDb *db)
+{
+	LiInstalledDbPrivate *priv = GET_PRIVATE (db);
+	return priv->pkgs;
+}
+
+/**
+ * li_installed_db_begin_update:
+ *
+ * Load the database for an incremental update of @pkid.
+ * If the database is missing or outdated, it is rebuilt from the software root,
+ * so every change to the installed software also changes the database file,
+ * which is what #LiManager monitors. If it can not be rebuilt, it is removed,
+ * so the next reader will rebuild it.
+ *
+ * On success, the database is locked until li_installed_db_finish_update()
+ * is called with the returned file descriptor.
+ *
+ * Returns: The lock file descriptor, or -1 if the database can not be updated.
+ */
+static gint
+li_installed_db_begin_update (LiInstalledDb *db, const gchar *pkid)
+{
+	gint lock_fd;
+	GError *error_local = NULL;
+
+	if (!li_utils_is_root ())
+		return -1;
+
+	lock_fd = li_installed_db_lock ();
+	if (lock_fd < 0) {
+		g_debug ("Unable to lock installed-software database: %s", g_strerror (errno));
+		g_remove (LI_INSTALLED_DB_FNAME);
+		return -1;
+	}
+
+	/* load the database only now, so we see the changes of the previous writer */
+	if (li_installed_db_load (db) && li_installed_db_stamps_valid (db, pkid))
+		return lock_fd;
+
+	g_debug ("Installed-software database is missing or outdated, rebuilding it.");
+	li_installed_db_rescan (db, &error_local);
+	if (error_local == NULL)
+		return lock_fd;
+
+	g_debug ("Unable to rebuild installed-software database: %s", error_local->message);
+	g_error_free (error_local);
+	g_remove (LI_INSTALLED_DB_FNAME);
+	close (lock_fd);
+	return -1;
+}
+
+/**
+ * li_installed_db_finish_update:
+ *
+ * Write the changed database and release the lock.
+ */
+static void
+li_installed_db_finish_update (LiInstalledDb *db, const gchar *pkid, gint lock_fd)
+{
+	g_autofree gchar *name = NULL;
+	GError *error_local = NULL;
+
+	name = g_path_get_dirname (pkid);
+	li_installed_db_stamp (db, "");
+	li_installed_db_stamp (db, name);
+	li_installed_db_stamp (db, pkid);
+
+	li_installed_db_save (db, &error_local);
+	if (error_local != NULL) {
+		g_debug ("Unable to update installed-software database: %s", error_local->message);
+		g_error_free (error_local);
+		g_remove (LI_INSTALLED_DB_FNAME);
+	}
+
+	close (lock_fd);
+}
+
+/**
+ * li_installed_db_commit_package:
+ *
+ * Register a new or changed installed package with the database.
+ * This must be called after the package's control file was written.
+ */
+void
+li_installed_db_commit_package (LiPkgInfo *pki)
+{
+	gint lock_fd;
+	const gchar *pkid;
+	g_autoptr(LiInstalledDb) db = NULL;
+	LiInstalledDbPrivate *priv;
+
+	pkid = li_pkg_info_get_id (pki);
+	if (pkid == NULL)
+		return;
+
+	db = li_installed_db_new ();
+	lock_fd = li_installed_db_begin_update (db, pkid);
+	if (lock_fd < 0)
+		return;
+	priv = GET_PRIVATE (db);
+
+	g_hash_table_insert (priv->pkgs,
+				g_strdup (pkid),
+				g_object_ref (pki));
+	li_installed_db_finish_update (db, pkid, lock_fd);
+}
+
+/**
+ * li_installed_db_commit_removal:
+ *
+ * Drop a removed package from the database.
+ * This must be called after the package's directory was deleted.
+ */
+void
+li_installed_db_commit_removal (const gchar *pkid)
+{
+	gint lock_fd;
+	g_autoptr(LiInstalledDb) db = NULL;
+	LiInstalledDbPrivate *priv;
+
+	db = li_installed_db_new ();
+	lock_fd = li_installed_db_begin_update (db, pkid);
+	if (lock_fd < 0)
+		return;
+	priv = GET_PRIVATE (db);
+
+	g_hash_table_remove (priv->pkgs, pkid);
+	li_installed_db_finish_update (db, pkid, lock_fd);
+}
+
+/**
+ * li_installed_db_class_init:
+ **/
+static void
+li_installed_db_class_init (LiInstalledDbClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	object_class->finalize = li_installed_db_finalize;
+}
+
+/**
+ * li_installed_db_new:
+ *
+ * Creates a new #LiInstalledDb.
+ *
+ * Returns: (transfer full): a #LiInstalledDb
+ *
+ **/
+LiInstalledDb *
+li_installed_db_new (void)
+{
+	LiInstalledDb *db;
+	db = g_object_new (LI_TYPE_INSTALLED_DB, NULL);
+	return LI_INSTALLED_DB (db);
+}
@@ -0,0 +1,69 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014-2016 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2.1 of the license, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined (__LIMBA_H) && !defined (LI_COMPILATION)
+#error "Only <limba.h> can be included directly."
+#endif
+
+#ifndef __LI_INSTALLED_DB_H
+#define __LI_INSTALLED_DB_H
+
+#include <glib-object.h>
+#include "li-pkg-info.h"
+
+G_BEGIN_DECLS
+
+#define LI_INSTALLED_DB_DIR LI_SOFTWARE_ROOT "/.limba"
+#define LI_INSTALLED_DB_FNAME LI_INSTALLED_DB_DIR "/installed.db"
+
+#define LI_TYPE_INSTALLED_DB (li_installed_db_get_type ())
+G_DECLARE_DERIVABLE_TYPE (LiInstalledDb, li_installed_db, LI, INSTALLED_DB, GObject)
+
+struct _LiInstalledDbClass
+{
+	GObjectClass		parent_class;
+	/*< private >*/
+	void (*_as_reserved1)	(void);
+	void (*_as_reserved2)	(void);
+	void (*_as_reserved3)	(void);
+	void (*_as_reserved4)	(void);
+	void (*_as_reserved5)	(void);
+	void (*_as_reserved6)	(void);
+	void (*_as_reserved7)	(void);
+	void (*_as_reserved8)	(void);
+};
+
+LiInstalledDb		*li_installed_db_new (void);
+
+gboolean		li_installed_db_open (LiInstalledDb *db,
+						GError **error);
+gboolean		li_installed_db_rescan (LiInstalledDb *db,
+						GError **error);
+gboolean		li_installed_db_save (LiInstalledDb *db,
+						GError **error);
+
+GHashTable		*li_installed_db_get_packages (LiInstalledDb *db);
+
+void			li_installed_db_commit_package (LiPkgInfo *pki);
+void			li_installed_db_commit_removal (const gchar *pkid);
+
+G_END_DECLS
+
+#endif /* __LI_INSTALLED_DB_H */
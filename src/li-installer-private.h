@@ -27,6 +27,7 @@
 
 #include <glib-object.h>
 #include "li-installer.h"
+#include "li-pkg-cache.h"
 
 G_BEGIN_DECLS
 
@@ -37,6 +38,14 @@ void			li_installer_open_extra_packages (LiInstaller *inst,
 								GPtrArray *files,
 								GError **error);
 
+gboolean		li_installer_prepare_updates (LiInstaller *inst,
+							LiPkgCache *cache,
+							GPtrArray *updates,
+							GError **error);
+gboolean		li_installer_apply_updates (LiInstaller *inst,
+							GPtrArray *new_pkids,
+							GError **error);
+
 G_END_DECLS
 
 #endif /* __LI_INSTALLER_PRIVATE_H */
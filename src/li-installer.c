@@ -35,9 +35,14 @@
 #include "li-manager.h"
 #include "li-runtime.h"
 #include "li-package-graph.h"
+#include "li-package-private.h"
 #include "li-pkg-cache.h"
+#include "li-update-item.h"
 #include "li-config-data.h"
+#include "li-launch-desc.h"
+#include "li-exporter.h"
 #include "li-dbus-interface.h"
+#include "li-progress.h"
 
 typedef struct _LiInstallerPrivate	LiInstallerPrivate;
 struct _LiInstallerPrivate
@@ -45,6 +50,8 @@ struct _LiInstallerPrivate
 	LiManager *mgr;
 	LiPackageGraph *pg;
 	LiPackage *pkg;
+	GHashTable *batch_roots; /* of LiPkgInfo, set when installing updates */
+	GPtrArray *new_pkids; /* of utf8, receives the IDs of the packages installed by a batch */
 	gboolean allow_insecure;
 
 	LiPkgCache *cache;
@@ -55,7 +62,10 @@ struct _LiInstallerPrivate
 	GMainLoop *loop;
 	GError *proxy_error;
 	LiProxyManager *bus_proxy;
+	guint proxy_job_id;
 	guint bus_watch_id;
+
+	LiProgressAggregator *progress;
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE (LiInstaller, li_installer, G_TYPE_OBJECT)
@@ -64,6 +74,7 @@ G_DEFINE_TYPE_WITH_PRIVATE (LiInstaller, li_installer, G_TYPE_OBJECT)
 enum {
 	SIGNAL_STAGE_CHANGED,
 	SIGNAL_PROGRESS,
+	SIGNAL_PROGRESS_DETAILS,
 	SIGNAL_LAST
 };
 
@@ -72,6 +83,7 @@ static guint signals[SIGNAL_LAST] = { 0 };
 static void li_installer_check_dependencies (LiInstaller *inst, LiPkgInfo *root, GError **error);
 static void li_installer_package_graph_progress_cb (LiPackageGraph *pg, guint percentage, const gchar *id, LiInstaller *inst);
 static void li_installer_package_graph_stage_changed_cb (LiPackageGraph *pg, LiPackageStage stage, const gchar *id, LiInstaller *inst);
+static void li_installer_progress_details_cb (const gchar *id, guint percentage, guint64 bytes_done, guint64 bytes_total, guint64 rate, gpointer user_data);
 
 /**
  * li_installer_finalize:
@@ -91,6 +103,7 @@ li_installer_finalize (GObject *object)
 		g_hash_table_unref (priv->extra_pkgs);
 	if (priv->pkg != NULL)
 		g_object_unref (priv->pkg);
+	g_hash_table_unref (priv->batch_roots);
 	g_free (priv->fname);
 	g_main_loop_unref (priv->loop);
 	if (priv->proxy_error != NULL)
@@ -99,6 +112,7 @@ li_installer_finalize (GObject *object)
 		g_object_unref (priv->bus_proxy);
 	if (priv->bus_watch_id != 0)
 		g_bus_unwatch_name (priv->bus_watch_id);
+	li_progress_aggregator_free (priv->progress);
 
 	G_OBJECT_CLASS (li_installer_parent_class)->finalize (object);
 }
@@ -114,6 +128,7 @@ li_installer_init (LiInstaller *inst)
 	priv->mgr = li_manager_new ();
 	priv->pg = li_package_graph_new ();
 	priv->cache = li_pkg_cache_new ();
+	priv->batch_roots = g_hash_table_new_full (g_direct_hash, g_direct_equal, g_object_unref, NULL);
 	priv->loop = g_main_loop_new (NULL, FALSE);
 
 	/* connect signals */
@@ -121,6 +136,26 @@ li_installer_init (LiInstaller *inst)
 				G_CALLBACK (li_installer_package_graph_progress_cb), inst);
 	g_signal_connect (priv->pg, "stage-changed",
 				G_CALLBACK (li_installer_package_graph_stage_changed_cb), inst);
+
+	priv->progress = li_progress_aggregator_new (LI_PROGRESS_DEFAULT_INTERVAL_MS,
+							li_installer_progress_details_cb,
+							inst);
+}
+
+/**
+ * li_installer_progress_details_cb:
+ */
+static void
+li_installer_progress_details_cb (const gchar *id, guint percentage, guint64 bytes_done, guint64 bytes_total, guint64 rate, gpointer user_data)
+{
+	LiInstaller *inst = LI_INSTALLER (user_data);
+
+	g_signal_emit (inst, signals[SIGNAL_PROGRESS_DETAILS], 0,
+					percentage,
+					bytes_done,
+					bytes_total,
+					rate,
+					li_progress_estimate_eta (bytes_done, bytes_total, rate));
 }
 
 /**
@@ -129,9 +164,20 @@ li_installer_init (LiInstaller *inst)
 static void
 li_installer_package_graph_progress_cb (LiPackageGraph *pg, guint percentage, const gchar *id, LiInstaller *inst)
 {
+	LiInstallerPrivate *priv = GET_PRIVATE (inst);
+
 	/* just forward that stuff */
 	g_signal_emit (inst, signals[SIGNAL_PROGRESS], 0,
 					percentage, id);
+
+	/* the overall progress also gets throughput and ETA */
+	if (id == NULL) {
+		guint64 done;
+		guint64 total;
+
+		li_package_graph_get_progress_bytes (pg, &done, &total);
+		li_progress_aggregator_update (priv->progress, NULL, percentage, done, total);
+	}
 }
 
 /**
@@ -385,6 +431,23 @@ li_installer_check_dependencies (LiInstaller *inst, LiPkgInfo *pki, GError **err
 	}
 }
 
+/**
+ * li_installer_node_is_root:
+ *
+ * Check if a package was requested for installation explicitly.
+ */
+static gboolean
+li_installer_node_is_root (LiInstaller *inst, LiPkgInfo *pki)
+{
+	LiInstallerPrivate *priv = GET_PRIVATE (inst);
+
+	if (g_hash_table_size (priv->batch_roots) > 0)
+		return g_hash_table_contains (priv->batch_roots, pki);
+	if (priv->pkg == NULL)
+		return TRUE;
+	return pki == li_package_get_info (priv->pkg);
+}
+
 /**
  * li_installer_install_node:
  */
@@ -415,13 +478,17 @@ li_installer_install_node (LiInstaller *inst, LiPkgInfo *node, GError **error)
 		}
 
 		/* only the initial package was set for manual installation */
-		if ((priv->pkg != NULL) && (info != li_package_get_info (priv->pkg)))
+		if (!li_installer_node_is_root (inst, info))
 			li_pkg_info_add_flag (info, LI_PACKAGE_FLAG_AUTOMATIC);
 
 		/* when in insecure mode (don't do that!) we skip verification */
 		if (priv->allow_insecure)
 			li_package_set_auto_verify (pkg, FALSE);
 
+		/* remember it before we start, so a partial installation gets rolled back too */
+		if (priv->new_pkids != NULL)
+			g_ptr_array_add (priv->new_pkids, g_strdup (li_package_get_id (pkg)));
+
 		/* now install the package */
 		li_package_install (pkg, &tmp_error);
 		if (tmp_error != NULL) {
@@ -460,6 +527,12 @@ li_installer_install_node (LiInstaller *inst, LiPkgInfo *node, GError **error)
 	/* store the changed metadata on disk */
 	li_pkg_info_save_changes (node);
 
+	/* precompute what runapp needs to know to launch this software */
+	if (!li_launch_desc_write (node, &tmp_error)) {
+		g_warning ("Unable to write launch descriptor for '%s': %s", li_pkg_info_get_id (node), tmp_error->message);
+		g_clear_error (&tmp_error);
+	}
+
 	return TRUE;
 }
 
@@ -486,10 +559,14 @@ li_installer_set_package (LiInstaller *inst, LiPackage *pkg)
  * Callback for the Error() DBus signal
  */
 static void
-li_installer_proxy_error_cb (LiProxyManager *mgr_bus, guint32 domain, guint code, const gchar *message, LiInstaller *inst)
+li_installer_proxy_error_cb (LiProxyManager *mgr_bus, guint job_id, guint32 domain, guint code, const gchar *message, LiInstaller *inst)
 {
 	LiInstallerPrivate *priv = GET_PRIVATE (inst);
 
+	/* ignore jobs other clients have started */
+	if (job_id != priv->proxy_job_id)
+		return;
+
 	/* ensure no error is set */
 	if (priv->proxy_error != NULL) {
 		g_error_free (priv->proxy_error);
@@ -505,10 +582,13 @@ li_installer_proxy_error_cb (LiProxyManager *mgr_bus, guint32 domain, guint code
  * Callback for the Finished() DBus signal
  */
 static void
-li_installer_proxy_finished_cb (LiProxyManager *mgr_bus, gboolean success, LiInstaller *inst)
+li_installer_proxy_finished_cb (LiProxyManager *mgr_bus, guint job_id, gboolean success, LiInstaller *inst)
 {
 	LiInstallerPrivate *priv = GET_PRIVATE (inst);
 
+	if (job_id != priv->proxy_job_id)
+		return;
+
 	if (success) {
 		/* ensure no error is set */
 		if (priv->proxy_error != NULL) {
@@ -524,8 +604,12 @@ li_installer_proxy_finished_cb (LiProxyManager *mgr_bus, gboolean success, LiIns
  * li_installer_proxy_progress_cb:
  */
 static void
-li_installer_proxy_progress_cb (LiProxyManager *mgr_bus, const gchar *id, gint percentage, LiInstaller *inst)
+li_installer_proxy_progress_cb (LiProxyManager *mgr_bus, guint job_id, const gchar *id, gint percentage, LiInstaller *inst)
 {
+	LiInstallerPrivate *priv = GET_PRIVATE (inst);
+
+	if (job_id != priv->proxy_job_id)
+		return;
 	if (g_strcmp0 (id, "") == 0)
 		id = NULL;
 
@@ -533,6 +617,25 @@ li_installer_proxy_progress_cb (LiProxyManager *mgr_bus, const gchar *id, gint p
 					percentage, id);
 }
 
+/**
+ * li_installer_proxy_progress_details_cb:
+ */
+static void
+li_installer_proxy_progress_details_cb (LiProxyManager *mgr_bus, guint job_id, guint percentage, guint64 bytes_done, guint64 bytes_total, guint64 rate, guint eta, LiInstaller *inst)
+{
+	LiInstallerPrivate *priv = GET_PRIVATE (inst);
+
+	if (job_id != priv->proxy_job_id)
+		return;
+
+	g_signal_emit (inst, signals[SIGNAL_PROGRESS_DETAILS], 0,
+					percentage,
+					bytes_done,
+					bytes_total,
+					rate,
+					eta);
+}
+
 /**
  * li_installer_bus_vanished:
  */
@@ -594,11 +697,13 @@ li_installer_install (LiInstaller *inst, GError **error)
 									NULL);
 			}
 
-			g_signal_connect (priv->bus_proxy, "progress",
+			g_signal_connect (priv->bus_proxy, "job-progress",
 						G_CALLBACK (li_installer_proxy_progress_cb), inst);
-			g_signal_connect (priv->bus_proxy, "error",
+			g_signal_connect (priv->bus_proxy, "job-progress-details",
+						G_CALLBACK (li_installer_proxy_progress_details_cb), inst);
+			g_signal_connect (priv->bus_proxy, "job-error",
 						G_CALLBACK (li_installer_proxy_error_cb), inst);
-			g_signal_connect (priv->bus_proxy, "finished",
+			g_signal_connect (priv->bus_proxy, "job-finished",
 						G_CALLBACK (li_installer_proxy_finished_cb), inst);
 		}
 
@@ -610,8 +715,9 @@ li_installer_install (LiInstaller *inst, GError **error)
 
 		if (priv->fname != NULL) {
 			/* we install a local package, so call the respective DBus method */
-			li_proxy_manager_call_install_local_sync (priv->bus_proxy,
+			li_proxy_manager_call_queue_install_local_sync (priv->bus_proxy,
 							priv->fname,
+							&priv->proxy_job_id,
 							NULL,
 							&tmp_error);
 			if (tmp_error != NULL) {
@@ -620,8 +726,9 @@ li_installer_install (LiInstaller *inst, GError **error)
 			}
 		} else {
 			/* we install package from a repository */
-			li_proxy_manager_call_install_sync (priv->bus_proxy,
+			li_proxy_manager_call_queue_install_sync (priv->bus_proxy,
 							li_package_get_id (priv->pkg),
+							&priv->proxy_job_id,
 							NULL,
 							&tmp_error);
 			if (tmp_error != NULL) {
@@ -673,10 +780,12 @@ li_installer_install (LiInstaller *inst, GError **error)
 		goto out;
 	}
 
-	/* install the package tree */
+	/* install the package tree, integrating all of it with the desktop at once */
+	li_exporter_transaction_begin ();
 	ret = li_installer_install_node (inst,
 					 li_package_get_info (priv->pkg),
 					 &tmp_error);
+	li_exporter_transaction_commit ();
 	if (tmp_error != NULL) {
 		g_propagate_error (error, tmp_error);
 		goto out;
@@ -829,6 +938,174 @@ out:
 	return ret;
 }
 
+/**
+ * li_installer_prepare_updates:
+ * @inst: An instance of #LiInstaller
+ * @cache: An opened #LiPkgCache the updates were found in
+ * @updates: (element-type LiUpdateItem): The updates to install
+ *
+ * Resolve the dependencies of all @updates at once and download all
+ * packages which need to be installed. Nothing is installed yet, call
+ * li_installer_apply_updates() to install the prepared updates.
+ */
+gboolean
+li_installer_prepare_updates (LiInstaller *inst, LiPkgCache *cache, GPtrArray *updates, GError **error)
+{
+	guint i;
+	GHashTableIter iter;
+	gpointer key;
+	g_autoptr(GPtrArray) todo = NULL;
+	g_autoptr(GPtrArray) pkids = NULL;
+	g_autoptr(GHashTable) files = NULL;
+	GError *tmp_error = NULL;
+	LiInstallerPrivate *priv = GET_PRIVATE (inst);
+
+	/* ensure the graph is initialized and additional data (foundations list) is loaded */
+	li_package_graph_initialize (priv->pg, &tmp_error);
+	if (tmp_error != NULL) {
+		g_propagate_error (error, tmp_error);
+		return FALSE;
+	}
+
+	/* use the same cache state the updates were calculated from */
+	g_object_unref (priv->cache);
+	priv->cache = g_object_ref (cache);
+
+	li_package_graph_reset (priv->pg);
+	g_hash_table_remove_all (priv->batch_roots);
+	if (priv->pkg != NULL)
+		g_object_unref (priv->pkg);
+	priv->pkg = NULL;
+	if (priv->all_pkgs != NULL)
+		g_ptr_array_unref (priv->all_pkgs);
+	priv->all_pkgs = NULL;
+
+	for (i = 0; i < updates->len; i++) {
+		g_autoptr(LiPackage) pkg = NULL;
+		LiPkgInfo *ipki;
+		LiPkgInfo *apki;
+		LiUpdateItem *uitem = LI_UPDATE_ITEM (g_ptr_array_index (updates, i));
+
+		ipki = li_update_item_get_installed_pkg (uitem);
+		apki = li_update_item_get_available_pkg (uitem);
+
+		pkg = li_package_new ();
+		li_package_open_remote (pkg, priv->cache, li_pkg_info_get_id (apki), &tmp_error);
+		if (tmp_error != NULL) {
+			g_propagate_error (error, tmp_error);
+			goto fail;
+		}
+
+		/* the index was verified already, see li_installer_open_remote() */
+		li_package_set_auto_verify (pkg, FALSE);
+
+		/* the new version was installed for the same reason as the old one */
+		if (li_pkg_info_has_flag (ipki, LI_PACKAGE_FLAG_AUTOMATIC))
+			li_pkg_info_add_flag (li_package_get_info (pkg), LI_PACKAGE_FLAG_AUTOMATIC);
+
+		li_package_graph_add_package_install_todo (priv->pg, NULL, pkg, NULL);
+		g_hash_table_add (priv->batch_roots, g_object_ref (li_package_get_info (pkg)));
+	}
+
+	/* create a single dependency graph for all updates */
+	g_hash_table_iter_init (&iter, priv->batch_roots);
+	while (g_hash_table_iter_next (&iter, &key, NULL)) {
+		li_installer_check_dependencies (inst, LI_PKG_INFO (key), &tmp_error);
+		if (tmp_error != NULL) {
+			g_propagate_error (error, tmp_error);
+			goto fail;
+		}
+	}
+
+	/* fetch everything we need to install in one go */
+	todo = li_package_graph_get_install_todo (priv->pg);
+	pkids = g_ptr_array_new ();
+	for (i = 0; i < todo->len; i++) {
+		LiPackage *pkg = LI_PACKAGE (g_ptr_array_index (todo, i));
+		if (!li_package_is_remote (pkg))
+			continue;
+
+		g_ptr_array_add (pkids, (gpointer) li_package_get_id (pkg));
+		g_signal_emit (inst, signals[SIGNAL_STAGE_CHANGED], 0,
+				LI_PACKAGE_STAGE_DOWNLOADING, li_package_get_id (pkg));
+	}
+
+	if (pkids->len == 0)
+		return TRUE;
+
+	files = li_pkg_cache_fetch_remote_batch (priv->cache, pkids, &tmp_error);
+	if (tmp_error != NULL) {
+		g_propagate_prefixed_error (error,
+					    tmp_error,
+					    _("Unable to download package:"));
+		goto fail;
+	}
+
+	for (i = 0; i < todo->len; i++) {
+		const gchar *fname;
+		LiPackage *pkg = LI_PACKAGE (g_ptr_array_index (todo, i));
+
+		fname = g_hash_table_lookup (files, li_package_get_id (pkg));
+		if (fname == NULL)
+			continue;
+
+		li_package_set_downloaded_file (pkg, fname, &tmp_error);
+		if (tmp_error != NULL) {
+			g_propagate_error (error, tmp_error);
+			goto fail;
+		}
+	}
+
+	return TRUE;
+
+fail:
+	li_package_graph_reset (priv->pg);
+	g_hash_table_remove_all (priv->batch_roots);
+
+	return FALSE;
+}
+
+/**
+ * li_installer_apply_updates:
+ * @inst: An instance of #LiInstaller
+ * @new_pkids: (element-type utf8) (allow-none): Receives the IDs of all packages
+ *             this installs, including new dependencies, or %NULL
+ *
+ * Install the updates which have been prepared using
+ * li_installer_prepare_updates().
+ * Packages are added to @new_pkids before their installation starts, so the
+ * caller can remove everything this has installed if it fails.
+ */
+gboolean
+li_installer_apply_updates (LiInstaller *inst, GPtrArray *new_pkids, GError **error)
+{
+	GHashTableIter iter;
+	gpointer key;
+	gboolean ret = TRUE;
+	GError *tmp_error = NULL;
+	LiInstallerPrivate *priv = GET_PRIVATE (inst);
+
+	priv->new_pkids = new_pkids;
+	li_exporter_transaction_begin ();
+	g_hash_table_iter_init (&iter, priv->batch_roots);
+	while (g_hash_table_iter_next (&iter, &key, NULL)) {
+		ret = li_installer_install_node (inst, LI_PKG_INFO (key), &tmp_error);
+		if (tmp_error != NULL) {
+			g_propagate_error (error, tmp_error);
+			ret = FALSE;
+			break;
+		}
+	}
+	li_exporter_transaction_commit ();
+	priv->new_pkids = NULL;
+
+	/* teardown current dependency graph */
+	li_package_graph_reset (priv->pg);
+	g_hash_table_remove_all (priv->batch_roots);
+
+	return ret;
+}
+
 /**
  * li_installer_open_extra_packages:
  * @inst: An instance of #LiInstaller
@@ -983,6 +1260,13 @@ li_installer_class_init (LiInstallerClass *klass)
 				G_TYPE_FROM_CLASS (object_class), G_SIGNAL_RUN_LAST,
 				0, NULL, NULL, g_cclosure_marshal_VOID__UINT_POINTER,
 				G_TYPE_NONE, 2, G_TYPE_UINT, G_TYPE_POINTER);
+
+	/* overall progress: percentage, bytes done, bytes total, bytes per second and ETA in seconds */
+	signals[SIGNAL_PROGRESS_DETAILS] =
+		g_signal_new ("progress-details",
+				G_TYPE_FROM_CLASS (object_class), G_SIGNAL_RUN_LAST,
+				0, NULL, NULL, NULL,
+				G_TYPE_NONE, 5, G_TYPE_UINT, G_TYPE_UINT64, G_TYPE_UINT64, G_TYPE_UINT64, G_TYPE_UINT);
 }
 
 /**
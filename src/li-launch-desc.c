@@ -0,0 +1,553 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014-2016 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2.1 of the license, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * SECTION:li-launch-desc
+ * @short_description: Precompiled description of an application's environment
+ *
+ * A launch descriptor contains everything runapp needs to know to set up
+ * the environment of an installed application: The overlay directories
+ * of the application and its runtime, the flattened tree of the runtime
+ * which can be used instead of its members, a dynamic linker cache for
+ * the libraries of the application and the environment variables to set.
+ * It is written when software is installed or when its runtime changes,
+ * so runapp does not need to parse any metadata when launching an application.
+ *
+ * The file consists of a header line, followed by lines of the form
+ * "key value". It is considered outdated if the control file of the software
+ * or its runtime are newer than the descriptor. The linker cache also contains
+ * the system libraries, so it is not used anymore once the system's cache has
+ * changed, until the next cleanup or cache refresh rebuilds it.
+ *
+ * As runapp mounts what the descriptor lists while it is privileged, a
+ * descriptor is only used if it and its directory are owned by root and
+ * not writable by anyone else, and all layers it lists are located in
+ * the software root.
+ */
+
+#include "config.h"
+#include "li-launch-desc.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
+#include "li-utils.h"
+#include "li-runtime.h"
+#include "li-run.h"
+
+/* bump this when changing the file format */
+#define LI_LAUNCH_DESC_HEADER "LimbaLaunch 1"
+
+/**
+ * li_launch_desc_write_ld_cache:
+ * @data_dirs: The data directories of the application and its runtime
+ *
+ * Generate a dynamic linker cache containing the libraries of the application
+ * and its runtime, as well as the system libraries, so the linker does not need
+ * to search the library directories of the application at all.
+ *
+ * Returns: %TRUE if a cache was written.
+ */
+static gboolean
+li_launch_desc_write_ld_cache (GPtrArray *data_dirs, const gchar *triplet, const gchar *cache_fname, GError **error)
+{
+	guint i;
+	gint conf_fd;
+	gint exit_status;
+	gboolean ret;
+	gboolean have_libs = FALSE;
+	GString *conf;
+	g_autofree gchar *conf_fname = NULL;
+	g_autofree gchar *old_conf_fname = NULL;
+	g_autofree gchar *ldconfig = NULL;
+	g_autofree gchar *stderr_txt = NULL;
+	const gchar *argv[7];
+
+	/* the multiarch library path takes precedence over the generic one, like in LD_LIBRARY_PATH */
+	conf = g_string_new ("");
+	for (i = 0; i < data_dirs->len; i++) {
+		g_autofree gchar *ma_lib_dir = NULL;
+		g_autofree gchar *lib_dir = NULL;
+		const gchar *data_dir = (const gchar*) g_ptr_array_index (data_dirs, i);
+
+		ma_lib_dir = g_build_filename (data_dir, "lib", triplet, NULL);
+		lib_dir = g_build_filename (data_dir, "lib", NULL);
+		if (g_file_test (ma_lib_dir, G_FILE_TEST_IS_DIR)) {
+			g_string_append_printf (conf, "%s\n", ma_lib_dir);
+			have_libs = TRUE;
+		}
+		if (g_file_test (lib_dir, G_FILE_TEST_IS_DIR)) {
+			g_string_append_printf (conf, "%s\n", lib_dir);
+			have_libs = TRUE;
+		}
+	}
+	g_string_append (conf, "include /etc/ld.so.conf\n");
+
+	/* nothing to do if there are no libraries */
+	if (!have_libs) {
+		g_string_free (conf, TRUE);
+		g_remove (cache_fname);
+		return FALSE;
+	}
+
+	/* the configuration is only needed by ldconfig, so don't leave it in the software
+	 * directory (and drop the one earlier versions left there) */
+	old_conf_fname = g_strconcat (cache_fname, ".conf", NULL);
+	g_remove (old_conf_fname);
+	conf_fd = g_file_open_tmp ("limba-ldconf-XXXXXX", &conf_fname, error);
+	if (conf_fd < 0) {
+		g_string_free (conf, TRUE);
+		return FALSE;
+	}
+	close (conf_fd);
+	if (!g_file_set_contents (conf_fname, conf->str, conf->len, error)) {
+		g_string_free (conf, TRUE);
+		g_remove (conf_fname);
+		return FALSE;
+	}
+	g_string_free (conf, TRUE);
+
+	ldconfig = g_find_program_in_path ("ldconfig");
+	if (ldconfig == NULL)
+		ldconfig = g_strdup ("/sbin/ldconfig");
+
+	/* -X: never create symlinks in the (read-only) software directories */
+	argv[0] = ldconfig;
+	argv[1] = "-X";
+	argv[2] = "-C";
+	argv[3] = cache_fname;
+	argv[4] = "-f";
+	argv[5] = conf_fname;
+	argv[6] = NULL;
+
+	ret = g_spawn_sync (NULL, (gchar**) argv, NULL,
+			   G_SPAWN_STDOUT_TO_DEV_NULL,
+			   NULL, NULL, NULL, &stderr_txt, &exit_status, error);
+	g_remove (conf_fname);
+	if (!ret)
+		return FALSE;
+	if (!g_spawn_check_exit_status (exit_status, error)) {
+		g_debug ("ldconfig output: %s", stderr_txt);
+		g_prefix_error (error, "ldconfig failed: ");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * li_launch_desc_write:
+ * @pki: The #LiPkgInfo of an installed application
+ *
+ * Write the launch descriptor for an installed application.
+ */
+gboolean
+li_launch_desc_write (LiPkgInfo *pki, GError **error)
+{
+	const gchar *rt_uuid;
+	GString *data;
+	gboolean ret;
+	guint i;
+	g_autofree gchar *triplet = NULL;
+	g_autofree gchar *fname = NULL;
+	g_autofree gchar *ld_cache_fname = NULL;
+	g_autoptr(GPtrArray) data_dirs = NULL;
+	GError *tmp_error = NULL;
+
+	fname = g_build_filename (LI_SOFTWARE_ROOT, li_pkg_info_get_id (pki), LI_LAUNCH_DESC_FNAME, NULL);
+
+	/* without a runtime dependency we can not construct an environment */
+	rt_uuid = li_pkg_info_get_runtime_dependency (pki);
+	if (rt_uuid == NULL) {
+		g_remove (fname);
+		return TRUE;
+	}
+
+	data = g_string_new (LI_LAUNCH_DESC_HEADER "\n");
+	g_string_append_printf (data, "runtime %s\n", rt_uuid);
+
+	/* collect the overlay layers, the topmost one first */
+	data_dirs = g_ptr_array_new_with_free_func (g_free);
+	if (g_strcmp0 (rt_uuid, "None") != 0) {
+		g_autoptr(LiRuntime) rt = NULL;
+		g_auto(GStrv) rt_members = NULL;
+		g_autofree gchar *flat_dir = NULL;
+
+		rt = li_runtime_new ();
+		li_runtime_load_by_uuid (rt, rt_uuid, &tmp_error);
+		if (tmp_error != NULL) {
+			g_propagate_error (error, tmp_error);
+			g_string_free (data, TRUE);
+			return FALSE;
+		}
+
+		/* the flattened tree might be created later, so we always record it */
+		flat_dir = li_runtime_get_flat_path (rt);
+		g_string_append_printf (data, "flat %s\n", flat_dir);
+
+		/* same order as in the flattened tree */
+		rt_members = li_runtime_dup_member_ids (rt);
+		for (i = 0; rt_members[i] != NULL; i++)
+			g_ptr_array_add (data_dirs, g_build_filename (LI_SOFTWARE_ROOT, rt_members[i], "data", NULL));
+	}
+	g_ptr_array_add (data_dirs, g_build_filename (LI_SOFTWARE_ROOT, li_pkg_info_get_id (pki), "data", NULL));
+
+	g_string_append (data, "lowerdir ");
+	for (i = 0; i < data_dirs->len; i++) {
+		if (i > 0)
+			g_string_append_c (data, ':');
+		g_string_append (data, (const gchar*) g_ptr_array_index (data_dirs, i));
+	}
+	g_string_append_c (data, '\n');
+
+	/* a linker cache is optional, without it we just use LD_LIBRARY_PATH */
+	triplet = li_get_arch_triplet ();
+	ld_cache_fname = g_build_filename (LI_SOFTWARE_ROOT, li_pkg_info_get_id (pki), LI_LAUNCH_DESC_LD_CACHE_FNAME, NULL);
+	if (li_launch_desc_write_ld_cache (data_dirs, triplet, ld_cache_fname, &tmp_error)) {
+		g_string_append_printf (data, "ldcache %s\n", ld_cache_fname);
+	} else if (tmp_error != NULL) {
+		g_warning ("Unable to create linker cache for '%s': %s", li_pkg_info_get_id (pki), tmp_error->message);
+		g_clear_error (&tmp_error);
+	}
+
+	/* the multiarch library path takes precedence over the generic one */
+	g_string_append_printf (data, "env LD_LIBRARY_PATH=%s/lib/%s:%s/lib\n",
+				LI_SW_ROOT_PREFIX, triplet, LI_SW_ROOT_PREFIX);
+	g_string_append_printf (data, "env PATH=%s/bin\n", LI_SW_ROOT_PREFIX);
+
+	ret = g_file_set_contents (fname, data->str, data->len, error);
+	g_string_free (data, TRUE);
+
+	/* runapp ignores descriptors which are writable by others, regardless of our umask */
+	if (ret)
+		g_chmod (fname, 0644);
+
+	return ret;
+}
+
+/**
+ * li_launch_desc_remove:
+ * @pki: The #LiPkgInfo of an installed application
+ *
+ * Remove the launch descriptor and the linker cache of an application,
+ * so runapp constructs its environment from the metadata again.
+ */
+void
+li_launch_desc_remove (LiPkgInfo *pki)
+{
+	g_autofree gchar *fname = NULL;
+	g_autofree gchar *ld_cache_fname = NULL;
+
+	fname = g_build_filename (LI_SOFTWARE_ROOT, li_pkg_info_get_id (pki), LI_LAUNCH_DESC_FNAME, NULL);
+	ld_cache_fname = g_build_filename (LI_SOFTWARE_ROOT, li_pkg_info_get_id (pki), LI_LAUNCH_DESC_LD_CACHE_FNAME, NULL);
+	g_remove (fname);
+	g_remove (ld_cache_fname);
+}
+
+/**
+ * li_launch_desc_file_is_newer:
+ */
+static gboolean
+li_launch_desc_file_is_newer (const gchar *fname, struct stat *desc_buf)
+{
+	struct stat buf;
+
+	if (stat (fname, &buf) != 0)
+		return TRUE;
+	if (buf.st_mtim.tv_sec != desc_buf->st_mtim.tv_sec)
+		return buf.st_mtim.tv_sec > desc_buf->st_mtim.tv_sec;
+	return buf.st_mtim.tv_nsec > desc_buf->st_mtim.tv_nsec;
+}
+
+/**
+ * li_launch_desc_ld_cache_is_outdated:
+ * @pki: The #LiPkgInfo of an installed application
+ *
+ * Check whether the linker cache of an application was generated before
+ * the system's linker cache changed. runapp doesn't use such a cache, so
+ * it should be rebuilt by calling li_launch_desc_write() again.
+ *
+ * Returns: %TRUE if the application has an outdated linker cache.
+ */
+gboolean
+li_launch_desc_ld_cache_is_outdated (LiPkgInfo *pki)
+{
+	struct stat cache_buf;
+	g_autofree gchar *ld_cache_fname = NULL;
+
+	ld_cache_fname = g_build_filename (LI_SOFTWARE_ROOT, li_pkg_info_get_id (pki), LI_LAUNCH_DESC_LD_CACHE_FNAME, NULL);
+	if (stat (ld_cache_fname, &cache_buf) != 0)
+		return FALSE;
+
+	return li_launch_desc_file_is_newer ("/etc/ld.so.cache", &cache_buf);
+}
+
+/**
+ * li_launch_desc_stat_is_trusted:
+ *
+ * Check that a file or directory is owned by root and can not
+ * be modified by anyone else.
+ */
+static gboolean
+li_launch_desc_stat_is_trusted (struct stat *buf)
+{
+	if (buf->st_uid != 0)
+		return FALSE;
+	if (S_ISDIR (buf->st_mode))
+		return (buf->st_mode & (S_IWGRP | S_IWOTH)) == 0;
+
+	/* regular files must not have any permissions beyond 0644 */
+	return S_ISREG (buf->st_mode) && ((buf->st_mode & 07777 & ~0644) == 0);
+}
+
+/**
+ * li_launch_desc_path_is_safe:
+ * @path: A path, or a ':'-separated list of paths
+ * @absolute: %TRUE if the paths need to be located in the software root
+ *
+ * Check that the paths do not contain ".." components, so they can not
+ * point outside of the directory they are expected in.
+ */
+static gboolean
+li_launch_desc_path_is_safe (const gchar *path, gboolean absolute)
+{
+	guint i;
+	g_auto(GStrv) paths = NULL;
+
+	paths = g_strsplit (path, ":", -1);
+	for (i = 0; paths[i] != NULL; i++) {
+		guint j;
+		g_auto(GStrv) parts = NULL;
+
+		if (absolute && !g_str_has_prefix (paths[i], LI_SOFTWARE_ROOT "/"))
+			return FALSE;
+		if (!absolute && g_path_is_absolute (paths[i]))
+			return FALSE;
+
+		parts = g_strsplit (paths[i], "/", -1);
+		for (j = 0; parts[j] != NULL; j++) {
+			if (g_strcmp0 (parts[j], "..") == 0)
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/**
+ * li_launch_desc_read_trusted:
+ *
+ * Read the descriptor of @pkid, if it and its directory are
+ * owned by root and can not be modified by anyone else.
+ */
+static gchar*
+li_launch_desc_read_trusted (const gchar *pkid, struct stat *desc_buf)
+{
+	int fd;
+	gssize len;
+	gchar buf[4096];
+	struct stat dir_buf;
+	GString *data;
+	g_autofree gchar *dirname = NULL;
+	g_autofree gchar *fname = NULL;
+
+	if (!li_launch_desc_path_is_safe (pkid, FALSE))
+		return NULL;
+
+	dirname = g_build_filename (LI_SOFTWARE_ROOT, pkid, NULL);
+	if ((lstat (dirname, &dir_buf) != 0) || !S_ISDIR (dir_buf.st_mode) || !li_launch_desc_stat_is_trusted (&dir_buf)) {
+		g_debug ("Ignoring launch descriptor of '%s': Its directory is not owned by root.", pkid);
+		return NULL;
+	}
+
+	fname = g_build_filename (dirname, LI_LAUNCH_DESC_FNAME, NULL);
+	fd = open (fname, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	if ((fstat (fd, desc_buf) != 0) || !li_launch_desc_stat_is_trusted (desc_buf)) {
+		g_debug ("Ignoring launch descriptor of '%s': It is not owned by root, or writable by others.", pkid);
+		close (fd);
+		return NULL;
+	}
+
+	data = g_string_new ("");
+	while ((len = read (fd, buf, sizeof (buf))) > 0)
+		g_string_append_len (data, buf, len);
+	close (fd);
+	if (len < 0) {
+		g_string_free (data, TRUE);
+		return NULL;
+	}
+
+	return g_string_free (data, FALSE);
+}
+
+/**
+ * li_launch_desc_load:
+ * @pkid: The identifier of an installed application
+ *
+ * Load the launch descriptor of an application.
+ *
+ * Returns: A new #LiLaunchDesc, or %NULL if no valid and up-to-date
+ * descriptor exists.
+ */
+LiLaunchDesc*
+li_launch_desc_load (const gchar *pkid)
+{
+	struct stat desc_buf;
+	guint i;
+	g_autofree gchar *fname = NULL;
+	g_autofree gchar *data = NULL;
+	g_auto(GStrv) lines = NULL;
+	g_autoptr(LiLaunchDesc) desc = NULL;
+
+	data = li_launch_desc_read_trusted (pkid, &desc_buf);
+	if (data == NULL)
+		return NULL;
+
+	lines = g_strsplit (data, "\n", -1);
+	if (g_strcmp0 (lines[0], LI_LAUNCH_DESC_HEADER) != 0) {
+		g_debug ("Ignoring launch descriptor of '%s' with unknown format.", pkid);
+		return NULL;
+	}
+
+	desc = g_new0 (LiLaunchDesc, 1);
+	desc->env = g_ptr_array_new_with_free_func (g_free);
+	for (i = 1; lines[i] != NULL; i++) {
+		gchar *value;
+
+		value = strchr (lines[i], ' ');
+		if (value == NULL)
+			continue;
+		*value = '\0';
+		value++;
+
+		if (g_strcmp0 (lines[i], "runtime") == 0) {
+			if (strchr (value, '/') != NULL)
+				return NULL;
+			g_free (desc->runtime_uuid);
+			desc->runtime_uuid = g_strdup (value);
+		} else if (g_strcmp0 (lines[i], "flat") == 0) {
+			g_free (desc->flat_lowerdirs);
+			desc->flat_lowerdirs = NULL;
+			g_free (desc->flat_dir);
+			desc->flat_dir = NULL;
+			if (!li_launch_desc_path_is_safe (value, TRUE)) {
+				g_debug ("Ignoring launch descriptor of '%s': Flattened runtime is outside of the software root.", pkid);
+				return NULL;
+			}
+			if (g_file_test (value, G_FILE_TEST_IS_DIR)) {
+				desc->flat_dir = g_strdup (value);
+				desc->flat_lowerdirs = g_strdup_printf ("%s:%s/%s/data", value, LI_SOFTWARE_ROOT, pkid);
+			}
+		} else if (g_strcmp0 (lines[i], "ldcache") == 0) {
+			struct stat cache_buf;
+
+			g_free (desc->ld_cache);
+			desc->ld_cache = NULL;
+
+			/* the cache is bind-mounted over the one of the system, so only root may have written it */
+			if (!li_launch_desc_path_is_safe (value, TRUE) ||
+			    (lstat (value, &cache_buf) != 0) ||
+			    !li_launch_desc_stat_is_trusted (&cache_buf)) {
+				g_debug ("Ignoring linker cache of '%s': It is not owned by root, or writable by others.", pkid);
+				continue;
+			}
+
+			/* the cache also contains the system libraries, so it is outdated
+			 * if the system cache has changed */
+			if (!li_launch_desc_file_is_newer ("/etc/ld.so.cache", &desc_buf) &&
+			    !li_launch_desc_file_is_newer (value, &desc_buf))
+				desc->ld_cache = g_strdup (value);
+		} else if (g_strcmp0 (lines[i], "lowerdir") == 0) {
+			if (!li_launch_desc_path_is_safe (value, TRUE)) {
+				g_debug ("Ignoring launch descriptor of '%s': Layers are outside of the software root.", pkid);
+				return NULL;
+			}
+			g_free (desc->lowerdirs);
+			desc->lowerdirs = g_strdup (value);
+		} else if (g_strcmp0 (lines[i], "env") == 0) {
+			if (strchr (value, '=') != NULL)
+				g_ptr_array_add (desc->env, g_strdup (value));
+		}
+	}
+
+	if ((desc->runtime_uuid == NULL) || (desc->lowerdirs == NULL))
+		return NULL;
+
+	/* check whether the software or its runtime changed since the descriptor was written */
+	g_free (fname);
+	fname = g_build_filename (LI_SOFTWARE_ROOT, pkid, "control", NULL);
+	if (li_launch_desc_file_is_newer (fname, &desc_buf))
+		return NULL;
+	if (g_strcmp0 (desc->runtime_uuid, "None") != 0) {
+		g_free (fname);
+		fname = g_build_filename (LI_SOFTWARE_ROOT, "runtimes", desc->runtime_uuid, NULL);
+		if (li_launch_desc_file_is_newer (fname, &desc_buf))
+			return NULL;
+	}
+
+	return g_steal_pointer (&desc);
+}
+
+/**
+ * li_launch_desc_apply_env:
+ *
+ * Set the environment variables of the descriptor for the current process.
+ */
+void
+li_launch_desc_apply_env (LiLaunchDesc *desc)
+{
+	guint i;
+
+	for (i = 0; i < desc->env->len; i++) {
+		g_auto(GStrv) parts = NULL;
+
+		parts = g_strsplit ((const gchar*) g_ptr_array_index (desc->env, i), "=", 2);
+
+		/* the linker cache already knows about our libraries */
+		if ((desc->ld_cache != NULL) && (g_strcmp0 (parts[0], "LD_LIBRARY_PATH") == 0))
+			continue;
+
+		li_run_env_prepend_path (parts[0], parts[1]);
+	}
+}
+
+/**
+ * li_launch_desc_free:
+ */
+void
+li_launch_desc_free (LiLaunchDesc *desc)
+{
+	if (desc == NULL)
+		return;
+	g_free (desc->runtime_uuid);
+	g_free (desc->lowerdirs);
+	g_free (desc->flat_lowerdirs);
+	g_free (desc->flat_dir);
+	g_free (desc->ld_cache);
+	if (desc->env != NULL)
+		g_ptr_array_unref (desc->env);
+	g_free (desc);
+}
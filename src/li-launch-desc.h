@@ -0,0 +1,61 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2014-2016 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2.1 of the license, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#if !defined (__LIMBA_H) && !defined (LI_COMPILATION)
+#error "Only <limba.h> can be included directly."
+#endif
+
+#ifndef __LI_LAUNCH_DESC_H
+#define __LI_LAUNCH_DESC_H
+
+#include <glib-object.h>
+#include "li-pkg-info.h"
+
+G_BEGIN_DECLS
+
+#define LI_LAUNCH_DESC_FNAME "launch"
+#define LI_LAUNCH_DESC_LD_CACHE_FNAME "ld.so.cache"
+
+typedef struct _LiLaunchDesc LiLaunchDesc;
+struct _LiLaunchDesc
+{
+	gchar		*runtime_uuid;
+	gchar		*lowerdirs;
+	gchar		*flat_lowerdirs; /* only set if the flattened runtime exists */
+	gchar		*flat_dir; /* the flattened runtime, only set with flat_lowerdirs */
+	gchar		*ld_cache; /* only set if the linker cache is up to date */
+	GPtrArray	*env; /* of "NAME=VALUE" entries to prepend */
+};
+
+gboolean		li_launch_desc_write (LiPkgInfo *pki,
+						GError **error);
+void			li_launch_desc_remove (LiPkgInfo *pki);
+gboolean		li_launch_desc_ld_cache_is_outdated (LiPkgInfo *pki);
+
+LiLaunchDesc		*li_launch_desc_load (const gchar *pkid);
+void			li_launch_desc_apply_env (LiLaunchDesc *desc);
+void			li_launch_desc_free (LiLaunchDesc *desc);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (LiLaunchDesc, li_launch_desc_free)
+
+G_END_DECLS
+
+#endif /* __LI_LAUNCH_DESC_H */
@@ -28,6 +28,10 @@
 
 #include <glib/gi18n-lib.h>
 #include <glib/gstdio.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
 
 #include "li-utils.h"
 #include "li-utils-private.h"
@@ -35,8 +39,13 @@
 #include "li-pkg-cache.h"
 #include "li-keyring.h"
 #include "li-installer.h"
+#include "li-installer-private.h"
 #include "li-update-item.h"
 #include "li-package-graph.h"
+#include "li-installed-db.h"
+#include "li-launch-desc.h"
+#include "li-exporter.h"
+#include "li-repo-entry.h"
 
 #include "li-dbus-interface.h"
 
@@ -46,12 +55,33 @@ typedef struct _LiManagerPrivate	LiManagerPrivate;
 struct _LiManagerPrivate
 {
 	GHashTable *pkgs; /* key:utf8;value:LiPkgInfo */
+	GHashTable *installed; /* key:utf8;value:LiPkgInfo */
+	GPtrArray *available; /* of LiPkgInfo */
 	GPtrArray *rts; /* of LiRuntime */
 	GHashTable *updates; /* of LiUpdateItem */
 
+	/* runtime lookup indices, built lazily from rts */
+	GHashTable *rts_by_member; /* key:utf8 (pkid);value:GPtrArray of LiRuntime */
+	GHashTable *rts_by_fingerprint; /* key:utf8 (member fingerprint);value:LiRuntime */
+	gboolean rts_index_valid;
+
+	gboolean installed_dirty;
+	gboolean available_dirty;
+	gboolean rts_loaded;
+	gboolean updates_valid;
+
+	/* filesystem monitoring */
+	GPtrArray *monitors; /* of GFileMonitor */
+
+	/* changes the monitors noticed, applied by the next query, which may run in another thread */
+	GMutex pending_lock;
+	guint pending_changes; /* LiManagerChanges */
+	GHashTable *pending_rts; /* set of UUIDs of changed runtimes */
+
 	/* DBus helper */
 	GMainLoop *loop;
 	LiProxyManager *bus_proxy;
+	guint proxy_job_id;
 	GError *proxy_error;
 	guint bus_watch_id;
 };
@@ -61,6 +91,8 @@ G_DEFINE_TYPE_WITH_PRIVATE (LiManager, li_manager, G_TYPE_OBJECT)
 
 enum {
 	SIGNAL_PROGRESS,
+	SIGNAL_CHANGED,
+	SIGNAL_PROGRESS_DETAILS,
 	SIGNAL_LAST
 };
 
@@ -75,8 +107,16 @@ li_manager_finalize (GObject *object)
 	LiManager *mgr = LI_MANAGER (object);
 	LiManagerPrivate *priv = GET_PRIVATE (mgr);
 
+	g_ptr_array_unref (priv->monitors);
+	g_hash_table_unref (priv->pending_rts);
+	g_mutex_clear (&priv->pending_lock);
 	g_hash_table_unref (priv->pkgs);
+	g_hash_table_unref (priv->installed);
+	if (priv->available != NULL)
+		g_ptr_array_unref (priv->available);
 	g_ptr_array_unref (priv->rts);
+	g_hash_table_unref (priv->rts_by_member);
+	g_hash_table_unref (priv->rts_by_fingerprint);
 	g_hash_table_unref (priv->updates);
 
 	g_main_loop_unref (priv->loop);
@@ -119,12 +159,21 @@ li_manager_init (LiManager *mgr)
 	LiManagerPrivate *priv = GET_PRIVATE (mgr);
 
 	priv->pkgs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+	priv->installed = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
 	priv->rts = g_ptr_array_new_with_free_func (g_object_unref);
 	priv->updates = g_hash_table_new_full ((GHashFunc) li_pki_hash_func,
 						(GEqualFunc) li_pki_equal_func,
 						g_object_unref,
 						g_object_unref);
+	priv->rts_by_member = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_ptr_array_unref);
+	priv->rts_by_fingerprint = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+	priv->monitors = g_ptr_array_new_with_free_func (g_object_unref);
+	g_mutex_init (&priv->pending_lock);
+	priv->pending_rts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 	priv->loop = g_main_loop_new (NULL, FALSE);
+
+	priv->installed_dirty = TRUE;
+	priv->available_dirty = TRUE;
 }
 
 /**
@@ -139,6 +188,11 @@ li_manager_reset_cached_data (LiManager *mgr)
 	g_ptr_array_unref (priv->rts);
 	priv->pkgs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
 	priv->rts = g_ptr_array_new_with_free_func (g_object_unref);
+
+	priv->installed_dirty = TRUE;
+	priv->available_dirty = TRUE;
+	priv->rts_loaded = FALSE;
+	priv->rts_index_valid = FALSE;
 }
 
 /**
@@ -168,8 +222,12 @@ li_manager_bus_vanished (GDBusConnection *connection, const gchar *name, LiManag
  * li_manager_proxy_progress_cb:
  */
 static void
-li_manager_proxy_progress_cb (LiProxyManager *mgr_bus, const gchar *id, gint percentage, LiManager *mgr)
+li_manager_proxy_progress_cb (LiProxyManager *mgr_bus, guint job_id, const gchar *id, gint percentage, LiManager *mgr)
 {
+	LiManagerPrivate *priv = GET_PRIVATE (mgr);
+
+	if (job_id != priv->proxy_job_id)
+		return;
 	if (g_strcmp0 (id, "") == 0)
 		id = NULL;
 
@@ -177,16 +235,39 @@ li_manager_proxy_progress_cb (LiProxyManager *mgr_bus, const gchar *id, gint per
 					percentage, id);
 }
 
+/**
+ * li_manager_proxy_progress_details_cb:
+ */
+static void
+li_manager_proxy_progress_details_cb (LiProxyManager *mgr_bus, guint job_id, guint percentage, guint64 bytes_done, guint64 bytes_total, guint64 rate, guint eta, LiManager *mgr)
+{
+	LiManagerPrivate *priv = GET_PRIVATE (mgr);
+
+	if (job_id != priv->proxy_job_id)
+		return;
+
+	g_signal_emit (mgr, signals[SIGNAL_PROGRESS_DETAILS], 0,
+					percentage,
+					bytes_done,
+					bytes_total,
+					rate,
+					eta);
+}
+
 /**
  * li_manager_proxy_error_cb:
  *
  * Callback for the Error() DBus signal
  */
 static void
-li_manager_proxy_error_cb (LiProxyManager *mgr_bus, guint32 domain, guint code, const gchar *message, LiManager *mgr)
+li_manager_proxy_error_cb (LiProxyManager *mgr_bus, guint job_id, guint32 domain, guint code, const gchar *message, LiManager *mgr)
 {
 	LiManagerPrivate *priv = GET_PRIVATE (mgr);
 
+	/* ignore jobs other clients have started */
+	if (job_id != priv->proxy_job_id)
+		return;
+
 	/* ensure no error is set */
 	if (priv->proxy_error != NULL) {
 		g_error_free (priv->proxy_error);
@@ -202,10 +283,13 @@ li_manager_proxy_error_cb (LiProxyManager *mgr_bus, guint32 domain, guint code,
  * Callback for the Finished() DBus signal
  */
 static void
-li_manager_proxy_finished_cb (LiProxyManager *mgr_bus, gboolean success, LiManager *mgr)
+li_manager_proxy_finished_cb (LiProxyManager *mgr_bus, guint job_id, gboolean success, LiManager *mgr)
 {
 	LiManagerPrivate *priv = GET_PRIVATE (mgr);
 
+	if (job_id != priv->proxy_job_id)
+		return;
+
 	if (success) {
 		/* ensure no error is set */
 		if (priv->proxy_error != NULL) {
@@ -250,11 +334,13 @@ li_manager_get_dbus_proxy (LiManager *mgr, GError **error)
 								NULL);
 		}
 
-		g_signal_connect (priv->bus_proxy, "progress",
+		g_signal_connect (priv->bus_proxy, "job-progress",
 					G_CALLBACK (li_manager_proxy_progress_cb), mgr);
-		g_signal_connect (priv->bus_proxy, "error",
+		g_signal_connect (priv->bus_proxy, "job-progress-details",
+					G_CALLBACK (li_manager_proxy_progress_details_cb), mgr);
+		g_signal_connect (priv->bus_proxy, "job-error",
 					G_CALLBACK (li_manager_proxy_error_cb), mgr);
-		g_signal_connect (priv->bus_proxy, "finished",
+		g_signal_connect (priv->bus_proxy, "job-finished",
 					G_CALLBACK (li_manager_proxy_finished_cb), mgr);
 	}
 
@@ -274,97 +360,93 @@ static GHashTable*
 li_manager_get_installed_software (LiManager *mgr, GError **error)
 {
 	GError *error_local = NULL;
-	g_autoptr(GFile) fdir = NULL;
-	g_autoptr(GFileEnumerator) enumerator = NULL;
-	GFileInfo *file_info;
-	GHashTable *pkgs = NULL;
+	g_autoptr(LiInstalledDb) db = NULL;
 
 	if (!g_file_test (LI_SOFTWARE_ROOT, G_FILE_TEST_IS_DIR)) {
 		/* directory not found, no software to be searched for */
 		return NULL;
 	}
 
-	/* get stuff in the software directory */
-	fdir = g_file_new_for_path (LI_SOFTWARE_ROOT);
-	enumerator = g_file_enumerate_children (fdir, G_FILE_ATTRIBUTE_STANDARD_NAME, 0, NULL, &error_local);
-	if (error_local != NULL)
-		goto out;
+	/* load the list of installed software from the database, which rescans the software root if needed */
+	db = li_installed_db_new ();
+	li_installed_db_open (db, &error_local);
+	if (error_local != NULL) {
+		g_propagate_prefixed_error (error,
+					error_local,
+					"Error while searching for installed software:");
+		return NULL;
+	}
 
-	pkgs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+	return g_hash_table_ref (li_installed_db_get_packages (db));
+}
 
-	while ((file_info = g_file_enumerator_next_file (enumerator, NULL, &error_local)) != NULL) {
-		g_autoptr(GFile) fsdir = NULL;
-		g_autoptr(GFileEnumerator) senum = NULL;
-		g_autofree gchar *mpath = NULL;
-		GFileInfo *s_finfo;
+static void li_manager_clear_updates_table (LiManager *mgr);
 
-		if (error_local != NULL)
-			goto out;
-		if (g_file_info_get_is_hidden (file_info))
-			continue;
-		/* ignore the runtimes directory */
-		if (g_strcmp0 (g_file_info_get_name (file_info), "runtimes") == 0)
-			continue;
+/**
+ * li_manager_apply_pending_changes:
+ *
+ * Drop the cached data the filesystem monitors reported as changed.
+ */
+static void
+li_manager_apply_pending_changes (LiManager *mgr)
+{
+	guint changes;
+	GHashTableIter iter;
+	gpointer key;
+	g_autoptr(GHashTable) rt_uuids = NULL;
+	LiManagerPrivate *priv = GET_PRIVATE (mgr);
 
-		mpath = g_build_filename (LI_SOFTWARE_ROOT, g_file_info_get_name (file_info), NULL);
+	g_mutex_lock (&priv->pending_lock);
+	changes = priv->pending_changes;
+	priv->pending_changes = LI_MANAGER_CHANGE_NONE;
+	if (g_hash_table_size (priv->pending_rts) > 0) {
+		rt_uuids = priv->pending_rts;
+		priv->pending_rts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	}
+	g_mutex_unlock (&priv->pending_lock);
 
-		fsdir = g_file_new_for_path (mpath);
-		senum = g_file_enumerate_children (fsdir, G_FILE_ATTRIBUTE_STANDARD_NAME, 0, NULL, &error_local);
-		if (error_local != NULL)
-			goto out;
+	if (changes == LI_MANAGER_CHANGE_NONE)
+		return;
 
-		while ((s_finfo = g_file_enumerator_next_file (senum, NULL, &error_local)) != NULL) {
-			g_autofree gchar *cpath = NULL;
+	if (changes & LI_MANAGER_CHANGE_INSTALLED)
+		priv->installed_dirty = TRUE;
+	if (changes & LI_MANAGER_CHANGE_AVAILABLE)
+		priv->available_dirty = TRUE;
+
+	/* we only reload the affected runtimes. If we do not have any
+	 * runtime data yet, there is nothing to invalidate */
+	if ((rt_uuids != NULL) && priv->rts_loaded) {
+		g_hash_table_iter_init (&iter, rt_uuids);
+		while (g_hash_table_iter_next (&iter, &key, NULL)) {
+			guint i;
+			g_autofree gchar *path = NULL;
+			const gchar *uuid = (const gchar*) key;
 
-			if (error_local != NULL)
-				goto out;
-			if (g_file_info_get_is_hidden (s_finfo))
-				continue;
+			i = 0;
+			while (i < priv->rts->len) {
+				LiRuntime *rt = LI_RUNTIME (g_ptr_array_index (priv->rts, i));
 
-			cpath = g_build_filename (mpath,
-						g_file_info_get_name (s_finfo),
-						"control",
-						NULL);
-
-			if (g_file_test (cpath, G_FILE_TEST_IS_REGULAR)) {
-				g_autoptr(GFile) ctlfile = NULL;
-				ctlfile = g_file_new_for_path (cpath);
-				if (g_file_query_exists (ctlfile, NULL)) {
-					LiPkgInfo *pki;
-
-					/* create new LiPkgInfo for an installed package */
-					pki = li_pkg_info_new ();
-
-					li_pkg_info_load_file (pki, ctlfile, &error_local);
-					if (error_local != NULL) {
-						g_object_unref (pki);
-						goto out;
-					}
-
-					/* do not list as installed if the software is faded */
-					if (!li_pkg_info_has_flag (pki, LI_PACKAGE_FLAG_FADED)) {
-						li_pkg_info_add_flag (pki, LI_PACKAGE_FLAG_INSTALLED);
-					}
-
-					g_hash_table_insert (pkgs,
-								g_strdup (li_pkg_info_get_id (pki)),
-								pki);
-				}
+				if (g_strcmp0 (li_runtime_get_uuid (rt), uuid) == 0)
+					g_ptr_array_remove_index (priv->rts, i);
+				else
+					i++;
 			}
-		}
-	}
 
-out:
-	if (error_local != NULL) {
-		g_propagate_prefixed_error (error,
-					error_local,
-					"Error while searching for installed software:");
-		if (pkgs != NULL)
-			g_hash_table_unref (pkgs);
-		return NULL;
+			path = g_build_filename (LI_SOFTWARE_ROOT, "runtimes", uuid, NULL);
+			if (g_file_test (path, G_FILE_TEST_IS_REGULAR)) {
+				g_autoptr(LiRuntime) rt = NULL;
+
+				rt = li_runtime_new ();
+				if (li_runtime_load_from_file (rt, path, NULL))
+					g_ptr_array_add (priv->rts, g_object_ref (rt));
+			}
+			g_debug ("Runtime '%s' changed, reloaded it.", uuid);
+		}
+		priv->rts_index_valid = FALSE;
 	}
 
-	return pkgs;
+	/* whether an installed package can be updated depends on all of the above */
+	li_manager_clear_updates_table (mgr);
 }
 
 /**
@@ -373,42 +455,63 @@ out:
 static void
 li_manager_update_software_table (LiManager *mgr, GError **error)
 {
-	g_autoptr(LiPkgCache) cache = NULL;
-	GPtrArray *apkgs;
-	GHashTable *ipkgs;
+	GHashTableIter iter;
+	gpointer key, value;
 	guint i;
 	GError *error_local = NULL;
 	LiManagerPrivate *priv = GET_PRIVATE (mgr);
 
-	if (g_hash_table_size (priv->pkgs) > 0) {
+	li_manager_apply_pending_changes (mgr);
+	if (!priv->installed_dirty && !priv->available_dirty) {
 		/* we have cached data, so no need to search for it again */
 		return;
 	}
 
-	cache = li_pkg_cache_new ();
+	if (priv->available_dirty) {
+		g_autoptr(LiPkgCache) cache = NULL;
 
-	li_pkg_cache_open (cache, &error_local);
-	if (error_local != NULL) {
-		g_propagate_error (error, error_local);
-		return;
+		cache = li_pkg_cache_new ();
+		li_pkg_cache_open (cache, &error_local);
+		if (error_local != NULL) {
+			g_propagate_error (error, error_local);
+			return;
+		}
+
+		if (priv->available != NULL)
+			g_ptr_array_unref (priv->available);
+		priv->available = g_ptr_array_ref (li_pkg_cache_get_packages (cache));
+		priv->available_dirty = FALSE;
 	}
 
-	/* populate table with installed packages */
-	ipkgs = li_manager_get_installed_software (mgr, &error_local);
-	if (error_local != NULL) {
-		g_propagate_error (error, error_local);
-		return;
+	if (priv->installed_dirty) {
+		GHashTable *ipkgs;
+
+		ipkgs = li_manager_get_installed_software (mgr, &error_local);
+		if (error_local != NULL) {
+			g_propagate_error (error, error_local);
+			return;
+		}
+
+		g_hash_table_unref (priv->installed);
+		if (ipkgs != NULL)
+			priv->installed = ipkgs;
+		else
+			priv->installed = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+		priv->installed_dirty = FALSE;
 	}
 
-	if (ipkgs != NULL) {
-		g_hash_table_unref (priv->pkgs);
-		priv->pkgs = ipkgs;
+	/* populate table with installed packages */
+	g_hash_table_remove_all (priv->pkgs);
+	g_hash_table_iter_init (&iter, priv->installed);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		g_hash_table_insert (priv->pkgs,
+					g_strdup ((const gchar*) key),
+					g_object_ref (LI_PKG_INFO (value)));
 	}
 
 	/* get available packages */
-	apkgs = li_pkg_cache_get_packages (cache);
-	for (i = 0; i < apkgs->len; i++) {
-		LiPkgInfo *pki = LI_PKG_INFO (g_ptr_array_index (apkgs, i));
+	for (i = 0; i < priv->available->len; i++) {
+		LiPkgInfo *pki = LI_PKG_INFO (g_ptr_array_index (priv->available, i));
 
 		/* add packages to the global list, if they are not already installed */
 		if (g_hash_table_lookup (priv->pkgs, li_pkg_info_get_id (pki)) == NULL) {
@@ -542,23 +645,82 @@ li_manager_get_installed_runtimes (LiManager *mgr)
 {
 	LiManagerPrivate *priv = GET_PRIVATE (mgr);
 
-	if (priv->rts->len == 0) {
-		/* in case no runtime was found or we never searched for it, we
-		 * do this again
-		 */
+	li_manager_apply_pending_changes (mgr);
+
+	/* in case no runtime was found or we never searched for it, we do this again.
+	 * If we monitor the filesystem, we know about new runtimes and an empty list is fine. */
+	if (!priv->rts_loaded || ((priv->rts->len == 0) && (priv->monitors->len == 0))) {
+		g_ptr_array_set_size (priv->rts, 0);
 		li_manager_find_installed_runtimes (mgr);
+		priv->rts_loaded = TRUE;
+		priv->rts_index_valid = FALSE;
 	}
 
 	return priv->rts;
 }
 
+/**
+ * li_manager_ensure_runtime_index:
+ *
+ * (Re)build the inverted member index of the installed runtimes,
+ * if it is not up to date.
+ */
+static void
+li_manager_ensure_runtime_index (LiManager *mgr)
+{
+	guint i;
+	LiManagerPrivate *priv = GET_PRIVATE (mgr);
+
+	/* ensure we have all installed runtimes cached */
+	li_manager_get_installed_runtimes (mgr);
+
+	if (priv->rts_index_valid)
+		return;
+
+	g_hash_table_remove_all (priv->rts_by_member);
+	g_hash_table_remove_all (priv->rts_by_fingerprint);
+
+	for (i = 0; i < priv->rts->len; i++) {
+		GHashTable *members;
+		GHashTableIter iter;
+		gpointer key;
+		LiRuntime *ert;
+		LiRuntime *rt = LI_RUNTIME (g_ptr_array_index (priv->rts, i));
+
+		/* if we have equivalent runtimes, the one with the lowest UUID is
+		 * the canonical one, so the choice does not depend on load order */
+		ert = g_hash_table_lookup (priv->rts_by_fingerprint, li_runtime_get_fingerprint (rt));
+		if ((ert == NULL) || (g_strcmp0 (li_runtime_get_uuid (rt), li_runtime_get_uuid (ert)) < 0))
+			g_hash_table_insert (priv->rts_by_fingerprint,
+					     g_strdup (li_runtime_get_fingerprint (rt)),
+					     g_object_ref (rt));
+
+		members = li_runtime_get_members (rt);
+
+		g_hash_table_iter_init (&iter, members);
+		while (g_hash_table_iter_next (&iter, &key, NULL)) {
+			GPtrArray *rts;
+
+			rts = g_hash_table_lookup (priv->rts_by_member, key);
+			if (rts == NULL) {
+				rts = g_ptr_array_new_with_free_func (g_object_unref);
+				g_hash_table_insert (priv->rts_by_member, g_strdup ((const gchar*) key), rts);
+			}
+			g_ptr_array_add (rts, g_object_ref (rt));
+		}
+	}
+
+	priv->rts_index_valid = TRUE;
+}
+
 /**
  * li_manager_find_runtime_with_members:
  * @mgr: An instance of #LiManager
  * @members: (element-type LiPkgInfo): Software components which should be present in the runtime
  *
  * Get an installed runtime which contains the specified members.
- * If none is available, %NULL is returned.
+ * A runtime with exactly these members is preferred, system dependencies
+ * are ignored. If none is available, %NULL is returned.
  * The resulting runtime needs to be unref'ed with g_object_unref()
  * if it is no longer needed.
  *
@@ -567,27 +729,60 @@ li_manager_get_installed_runtimes (LiManager *mgr)
 LiRuntime*
 li_manager_find_runtime_with_members (LiManager *mgr, GPtrArray *members)
 {
-	guint i, j;
+	guint i;
+	GHashTableIter iter;
+	gpointer key;
+	LiRuntime *rt;
+	GPtrArray *candidates = NULL;
+	g_autoptr(GHashTable) wanted = NULL;
+	g_autofree gchar *fingerprint = NULL;
 	LiManagerPrivate *priv = GET_PRIVATE (mgr);
 
-	/* ensure we have all installed runtimes cached */
-	li_manager_get_installed_runtimes (mgr);
+	li_manager_ensure_runtime_index (mgr);
 
-	/* NOTE: If we ever have more frameworks with more members, we might need a more efficient implementation here */
-	for (i = 0; i < priv->rts->len; i++) {
+	/* runtimes never contain system dependencies, so we don't look for them */
+	wanted = g_hash_table_new (g_str_hash, g_str_equal);
+	for (i = 0; i < members->len; i++) {
+		LiPkgInfo *pki = LI_PKG_INFO (g_ptr_array_index (members, i));
+		if (li_pkg_info_get_id (pki) == NULL)
+			continue;
+		if (g_str_has_prefix (li_pkg_info_get_name (pki), "foundation:"))
+			continue;
+		g_hash_table_add (wanted, (gpointer) li_pkg_info_get_id (pki));
+	}
+	if (g_hash_table_size (wanted) == 0)
+		return NULL;
+
+	/* fast path: a runtime with exactly the requested members */
+	fingerprint = li_runtime_compute_fingerprint (members);
+	rt = g_hash_table_lookup (priv->rts_by_fingerprint, fingerprint);
+	if (rt != NULL)
+		return g_object_ref (rt);
+
+	/* otherwise, test the runtimes containing the least common member for the remaining ones */
+	g_hash_table_iter_init (&iter, wanted);
+	while (g_hash_table_iter_next (&iter, &key, NULL)) {
+		GPtrArray *rts;
+
+		rts = g_hash_table_lookup (priv->rts_by_member, key);
+		if (rts == NULL)
+			return NULL;
+		if ((candidates == NULL) || (rts->len < candidates->len))
+			candidates = rts;
+	}
+
+	for (i = 0; i < candidates->len; i++) {
 		GHashTable *test_members;
-		gboolean ret = FALSE;
-		LiRuntime *rt = LI_RUNTIME (g_ptr_array_index (priv->rts, i));
+		gboolean ret = TRUE;
+		rt = LI_RUNTIME (g_ptr_array_index (candidates, i));
 
 		test_members = li_runtime_get_members (rt);
-		for (j = 0; j < members->len; j++) {
-			const gchar *pkid;
-			LiPkgInfo *pki = LI_PKG_INFO (g_ptr_array_index (members, j));
-			pkid = li_pkg_info_get_id (pki);
-
-			ret = g_hash_table_lookup (test_members, pkid) != NULL;
-			if (!ret)
+		g_hash_table_iter_init (&iter, wanted);
+		while (g_hash_table_iter_next (&iter, &key, NULL)) {
+			if (!g_hash_table_contains (test_members, key)) {
+				ret = FALSE;
 				break;
+			}
 		}
 
 		if (ret)
@@ -600,47 +795,45 @@ li_manager_find_runtime_with_members (LiManager *mgr, GPtrArray *members)
 /**
  * li_manager_find_runtimes_with_member:
  * @mgr: An instance of #LiManager
+ *
+ * Returns: (transfer full): Array of runtimes using @member, or %NULL
+ * if no runtime is using it. The array must not be modified.
  */
 static GPtrArray*
 li_manager_find_runtimes_with_member (LiManager *mgr, LiPkgInfo *member)
 {
-	guint i;
-	GPtrArray *res = NULL;
+	GPtrArray *rts;
 	LiManagerPrivate *priv = GET_PRIVATE (mgr);
 
-	/* ensure we have all installed runtimes cached */
-	li_manager_get_installed_runtimes (mgr);
-
-	/* NOTE: If we ever have more frameworks with more members, we might need a more efficient implementation here */
-	for (i = 0; i < priv->rts->len; i++) {
-		GHashTable *test_members;
-		gboolean ret = FALSE;
-		LiRuntime *rt = LI_RUNTIME (g_ptr_array_index (priv->rts, i));
+	li_manager_ensure_runtime_index (mgr);
 
-		test_members = li_runtime_get_members (rt);
-		ret = g_hash_table_lookup (test_members, li_pkg_info_get_id (member)) != NULL;
-		if (ret) {
-			if (res == NULL)
-				res = g_ptr_array_new_with_free_func (g_object_unref);
-			g_ptr_array_add (res, g_object_ref (rt));
-		}
-	}
+	rts = g_hash_table_lookup (priv->rts_by_member, li_pkg_info_get_id (member));
+	if (rts == NULL)
+		return NULL;
 
-	return res;
+	return g_ptr_array_ref (rts);
 }
 
 /**
- * li_manager_remove_exported_files:
+ * li_manager_get_owned_exports:
+ *
+ * Read the list of exported files of a package.
+ *
+ * Returns: (transfer full) (element-type utf8): The exported files
+ * which still exist and still belong to the package.
  */
-static void
-li_manager_remove_exported_files (GFile *file, GError **error)
+static GPtrArray*
+li_manager_get_owned_exports (GFile *file)
 {
 	gchar *line = NULL;
 	GFileInputStream* ir;
 	GDataInputStream* dis;
-	gint res;
+	GPtrArray *paths;
 
+	paths = g_ptr_array_new_with_free_func (g_free);
 	ir = g_file_read (file, NULL, NULL);
+	if (ir == NULL)
+		return paths;
 	dis = g_data_input_stream_new ((GInputStream*) ir);
 	g_object_unref (ir);
 
@@ -651,7 +844,9 @@ li_manager_remove_exported_files (GFile *file, GError **error)
 			break;
 		}
 
-		parts = g_strsplit (line, "\t", 2);
+		/* checksum, filename and optionally export method and source file */
+		parts = g_strsplit (line, "\t", 4);
+		g_free (line);
 		if (parts[1] == NULL)
 			continue;
 
@@ -659,20 +854,51 @@ li_manager_remove_exported_files (GFile *file, GError **error)
 			/* don't fail if file is already gone */
 			if (!g_file_test (parts[1], G_FILE_TEST_EXISTS))
 				continue;
-			/* delete file */
-			res = g_remove (parts[1]);
-			if (res != 0) {
-				g_set_error (error,
-					LI_MANAGER_ERROR,
-					LI_MANAGER_ERROR_REMOVE_FAILED,
-					_("Could not delete file '%s'"), parts[1]);
-				goto out;
+
+			/* a hardlink which doesn't point to our file anymore was replaced
+			 * by someone else, so it isn't ours to delete */
+			if ((g_strcmp0 (parts[2], "hardlink") == 0) && (parts[3] != NULL)) {
+				struct stat dest_sb;
+				struct stat src_sb;
+
+				if ((stat (parts[1], &dest_sb) == 0) && (stat (parts[3], &src_sb) == 0) &&
+				    ((dest_sb.st_ino != src_sb.st_ino) || (dest_sb.st_dev != src_sb.st_dev))) {
+					g_debug ("Not removing '%s', it was replaced.", parts[1]);
+					continue;
+				}
 			}
+
+			g_ptr_array_add (paths, g_strdup (parts[1]));
 		}
 	}
 
-out:
 	g_object_unref (dis);
+	return paths;
+}
+
+/**
+ * li_manager_remove_exported_files:
+ */
+static void
+li_manager_remove_exported_files (GFile *file, GError **error)
+{
+	guint i;
+	g_autoptr(GPtrArray) paths = NULL;
+
+	paths = li_manager_get_owned_exports (file);
+	for (i = 0; i < paths->len; i++) {
+		const gchar *path = (const gchar*) g_ptr_array_index (paths, i);
+
+		/* delete file */
+		if (g_remove (path) != 0) {
+			g_set_error (error,
+				LI_MANAGER_ERROR,
+				LI_MANAGER_ERROR_REMOVE_FAILED,
+				_("Could not delete file '%s'"), path);
+			return;
+		}
+		li_exporter_transaction_add_path (path);
+	}
 }
 
 /**
@@ -702,8 +928,9 @@ li_manager_remove_software (LiManager *mgr, const gchar *pkgid, GError **error)
 			goto out;
 		}
 
-		li_proxy_manager_call_remove_sync (bus_proxy,
+		li_proxy_manager_call_queue_remove_sync (bus_proxy,
 						pkgid,
+						&priv->proxy_job_id,
 						NULL,
 						&error_local);
 		if (error_local != NULL) {
@@ -794,7 +1021,9 @@ li_manager_remove_software (LiManager *mgr, const gchar *pkgid, GError **error)
 	expfile = g_file_new_for_path (tmp);
 	g_free (tmp);
 	if (g_file_query_exists (expfile, NULL)) {
+		li_exporter_transaction_begin ();
 		li_manager_remove_exported_files (expfile, &error_local);
+		li_exporter_transaction_commit ();
 	}
 	g_object_unref (expfile);
 	if (error_local != NULL) {
@@ -813,6 +1042,9 @@ li_manager_remove_software (LiManager *mgr, const gchar *pkgid, GError **error)
 
 	g_debug ("Removed package: %s", pkgid);
 
+	/* keep the installed-software database in sync */
+	li_installed_db_commit_removal (pkgid);
+
 	/* we need to recreate the caches, now that the installed software has changed */
 	li_manager_reset_cached_data (mgr);
 
@@ -933,68 +1165,316 @@ out:
 }
 
 /**
- * li_manager_cleanup:
+ * li_manager_runtime_satisfies_software:
  *
- * Remove unnecessary software.
- * Limba automatically determines whether software is still needed.
- * Only software which has been explicitly installed is kept, anything
- * else will be automatically cleaned as soon as nothing needs it anymore.
- * The cleanup routine will remove faded bundles, so it is recommended to
- * runt it when to Limba-installed app is still in use.
- * By default, cleanup happens when the system is shutting down.
+ * Check that the members of @rt satisfy all dependencies of @pki
+ * on packages which are part of the runtime.
  */
-gboolean
-li_manager_cleanup (LiManager *mgr, GError **error)
+static gboolean
+li_manager_runtime_satisfies_software (LiRuntime *rt, LiPkgInfo *pki)
 {
-	g_autoptr(GHashTable) sws = NULL;
-	g_autoptr(GHashTable) remove_rts = NULL;
-	g_autoptr(GPtrArray) active_rts = NULL;
-	g_autoptr(GList) sw_list = NULL;
-	g_autoptr(GList) list = NULL;
-	g_autoptr(LiPackageGraph) pg = NULL;
-	g_autoptr(GPtrArray) removal_candidates = NULL;
-	GPtrArray *all_rts_array;
 	guint i;
-	GList *l;
-	GError *error_local = NULL;
-	gboolean faded_sw_removed = FALSE;
-	gboolean ret = FALSE;
+	g_autoptr(GPtrArray) deps = NULL;
+	g_auto(GStrv) member_ids = NULL;
+	g_autoptr(GPtrArray) members = NULL;
 
-	/* cleanup software directory */
-	li_manager_cleanup_broken_packages (mgr, &error_local);
-	if (error_local != NULL) {
-		g_propagate_error (error, error_local);
-		goto out;
-	}
+	deps = li_parse_dependencies_string (li_pkg_info_get_dependencies (pki));
+	if (deps == NULL)
+		return TRUE;
 
-	/* load software list */
-	sws = li_manager_get_installed_software (mgr, &error_local);
-	if (error_local != NULL) {
-		g_propagate_error (error, error_local);
-		return FALSE;
+	members = g_ptr_array_new_with_free_func (g_object_unref);
+	member_ids = li_runtime_dup_member_ids (rt);
+	for (i = 0; member_ids[i] != NULL; i++) {
+		g_auto(GStrv) parts = NULL;
+		LiPkgInfo *mpki;
+
+		parts = g_strsplit (member_ids[i], "/", 2);
+		if (g_strv_length (parts) != 2)
+			continue;
+		mpki = li_pkg_info_new ();
+		li_pkg_info_set_name (mpki, parts[0]);
+		li_pkg_info_set_version (mpki, parts[1]);
+		g_ptr_array_add (members, mpki);
 	}
-	sw_list = g_hash_table_get_values (sws);
 
-	/* first, always remove software which has the "faded" flag */
-	for (l = sw_list; l != NULL; l = l->next) {
-		LiPkgInfo *pki = LI_PKG_INFO (l->data);
+	for (i = 0; i < deps->len; i++) {
+		guint j;
+		gboolean found = FALSE;
+		gboolean satisfied = FALSE;
+		LiPkgInfo *dep = LI_PKG_INFO (g_ptr_array_index (deps, i));
 
-		if (li_pkg_info_has_flag (pki, LI_PACKAGE_FLAG_FADED)) {
-			g_debug ("Found faded package: %s", li_pkg_info_get_id (pki));
-			li_manager_remove_software (mgr, li_pkg_info_get_id (pki), &error_local);
-			if (error_local != NULL) {
-				g_propagate_error (error, error_local);
-				goto out;
+		/* dependencies which are not part of the runtime (system components,
+		 * embedded copies) are not affected by switching the runtime */
+		for (j = 0; j < members->len; j++) {
+			LiPkgInfo *mpki = LI_PKG_INFO (g_ptr_array_index (members, j));
+
+			if (g_strcmp0 (li_pkg_info_get_name (mpki), li_pkg_info_get_name (dep)) != 0)
+				continue;
+			found = TRUE;
+			if (li_pkg_info_satisfies_requirement (mpki, dep)) {
+				satisfied = TRUE;
+				break;
 			}
-			faded_sw_removed = TRUE;
-			continue;
 		}
-	}
 
-	/* update cache in case we removed software */
-	if (faded_sw_removed) {
-		/* installed software might have changed */
-		li_manager_reset_cached_data (mgr);
+		if (found && !satisfied)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * li_manager_merge_equivalent_runtimes:
+ * @sw_list: (element-type LiPkgInfo): Installed software
+ *
+ * Runtimes can end up with identical members after package upgrades,
+ * even if they were created for different requirements.
+ * Make all software use the canonical runtime of each member set, so
+ * the duplicates become unused and are dropped by the cleanup.
+ * Software is only moved if the canonical runtime satisfies its
+ * dependencies, and its launch descriptor and linker cache are
+ * regenerated for the new runtime right away.
+ */
+static gboolean
+li_manager_merge_equivalent_runtimes (LiManager *mgr, GList *sw_list, GError **error)
+{
+	guint i;
+	GList *l;
+	g_autoptr(GHashTable) rts_by_uuid = NULL;
+	GError *error_local = NULL;
+	LiManagerPrivate *priv = GET_PRIVATE (mgr);
+
+	li_manager_ensure_runtime_index (mgr);
+
+	rts_by_uuid = g_hash_table_new (g_str_hash, g_str_equal);
+	for (i = 0; i < priv->rts->len; i++) {
+		LiRuntime *rt = LI_RUNTIME (g_ptr_array_index (priv->rts, i));
+		g_hash_table_insert (rts_by_uuid, (gpointer) li_runtime_get_uuid (rt), rt);
+	}
+
+	for (l = sw_list; l != NULL; l = l->next) {
+		const gchar *rt_uuid;
+		LiRuntime *rt;
+		LiRuntime *crt;
+		LiPkgInfo *pki = LI_PKG_INFO (l->data);
+
+		rt_uuid = li_pkg_info_get_runtime_dependency (pki);
+		if (rt_uuid == NULL)
+			continue;
+
+		rt = g_hash_table_lookup (rts_by_uuid, rt_uuid);
+		if (rt == NULL)
+			continue;
+
+		crt = g_hash_table_lookup (priv->rts_by_fingerprint, li_runtime_get_fingerprint (rt));
+		if ((crt == NULL) || (crt == rt))
+			continue;
+
+		if (!li_manager_runtime_satisfies_software (crt, pki)) {
+			g_debug ("Not moving %s to runtime %s, it does not satisfy its dependencies.",
+				 li_pkg_info_get_id (pki), li_runtime_get_uuid (crt));
+			continue;
+		}
+
+		g_debug ("Moving %s from runtime %s to equivalent runtime %s.",
+			 li_pkg_info_get_id (pki), rt_uuid, li_runtime_get_uuid (crt));
+		li_pkg_info_set_runtime_dependency (pki, li_runtime_get_uuid (crt));
+		if (!li_pkg_info_save_changes (pki)) {
+			g_set_error (error,
+				LI_MANAGER_ERROR,
+				LI_MANAGER_ERROR_FAILED,
+				_("Unable to switch '%s' to a shared runtime."), li_pkg_info_get_id (pki));
+			return FALSE;
+		}
+
+		/* the launch descriptor and the linker cache list the layers of the old runtime,
+		 * which is about to be removed, so they must not survive a failed rewrite */
+		if (!li_launch_desc_write (pki, &error_local)) {
+			g_warning ("Unable to write launch descriptor for '%s': %s", li_pkg_info_get_id (pki), error_local->message);
+			g_clear_error (&error_local);
+			li_launch_desc_remove (pki);
+		}
+	}
+
+	return TRUE;
+}
+
+/**
+ * li_manager_cleanup_flat_runtimes:
+ * @active_rts: (element-type LiRuntime): The runtimes which are still in use
+ *
+ * Build missing flattened runtime trees and remove the ones which
+ * are not used anymore. Trees which are still mounted by an application
+ * or a cached environment are kept until a later cleanup.
+ */
+static void
+li_manager_cleanup_flat_runtimes (LiManager *mgr, GPtrArray *active_rts)
+{
+	guint i;
+	GDir *dir;
+	gint lock_fd;
+	const gchar *name;
+	g_autofree gchar *flat_root = NULL;
+	g_autoptr(GHashTable) keep = NULL;
+	GError *error_local = NULL;
+
+	keep = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	for (i = 0; i < active_rts->len; i++) {
+		g_autofree gchar *flat_dir = NULL;
+		LiRuntime *rt = LI_RUNTIME (g_ptr_array_index (active_rts, i));
+
+		if (!li_runtime_flatten (rt, &error_local)) {
+			g_warning ("Unable to flatten runtime '%s': %s", li_runtime_get_uuid (rt), error_local->message);
+			g_clear_error (&error_local);
+		}
+
+		flat_dir = li_runtime_get_flat_path (rt);
+		g_hash_table_add (keep, g_path_get_basename (flat_dir));
+		if (flat_root == NULL)
+			flat_root = g_path_get_dirname (flat_dir);
+	}
+
+	if (flat_root == NULL)
+		flat_root = g_build_filename (LI_SOFTWARE_ROOT, "runtimes", ".flat", NULL);
+	dir = g_dir_open (flat_root, 0, NULL);
+	if (dir == NULL)
+		return;
+
+	/* another process might be building a tree right now, which we don't know
+	 * about, so we only remove anything if nobody else is building one */
+	lock_fd = li_runtime_lock_flat_root (TRUE);
+	if (lock_fd < 0) {
+		g_debug ("Not removing unused flattened runtimes: The runtime cache is in use.");
+		g_dir_close (dir);
+		return;
+	}
+
+	/* this also removes leftovers of interrupted builds */
+	while ((name = g_dir_read_name (dir)) != NULL) {
+		g_autofree gchar *path = NULL;
+
+		if (g_hash_table_contains (keep, name))
+			continue;
+		if (g_strcmp0 (name, ".lock") == 0)
+			continue;
+
+		path = g_build_filename (flat_root, name, NULL);
+		if (!g_file_test (path, G_FILE_TEST_IS_DIR)) {
+			g_remove (path);
+			continue;
+		}
+
+		/* temporary directories are never leased */
+		if (strstr (name, ".tmp-") != NULL) {
+			li_delete_dir_recursive (path);
+			continue;
+		}
+
+		if (li_runtime_remove_flat_tree (path))
+			g_debug ("Removed unused flattened runtime: %s", name);
+		else
+			g_debug ("Keeping unused flattened runtime '%s', it is still in use.", name);
+	}
+	g_dir_close (dir);
+
+	close (lock_fd);
+}
+
+/**
+ * li_manager_refresh_ld_caches:
+ *
+ * Rebuild the linker caches of installed applications which were
+ * generated before the system's linker cache changed, as runapp
+ * ignores them.
+ */
+static void
+li_manager_refresh_ld_caches (LiManager *mgr)
+{
+	GHashTableIter iter;
+	gpointer value;
+	g_autoptr(GHashTable) sws = NULL;
+	GError *error_local = NULL;
+
+	sws = li_manager_get_installed_software (mgr, &error_local);
+	if (error_local != NULL) {
+		g_warning ("Unable to refresh linker caches: %s", error_local->message);
+		g_error_free (error_local);
+		return;
+	}
+	if (sws == NULL)
+		return;
+
+	g_hash_table_iter_init (&iter, sws);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		LiPkgInfo *pki = LI_PKG_INFO (value);
+
+		if (!li_launch_desc_ld_cache_is_outdated (pki))
+			continue;
+
+		g_debug ("Rebuilding outdated linker cache of %s", li_pkg_info_get_id (pki));
+		if (!li_launch_desc_write (pki, &error_local)) {
+			g_warning ("Unable to write launch descriptor for '%s': %s", li_pkg_info_get_id (pki), error_local->message);
+			g_clear_error (&error_local);
+		}
+	}
+}
+
+/**
+ * li_manager_cleanup_internal:
+ */
+static gboolean
+li_manager_cleanup_internal (LiManager *mgr, GError **error)
+{
+	g_autoptr(GHashTable) sws = NULL;
+	g_autoptr(GHashTable) remove_rts = NULL;
+	g_autoptr(GPtrArray) active_rts = NULL;
+	g_autoptr(GList) sw_list = NULL;
+	g_autoptr(GList) list = NULL;
+	g_autoptr(LiPackageGraph) pg = NULL;
+	g_autoptr(GPtrArray) removal_candidates = NULL;
+	GPtrArray *all_rts_array;
+	guint i;
+	GList *l;
+	GError *error_local = NULL;
+	gboolean faded_sw_removed = FALSE;
+	gboolean ret = FALSE;
+
+	/* cleanup software directory */
+	li_manager_cleanup_broken_packages (mgr, &error_local);
+	if (error_local != NULL) {
+		g_propagate_error (error, error_local);
+		goto out;
+	}
+
+	/* load software list */
+	sws = li_manager_get_installed_software (mgr, &error_local);
+	if (error_local != NULL) {
+		g_propagate_error (error, error_local);
+		return FALSE;
+	}
+	sw_list = g_hash_table_get_values (sws);
+
+	/* first, always remove software which has the "faded" flag */
+	for (l = sw_list; l != NULL; l = l->next) {
+		LiPkgInfo *pki = LI_PKG_INFO (l->data);
+
+		if (li_pkg_info_has_flag (pki, LI_PACKAGE_FLAG_FADED)) {
+			g_debug ("Found faded package: %s", li_pkg_info_get_id (pki));
+			li_manager_remove_software (mgr, li_pkg_info_get_id (pki), &error_local);
+			if (error_local != NULL) {
+				g_propagate_error (error, error_local);
+				goto out;
+			}
+			faded_sw_removed = TRUE;
+			continue;
+		}
+	}
+
+	/* update cache in case we removed software */
+	if (faded_sw_removed) {
+		/* installed software might have changed */
+		li_manager_reset_cached_data (mgr);
 
 		g_hash_table_unref (sws);
 		sws = li_manager_get_installed_software (mgr, &error_local);
@@ -1020,6 +1500,13 @@ li_manager_cleanup (LiManager *mgr, GError **error)
 		goto out;
 	}
 
+	/* make software share runtimes which have become identical */
+	li_manager_merge_equivalent_runtimes (mgr, sw_list, &error_local);
+	if (error_local != NULL) {
+		g_propagate_error (error, error_local);
+		goto out;
+	}
+
 	/* load runtime list */
 	all_rts_array = li_manager_get_installed_runtimes (mgr);
 	remove_rts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
@@ -1103,6 +1590,12 @@ li_manager_cleanup (LiManager *mgr, GError **error)
 		}
 	}
 
+	/* make sure the remaining runtimes have a flattened tree, and drop stale ones */
+	li_manager_cleanup_flat_runtimes (mgr, active_rts);
+
+	/* the system's libraries might have changed since the linker caches were built */
+	li_manager_refresh_ld_caches (mgr);
+
 	/* cleanup tmp dir */
 	li_delete_dir_recursive ("/var/tmp/limba");
 
@@ -1120,6 +1613,30 @@ out:
 	return ret;
 }
 
+/**
+ * li_manager_cleanup:
+ *
+ * Remove unnecessary software.
+ * Limba automatically determines whether software is still needed.
+ * Only software which has been explicitly installed is kept, anything
+ * else will be automatically cleaned as soon as nothing needs it anymore.
+ * The cleanup routine will remove faded bundles, so it is recommended to
+ * runt it when to Limba-installed app is still in use.
+ * By default, cleanup happens when the system is shutting down.
+ */
+gboolean
+li_manager_cleanup (LiManager *mgr, GError **error)
+{
+	gboolean ret;
+
+	/* run the desktop integration triggers only once for all removals */
+	li_exporter_transaction_begin ();
+	ret = li_manager_cleanup_internal (mgr, error);
+	li_exporter_transaction_commit ();
+
+	return ret;
+}
+
 /**
  * li_manager_refresh_cache:
  * @mgr: An instance of #LiManager
@@ -1137,7 +1654,7 @@ li_manager_refresh_cache (LiManager *mgr, GError **error)
 	if (!li_utils_is_root ()) {
 		LiProxyManager *bus_proxy;
 		/* we do not have root privileges - call the helper daemon to install the package */
-		g_debug ("Calling Limba DBus service for RefreshCache().");
+		g_debug ("Calling Limba DBus service for QueueRefreshCache().");
 
 		bus_proxy = li_manager_get_dbus_proxy (mgr, &error_local);
 		if (error_local != NULL) {
@@ -1145,7 +1662,7 @@ li_manager_refresh_cache (LiManager *mgr, GError **error)
 			return;
 		}
 
-		li_proxy_manager_call_refresh_cache_sync (bus_proxy, NULL, &error_local);
+		li_proxy_manager_call_queue_refresh_cache_sync (bus_proxy, &priv->proxy_job_id, NULL, &error_local);
 		if (error_local != NULL) {
 			g_propagate_error (error, error_local);
 			return;
@@ -1173,6 +1690,9 @@ li_manager_refresh_cache (LiManager *mgr, GError **error)
 		g_propagate_error (error, error_local);
 		return;
 	}
+
+	/* refreshing runs as root, so catch up with changes of the system's libraries as well */
+	li_manager_refresh_ld_caches (mgr);
 }
 
 /**
@@ -1233,6 +1753,8 @@ li_manager_clear_updates_table (LiManager *mgr)
 {
 	LiManagerPrivate *priv = GET_PRIVATE (mgr);
 
+	priv->updates_valid = FALSE;
+
 	/* clear table by recreating it, if necessary */
 	if (g_hash_table_size (priv->updates) == 0)
 		return;
@@ -1245,17 +1767,57 @@ li_manager_clear_updates_table (LiManager *mgr)
 }
 
 /**
- * li_manager_get_update_list:
- * @mgr: An instance of #LiManager
+ * li_manager_get_runtimes_for_upgrade:
+ * @ipki: An installed package
+ * @apki: The new version of @ipki
+ * @in_use: (out): Set to %TRUE if any runtime uses @ipki
  *
- * Get a list of available updates for the installed software.
+ * Returns: (transfer full): Runtimes using @ipki which can use @apki instead
+ */
+static GPtrArray*
+li_manager_get_runtimes_for_upgrade (LiManager *mgr, LiPkgInfo *ipki, LiPkgInfo *apki, gboolean *in_use)
+{
+	guint i;
+	g_autoptr(GPtrArray) rts = NULL;
+	GPtrArray *update_rts;
+
+	update_rts = g_ptr_array_new_with_free_func (g_object_unref);
+
+	rts = li_manager_find_runtimes_with_member (mgr, ipki);
+	*in_use = rts != NULL;
+	if (rts == NULL)
+		return update_rts;
+
+	for (i = 0; i < rts->len; i++) {
+		g_autofree gchar **reqs = NULL;
+		guint j;
+		LiRuntime *rt = LI_RUNTIME (g_ptr_array_index (rts, i));
+
+		reqs = (gchar**) g_hash_table_get_keys_as_array (li_runtime_get_requirements (rt), NULL);
+		for (j = 0; reqs[j] != NULL; j++) {
+			g_autoptr(LiPkgInfo) rt_req = NULL;
+			rt_req = li_parse_dependency_string (reqs[j]);
+
+			/* check if we can replace the package used by this runtime */
+			if (li_pkg_info_satisfies_requirement (apki, rt_req)) {
+				g_ptr_array_add (update_rts, g_object_ref (rt));
+				break;
+			}
+		}
+	}
+
+	return update_rts;
+}
+
+/**
+ * li_manager_find_updates:
+ * @cache: An opened #LiPkgCache
  *
- * Returns: (transfer full) (element-type LiUpdateItem): A list of #LiUpdateItem describing the potential updates. Free with g_list_free().
- **/
-GList*
-li_manager_get_update_list (LiManager *mgr, GError **error)
+ * Find updates for the installed software in @cache.
+ */
+static GList*
+li_manager_find_updates (LiManager *mgr, LiPkgCache *cache, GError **error)
 {
-	g_autoptr(LiPkgCache) cache = NULL;
 	g_autoptr(GHashTable) ipkgs = NULL;
 	g_autoptr(GHashTable) apkgs = NULL;
 	g_autoptr(GList) ipkg_list = NULL;
@@ -1265,8 +1827,6 @@ li_manager_get_update_list (LiManager *mgr, GError **error)
 	GError *error_local = NULL;
 	LiManagerPrivate *priv = GET_PRIVATE (mgr);
 
-	cache = li_pkg_cache_new ();
-
 	/* get a list of all packages we have installed */
 	ipkgs = li_manager_get_installed_software (mgr, &error_local);
 	if (error_local != NULL) {
@@ -1274,12 +1834,6 @@ li_manager_get_update_list (LiManager *mgr, GError **error)
 		return NULL;
 	}
 
-	li_pkg_cache_open (cache, &error_local);
-	if (error_local != NULL) {
-		g_propagate_error (error, error_local);
-		return NULL;
-	}
-
 	/* get available packages and prepare a hash map with the newest releases and the pkg name as key */
 	apkgs_list = li_pkg_cache_get_packages (cache);
 	apkgs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
@@ -1307,6 +1861,7 @@ li_manager_get_update_list (LiManager *mgr, GError **error)
 	ipkg_list = g_hash_table_get_values (ipkgs);
 	for (l = ipkg_list; l != NULL; l = l->next) {
 		g_autoptr(GPtrArray) rts = NULL;
+		gboolean in_use;
 		LiUpdateItem *uitem;
 		LiPkgInfo *ipki = LI_PKG_INFO (l->data);
 		LiPkgInfo *apki = NULL;
@@ -1326,34 +1881,9 @@ li_manager_get_update_list (LiManager *mgr, GError **error)
 			continue;
 
 		/* check if a runtime uses it and if we can upgrade the package. If that isn't possible, we don't list this upgrade */
-		rts = li_manager_find_runtimes_with_member (mgr, ipki);
-		if (rts != NULL) {
-			guint rts_allowing_upgrade = 0;
-			guint j;
-
-			for (j = 0; j < rts->len; j++) {
-				gchar **reqs;
-				guint k;
-				LiRuntime *rt = LI_RUNTIME (g_ptr_array_index (rts, j));
-
-				reqs = (gchar**) g_hash_table_get_keys_as_array (li_runtime_get_requirements (rt), NULL);
-				for (k = 0; reqs[k] != NULL; k++) {
-					LiPkgInfo *rt_req;
-					rt_req = li_parse_dependency_string (reqs[k]);
-
-					/* check if we can replace the package used by this runtime */
-					if (li_pkg_info_satisfies_requirement (apki, rt_req)) {
-						rts_allowing_upgrade++;
-						break;
-					}
-				}
-
-				g_free (reqs);
-			}
-			/* no runtime allows us to upgrad ethis package, so we don't list the upgrade */
-			if (rts_allowing_upgrade == 0)
-				continue;
-		}
+		rts = li_manager_get_runtimes_for_upgrade (mgr, ipki, apki, &in_use);
+		if (in_use && (rts->len == 0))
+			continue;
 
 		/* if we got this far, we have an update candidate */
 		uitem = li_update_item_new_with_packages (ipki, apki);
@@ -1361,10 +1891,42 @@ li_manager_get_update_list (LiManager *mgr, GError **error)
 					g_object_ref (ipki),
 					uitem);
 	}
+	priv->updates_valid = TRUE;
 
 	return g_hash_table_get_values (priv->updates);
 }
 
+/**
+ * li_manager_get_update_list:
+ * @mgr: An instance of #LiManager
+ *
+ * Get a list of available updates for the installed software.
+ * If the filesystem is monitored, the list is only searched again
+ * after the installed or available software or the runtimes changed.
+ *
+ * Returns: (transfer full) (element-type LiUpdateItem): A list of #LiUpdateItem describing the potential updates. Free with g_list_free().
+ **/
+GList*
+li_manager_get_update_list (LiManager *mgr, GError **error)
+{
+	g_autoptr(LiPkgCache) cache = NULL;
+	GError *error_local = NULL;
+	LiManagerPrivate *priv = GET_PRIVATE (mgr);
+
+	li_manager_apply_pending_changes (mgr);
+	if (priv->updates_valid && (priv->monitors->len > 0))
+		return g_hash_table_get_values (priv->updates);
+
+	cache = li_pkg_cache_new ();
+	li_pkg_cache_open (cache, &error_local);
+	if (error_local != NULL) {
+		g_propagate_error (error, error_local);
+		return NULL;
+	}
+
+	return li_manager_find_updates (mgr, cache, error);
+}
+
 /**
  * li_manager_remove_exported_files_by_pki:
  */
@@ -1401,18 +1963,62 @@ li_manager_remove_exported_files_by_pki (LiManager *mgr, LiPkgInfo *pki, GError
 }
 
 /**
- * li_manager_upgrade_single_package:
- *
- * Upgrade a single package to a more recent version.
+ * li_manager_installer_progress_cb:
  */
-static gboolean
-li_manager_upgrade_single_package (LiManager *mgr, LiPkgInfo *ipki, LiPkgInfo *apki, GError **error)
+static void
+li_manager_installer_progress_cb (LiInstaller *inst, guint percentage, const gchar *id, LiManager *mgr)
 {
-	g_autoptr(LiInstaller) inst = NULL;
+	/* just forward that stuff */
+	g_signal_emit (mgr, signals[SIGNAL_PROGRESS], 0,
+					percentage, id);
+}
+
+/**
+ * li_manager_installer_progress_details_cb:
+ */
+static void
+li_manager_installer_progress_details_cb (LiInstaller *inst, guint percentage, guint64 bytes_done, guint64 bytes_total, guint64 rate, guint eta, LiManager *mgr)
+{
+	g_signal_emit (mgr, signals[SIGNAL_PROGRESS_DETAILS], 0,
+					percentage,
+					bytes_done,
+					bytes_total,
+					rate,
+					eta);
+}
+
+/**
+ * li_manager_new_installer:
+ *
+ * Create an installer which reports its progress through @mgr.
+ */
+static LiInstaller*
+li_manager_new_installer (LiManager *mgr)
+{
+	LiInstaller *inst;
+
+	inst = li_installer_new ();
+	g_signal_connect (inst, "progress",
+				G_CALLBACK (li_manager_installer_progress_cb), mgr);
+	g_signal_connect (inst, "progress-details",
+				G_CALLBACK (li_manager_installer_progress_details_cb), mgr);
+
+	return inst;
+}
+
+/**
+ * li_manager_upgrade_single_package:
+ *
+ * Upgrade a single package to a more recent version.
+ */
+static gboolean
+li_manager_upgrade_single_package (LiManager *mgr, LiPkgInfo *ipki, LiPkgInfo *apki, GError **error)
+{
+	g_autoptr(LiInstaller) inst = NULL;
 	GError *error_local = NULL;
 
 	/* prepare installation */
-	inst = li_installer_new ();
+	inst = li_manager_new_installer (mgr);
 	li_installer_open_remote (inst, li_pkg_info_get_id (apki), &error_local);
 	if (error_local != NULL) {
 		g_propagate_error (error, error_local);
@@ -1435,6 +2041,44 @@ li_manager_upgrade_single_package (LiManager *mgr, LiPkgInfo *ipki, LiPkgInfo *a
 	return TRUE;
 }
 
+/**
+ * li_manager_refresh_launch_descriptors:
+ * @rt_uuids: Set of UUIDs of runtimes which have been changed
+ *
+ * Rewrite the launch descriptors of all installed software which uses
+ * one of the given runtimes.
+ */
+static void
+li_manager_refresh_launch_descriptors (LiManager *mgr, GHashTable *rt_uuids)
+{
+	guint i;
+	g_autoptr(GPtrArray) sw_list = NULL;
+	GError *error_local = NULL;
+
+	sw_list = li_manager_get_software_list (mgr, &error_local);
+	if (error_local != NULL) {
+		g_warning ("Unable to refresh launch descriptors: %s", error_local->message);
+		g_error_free (error_local);
+		return;
+	}
+
+	for (i = 0; i < sw_list->len; i++) {
+		const gchar *rt_uuid;
+		LiPkgInfo *pki = LI_PKG_INFO (g_ptr_array_index (sw_list, i));
+
+		if (!li_pkg_info_has_flag (pki, LI_PACKAGE_FLAG_INSTALLED))
+			continue;
+		rt_uuid = li_pkg_info_get_runtime_dependency (pki);
+		if ((rt_uuid == NULL) || (!g_hash_table_contains (rt_uuids, rt_uuid)))
+			continue;
+
+		if (!li_launch_desc_write (pki, &error_local)) {
+			g_warning ("Unable to write launch descriptor for '%s': %s", li_pkg_info_get_id (pki), error_local->message);
+			g_clear_error (&error_local);
+		}
+	}
+}
+
 /**
  * li_manager_update_internal:
  * @mgr: An instance of #LiManager
@@ -1450,15 +2094,17 @@ li_manager_update_internal (LiManager *mgr, LiUpdateItem *uitem, GError **error)
 {
 	LiPkgInfo *ipki;
 	LiPkgInfo *apki;
-	g_autoptr(GPtrArray) rts = NULL;
+	g_autoptr(GPtrArray) update_rts = NULL;
+	gboolean in_use;
 	GError *error_local = NULL;
+	LiManagerPrivate *priv = GET_PRIVATE (mgr);
 
 	g_assert (uitem != NULL);
 	ipki = li_update_item_get_installed_pkg (uitem);
 	apki = li_update_item_get_available_pkg (uitem);
 
-	rts = li_manager_find_runtimes_with_member (mgr, ipki);
-	if (rts == NULL) {
+	update_rts = li_manager_get_runtimes_for_upgrade (mgr, ipki, apki, &in_use);
+	if (!in_use) {
 		/* we have no runtime, it is safe to update in any case */
 
 		g_debug ("Performing straight-forward update of '%s'", li_pkg_info_get_id (ipki));
@@ -1478,31 +2124,10 @@ li_manager_update_internal (LiManager *mgr, LiUpdateItem *uitem, GError **error)
 
 	} else {
 		guint i;
-		g_autoptr(GPtrArray) update_rts = NULL;
+		g_autoptr(GHashTable) rt_uuids = NULL;
 
 		g_debug ("Performing complex upgrade of '%s'", li_pkg_info_get_id (ipki));
 
-		update_rts = g_ptr_array_new_with_free_func (g_object_unref);
-		for (i = 0; i < rts->len; i++) {
-			gchar **reqs;
-			guint j;
-			LiRuntime *rt = LI_RUNTIME (g_ptr_array_index (rts, i));
-
-			reqs = (gchar**) g_hash_table_get_keys_as_array (li_runtime_get_requirements (rt), NULL);
-			for (j = 0; reqs[j] != NULL; j++) {
-				LiPkgInfo *rt_req;
-				rt_req = li_parse_dependency_string (reqs[i]);
-
-				/* check if we can replace the package used by this runtime */
-				if (li_pkg_info_satisfies_requirement (apki, rt_req)) {
-					g_ptr_array_add (update_rts, g_object_ref (rt));
-					break;
-				}
-			}
-
-			g_free (reqs);
-		}
-
 		if (update_rts->len == 0) {
 			/* we can't upgrade, the new version would break runtimes */
 			g_debug ("Can not upgrade package '%s' as it would break all runtimes which are using it.", li_pkg_info_get_id (ipki));
@@ -1516,6 +2141,9 @@ li_manager_update_internal (LiManager *mgr, LiUpdateItem *uitem, GError **error)
 			return FALSE;
 		}
 
+		/* the members of our runtimes will change */
+		priv->rts_index_valid = FALSE;
+		rt_uuids = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 		for (i = 0; i < update_rts->len; i++) {
 			LiRuntime *rt = LI_RUNTIME (g_ptr_array_index (update_rts, i));
 
@@ -1527,8 +2155,12 @@ li_manager_update_internal (LiManager *mgr, LiUpdateItem *uitem, GError **error)
 				g_propagate_error (error, error_local);
 				return FALSE;
 			}
+			g_hash_table_add (rt_uuids, g_strdup (li_runtime_get_uuid (rt)));
 		}
 
+		/* applications using these runtimes need to mount different directories now */
+		li_manager_refresh_launch_descriptors (mgr, rt_uuids);
+
 		/* tell the system to remove old packages on reboot */
 		g_file_set_contents (LI_CLEANUP_HINT_FNAME, "please clean removed packages", -1, NULL);
 
@@ -1540,6 +2172,325 @@ li_manager_update_internal (LiManager *mgr, LiUpdateItem *uitem, GError **error)
 	return TRUE;
 }
 
+/**
+ * li_manager_get_stash_path:
+ *
+ * Returns: The name an exported file is kept under while it is stashed.
+ */
+static gchar*
+li_manager_get_stash_path (const gchar *path)
+{
+	g_autofree gchar *dirname = NULL;
+	g_autofree gchar *basename = NULL;
+	g_autofree gchar *stash_name = NULL;
+
+	dirname = g_path_get_dirname (path);
+	basename = g_path_get_basename (path);
+	stash_name = g_strdup_printf (".%s.limba-old", basename);
+
+	return g_build_filename (dirname, stash_name, NULL);
+}
+
+/**
+ * li_manager_stash_exported_files:
+ * @stash: (element-type utf8): Receives the paths of the stashed files
+ *
+ * Move the files exported by @pki out of the way, so a new version can
+ * export its own files, while we can still restore the old ones if
+ * the update fails.
+ */
+static gboolean
+li_manager_stash_exported_files (LiManager *mgr, LiPkgInfo *pki, GPtrArray *stash, GError **error)
+{
+	guint i;
+	g_autofree gchar *tmp = NULL;
+	g_autoptr(GFile) expfile = NULL;
+	g_autoptr(GPtrArray) paths = NULL;
+
+	tmp = g_build_filename (LI_SOFTWARE_ROOT, li_pkg_info_get_id (pki), "exported", NULL);
+	expfile = g_file_new_for_path (tmp);
+
+	paths = li_manager_get_owned_exports (expfile);
+	for (i = 0; i < paths->len; i++) {
+		g_autofree gchar *stash_path = NULL;
+		const gchar *path = (const gchar*) g_ptr_array_index (paths, i);
+
+		stash_path = li_manager_get_stash_path (path);
+		if (g_rename (path, stash_path) != 0) {
+			g_set_error (error,
+				LI_MANAGER_ERROR,
+				LI_MANAGER_ERROR_REMOVE_FAILED,
+				_("Could not move exported file '%s' out of the way: %s"), path, g_strerror (errno));
+			return FALSE;
+		}
+		g_ptr_array_add (stash, g_strdup (path));
+	}
+
+	return TRUE;
+}
+
+/**
+ * li_manager_restore_stashed_files:
+ *
+ * Move stashed exported files back into place, replacing anything
+ * which has been exported at their location in the meantime.
+ */
+static void
+li_manager_restore_stashed_files (GPtrArray *stash)
+{
+	guint i;
+
+	for (i = 0; i < stash->len; i++) {
+		g_autofree gchar *stash_path = NULL;
+		const gchar *path = (const gchar*) g_ptr_array_index (stash, i);
+
+		stash_path = li_manager_get_stash_path (path);
+		if (g_rename (stash_path, path) != 0)
+			g_warning ("Unable to restore exported file '%s': %s", path, g_strerror (errno));
+		li_exporter_transaction_add_path (path);
+	}
+}
+
+/**
+ * li_manager_drop_stashed_files:
+ */
+static void
+li_manager_drop_stashed_files (GPtrArray *stash)
+{
+	guint i;
+
+	for (i = 0; i < stash->len; i++) {
+		g_autofree gchar *stash_path = NULL;
+		const gchar *path = (const gchar*) g_ptr_array_index (stash, i);
+
+		stash_path = li_manager_get_stash_path (path);
+		g_remove (stash_path);
+		li_exporter_transaction_add_path (path);
+	}
+}
+
+/**
+ * li_manager_undo_install:
+ *
+ * Remove a package which was installed by a failed update,
+ * including the files it exported.
+ */
+static void
+li_manager_undo_install (LiManager *mgr, const gchar *pkid)
+{
+	g_autofree gchar *swpath = NULL;
+	g_autofree gchar *tmp = NULL;
+	g_autoptr(GFile) expfile = NULL;
+	GError *error_local = NULL;
+
+	swpath = g_build_filename (LI_SOFTWARE_ROOT, pkid, NULL);
+	if (!g_file_test (swpath, G_FILE_TEST_IS_DIR))
+		return;
+
+	tmp = g_build_filename (swpath, "exported", NULL);
+	expfile = g_file_new_for_path (tmp);
+	li_manager_remove_exported_files (expfile, &error_local);
+	if (error_local != NULL) {
+		g_warning ("Unable to remove files exported by '%s': %s", pkid, error_local->message);
+		g_clear_error (&error_local);
+	}
+
+	if (!li_delete_dir_recursive (swpath))
+		g_warning ("Unable to remove '%s'.", swpath);
+	li_installed_db_commit_removal (pkid);
+}
+
+/**
+ * li_manager_update_batch:
+ * @cache: The opened #LiPkgCache the updates were found in
+ * @updlist: (element-type LiUpdateItem): The updates to apply
+ *
+ * Apply multiple updates in one transaction: The dependencies of all updates
+ * are resolved together and all packages are downloaded before the installation
+ * is changed, and every affected runtime is only written once.
+ * If installing an update or writing a runtime fails, every package the
+ * transaction installed (new versions as well as new dependencies) is removed,
+ * and the runtimes and exported files of the old versions are restored.
+ *
+ * INTERNAL HELPER
+ */
+static gboolean
+li_manager_update_batch (LiManager *mgr, LiPkgCache *cache, GList *updlist, GError **error)
+{
+	guint i;
+	GList *l;
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+	g_autoptr(GPtrArray) updates = NULL;
+	g_autoptr(GPtrArray) unused_pkgs = NULL;
+	g_autoptr(GHashTable) rt_changes = NULL;
+	g_autoptr(GHashTable) rt_uuids = NULL;
+	g_autoptr(GPtrArray) stash = NULL;
+	g_autoptr(GPtrArray) new_pkids = NULL;
+	g_autoptr(GPtrArray) changed_rts = NULL;
+	g_autoptr(LiInstaller) inst = NULL;
+	GError *error_local = NULL;
+	LiManagerPrivate *priv = GET_PRIVATE (mgr);
+
+	/* find out which runtimes need to change, and drop updates which would break all of their runtimes */
+	updates = g_ptr_array_new_with_free_func (g_object_unref);
+	unused_pkgs = g_ptr_array_new_with_free_func (g_object_unref);
+	rt_changes = g_hash_table_new_full (g_direct_hash, g_direct_equal, g_object_unref, (GDestroyNotify) g_ptr_array_unref);
+	for (l = updlist; l != NULL; l = l->next) {
+		g_autoptr(GPtrArray) update_rts = NULL;
+		gboolean in_use;
+		LiPkgInfo *ipki;
+		LiUpdateItem *uitem = LI_UPDATE_ITEM (l->data);
+
+		ipki = li_update_item_get_installed_pkg (uitem);
+		update_rts = li_manager_get_runtimes_for_upgrade (mgr,
+								  ipki,
+								  li_update_item_get_available_pkg (uitem),
+								  &in_use);
+		if (in_use && (update_rts->len == 0)) {
+			g_debug ("Can not upgrade package '%s' as it would break all runtimes which are using it.", li_pkg_info_get_id (ipki));
+			continue;
+		}
+
+		g_ptr_array_add (updates, g_object_ref (uitem));
+		if (!in_use)
+			g_ptr_array_add (unused_pkgs, g_object_ref (ipki));
+
+		for (i = 0; i < update_rts->len; i++) {
+			GPtrArray *rt_updates;
+			LiRuntime *rt = LI_RUNTIME (g_ptr_array_index (update_rts, i));
+
+			rt_updates = g_hash_table_lookup (rt_changes, rt);
+			if (rt_updates == NULL) {
+				rt_updates = g_ptr_array_new_with_free_func (g_object_unref);
+				g_hash_table_insert (rt_changes, g_object_ref (rt), rt_updates);
+			}
+			g_ptr_array_add (rt_updates, g_object_ref (uitem));
+		}
+	}
+
+	if (updates->len == 0)
+		return TRUE;
+
+	/* resolve dependencies and download everything before touching the installation */
+	inst = li_manager_new_installer (mgr);
+	li_installer_prepare_updates (inst, cache, updates, &error_local);
+	if (error_local != NULL) {
+		g_propagate_error (error, error_local);
+		return FALSE;
+	}
+
+	/* move the files exported by the old versions aside, so we can go back if anything fails */
+	stash = g_ptr_array_new_with_free_func (g_free);
+	for (i = 0; i < updates->len; i++) {
+		LiUpdateItem *uitem = LI_UPDATE_ITEM (g_ptr_array_index (updates, i));
+
+		li_manager_stash_exported_files (mgr, li_update_item_get_installed_pkg (uitem), stash, &error_local);
+		if (error_local != NULL)
+			goto rollback;
+	}
+
+	/* the installer tells us about everything it installs, new dependencies included */
+	new_pkids = g_ptr_array_new_with_free_func (g_free);
+	li_installer_apply_updates (inst, new_pkids, &error_local);
+	if (error_local != NULL)
+		goto rollback;
+
+	/* apply all changes to a runtime before writing it */
+	priv->rts_index_valid = FALSE;
+	changed_rts = g_ptr_array_new ();
+	rt_uuids = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	g_hash_table_iter_init (&iter, rt_changes);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		LiRuntime *rt = LI_RUNTIME (key);
+		GPtrArray *rt_updates = (GPtrArray*) value;
+
+		g_debug ("Updating runtime '%s'", li_runtime_get_uuid (rt));
+		for (i = 0; i < rt_updates->len; i++) {
+			LiUpdateItem *uitem = LI_UPDATE_ITEM (g_ptr_array_index (rt_updates, i));
+			li_runtime_update_package (rt,
+						   li_update_item_get_installed_pkg (uitem),
+						   li_update_item_get_available_pkg (uitem));
+		}
+		g_ptr_array_add (changed_rts, rt);
+
+		li_runtime_save (rt, &error_local);
+		if (error_local != NULL)
+			goto rollback;
+		g_hash_table_add (rt_uuids, g_strdup (li_runtime_get_uuid (rt)));
+	}
+
+	/* everything is in place, so the old exports are gone for good, and the old
+	 * versions must not remove files of the new ones when they are cleaned up */
+	li_manager_drop_stashed_files (stash);
+	for (i = 0; i < updates->len; i++) {
+		g_autofree gchar *tmp = NULL;
+		LiUpdateItem *uitem = LI_UPDATE_ITEM (g_ptr_array_index (updates, i));
+
+		tmp = g_build_filename (LI_SOFTWARE_ROOT,
+					li_pkg_info_get_id (li_update_item_get_installed_pkg (uitem)),
+					"exported",
+					NULL);
+		g_remove (tmp);
+	}
+
+	/* applications using these runtimes need to mount different directories now */
+	li_manager_refresh_launch_descriptors (mgr, rt_uuids);
+
+	/* mark packages no runtime uses as faded, so they will get killed on the shutdown-cleanup run */
+	for (i = 0; i < unused_pkgs->len; i++) {
+		LiPkgInfo *ipki = LI_PKG_INFO (g_ptr_array_index (unused_pkgs, i));
+
+		li_pkg_info_add_flag (ipki, LI_PACKAGE_FLAG_FADED);
+		li_pkg_info_save_changes (ipki);
+	}
+
+	/* tell the system to remove old packages on reboot */
+	g_file_set_contents (LI_CLEANUP_HINT_FNAME, "please clean removed packages", -1, NULL);
+
+	return TRUE;
+
+rollback:
+	g_debug ("Update failed, rolling back.");
+
+	/* point the runtimes at the old versions again */
+	if (changed_rts != NULL) {
+		for (i = 0; i < changed_rts->len; i++) {
+			guint j;
+			GError *tmp_error = NULL;
+			LiRuntime *rt = LI_RUNTIME (g_ptr_array_index (changed_rts, i));
+			GPtrArray *rt_updates = g_hash_table_lookup (rt_changes, rt);
+
+			for (j = 0; j < rt_updates->len; j++) {
+				LiUpdateItem *uitem = LI_UPDATE_ITEM (g_ptr_array_index (rt_updates, j));
+				li_runtime_update_package (rt,
+							   li_update_item_get_available_pkg (uitem),
+							   li_update_item_get_installed_pkg (uitem));
+			}
+
+			li_runtime_save (rt, &tmp_error);
+			if (tmp_error != NULL) {
+				g_warning ("Unable to restore runtime '%s': %s", li_runtime_get_uuid (rt), tmp_error->message);
+				g_error_free (tmp_error);
+			}
+		}
+	}
+
+	/* remove everything we installed, then put the old exports back in their place */
+	if (new_pkids != NULL) {
+		for (i = 0; i < new_pkids->len; i++)
+			li_manager_undo_install (mgr, (const gchar*) g_ptr_array_index (new_pkids, i));
+	}
+	if (stash != NULL)
+		li_manager_restore_stashed_files (stash);
+
+	li_manager_reset_cached_data (mgr);
+	g_propagate_error (error, error_local);
+
+	return FALSE;
+}
+
 /**
  * li_manager_update:
  * @mgr: An instance of #LiManager
@@ -1550,6 +2501,7 @@ li_manager_update_internal (LiManager *mgr, LiUpdateItem *uitem, GError **error)
 gboolean
 li_manager_update (LiManager *mgr, LiUpdateItem *uitem, GError **error)
 {
+	gboolean ret;
 	GError *error_local = NULL;
 	LiPkgInfo *pki;
 	LiManagerPrivate *priv = GET_PRIVATE (mgr);
@@ -1567,8 +2519,9 @@ li_manager_update (LiManager *mgr, LiUpdateItem *uitem, GError **error)
 		}
 
 		pki = li_update_item_get_installed_pkg (uitem);
-		li_proxy_manager_call_update_sync (bus_proxy,
+		li_proxy_manager_call_queue_update_sync (bus_proxy,
 							li_pkg_info_get_id (pki),
+							&priv->proxy_job_id,
 							NULL,
 							&error_local);
 		if (error_local != NULL) {
@@ -1587,7 +2540,11 @@ li_manager_update (LiManager *mgr, LiUpdateItem *uitem, GError **error)
 		return TRUE;
 	}
 
-	return li_manager_update_internal (mgr, uitem, error);
+	li_exporter_transaction_begin ();
+	ret = li_manager_update_internal (mgr, uitem, error);
+	li_exporter_transaction_commit ();
+
+	return ret;
 }
 
 /**
@@ -1600,7 +2557,8 @@ gboolean
 li_manager_update_all (LiManager *mgr, GError **error)
 {
 	g_autoptr(GList) updlist = NULL;
-	GList *l;
+	g_autoptr(LiPkgCache) cache = NULL;
+	gboolean ret;
 	GError *error_local = NULL;
 	LiManagerPrivate *priv = GET_PRIVATE (mgr);
 
@@ -1616,7 +2574,8 @@ li_manager_update_all (LiManager *mgr, GError **error)
 			return FALSE;
 		}
 
-		li_proxy_manager_call_update_all_sync (bus_proxy,
+		li_proxy_manager_call_queue_update_all_sync (bus_proxy,
+							&priv->proxy_job_id,
 							NULL,
 							&error_local);
 		if (error_local != NULL) {
@@ -1635,9 +2594,17 @@ li_manager_update_all (LiManager *mgr, GError **error)
 		return TRUE;
 	}
 
+	/* use one snapshot of the package cache for the whole transaction */
+	cache = li_pkg_cache_new ();
+	li_pkg_cache_open (cache, &error_local);
+	if (error_local != NULL) {
+		g_propagate_error (error, error_local);
+		return FALSE;
+	}
+
 	/* only search for new updates if we don't have some already in the queue */
 	if (g_hash_table_size (priv->updates) == 0) {
-		updlist = li_manager_get_update_list (mgr, &error_local);
+		updlist = li_manager_find_updates (mgr, cache, &error_local);
 		if (error_local != NULL) {
 			g_propagate_error (error, error_local);
 			return FALSE;
@@ -1646,17 +2613,16 @@ li_manager_update_all (LiManager *mgr, GError **error)
 		updlist = g_hash_table_get_values (priv->updates);
 	}
 
-	for (l = updlist; l != NULL; l = l->next) {
-		LiUpdateItem *uitem = LI_UPDATE_ITEM (l->data);
+	/* run the desktop integration triggers only once for all updates */
+	li_exporter_transaction_begin ();
+	ret = li_manager_update_batch (mgr, cache, updlist, error);
+	li_exporter_transaction_commit ();
 
-		li_manager_update_internal (mgr, uitem, &error_local);
-		if (error_local != NULL) {
-			g_propagate_error (error, error_local);
-			return FALSE;
-		}
-	}
+	/* the installed software has changed, the queued updates are no longer valid */
+	li_manager_clear_updates_table (mgr);
+	li_manager_reset_cached_data (mgr);
 
-	return TRUE;
+	return ret;
 }
 
 /**
@@ -1701,6 +2667,198 @@ li_manager_get_update_for_id (LiManager *mgr, const gchar *pkid, GError **error)
 	return NULL;
 }
 
+/**
+ * li_manager_add_pending_changes:
+ *
+ * Remember changes reported by a filesystem monitor, and tell
+ * our users about them.
+ */
+static void
+li_manager_add_pending_changes (LiManager *mgr, LiManagerChanges changes, const gchar *rt_uuid)
+{
+	LiManagerPrivate *priv = GET_PRIVATE (mgr);
+
+	g_mutex_lock (&priv->pending_lock);
+	priv->pending_changes |= changes;
+	if (rt_uuid != NULL)
+		g_hash_table_add (priv->pending_rts, g_strdup (rt_uuid));
+	g_mutex_unlock (&priv->pending_lock);
+
+	g_signal_emit (mgr, signals[SIGNAL_CHANGED], 0, (guint) changes);
+}
+
+/**
+ * li_manager_monitor_event_relevant:
+ */
+static gboolean
+li_manager_monitor_event_relevant (GFileMonitorEvent event_type)
+{
+	switch (event_type) {
+		case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+		case G_FILE_MONITOR_EVENT_DELETED:
+		case G_FILE_MONITOR_EVENT_CREATED:
+		case G_FILE_MONITOR_EVENT_MOVED:
+			return TRUE;
+		default:
+			/* we wait for the CHANGES_DONE hint before reloading modified data */
+			return FALSE;
+	}
+}
+
+/**
+ * li_manager_software_changed_cb:
+ *
+ * Called when the software root or the installed-software
+ * database was modified.
+ */
+static void
+li_manager_software_changed_cb (GFileMonitor *monitor, GFile *file, GFile *other_file, GFileMonitorEvent event_type, LiManager *mgr)
+{
+	g_autofree gchar *basename = NULL;
+
+	if (!li_manager_monitor_event_relevant (event_type))
+		return;
+
+	basename = g_file_get_basename (file);
+	if (g_str_has_prefix (basename, "."))
+		return;
+	/* runtimes are monitored separately */
+	if (g_strcmp0 (basename, "runtimes") == 0)
+		return;
+	/* ignore temporary files created while the database is written */
+	if (g_str_has_prefix (basename, "installed.db."))
+		return;
+
+	g_debug ("Installed software changed, invalidating cache.");
+	li_manager_add_pending_changes (mgr, LI_MANAGER_CHANGE_INSTALLED, NULL);
+}
+
+/**
+ * li_manager_available_changed_cb:
+ *
+ * Called when the cache of available software was modified.
+ */
+static void
+li_manager_available_changed_cb (GFileMonitor *monitor, GFile *file, GFile *other_file, GFileMonitorEvent event_type, LiManager *mgr)
+{
+	if (!li_manager_monitor_event_relevant (event_type))
+		return;
+
+	g_debug ("Package cache changed, invalidating cache.");
+	li_manager_add_pending_changes (mgr, LI_MANAGER_CHANGE_AVAILABLE, NULL);
+}
+
+/**
+ * li_manager_runtimes_changed_cb:
+ *
+ * Called when a runtime was added, modified or removed.
+ * We only reload the affected runtime, on the next query.
+ */
+static void
+li_manager_runtimes_changed_cb (GFileMonitor *monitor, GFile *file, GFile *other_file, GFileMonitorEvent event_type, LiManager *mgr)
+{
+	g_autofree gchar *uuid = NULL;
+
+	if (!li_manager_monitor_event_relevant (event_type))
+		return;
+
+	uuid = g_file_get_basename (file);
+	if (g_str_has_prefix (uuid, "."))
+		return;
+
+	g_debug ("Runtime '%s' changed.", uuid);
+	li_manager_add_pending_changes (mgr, LI_MANAGER_CHANGE_RUNTIMES, uuid);
+}
+
+/**
+ * li_manager_add_monitor:
+ */
+static void
+li_manager_add_monitor (LiManager *mgr, const gchar *path, gboolean is_dir, GCallback callback)
+{
+	GFileMonitor *monitor;
+	g_autoptr(GFile) file = NULL;
+	GError *error_local = NULL;
+	LiManagerPrivate *priv = GET_PRIVATE (mgr);
+
+	file = g_file_new_for_path (path);
+	if (is_dir)
+		monitor = g_file_monitor_directory (file, G_FILE_MONITOR_NONE, NULL, &error_local);
+	else
+		monitor = g_file_monitor_file (file, G_FILE_MONITOR_NONE, NULL, &error_local);
+	if (error_local != NULL) {
+		g_warning ("Unable to monitor '%s' for changes: %s", path, error_local->message);
+		g_error_free (error_local);
+		return;
+	}
+
+	g_signal_connect (monitor, "changed", callback, mgr);
+	g_ptr_array_add (priv->monitors, monitor);
+}
+
+/**
+ * li_manager_set_monitor_changes:
+ * @mgr: An instance of #LiManager
+ * @monitor: %TRUE to monitor the filesystem for changes
+ *
+ * Monitor the software root, the installed runtimes and the package
+ * cache for changes, and only invalidate cached data if something changed.
+ * This allows long-running processes to keep a #LiManager around without
+ * serving stale data or rescanning the disk on every query.
+ *
+ * Change notifications are delivered via the thread-default main context
+ * of the thread which enabled monitoring. They only mark the affected data
+ * as outdated, it is reloaded by the next query. So while the manager is
+ * not thread-safe, one other thread at a time may query a monitored
+ * manager while notifications are being delivered.
+ */
+void
+li_manager_set_monitor_changes (LiManager *mgr, gboolean monitor)
+{
+	g_autofree gchar *runtime_root = NULL;
+	g_autofree gchar *cache_index_fname = NULL;
+	LiManagerPrivate *priv = GET_PRIVATE (mgr);
+
+	if (monitor == (priv->monitors->len > 0))
+		return;
+
+	if (!monitor) {
+		g_ptr_array_set_size (priv->monitors, 0);
+		return;
+	}
+
+	runtime_root = g_build_filename (LI_SOFTWARE_ROOT, "runtimes", NULL);
+	cache_index_fname = g_build_filename (LIMBA_CACHE_DIR, "available.index", NULL);
+
+	/* directory monitors are not recursive: the software root only tells us about
+	 * new or removed names, new versions and changed control files are noticed
+	 * through the installed-software database, which is rewritten on every change */
+	li_manager_add_monitor (mgr, LI_SOFTWARE_ROOT, TRUE,
+				G_CALLBACK (li_manager_software_changed_cb));
+	li_manager_add_monitor (mgr, LI_INSTALLED_DB_DIR, TRUE,
+				G_CALLBACK (li_manager_software_changed_cb));
+	li_manager_add_monitor (mgr, runtime_root, TRUE,
+				G_CALLBACK (li_manager_runtimes_changed_cb));
+	li_manager_add_monitor (mgr, cache_index_fname, FALSE,
+				G_CALLBACK (li_manager_available_changed_cb));
+
+	/* the data we have might already be stale */
+	li_manager_reset_cached_data (mgr);
+}
+
+/**
+ * li_manager_get_monitor_changes:
+ * @mgr: An instance of #LiManager
+ *
+ * Returns: %TRUE if the filesystem is monitored for changes.
+ */
+gboolean
+li_manager_get_monitor_changes (LiManager *mgr)
+{
+	LiManagerPrivate *priv = GET_PRIVATE (mgr);
+	return priv->monitors->len > 0;
+}
+
 /**
  * li_manager_error_quark:
  *
@@ -1729,6 +2887,38 @@ li_manager_class_init (LiManagerClass *klass)
 				G_TYPE_FROM_CLASS (object_class), G_SIGNAL_RUN_LAST,
 				0, NULL, NULL, g_cclosure_marshal_VOID__UINT_POINTER,
 				G_TYPE_NONE, 2, G_TYPE_UINT, G_TYPE_POINTER);
+
+	/**
+	 * LiManager::changed:
+	 * @mgr: the #LiManager
+	 * @changes: the #LiManagerChanges describing what was invalidated
+	 *
+	 * Emitted when monitoring is enabled and the installed software,
+	 * the installed runtimes or the available software changed.
+	 * Only the lists named in @changes need to be fetched again.
+	 */
+	signals[SIGNAL_CHANGED] =
+		g_signal_new ("changed",
+				G_TYPE_FROM_CLASS (object_class), G_SIGNAL_RUN_LAST,
+				0, NULL, NULL, g_cclosure_marshal_VOID__UINT,
+				G_TYPE_NONE, 1, G_TYPE_UINT);
+
+	/**
+	 * LiManager::progress-details:
+	 * @mgr: the #LiManager
+	 * @percentage: overall progress
+	 * @bytes_done: number of bytes processed so far
+	 * @bytes_total: number of bytes to process
+	 * @rate: throughput in bytes per second
+	 * @eta: estimated remaining time in seconds
+	 *
+	 * Emitted while updates are installed.
+	 */
+	signals[SIGNAL_PROGRESS_DETAILS] =
+		g_signal_new ("progress-details",
+				G_TYPE_FROM_CLASS (object_class), G_SIGNAL_RUN_LAST,
+				0, NULL, NULL, NULL,
+				G_TYPE_NONE, 5, G_TYPE_UINT, G_TYPE_UINT64, G_TYPE_UINT64, G_TYPE_UINT64, G_TYPE_UINT);
 }
 
 /**
@@ -67,6 +67,22 @@ typedef enum {
 	LI_MANAGER_ERROR_LAST
 } LiManagerError;
 
+/**
+ * LiManagerChanges:
+ * @LI_MANAGER_CHANGE_NONE:		Nothing changed
+ * @LI_MANAGER_CHANGE_INSTALLED:	The installed software changed
+ * @LI_MANAGER_CHANGE_AVAILABLE:	The available software changed
+ * @LI_MANAGER_CHANGE_RUNTIMES:		The installed runtimes changed
+ *
+ * Flags describing which software lists were invalidated.
+ **/
+typedef enum  {
+	LI_MANAGER_CHANGE_NONE = 0,
+	LI_MANAGER_CHANGE_INSTALLED = 1 << 0,
+	LI_MANAGER_CHANGE_AVAILABLE = 1 << 1,
+	LI_MANAGER_CHANGE_RUNTIMES = 1 << 2
+} LiManagerChanges;
+
 #define	LI_MANAGER_ERROR li_manager_error_quark ()
 GQuark li_manager_error_quark (void);
 
@@ -116,6 +132,10 @@ LiUpdateItem		*li_manager_get_update_for_id (LiManager *mgr,
 							const gchar *pkid,
 							GError **error);
 
+void			li_manager_set_monitor_changes (LiManager *mgr,
+							gboolean monitor);
+gboolean		li_manager_get_monitor_changes (LiManager *mgr);
+
 G_END_DECLS
 
 #endif /* __LI_MANAGER_H */
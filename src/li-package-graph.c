@@ -31,6 +31,7 @@
 #include <glib/gi18n-lib.h>
 #include <math.h>
 #include "li-package-graph.h"
+#include "li-package-private.h"
 
 #include "li-utils.h"
 #include "li-config-data.h"
@@ -44,8 +45,8 @@ struct _LiPackageGraphPrivate
 	GHashTable *nindex;
 	GHashTable *install_todo;
 
-	guint progress;
-	guint max_progress;
+	guint64 finished_bytes;	/* work of packages which were already installed */
+	gint last_main_percentage;
 
 	GHashTable *foundations;
 	gboolean ignore_foundations;
@@ -180,15 +181,24 @@ static void
 li_package_graph_package_progress_cb (LiPackage *pkg, guint percentage, LiPackageGraph *pg)
 {
 	guint main_percentage;
+	guint64 done;
+	guint64 total;
 	LiPackageGraphPrivate *priv = GET_PRIVATE (pg);
 
-	main_percentage = round ((100 / (double) priv->max_progress) * (priv->progress+percentage));
+	li_package_graph_get_progress_bytes (pg, &done, &total);
+	if (total == 0)
+		main_percentage = 0;
+	else
+		main_percentage = round ((100 / (double) total) * done);
 
-	/* emit individual progress */
+	/* emit individual progress (the package only notifies us on changes) */
 	g_signal_emit (pg, signals[SIGNAL_PROGRESS], 0,
 			percentage, li_package_get_id (pkg));
 
-	/* emit main progress */
+	/* emit main progress, if it actually moved */
+	if ((gint) main_percentage == priv->last_main_percentage)
+		return;
+	priv->last_main_percentage = main_percentage;
 	g_signal_emit (pg, signals[SIGNAL_PROGRESS], 0,
 			main_percentage, NULL);
 }
@@ -287,7 +297,7 @@ li_package_graph_add_package_install_todo (LiPackageGraph *pg, LiPkgInfo *parent
 		g_debug ("Package %s already marked for installation.", li_package_get_id (pkg));
 	}
 
-	priv->max_progress = g_hash_table_size (priv->install_todo)*100;
+	priv->last_main_percentage = -1;
 
 	return row;
 }
@@ -335,19 +345,79 @@ li_package_graph_get_install_candidate (LiPackageGraph *pg, LiPkgInfo *pki)
 	return pkg;
 }
 
+/**
+ * li_package_graph_get_install_todo:
+ *
+ * Returns: (transfer container) (element-type LiPackage): Packages which need to be installed
+ */
+GPtrArray*
+li_package_graph_get_install_todo (LiPackageGraph *pg)
+{
+	GHashTableIter iter;
+	gpointer value;
+	GPtrArray *pkgs;
+	LiPackageGraphPrivate *priv = GET_PRIVATE (pg);
+
+	pkgs = g_ptr_array_new ();
+	g_hash_table_iter_init (&iter, priv->install_todo);
+	while (g_hash_table_iter_next (&iter, NULL, &value))
+		g_ptr_array_add (pkgs, value);
+
+	return pkgs;
+}
+
 /**
  * li_package_graph_mark_installed:
  */
 gboolean
 li_package_graph_mark_installed (LiPackageGraph *pg, LiPkgInfo *pki)
 {
+	LiPackage *pkg;
 	LiPackageGraphPrivate *priv = GET_PRIVATE (pg);
 
-	priv->progress += 100;
+	pkg = g_hash_table_lookup (priv->install_todo, li_pkg_info_get_id (pki));
+	if (pkg != NULL) {
+		guint64 done;
+		guint64 total;
+
+		li_package_get_progress_bytes (pkg, &done, &total);
+		priv->finished_bytes += total;
+	}
+
 	return g_hash_table_remove (priv->install_todo,
 					li_pkg_info_get_id (pki));
 }
 
+/**
+ * li_package_graph_get_progress_bytes:
+ * @pg: An instance of #LiPackageGraph
+ * @bytes_done: (out): Number of bytes processed so far
+ * @bytes_total: (out): Number of bytes which need to be processed
+ *
+ * Get the amount of data all installation steps of all packages in
+ * this graph have processed, and need to process in total.
+ */
+void
+li_package_graph_get_progress_bytes (LiPackageGraph *pg, guint64 *bytes_done, guint64 *bytes_total)
+{
+	GHashTableIter iter;
+	gpointer value;
+	LiPackageGraphPrivate *priv = GET_PRIVATE (pg);
+
+	*bytes_done = priv->finished_bytes;
+	*bytes_total = priv->finished_bytes;
+
+	g_hash_table_iter_init (&iter, priv->install_todo);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		guint64 done;
+		guint64 total;
+
+		li_package_get_progress_bytes (LI_PACKAGE (value), &done, &total);
+		*bytes_done += done;
+		*bytes_total += total;
+	}
+}
+
 /**
  * li_package_graph_branch_to_set_internal:
  *
@@ -489,6 +559,8 @@ li_package_graph_reset (LiPackageGraph *pg)
 	priv->alist = g_ptr_array_new_with_free_func ((GDestroyNotify) g_ptr_array_unref);
 	priv->nindex = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 	priv->install_todo = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+	priv->finished_bytes = 0;
+	priv->last_main_percentage = -1;
 }
 
 /**
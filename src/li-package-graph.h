@@ -74,10 +74,14 @@ GPtrArray		*li_package_graph_add_package_install_todo (LiPackageGraph *pg,
 
 LiPackage		*li_package_graph_get_install_candidate (LiPackageGraph *pg,
 									LiPkgInfo *pki);
+GPtrArray		*li_package_graph_get_install_todo (LiPackageGraph *pg);
 gboolean		li_package_graph_mark_installed (LiPackageGraph *pg,
 								LiPkgInfo *pki);
 
 guint			li_package_graph_get_install_todo_count (LiPackageGraph *pg);
+void			li_package_graph_get_progress_bytes (LiPackageGraph *pg,
+								guint64 *bytes_done,
+								guint64 *bytes_total);
 
 gboolean		li_package_graph_test_foundation_dependency (LiPackageGraph *pg,
 									LiPkgInfo *dep_pki,
@@ -32,6 +32,12 @@
 G_BEGIN_DECLS
 
 AsComponent		*li_package_get_appstream_cpt (LiPackage *pkg);
+gboolean		li_package_set_downloaded_file (LiPackage *pkg,
+							const gchar *filename,
+							GError **error);
+void			li_package_get_progress_bytes (LiPackage *pkg,
+							guint64 *bytes_done,
+							guint64 *bytes_total);
 
 G_END_DECLS
 
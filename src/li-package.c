@@ -25,6 +25,7 @@
 
 #include "config.h"
 #include "li-package.h"
+#include "li-package-private.h"
 
 #include <glib/gstdio.h>
 #include <math.h>
@@ -41,12 +42,27 @@
 
 #include "li-utils.h"
 #include "li-utils-private.h"
+#include "li-checksum.h"
 #include "li-exporter.h"
 #include "li-pkg-index.h"
 #include "li-keyring.h"
+#include "li-installed-db.h"
 
 #define DEFAULT_BLOCK_SIZE 65536
 
+/*
+ * The steps of an installation we track progress for. Every step reports
+ * the bytes it has processed, so each one is weighted by the amount of
+ * data it has to move.
+ */
+typedef enum {
+	LI_PACKAGE_WORK_DOWNLOAD,	/* fetching the package from a repository */
+	LI_PACKAGE_WORK_UNPACK,		/* copying the payload out of the IPK */
+	LI_PACKAGE_WORK_VERIFY,		/* hashing the payload */
+	LI_PACKAGE_WORK_INSTALL,	/* extracting and exporting the payload */
+	LI_PACKAGE_WORK_LAST
+} LiPackageWork;
+
 typedef struct _LiPackagePrivate	LiPackagePrivate;
 struct _LiPackagePrivate
 {
@@ -70,8 +86,10 @@ struct _LiPackagePrivate
 	LiPkgCache *cache;
 	gboolean remote_package;
 
-	guint max_progress;
-	guint progress;
+	guint64 payload_size;
+	guint64 work_done[LI_PACKAGE_WORK_LAST];
+	guint64 work_total[LI_PACKAGE_WORK_LAST];
+	gint last_percentage;
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE (LiPackage, li_package, G_TYPE_OBJECT)
@@ -139,6 +157,61 @@ li_package_init (LiPackage *pkg)
 	priv->contents_hash = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
 	priv->tlevel = LI_TRUST_LEVEL_NONE;
 	priv->auto_verify = TRUE; /* we verify the package signature by default */
+	priv->last_percentage = -1;
+}
+
+/**
+ * li_package_get_progress_bytes:
+ * @pkg: An instance of #LiPackage
+ * @bytes_done: (out): Number of bytes processed so far
+ * @bytes_total: (out): Number of bytes which need to be processed
+ *
+ * Get the amount of data processed by all installation steps of this package.
+ * The total may grow once the package has been downloaded, since the size of
+ * its payload is not known before that.
+ */
+void
+li_package_get_progress_bytes (LiPackage *pkg, guint64 *bytes_done, guint64 *bytes_total)
+{
+	guint i;
+	LiPackagePrivate *priv = GET_PRIVATE (pkg);
+
+	*bytes_done = 0;
+	*bytes_total = 0;
+	for (i = 0; i < LI_PACKAGE_WORK_LAST; i++) {
+		*bytes_done += priv->work_done[i];
+		*bytes_total += priv->work_total[i];
+	}
+}
+
+/**
+ * li_package_update_work_totals:
+ *
+ * Recalculate how many bytes each step needs to process.
+ */
+static void
+li_package_update_work_totals (LiPackage *pkg)
+{
+	guint64 payload_size;
+	guint i;
+	LiPackagePrivate *priv = GET_PRIVATE (pkg);
+
+	if (priv->remote_package)
+		priv->work_total[LI_PACKAGE_WORK_DOWNLOAD] = li_pkg_info_get_download_size (priv->info);
+
+	/* until we have the package, the payload makes up most of its download */
+	payload_size = priv->payload_size;
+	if (payload_size == 0)
+		payload_size = priv->work_total[LI_PACKAGE_WORK_DOWNLOAD];
+
+	priv->work_total[LI_PACKAGE_WORK_UNPACK] = payload_size;
+	priv->work_total[LI_PACKAGE_WORK_VERIFY] = payload_size;
+	priv->work_total[LI_PACKAGE_WORK_INSTALL] = payload_size;
+
+	for (i = 0; i < LI_PACKAGE_WORK_LAST; i++) {
+		if (priv->work_done[i] > priv->work_total[i])
+			priv->work_done[i] = priv->work_total[i];
+	}
 }
 
 /**
@@ -148,9 +221,19 @@ static void
 li_package_emit_progress (LiPackage *pkg)
 {
 	guint percentage;
+	guint64 done;
+	guint64 total;
 	LiPackagePrivate *priv = GET_PRIVATE (pkg);
 
-	percentage = round ((100 / (double) priv->max_progress) * priv->progress);
+	li_package_get_progress_bytes (pkg, &done, &total);
+	if (total == 0)
+		return;
+
+	percentage = round ((100 / (double) total) * done);
+	if ((gint) percentage == priv->last_percentage)
+		return;
+	priv->last_percentage = percentage;
+
 	g_signal_emit (pkg, signals[SIGNAL_PROGRESS], 0,
 					percentage);
 }
@@ -165,30 +248,39 @@ li_package_emit_stage_change (LiPackage *pkg, LiPackageStage stage)
 					stage);
 }
 
+/**
+ * li_package_set_work_done:
+ *
+ * Update the number of bytes a step has processed, and notify
+ * listeners about the new progress.
+ */
+static void
+li_package_set_work_done (LiPackage *pkg, LiPackageWork work, guint64 bytes)
+{
+	LiPackagePrivate *priv = GET_PRIVATE (pkg);
+
+	priv->work_done[work] = MIN (bytes, priv->work_total[work]);
+	li_package_emit_progress (pkg);
+}
+
 /**
  * li_package_cache_progress_cb:
  */
 static void
 li_package_cache_progress_cb (LiPkgCache *cache, guint cache_percentage, const gchar *id, LiPackage *pkg)
 {
-	guint percentage;
 	LiPackagePrivate *priv = GET_PRIVATE (pkg);
 	g_assert (LI_IS_PACKAGE (pkg));
 
-	/* skip progress propagation if we don't know the maximum number of steps yet */
-	if (priv->max_progress == 0)
-		return;
-
 	/* check if this event is for us */
 	if (id == NULL)
 		return;
 	if (g_strcmp0 (priv->id, id) != 0)
 		return;
 
-	percentage = round ((100 / (double) priv->max_progress) * (priv->progress+cache_percentage));
-
-	g_signal_emit (pkg, signals[SIGNAL_PROGRESS], 0,
-					percentage);
+	li_package_set_work_done (pkg,
+				  LI_PACKAGE_WORK_DOWNLOAD,
+				  priv->work_total[LI_PACKAGE_WORK_DOWNLOAD] * cache_percentage / 100);
 }
 
 /**
@@ -571,6 +663,10 @@ li_package_open_file (LiPackage *pkg, const gchar *filename, GError **error)
 				g_propagate_error (error, tmp_error);
 				goto out;
 			}
+		} else if (g_strcmp0 (pathname, "main-data.tar.xz") == 0) {
+			/* the payload size determines how much work an installation is */
+			priv->payload_size = archive_entry_size (e);
+			archive_read_data_skip (ar);
 		} else {
 			archive_read_data_skip (ar);
 		}
@@ -585,7 +681,7 @@ li_package_open_file (LiPackage *pkg, const gchar *filename, GError **error)
 		goto out;
 	}
 
-	priv->max_progress += 100;
+	li_package_update_work_totals (pkg);
 
 	ret = TRUE;
 
@@ -629,7 +725,7 @@ li_package_open_remote (LiPackage *pkg, LiPkgCache *cache, const gchar *pkid, GE
 	g_signal_connect (priv->cache, "progress",
 				G_CALLBACK (li_package_cache_progress_cb), pkg);
 
-	priv->max_progress += 100;
+	li_package_update_work_totals (pkg);
 
 	return TRUE;
 }
@@ -677,6 +773,7 @@ li_package_extract_payload_archive (LiPackage *pkg, GError **error)
 	archive_read_free (ar);
 
 	priv->tmp_payload_path = g_build_filename (priv->tmp_dir, "main-data.tar.xz", NULL);
+	li_package_set_work_done (pkg, LI_PACKAGE_WORK_UNPACK, priv->payload_size);
 
 finish:
 	if (!g_file_test (priv->tmp_payload_path, G_FILE_TEST_EXISTS)) {
@@ -768,6 +865,8 @@ li_package_install (LiPackage *pkg, GError **error)
 			}
 		}
 	}
+	/* nothing (more) to hash if we skipped verification */
+	li_package_set_work_done (pkg, LI_PACKAGE_WORK_VERIFY, priv->payload_size);
 
 	/* change process state */
 	li_package_emit_stage_change (pkg, LI_PACKAGE_STAGE_INSTALLING);
@@ -856,6 +955,11 @@ li_package_install (LiPackage *pkg, GError **error)
 			archive_read_free (payload_ar);
 			return FALSE;
 		}
+
+		/* the compressed bytes consumed so far tell us how far along we are */
+		li_package_set_work_done (pkg,
+					  LI_PACKAGE_WORK_INSTALL,
+					  archive_filter_bytes (payload_ar, -1));
 	}
 
 	archive_read_free (payload_ar);
@@ -875,8 +979,11 @@ li_package_install (LiPackage *pkg, GError **error)
 	g_free (tmp);
 	g_free (tmp2);
 
-	priv->progress += 100;
-	li_package_emit_progress (pkg);
+	/* register the new package with the installed-software database */
+	if (ret && (g_strcmp0 (priv->install_root, LI_SOFTWARE_ROOT) == 0))
+		li_installed_db_commit_package (priv->info);
+
+	li_package_set_work_done (pkg, LI_PACKAGE_WORK_INSTALL, priv->payload_size);
 
 	return ret;
 }
@@ -919,7 +1026,6 @@ li_package_download (LiPackage *pkg, GError **error)
 	/* change process state */
 	li_package_emit_stage_change (pkg, LI_PACKAGE_STAGE_DOWNLOADING);
 
-	priv->max_progress += 100;
 	pkg_fname = li_pkg_cache_fetch_remote (priv->cache,
 					       li_pkg_info_get_id (priv->info),
 					       &tmp_error);
@@ -930,18 +1036,36 @@ li_package_download (LiPackage *pkg, GError **error)
 		return FALSE;
 	}
 
-	li_package_open_file (pkg, pkg_fname, &tmp_error);
+	return li_package_set_downloaded_file (pkg, pkg_fname, error);
+}
+
+/**
+ * li_package_set_downloaded_file:
+ * @pkg: An instance of #LiPackage
+ * @filename: The downloaded package file
+ *
+ * Use a package file which has been downloaded already (e.g. together with
+ * other packages) as data source for a remote package.
+ */
+gboolean
+li_package_set_downloaded_file (LiPackage *pkg, const gchar *filename, GError **error)
+{
+	GStatBuf st;
+	GError *tmp_error = NULL;
+	LiPackagePrivate *priv = GET_PRIVATE (pkg);
+
+	li_package_open_file (pkg, filename, &tmp_error);
 	if (tmp_error != NULL) {
 		g_propagate_error (error, tmp_error);
 		return FALSE;
 	}
-	/* FIXME: Opening the file incremented our max_progress, so we decrease it again to get a 50/50 split between
-	 * download and installation. This is a bit ugly, and will have to be fixed when we emit progress for the installation
-	 * itself as well. */
-	priv->max_progress -= 100;
 
-	priv->progress += 100;
-	li_package_emit_progress (pkg);
+	/* older repository indices don't tell us the package size */
+	if ((priv->work_total[LI_PACKAGE_WORK_DOWNLOAD] == 0) && (g_stat (filename, &st) == 0))
+		priv->work_total[LI_PACKAGE_WORK_DOWNLOAD] = st.st_size;
+	li_package_set_work_done (pkg,
+				  LI_PACKAGE_WORK_DOWNLOAD,
+				  priv->work_total[LI_PACKAGE_WORK_DOWNLOAD]);
 
 	return TRUE;
 }
@@ -1211,6 +1335,15 @@ _li_package_signature_hash_matches (GHashTable *contents_hash, gchar **sigparts,
 	return valid;
 }
 
+/**
+ * li_package_verify_progress_cb:
+ */
+static void
+li_package_verify_progress_cb (guint64 bytes_done, gpointer user_data)
+{
+	li_package_set_work_done (LI_PACKAGE (user_data), LI_PACKAGE_WORK_VERIFY, bytes_done);
+}
+
 /**
  * li_package_verify_signature:
  *
@@ -1247,8 +1380,11 @@ li_package_verify_signature (LiPackage *pkg, GError **error)
 		}
 		g_hash_table_insert (priv->contents_hash,
 						g_strdup ("main-data.tar.xz"),
-						li_compute_checksum_for_file (payload_fname));
+						li_checksum_compute_for_file_full (payload_fname,
+										   li_package_verify_progress_cb,
+										   pkg));
 	}
+	li_package_set_work_done (pkg, LI_PACKAGE_WORK_VERIFY, priv->payload_size);
 
 	priv->tlevel = LI_TRUST_LEVEL_INVALID;
 	if (priv->sig_fpr != NULL)
@@ -42,6 +42,7 @@
 #include "li-package.h"
 #include "li-pkg-index.h"
 #include "li-config-data.h"
+#include "li-checksum.h"
 
 typedef struct _LiPkgBuilderPrivate	LiPkgBuilderPrivate;
 struct _LiPkgBuilderPrivate
@@ -523,6 +524,7 @@ li_pkg_builder_sign_package (LiPkgBuilder *builder, const gchar *tmp_dir, GPtrAr
 	guint i;
 	GString *index_str;
 	g_autofree gchar *indexdata = NULL;
+	g_autoptr(GPtrArray) checksums = NULL;
 	gpgme_data_t sigdata;
 
 	#define BUF_SIZE 512
@@ -532,9 +534,12 @@ li_pkg_builder_sign_package (LiPkgBuilder *builder, const gchar *tmp_dir, GPtrAr
 	gint ret;
 	GError *tmp_error = NULL;
 
+	/* hash the payload and metadata files in parallel */
+	checksums = li_checksum_compute_for_files (sign_files);
+
 	index_str = g_string_new ("");
 	for (i = 0; i < sign_files->len; i++) {
-		gchar *checksum;
+		const gchar *checksum;
 		gchar *internal_name;
 		const gchar *fname = (const gchar *) g_ptr_array_index (sign_files, i);
 
@@ -544,7 +549,7 @@ li_pkg_builder_sign_package (LiPkgBuilder *builder, const gchar *tmp_dir, GPtrAr
 			internal_name = g_path_get_basename (fname);
 		}
 
-		checksum = li_compute_checksum_for_file (fname);
+		checksum = (const gchar *) g_ptr_array_index (checksums, i);
 		if (checksum == NULL) {
 			g_set_error (error,
 				LI_BUILDER_ERROR,
@@ -552,11 +557,11 @@ li_pkg_builder_sign_package (LiPkgBuilder *builder, const gchar *tmp_dir, GPtrAr
 				_("Unable to calculate checksum for: %s"),
 				internal_name);
 			g_free (internal_name);
+			g_string_free (index_str, TRUE);
 			return NULL;
 		}
 
 		g_string_append_printf (index_str, "%s\t%s\n", checksum, internal_name);
-		g_free (checksum);
 		g_free (internal_name);
 	}
 	indexdata = g_string_free (index_str, FALSE);
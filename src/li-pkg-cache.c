@@ -47,6 +47,14 @@
 #include "li-keyring.h"
 
 #define DEFAULT_BLOCK_SIZE 65536
+#define MAX_PARALLEL_DOWNLOADS 4
+#define MAX_ICON_TRANSFERS 64
+
+/* size and mtime of shards we verified already, so we don't need to hash them again */
+#define LI_SHARD_STAMPS_FNAME ".verified"
+
+/* bump this when changing the format of the component cache */
+#define LI_COMPONENT_CACHE_VERSION 3
 
 typedef struct _LiPkgCachePrivate	LiPkgCachePrivate;
 struct _LiPkgCachePrivate
@@ -57,6 +65,9 @@ struct _LiPkgCachePrivate
 	LiKeyring *kr;
 	gchar *cache_index_fname;
 	gchar *tmp_dir;
+
+	gchar *cpt_cache_fname;
+	GVariant *cpt_cache; /* sorted array of (pkid, component data) */
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE (LiPkgCache, li_pkg_cache, G_TYPE_OBJECT)
@@ -73,8 +84,18 @@ static guint signals[SIGNAL_LAST] = { 0 };
 typedef struct {
 	LiPkgCache *cache;
 	gchar *id;
+	gint last_percentage;
 } LiCacheProgressHelper;
 
+typedef struct {
+	CURL *curl;
+	FILE *outfile;
+	gchar *url;
+	gchar *dest;
+	gboolean started;
+	LiCacheProgressHelper helper;
+} LiCacheTransfer;
+
 /**
  * li_pkg_cache_finalize:
  **/
@@ -87,6 +108,9 @@ li_pkg_cache_finalize (GObject *object)
 	g_object_unref (priv->index);
 	g_ptr_array_unref (priv->repo_srcs);
 	g_free (priv->cache_index_fname);
+	g_free (priv->cpt_cache_fname);
+	if (priv->cpt_cache != NULL)
+		g_variant_unref (priv->cpt_cache);
 	g_object_unref (priv->kr);
 
 	/* cleanup */
@@ -148,6 +172,7 @@ li_pkg_cache_init (LiPkgCache *cache)
 	priv->index = li_pkg_index_new ();
 	priv->repo_srcs = g_ptr_array_new_with_free_func (g_object_unref);
 	priv->cache_index_fname = g_build_filename (LIMBA_CACHE_DIR, "available.index", NULL);
+	priv->cpt_cache_fname = g_build_filename (LIMBA_CACHE_DIR, "components.cache", NULL);
 	priv->kr = li_keyring_new ();
 
 	/* get temporary directory */
@@ -184,7 +209,14 @@ li_pkg_cache_curl_progress_cb (LiCacheProgressHelper *helper, double dltotal, do
 {
 	guint percentage;
 
+	/* curl calls us many times per second, even if nothing happened */
+	if (dltotal <= 0)
+		return 0;
 	percentage = round (100/dltotal*dlnow);
+	if ((gint) percentage == helper->last_percentage)
+		return 0;
+	helper->last_percentage = percentage;
+
 	g_signal_emit (helper->cache, signals[SIGNAL_PROGRESS], 0,
 					percentage, helper->id);
 
@@ -225,6 +257,7 @@ li_pkg_cache_download_file_sync (LiPkgCache *cache, const gchar *url, const gcha
 
 	helper.cache = g_object_ref (cache);
 	helper.id = g_strdup (id);
+	helper.last_percentage = -1;
 
 	curl_easy_setopt (curl, CURLOPT_URL, url);
 	curl_easy_setopt (curl, CURLOPT_WRITEDATA, outfile);
@@ -264,6 +297,199 @@ li_pkg_cache_download_file_sync (LiPkgCache *cache, const gchar *url, const gcha
 	g_free (helper.id);
 }
 
+/**
+ * li_pkg_cache_transfer_free:
+ */
+static void
+li_pkg_cache_transfer_free (LiCacheTransfer *transfer)
+{
+	if (transfer->curl != NULL)
+		curl_easy_cleanup (transfer->curl);
+	if (transfer->outfile != NULL)
+		fclose (transfer->outfile);
+	g_free (transfer->url);
+	g_free (transfer->dest);
+	g_object_unref (transfer->helper.cache);
+	g_free (transfer->helper.id);
+	g_free (transfer);
+}
+
+/**
+ * li_pkg_cache_transfer_new:
+ */
+static LiCacheTransfer*
+li_pkg_cache_transfer_new (LiPkgCache *cache, const gchar *url, const gchar *dest, const gchar *id)
+{
+	LiCacheTransfer *transfer;
+
+	transfer = g_new0 (LiCacheTransfer, 1);
+	transfer->helper.cache = g_object_ref (cache);
+	transfer->helper.id = g_strdup (id);
+	transfer->helper.last_percentage = -1;
+	transfer->url = g_strdup (url);
+	transfer->dest = g_strdup (dest);
+
+	return transfer;
+}
+
+/**
+ * li_pkg_cache_start_transfer:
+ *
+ * Open the destination of @transfer and add it to @multi.
+ */
+static gboolean
+li_pkg_cache_start_transfer (CURLM *multi, LiCacheTransfer *transfer, GError **error)
+{
+	transfer->curl = curl_easy_init ();
+	if (transfer->curl == NULL) {
+		g_set_error (error,
+				LI_PKG_CACHE_ERROR,
+				LI_PKG_CACHE_ERROR_FAILED,
+				_("Could not initialize CURL!"));
+		return FALSE;
+	}
+
+	transfer->started = TRUE;
+	transfer->outfile = fopen (transfer->dest, "w");
+	if (transfer->outfile == NULL) {
+		g_set_error (error,
+				LI_PKG_CACHE_ERROR,
+				LI_PKG_CACHE_ERROR_FAILED,
+				_("Could not open file '%s' for writing."), transfer->dest);
+		return FALSE;
+	}
+
+	curl_easy_setopt (transfer->curl, CURLOPT_URL, transfer->url);
+	curl_easy_setopt (transfer->curl, CURLOPT_WRITEDATA, transfer->outfile);
+	curl_easy_setopt (transfer->curl, CURLOPT_WRITEFUNCTION, curl_dl_write_data);
+	/* only transfers belonging to a package report progress */
+	curl_easy_setopt (transfer->curl, CURLOPT_NOPROGRESS, (long) (transfer->helper.id == NULL));
+	curl_easy_setopt (transfer->curl, CURLOPT_FAILONERROR, TRUE);
+	curl_easy_setopt (transfer->curl, CURLOPT_PROGRESSFUNCTION, li_pkg_cache_curl_progress_cb);
+	curl_easy_setopt (transfer->curl, CURLOPT_PROGRESSDATA, &transfer->helper);
+	curl_easy_setopt (transfer->curl, CURLOPT_PRIVATE, transfer);
+
+	g_debug ("Fetching remote data from: %s", transfer->url);
+	curl_multi_add_handle (multi, transfer->curl);
+
+	return TRUE;
+}
+
+/**
+ * li_pkg_cache_run_transfers:
+ * @transfers: (element-type LiCacheTransfer): The downloads to perform
+ *
+ * Run several downloads in parallel. Only MAX_PARALLEL_DOWNLOADS transfers
+ * are active at a time, and the destination of a transfer is only opened
+ * when it starts, so large batches don't run out of file descriptors.
+ * If any of them fails, the files of all started transfers are removed.
+ */
+static gboolean
+li_pkg_cache_run_transfers (LiPkgCache *cache, GPtrArray *transfers, GError **error)
+{
+	CURLM *multi;
+	CURLMcode mres;
+	CURLMsg *msg;
+	gint running = 0;
+	gint msgs_left;
+	guint i;
+	guint next = 0;
+	guint active = 0;
+	GError *tmp_error = NULL;
+
+	multi = curl_multi_init ();
+	if (multi == NULL) {
+		g_set_error (error,
+				LI_PKG_CACHE_ERROR,
+				LI_PKG_CACHE_ERROR_FAILED,
+				_("Could not initialize CURL!"));
+		return FALSE;
+	}
+	curl_multi_setopt (multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long) MAX_PARALLEL_DOWNLOADS);
+
+	/* run all transfers, the progress callbacks are invoked from this thread */
+	do {
+		/* start new transfers as others finish */
+		while ((active < MAX_PARALLEL_DOWNLOADS) && (next < transfers->len)) {
+			LiCacheTransfer *transfer = (LiCacheTransfer*) g_ptr_array_index (transfers, next);
+
+			next++;
+			if (!li_pkg_cache_start_transfer (multi, transfer, &tmp_error))
+				goto out;
+			active++;
+		}
+
+		mres = curl_multi_perform (multi, &running);
+		if ((mres == CURLM_OK) && (running > 0))
+			mres = curl_multi_wait (multi, NULL, 0, 1000, NULL);
+		if (mres != CURLM_OK) {
+			g_set_error (&tmp_error,
+					LI_PKG_CACHE_ERROR,
+					LI_PKG_CACHE_ERROR_DOWNLOAD_FAILED,
+					_("Unable to download data: %s"), curl_multi_strerror (mres));
+			goto out;
+		}
+
+		/* check the results of finished transfers */
+		while ((msg = curl_multi_info_read (multi, &msgs_left)) != NULL) {
+			LiCacheTransfer *transfer = NULL;
+			long http_code = 0;
+
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+
+			curl_easy_getinfo (msg->easy_handle, CURLINFO_PRIVATE, (char**) &transfer);
+			if (msg->data.result != CURLE_OK) {
+				curl_easy_getinfo (msg->easy_handle, CURLINFO_RESPONSE_CODE, &http_code);
+				if (http_code == 404) {
+					g_set_error (&tmp_error,
+							LI_PKG_CACHE_ERROR,
+							LI_PKG_CACHE_ERROR_REMOTE_NOT_FOUND,
+							_("Could not find remote data '%s': %s."), transfer->url, curl_easy_strerror (msg->data.result));
+				} else {
+					g_set_error (&tmp_error,
+							LI_PKG_CACHE_ERROR,
+							LI_PKG_CACHE_ERROR_DOWNLOAD_FAILED,
+							_("Unable to download data from '%s': %s."), transfer->url, curl_easy_strerror (msg->data.result));
+				}
+				goto out;
+			}
+
+			/* flush the downloaded data and free the slot */
+			curl_multi_remove_handle (multi, transfer->curl);
+			curl_easy_cleanup (transfer->curl);
+			transfer->curl = NULL;
+			fclose (transfer->outfile);
+			transfer->outfile = NULL;
+			active--;
+		}
+	} while ((running > 0) || (next < transfers->len));
+
+out:
+	for (i = 0; i < transfers->len; i++) {
+		LiCacheTransfer *transfer = (LiCacheTransfer*) g_ptr_array_index (transfers, i);
+
+		if (transfer->curl != NULL)
+			curl_multi_remove_handle (multi, transfer->curl);
+
+		/* flush the downloaded data */
+		if (transfer->outfile != NULL) {
+			fclose (transfer->outfile);
+			transfer->outfile = NULL;
+		}
+		if ((tmp_error != NULL) && transfer->started)
+			g_remove (transfer->dest);
+	}
+	curl_multi_cleanup (multi);
+
+	if (tmp_error != NULL) {
+		g_propagate_error (error, tmp_error);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
 /**
  * _li_pkg_cache_signature_hash_matches:
  *
@@ -398,14 +624,227 @@ out:
 }
 
 /**
- * li_pkg_cache_update_icon_cache_for_size:
+ * li_pkg_cache_is_checksum:
+ */
+static gboolean
+li_pkg_cache_is_checksum (const gchar *str)
+{
+	return (strlen (str) == 64) && (strspn (str, "0123456789abcdef") == 64);
+}
+
+/**
+ * li_pkg_cache_hashlist_has_entry:
+ *
+ * Returns: %TRUE if the signed index list contains a checksum for @id.
+ */
+static gboolean
+li_pkg_cache_hashlist_has_entry (gchar **hashlist, const gchar *id)
+{
+	guint i;
+
+	for (i = 0; hashlist[i] != NULL; i++) {
+		g_auto(GStrv) parts = NULL;
+
+		parts = g_strsplit (hashlist[i], "\t", 2);
+		if ((g_strv_length (parts) == 2) && (g_strcmp0 (parts[1], id) == 0))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * li_pkg_cache_load_icon_manifest:
+ *
+ * Load a list of icons, as published by a repository.
+ *
+ * Returns: (transfer full): Map of icon file names to their checksums.
+ */
+static GHashTable*
+li_pkg_cache_load_icon_manifest (const gchar *fname)
+{
+	GHashTable *icons;
+	g_autofree gchar *data = NULL;
+	g_auto(GStrv) lines = NULL;
+	guint i;
+
+	icons = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	if (!g_file_get_contents (fname, &data, NULL, NULL))
+		return icons;
+
+	lines = g_strsplit (data, "\n", -1);
+	for (i = 0; lines[i] != NULL; i++) {
+		g_auto(GStrv) parts = NULL;
+
+		parts = g_strsplit (lines[i], "\t", 2);
+		if (g_strv_length (parts) != 2)
+			continue;
+		/* never allow the repository to write outside of our icon directory */
+		if ((strchr (parts[1], '/') != NULL) || (parts[1][0] == '.'))
+			continue;
+		if (!li_pkg_cache_is_checksum (parts[0]))
+			continue;
+
+		g_hash_table_insert (icons, g_strdup (parts[1]), g_strdup (parts[0]));
+	}
+
+	return icons;
+}
+
+/**
+ * li_pkg_cache_fetch_icons:
+ *
+ * Download a set of content-addressed icons and move them into place.
+ */
+static gboolean
+li_pkg_cache_fetch_icons (LiPkgCache *cache, GPtrArray *transfers, GPtrArray *checksums, const gchar *icons_dest, GError **error)
+{
+	guint i;
+
+	if (transfers->len == 0)
+		return TRUE;
+
+	if (!li_pkg_cache_run_transfers (cache, transfers, error))
+		return FALSE;
+
+	for (i = 0; i < transfers->len; i++) {
+		g_autofree gchar *hash = NULL;
+		g_autofree gchar *dest = NULL;
+		LiCacheTransfer *transfer = (LiCacheTransfer*) g_ptr_array_index (transfers, i);
+		const gchar *expected_hash = (const gchar*) g_ptr_array_index (checksums, i);
+
+		/* the download has a ".part" suffix, which we remove when moving it into place */
+		dest = g_strndup (transfer->dest, strlen (transfer->dest) - 5);
+
+		hash = li_compute_checksum_for_file (transfer->dest);
+		if (g_strcmp0 (hash, expected_hash) != 0) {
+			g_warning ("Checksum of icon '%s' does not match. Ignoring it.", transfer->url);
+			g_remove (transfer->dest);
+			/* the old version of the icon is outdated, and without it
+			 * we try to fetch the icon again with the next update */
+			g_remove (dest);
+			continue;
+		}
+		if (g_rename (transfer->dest, dest) != 0) {
+			g_set_error (error,
+					LI_PKG_CACHE_ERROR,
+					LI_PKG_CACHE_ERROR_WRITE,
+					_("Unable to store icon '%s': %s"), dest, g_strerror (errno));
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/**
+ * li_pkg_cache_sync_icons:
+ *
+ * Update the cached icons of a repository using its icon manifest. Only icons
+ * which changed since the last update are downloaded, removed ones are deleted.
+ * The manifest is only used if it matches the checksum in the signed index list.
+ */
+static gboolean
+li_pkg_cache_sync_icons (LiPkgCache *cache, gchar **hashlist, const gchar *manifest_id, const gchar *manifest_fname, const gchar *old_manifest_fname, const gchar *url, const gchar *icons_dest, const gchar *size, GError **error)
+{
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+	guint count = 0;
+	g_autoptr(GHashTable) icons = NULL;
+	g_autoptr(GHashTable) old_icons = NULL;
+	g_autoptr(GPtrArray) transfers = NULL;
+	g_autoptr(GPtrArray) checksums = NULL;
+	GError *tmp_error = NULL;
+
+	if (!_li_pkg_cache_signature_hash_matches (hashlist, manifest_fname, manifest_id)) {
+		g_remove (manifest_fname);
+		g_set_error (error,
+				LI_PKG_CACHE_ERROR,
+				LI_PKG_CACHE_ERROR_VERIFICATION,
+				_("Siganture on '%s' is invalid."), manifest_id);
+		return FALSE;
+	}
+
+	icons = li_pkg_cache_load_icon_manifest (manifest_fname);
+	old_icons = li_pkg_cache_load_icon_manifest (old_manifest_fname);
+
+	g_mkdir_with_parents (icons_dest, 0755);
+
+	/* drop icons the repository doesn't have anymore */
+	g_hash_table_iter_init (&iter, old_icons);
+	while (g_hash_table_iter_next (&iter, &key, NULL)) {
+		g_autofree gchar *fname = NULL;
+
+		if (g_hash_table_contains (icons, key))
+			continue;
+		fname = g_build_filename (icons_dest, (const gchar*) key, NULL);
+		g_remove (fname);
+	}
+
+	transfers = g_ptr_array_new_with_free_func ((GDestroyNotify) li_pkg_cache_transfer_free);
+	checksums = g_ptr_array_new ();
+
+	g_hash_table_iter_init (&iter, icons);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		g_autofree gchar *fname = NULL;
+		g_autofree gchar *part_fname = NULL;
+		g_autofree gchar *icon_url = NULL;
+		g_autofree gchar *prefix = NULL;
+		const gchar *hash = (const gchar*) value;
+
+		/* skip icons we already have */
+		fname = g_build_filename (icons_dest, (const gchar*) key, NULL);
+		if ((g_strcmp0 (g_hash_table_lookup (old_icons, key), hash) == 0) && g_file_test (fname, G_FILE_TEST_EXISTS))
+			continue;
+
+		prefix = g_strndup (hash, 2);
+		icon_url = g_strdup_printf ("%s/icons/%s/%s/%s.png", url, size, prefix, hash);
+		part_fname = g_strdup_printf ("%s.part", fname);
+		g_ptr_array_add (transfers, li_pkg_cache_transfer_new (cache, icon_url, part_fname, NULL));
+		g_ptr_array_add (checksums, value);
+		count++;
+
+		/* don't keep too many files open at a time */
+		if (transfers->len >= MAX_ICON_TRANSFERS) {
+			if (!li_pkg_cache_fetch_icons (cache, transfers, checksums, icons_dest, &tmp_error)) {
+				g_propagate_error (error, tmp_error);
+				return FALSE;
+			}
+			g_ptr_array_set_size (transfers, 0);
+			g_ptr_array_set_size (checksums, 0);
+		}
+	}
+
+	if (!li_pkg_cache_fetch_icons (cache, transfers, checksums, icons_dest, &tmp_error)) {
+		g_propagate_error (error, tmp_error);
+		return FALSE;
+	}
+
+	g_debug ("Fetched %u of %u '%s' icons for repository: %s", count, g_hash_table_size (icons), size, url);
+
+	/* remember what we have now */
+	if (g_rename (manifest_fname, old_manifest_fname) != 0) {
+		g_set_error (error,
+				LI_PKG_CACHE_ERROR,
+				LI_PKG_CACHE_ERROR_WRITE,
+				_("Unable to store icon list: %s"), g_strerror (errno));
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * li_pkg_cache_update_icon_cache_from_tarball:
+ *
+ * Fetch the icons of repositories which don't publish individual icons.
  */
 static void
-li_pkg_cache_update_icon_cache_for_size (LiPkgCache *cache, const gchar *tmp_dir, const gchar *url, const gchar *destination, const gchar *size, GError **error)
+li_pkg_cache_update_icon_cache_from_tarball (LiPkgCache *cache, const gchar *tmp_dir, const gchar *url, const gchar *icons_dest, const gchar *size, GError **error)
 {
 	g_autofree gchar *icon_url = NULL;
 	g_autofree gchar *tar_dest = NULL;
-	g_autofree gchar *icons_dest = NULL;
 	GError *tmp_error = NULL;
 
 	/* download and extract icons */
@@ -424,7 +863,6 @@ li_pkg_cache_update_icon_cache_for_size (LiPkgCache *cache, const gchar *tmp_dir
 			return;
 		}
 	}
-	icons_dest = g_build_filename (destination, size, NULL);
 	li_pkg_cache_extract_icon_tarball (cache, tar_dest, icons_dest, &tmp_error);
 	if (tmp_error != NULL) {
 		g_propagate_error (error, tmp_error);
@@ -432,11 +870,51 @@ li_pkg_cache_update_icon_cache_for_size (LiPkgCache *cache, const gchar *tmp_dir
 	}
 }
 
+/**
+ * li_pkg_cache_update_icon_cache_for_size:
+ */
+static void
+li_pkg_cache_update_icon_cache_for_size (LiPkgCache *cache, gchar **hashlist, const gchar *repo_cache, const gchar *tmp_dir, const gchar *url, const gchar *destination, const gchar *size, GError **error)
+{
+	g_autofree gchar *manifest_id = NULL;
+	g_autofree gchar *manifest_url = NULL;
+	g_autofree gchar *manifest_dest = NULL;
+	g_autofree gchar *old_manifest_fname = NULL;
+	g_autofree gchar *icons_dest = NULL;
+	GError *tmp_error = NULL;
+
+	icons_dest = g_build_filename (destination, size, NULL);
+	old_manifest_fname = g_strdup_printf ("%s/icons_%s.list", repo_cache, size);
+
+	/* prefer the icon list, so we only need to download what changed - but
+	 * only if the repository signed it */
+	manifest_id = g_strdup_printf ("indices/icons_%s.list", size);
+	if (li_pkg_cache_hashlist_has_entry (hashlist, manifest_id)) {
+		manifest_url = g_strdup_printf ("%s/%s", url, manifest_id);
+		manifest_dest = g_strdup_printf ("%s/icons_%s.list", tmp_dir, size);
+		li_pkg_cache_download_file_sync (cache, manifest_url, manifest_dest, NULL, &tmp_error);
+		if (tmp_error == NULL) {
+			li_pkg_cache_sync_icons (cache, hashlist, manifest_id, manifest_dest, old_manifest_fname, url, icons_dest, size, error);
+			return;
+		}
+
+		if (tmp_error->code != LI_PKG_CACHE_ERROR_REMOTE_NOT_FOUND) {
+			g_propagate_error (error, tmp_error);
+			return;
+		}
+		g_error_free (tmp_error);
+	}
+
+	/* this repository has no signed icon list (yet), our local one is outdated */
+	g_remove (old_manifest_fname);
+	li_pkg_cache_update_icon_cache_from_tarball (cache, tmp_dir, url, icons_dest, size, error);
+}
+
 /**
  * li_pkg_cache_update_icon_cache:
  */
 static void
-li_pkg_cache_update_icon_cache (LiPkgCache *cache, const gchar *repo_cache, const gchar *url, const gchar *destination, GError **error)
+li_pkg_cache_update_icon_cache (LiPkgCache *cache, gchar **hashlist, const gchar *repo_cache, const gchar *url, const gchar *destination, GError **error)
 {
 	g_autofree gchar *tmp_dir = NULL;
 	GError *tmp_error = NULL;
@@ -444,13 +922,13 @@ li_pkg_cache_update_icon_cache (LiPkgCache *cache, const gchar *repo_cache, cons
 	tmp_dir = g_build_filename (repo_cache, "icon-tmp", NULL);
 	g_mkdir_with_parents (tmp_dir, 0755);
 
-	li_pkg_cache_update_icon_cache_for_size (cache, tmp_dir, url, destination, "64x64", &tmp_error);
+	li_pkg_cache_update_icon_cache_for_size (cache, hashlist, repo_cache, tmp_dir, url, destination, "64x64", &tmp_error);
 	if (tmp_error != NULL) {
 		g_propagate_error (error, tmp_error);
 		return;
 	}
 
-	li_pkg_cache_update_icon_cache_for_size (cache, tmp_dir, url, destination, "128x128", &tmp_error);
+	li_pkg_cache_update_icon_cache_for_size (cache, hashlist, repo_cache, tmp_dir, url, destination, "128x128", &tmp_error);
 	if (tmp_error != NULL) {
 		g_propagate_error (error, tmp_error);
 		return;
@@ -460,6 +938,300 @@ li_pkg_cache_update_icon_cache (LiPkgCache *cache, const gchar *repo_cache, cons
 	li_delete_dir_recursive (tmp_dir);
 }
 
+/**
+ * li_pkg_cache_repo_is_sharded:
+ *
+ * Returns: %TRUE if the repository publishes its indices in shards.
+ */
+static gboolean
+li_pkg_cache_repo_is_sharded (gchar **hashlist)
+{
+	guint i;
+
+	for (i = 0; hashlist[i] != NULL; i++) {
+		if (g_strcmp0 (hashlist[i], LI_REPO_FORMAT_VERSION_LINE) == 0)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * li_pkg_cache_get_shard_stamp:
+ *
+ * Returns: A string identifying the current state of a shard file on disk,
+ * or %NULL if it does not exist.
+ */
+static gchar*
+li_pkg_cache_get_shard_stamp (const gchar *fname)
+{
+	GStatBuf st;
+
+	if (g_stat (fname, &st) != 0)
+		return NULL;
+	return g_strdup_printf ("%" G_GUINT64_FORMAT "\t%" G_GINT64_FORMAT,
+				(guint64) st.st_size,
+				(gint64) st.st_mtime);
+}
+
+/**
+ * li_pkg_cache_load_shard_stamps:
+ *
+ * Returns: (transfer full): Map of shard basenames to their stamps.
+ */
+static GHashTable*
+li_pkg_cache_load_shard_stamps (const gchar *shard_dir)
+{
+	GHashTable *stamps;
+	guint i;
+	g_autofree gchar *fname = NULL;
+	g_autofree gchar *data = NULL;
+	g_auto(GStrv) lines = NULL;
+
+	stamps = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	fname = g_build_filename (shard_dir, LI_SHARD_STAMPS_FNAME, NULL);
+	if (!g_file_get_contents (fname, &data, NULL, NULL))
+		return stamps;
+
+	lines = g_strsplit (data, "\n", -1);
+	for (i = 0; lines[i] != NULL; i++) {
+		g_auto(GStrv) parts = NULL;
+
+		parts = g_strsplit (lines[i], "\t", 2);
+		if (g_strv_length (parts) != 2)
+			continue;
+		g_hash_table_insert (stamps, g_strdup (parts[0]), g_strdup (parts[1]));
+	}
+
+	return stamps;
+}
+
+/**
+ * li_pkg_cache_save_shard_stamps:
+ */
+static void
+li_pkg_cache_save_shard_stamps (const gchar *shard_dir, GHashTable *stamps)
+{
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+	g_autofree gchar *fname = NULL;
+	g_autoptr(GString) data = NULL;
+
+	data = g_string_new ("");
+	g_hash_table_iter_init (&iter, stamps);
+	while (g_hash_table_iter_next (&iter, &key, &value))
+		g_string_append_printf (data, "%s\t%s\n", (const gchar*) key, (const gchar*) value);
+
+	/* this is just an optimization, we will hash the shards again if it is missing */
+	fname = g_build_filename (shard_dir, LI_SHARD_STAMPS_FNAME, NULL);
+	if (!g_file_set_contents (fname, data->str, data->len, NULL))
+		g_debug ("Unable to write list of verified shards.");
+}
+
+/**
+ * li_pkg_cache_fetch_shards:
+ * @id: Name of the index, e.g. "indices/amd64/Index.gz"
+ *
+ * Download the shards of an index, reusing all shards we already
+ * have a verified copy of. Cached shards are only hashed again if their
+ * size or modification time changed since we last verified them.
+ *
+ * Returns: (transfer full) (element-type utf8): Local filenames of the shards, or %NULL
+ * if the index is not sharded or an error occurred.
+ */
+static GPtrArray*
+li_pkg_cache_fetch_shards (LiPkgCache *cache, LiRepoEntry *re, gchar **hashlist, const gchar *id, GError **error)
+{
+	guint i;
+	g_autofree gchar *shard_dir = NULL;
+	g_autofree gchar *url_dir = NULL;
+	g_autoptr(GPtrArray) shards = NULL;
+	g_autoptr(GPtrArray) transfers = NULL;
+	g_autoptr(GPtrArray) checksums = NULL;
+	g_autoptr(GHashTable) stamps = NULL;
+	gboolean stamps_changed = FALSE;
+	GError *tmp_error = NULL;
+
+	if (!li_pkg_cache_repo_is_sharded (hashlist))
+		return NULL;
+
+	shard_dir = g_build_filename (li_repo_entry_get_cache_dir (re), "shards", NULL);
+	g_mkdir_with_parents (shard_dir, 0755);
+	url_dir = g_path_get_dirname (id);
+	stamps = li_pkg_cache_load_shard_stamps (shard_dir);
+
+	shards = g_ptr_array_new_with_free_func (g_free);
+	transfers = g_ptr_array_new_with_free_func ((GDestroyNotify) li_pkg_cache_transfer_free);
+	checksums = g_ptr_array_new_with_free_func (g_free);
+	for (i = 0; hashlist[i] != NULL; i++) {
+		g_auto(GStrv) parts = NULL;
+		g_autofree gchar *basename = NULL;
+		g_autofree gchar *fname = NULL;
+		g_autofree gchar *shard_url = NULL;
+		g_autofree gchar *stamp = NULL;
+
+		parts = g_strsplit (hashlist[i], "\t", 4);
+		if (g_strv_length (parts) != 4)
+			continue;
+		if ((g_strcmp0 (parts[1], LI_REPO_SHARD_TAG) != 0) || (g_strcmp0 (parts[2], id) != 0))
+			continue;
+		if (!li_pkg_cache_is_checksum (parts[0])) {
+			g_set_error (error,
+					LI_PKG_CACHE_ERROR,
+					LI_PKG_CACHE_ERROR_VERIFICATION,
+					_("Invalid shard checksum for '%s'."), id);
+			return NULL;
+		}
+
+		basename = g_strdup_printf ("%s.gz", parts[0]);
+		fname = g_build_filename (shard_dir, basename, NULL);
+
+		/* shards are named by their checksum, so a valid copy is always up to date */
+		stamp = li_pkg_cache_get_shard_stamp (fname);
+		if (stamp != NULL) {
+			g_autofree gchar *hash = NULL;
+
+			if (g_strcmp0 (g_hash_table_lookup (stamps, basename), stamp) == 0) {
+				g_ptr_array_add (shards, g_steal_pointer (&fname));
+				continue;
+			}
+
+			hash = li_compute_checksum_for_file (fname);
+			if (g_strcmp0 (hash, parts[0]) == 0) {
+				g_hash_table_insert (stamps, g_strdup (basename), g_steal_pointer (&stamp));
+				stamps_changed = TRUE;
+				g_ptr_array_add (shards, g_steal_pointer (&fname));
+				continue;
+			}
+		}
+
+		shard_url = g_build_filename (li_repo_entry_get_url (re), url_dir, "shards", basename, NULL);
+		g_ptr_array_add (transfers, li_pkg_cache_transfer_new (cache, shard_url, fname, NULL));
+		g_ptr_array_add (checksums, g_strdup (parts[0]));
+		g_ptr_array_add (shards, g_steal_pointer (&fname));
+	}
+
+	/* this index was not split, we need to fetch it completely */
+	if (shards->len == 0)
+		return NULL;
+
+	g_debug ("Fetching %u of %u shards of '%s' for repository: %s",
+		 transfers->len, shards->len, id, li_repo_entry_get_url (re));
+	if (transfers->len == 0) {
+		if (stamps_changed)
+			li_pkg_cache_save_shard_stamps (shard_dir, stamps);
+		return g_steal_pointer (&shards);
+	}
+
+	if (!li_pkg_cache_run_transfers (cache, transfers, &tmp_error)) {
+		g_propagate_error (error, tmp_error);
+		return NULL;
+	}
+
+	for (i = 0; i < transfers->len; i++) {
+		g_autofree gchar *hash = NULL;
+		g_autofree gchar *basename = NULL;
+		gchar *stamp;
+		LiCacheTransfer *transfer = (LiCacheTransfer*) g_ptr_array_index (transfers, i);
+
+		hash = li_compute_checksum_for_file (transfer->dest);
+		if (g_strcmp0 (hash, (const gchar*) g_ptr_array_index (checksums, i)) != 0) {
+			g_remove (transfer->dest);
+			g_set_error (error,
+					LI_PKG_CACHE_ERROR,
+					LI_PKG_CACHE_ERROR_VERIFICATION,
+					_("Siganture on '%s' is invalid."), transfer->url);
+			return NULL;
+		}
+
+		stamp = li_pkg_cache_get_shard_stamp (transfer->dest);
+		if (stamp == NULL)
+			continue;
+		basename = g_path_get_basename (transfer->dest);
+		g_hash_table_insert (stamps, g_steal_pointer (&basename), stamp);
+	}
+	li_pkg_cache_save_shard_stamps (shard_dir, stamps);
+
+	return g_steal_pointer (&shards);
+}
+
+/**
+ * li_pkg_cache_load_index_shards:
+ */
+static gboolean
+li_pkg_cache_load_index_shards (LiPkgIndex *index, GPtrArray *shards, GError **error)
+{
+	guint i;
+	GError *tmp_error = NULL;
+
+	for (i = 0; i < shards->len; i++) {
+		g_autoptr(GFile) file = NULL;
+
+		file = g_file_new_for_path ((const gchar*) g_ptr_array_index (shards, i));
+		li_pkg_index_load_file (index, file, &tmp_error);
+		if (tmp_error != NULL) {
+			g_propagate_error (error, tmp_error);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/**
+ * li_pkg_cache_prune_shards:
+ *
+ * Remove cached shards which the repository doesn't list anymore.
+ */
+static void
+li_pkg_cache_prune_shards (LiRepoEntry *re, gchar **hashlist)
+{
+	GHashTableIter iter;
+	gpointer key;
+	guint i;
+	g_autofree gchar *shard_dir = NULL;
+	g_autoptr(GHashTable) known = NULL;
+	g_autoptr(GHashTable) stamps = NULL;
+	g_autoptr(GPtrArray) files = NULL;
+
+	shard_dir = g_build_filename (li_repo_entry_get_cache_dir (re), "shards", NULL);
+	if (!g_file_test (shard_dir, G_FILE_TEST_IS_DIR))
+		return;
+
+	known = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	for (i = 0; hashlist[i] != NULL; i++) {
+		g_auto(GStrv) parts = NULL;
+
+		parts = g_strsplit (hashlist[i], "\t", 4);
+		if ((g_strv_length (parts) == 4) && (g_strcmp0 (parts[1], LI_REPO_SHARD_TAG) == 0))
+			g_hash_table_add (known, g_strdup_printf ("%s.gz", parts[0]));
+	}
+
+	files = li_utils_find_files (shard_dir, FALSE);
+	if (files == NULL)
+		return;
+	for (i = 0; i < files->len; i++) {
+		g_autofree gchar *basename = NULL;
+		const gchar *fname = (const gchar*) g_ptr_array_index (files, i);
+
+		basename = g_path_get_basename (fname);
+		if (g_strcmp0 (basename, LI_SHARD_STAMPS_FNAME) == 0)
+			continue;
+		if (!g_hash_table_contains (known, basename))
+			g_remove (fname);
+	}
+
+	/* forget about the shards we just removed */
+	stamps = li_pkg_cache_load_shard_stamps (shard_dir);
+	g_hash_table_iter_init (&iter, stamps);
+	while (g_hash_table_iter_next (&iter, &key, NULL)) {
+		if (!g_hash_table_contains (known, key))
+			g_hash_table_iter_remove (&iter);
+	}
+	li_pkg_cache_save_shard_stamps (shard_dir, stamps);
+}
+
 /**
  * li_pkg_cache_download_repodata:
  */
@@ -471,6 +1243,7 @@ li_pkg_cache_download_repodata (LiPkgCache *cache, LiRepoEntry *re, const gchar
 	guint i;
 	g_autofree gchar *dest_asfname = NULL;
 	g_autoptr(GFile) asfile = NULL;
+	g_autoptr(GPtrArray) as_shards = NULL;
 	gchar *tmp = NULL;
 	GError *tmp_error = NULL;
 
@@ -482,9 +1255,27 @@ li_pkg_cache_download_repodata (LiPkgCache *cache, LiRepoEntry *re, const gchar
 	for (i = 0; urls[i] != NULL; i++) {
 		g_autofree gchar *dest_fname = NULL;
 		g_autofree gchar *basename = NULL;
+		g_autofree gchar *index_id = NULL;
 		g_autoptr(GFile) idxfile = NULL;
+		g_autoptr(GPtrArray) shards = NULL;
 
 		basename = g_path_get_basename (urls[i]);
+		index_id = g_strdup_printf ("indices/%s/%s", arch, basename);
+
+		/* only fetch the changed parts of the index, if we can */
+		shards = li_pkg_cache_fetch_shards (cache, re, hashlist, index_id, &tmp_error);
+		if (tmp_error != NULL) {
+			/* the complete index is still there, try that instead */
+			g_debug ("Unable to fetch shards of '%s', downloading the full index: %s", index_id, tmp_error->message);
+			g_clear_error (&tmp_error);
+		}
+		if (shards != NULL) {
+			if (!li_pkg_cache_load_index_shards (dest_index, shards, &tmp_error)) {
+				g_propagate_prefixed_error (error, tmp_error, "Unable to load %s index for repository: %s", arch, li_repo_entry_get_url (re));
+				return;
+			}
+			continue;
+		}
 
 		tmp = g_strdup_printf ("%s-%s", arch, basename);
 		dest_fname = g_build_filename (li_repo_entry_get_cache_dir (re), tmp, NULL);
@@ -506,16 +1297,13 @@ li_pkg_cache_download_repodata (LiPkgCache *cache, LiRepoEntry *re, const gchar
 		}
 
 		/* validate the recently downloaded index */
-		tmp = g_strdup_printf ("indices/%s/%s", arch, basename);
-		if (!_li_pkg_cache_signature_hash_matches (hashlist, dest_fname, tmp)) {
+		if (!_li_pkg_cache_signature_hash_matches (hashlist, dest_fname, index_id)) {
 			g_set_error (error,
 					LI_PKG_CACHE_ERROR,
 					LI_PKG_CACHE_ERROR_VERIFICATION,
 					_("Siganture on '%s' is invalid."), urls[i]);
-			g_free (tmp);
 			return;
 		}
-		g_free (tmp);
 
 		/* we can load the index now */
 		idxfile = g_file_new_for_path (dest_fname);
@@ -526,7 +1314,31 @@ li_pkg_cache_download_repodata (LiPkgCache *cache, LiRepoEntry *re, const gchar
 		}
 	}
 
-	/* download AppStream metadata */
+	/* download AppStream metadata, preferably only the parts which changed */
+	tmp = g_strdup_printf ("indices/%s/Metadata.xml.gz", arch);
+	as_shards = li_pkg_cache_fetch_shards (cache, re, hashlist, tmp, &tmp_error);
+	if (tmp_error != NULL) {
+		g_debug ("Unable to fetch shards of '%s', downloading the full metadata: %s", tmp, tmp_error->message);
+		g_clear_error (&tmp_error);
+	}
+	g_free (tmp);
+	if (as_shards != NULL) {
+		for (i = 0; i < as_shards->len; i++) {
+			g_autoptr(GFile) shard_file = NULL;
+
+			shard_file = g_file_new_for_path ((const gchar*) g_ptr_array_index (as_shards, i));
+			as_metadata_parse_file (metad,
+						shard_file,
+						AS_FORMAT_KIND_XML,
+						&tmp_error);
+			if (tmp_error != NULL) {
+				g_propagate_prefixed_error (error, tmp_error, "Unable to load AppStream data for: %s", li_repo_entry_get_url (re));
+				return;
+			}
+		}
+		return;
+	}
+
 	asurl = li_repo_entry_get_metadata_url_for_arch (re, arch);
 	tmp = g_strdup_printf ("Metainfo_%s.xml.gz", arch);
 	dest_asfname = g_build_filename (li_repo_entry_get_cache_dir (re), tmp, NULL);
@@ -570,6 +1382,289 @@ li_pkg_cache_download_repodata (LiPkgCache *cache, LiRepoEntry *re, const gchar
 	}
 }
 
+/**
+ * li_pkg_cache_pkid_cmp:
+ */
+static gint
+li_pkg_cache_pkid_cmp (gconstpointer a, gconstpointer b)
+{
+	return g_strcmp0 (*((const gchar**) a), *((const gchar**) b));
+}
+
+/**
+ * li_pkg_cache_find_xml_locales:
+ *
+ * AppStream doesn't tell us which translations a component has, so
+ * we look for the languages used in the (compressed) AppStream XML.
+ *
+ * Returns: (transfer full) (element-type utf8): The locales of all
+ * translated strings in @xml_fname.
+ */
+static GPtrArray*
+li_pkg_cache_find_xml_locales (const gchar *xml_fname)
+{
+	GPtrArray *locales;
+	const gchar *pos;
+	g_autoptr(GFile) file = NULL;
+	g_autoptr(GInputStream) fstream = NULL;
+	g_autoptr(GInputStream) stream = NULL;
+	g_autoptr(GOutputStream) ostream = NULL;
+	g_autoptr(GConverter) conv = NULL;
+	g_autoptr(GHashTable) seen = NULL;
+	g_autofree gchar *data = NULL;
+
+	locales = g_ptr_array_new_with_free_func (g_free);
+
+	file = g_file_new_for_path (xml_fname);
+	fstream = G_INPUT_STREAM (g_file_read (file, NULL, NULL));
+	if (fstream == NULL)
+		return locales;
+	if (g_str_has_suffix (xml_fname, ".gz")) {
+		conv = G_CONVERTER (g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP));
+		stream = g_converter_input_stream_new (fstream, conv);
+	} else {
+		stream = g_object_ref (fstream);
+	}
+
+	ostream = g_memory_output_stream_new_resizable ();
+	if (g_output_stream_splice (ostream, stream, G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE, NULL, NULL) < 0)
+		return locales;
+	/* terminate the data, so we can search it */
+	g_output_stream_write (ostream, "", 1, NULL, NULL);
+	g_output_stream_close (ostream, NULL, NULL);
+	data = g_memory_output_stream_steal_data (G_MEMORY_OUTPUT_STREAM (ostream));
+
+	seen = g_hash_table_new (g_str_hash, g_str_equal);
+	for (pos = strstr (data, "xml:lang="); pos != NULL; pos = strstr (pos, "xml:lang=")) {
+		const gchar *end;
+		gchar quote;
+		gchar *locale;
+
+		pos += strlen ("xml:lang=");
+		quote = pos[0];
+		if ((quote != '"') && (quote != '\''))
+			continue;
+		pos++;
+		end = strchr (pos, quote);
+		if (end == NULL)
+			break;
+
+		locale = g_strndup (pos, end - pos);
+		if ((locale[0] == '\0') || (g_strcmp0 (locale, "C") == 0) || g_hash_table_contains (seen, locale)) {
+			g_free (locale);
+		} else {
+			g_hash_table_add (seen, locale);
+			g_ptr_array_add (locales, locale);
+		}
+		pos = end;
+	}
+
+	return locales;
+}
+
+/**
+ * li_pkg_cache_build_translations:
+ * @getter: Function returning the string for the active locale of @cpt
+ * @untranslated: The untranslated string
+ *
+ * Returns: A map of locales to translations of a string, or %NULL
+ * if it is not translated.
+ */
+static GVariant*
+li_pkg_cache_build_translations (AsComponent *cpt, GPtrArray *locales, const gchar* (*getter) (AsComponent*), const gchar *untranslated)
+{
+	guint i;
+	guint count = 0;
+	GVariantBuilder b;
+
+	if (untranslated == NULL)
+		return NULL;
+
+	g_variant_builder_init (&b, G_VARIANT_TYPE ("a{ss}"));
+	for (i = 0; i < locales->len; i++) {
+		const gchar *str;
+		const gchar *locale = (const gchar*) g_ptr_array_index (locales, i);
+
+		as_component_set_active_locale (cpt, locale);
+		str = getter (cpt);
+		/* AppStream falls back to the untranslated string */
+		if ((str == NULL) || (g_strcmp0 (str, untranslated) == 0))
+			continue;
+		g_variant_builder_add (&b, "{ss}", locale, str);
+		count++;
+	}
+	as_component_set_active_locale (cpt, "C");
+
+	if (count == 0) {
+		g_variant_builder_clear (&b);
+		return NULL;
+	}
+
+	return g_variant_builder_end (&b);
+}
+
+/**
+ * li_pkg_cache_add_translatable:
+ *
+ * Add an untranslated string and its translations to a component cache entry.
+ */
+static void
+li_pkg_cache_add_translatable (GVariantBuilder *b, AsComponent *cpt, GPtrArray *locales, const gchar *key, const gchar* (*getter) (AsComponent*))
+{
+	GVariant *translations;
+	g_autofree gchar *untranslated = NULL;
+	g_autofree gchar *tkey = NULL;
+
+	as_component_set_active_locale (cpt, "C");
+	untranslated = g_strdup (getter (cpt));
+	if (untranslated == NULL)
+		return;
+	g_variant_builder_add (b, "{sv}", key, g_variant_new_string (untranslated));
+
+	translations = li_pkg_cache_build_translations (cpt, locales, getter, untranslated);
+	if (translations == NULL)
+		return;
+	tkey = g_strdup_printf ("%s-translations", key);
+	g_variant_builder_add (b, "{sv}", tkey, translations);
+}
+
+/**
+ * li_pkg_cache_add_component_entries:
+ * @entries: Map of package-ids to component data
+ * @xml_fname: The AppStream XML file @metad was saved to
+ *
+ * Collect the fields of all Limba components in @metad which front-ends
+ * need to display a package.
+ * Name, summary and description are stored untranslated, together with
+ * a map of their translations, so no XML needs to be parsed for lookups.
+ */
+static void
+li_pkg_cache_add_component_entries (GHashTable *entries, AsMetadata *metad, const gchar *xml_fname)
+{
+	guint i;
+	GPtrArray *cpts;
+	const gchar *origin;
+	g_autoptr(GPtrArray) locales = NULL;
+
+	origin = as_metadata_get_origin (metad);
+	cpts = as_metadata_get_components (metad);
+	locales = li_pkg_cache_find_xml_locales (xml_fname);
+	for (i = 0; i < cpts->len; i++) {
+		AsBundle *bundle;
+		AsIcon *icon;
+		GVariantBuilder b;
+		const gchar *pkid;
+		AsComponent *cpt = AS_COMPONENT (g_ptr_array_index (cpts, i));
+
+		bundle = as_component_get_bundle (cpt, AS_BUNDLE_KIND_LIMBA);
+		if (bundle == NULL)
+			continue;
+		pkid = as_bundle_get_id (bundle);
+		/* the first repository providing a package wins */
+		if ((pkid == NULL) || g_hash_table_contains (entries, pkid))
+			continue;
+		as_component_set_active_locale (cpt, "C");
+
+		g_variant_builder_init (&b, G_VARIANT_TYPE_VARDICT);
+		g_variant_builder_add (&b, "{sv}", "id", g_variant_new_string (as_component_get_id (cpt)));
+		li_pkg_cache_add_translatable (&b, cpt, locales, "name", as_component_get_name);
+		li_pkg_cache_add_translatable (&b, cpt, locales, "summary", as_component_get_summary);
+		li_pkg_cache_add_translatable (&b, cpt, locales, "description", as_component_get_description);
+		if (as_component_get_developer_name (cpt) != NULL)
+			g_variant_builder_add (&b, "{sv}", "developer-name", g_variant_new_string (as_component_get_developer_name (cpt)));
+		if (origin != NULL)
+			g_variant_builder_add (&b, "{sv}", "origin", g_variant_new_string (origin));
+		g_variant_builder_add (&b, "{sv}", "appstream-file", g_variant_new_string (xml_fname));
+
+		icon = as_component_get_icon_by_size (cpt, 64, 64);
+		if ((icon != NULL) && (as_icon_get_kind (icon) == AS_ICON_KIND_CACHED) && (origin != NULL)) {
+			g_autofree gchar *icon_fname = NULL;
+
+			icon_fname = g_build_filename (APPSTREAM_CACHE_DIR,
+							"icons",
+							origin,
+							"64x64",
+							as_icon_get_name (icon),
+							NULL);
+			g_variant_builder_add (&b, "{sv}", "icon", g_variant_new_string (icon_fname));
+		}
+
+		g_hash_table_insert (entries,
+				     g_strdup (pkid),
+				     g_variant_ref_sink (g_variant_builder_end (&b)));
+	}
+}
+
+/**
+ * li_pkg_cache_save_component_cache:
+ *
+ * Write the component cache. Entries are sorted by package-id, so
+ * lookups can bisect the memory-mapped file without loading it.
+ */
+static gboolean
+li_pkg_cache_save_component_cache (LiPkgCache *cache, GHashTable *entries, GError **error)
+{
+	guint i;
+	GVariantBuilder b;
+	g_autofree gpointer *pkids = NULL;
+	guint pkids_len;
+	g_autoptr(GVariant) variant = NULL;
+	LiPkgCachePrivate *priv = GET_PRIVATE (cache);
+
+	pkids = g_hash_table_get_keys_as_array (entries, &pkids_len);
+	qsort (pkids, pkids_len, sizeof (gpointer), li_pkg_cache_pkid_cmp);
+
+	g_variant_builder_init (&b, G_VARIANT_TYPE ("a(sa{sv})"));
+	for (i = 0; i < pkids_len; i++)
+		g_variant_builder_add (&b, "(s@a{sv})",
+					(const gchar*) pkids[i],
+					(GVariant*) g_hash_table_lookup (entries, pkids[i]));
+
+	variant = g_variant_ref_sink (g_variant_new ("(ua(sa{sv}))",
+							LI_COMPONENT_CACHE_VERSION,
+							&b));
+
+	return g_file_set_contents (priv->cpt_cache_fname,
+				    g_variant_get_data (variant),
+				    g_variant_get_size (variant),
+				    error);
+}
+
+/**
+ * li_pkg_cache_load_component_cache:
+ *
+ * Map the component cache into memory.
+ */
+static void
+li_pkg_cache_load_component_cache (LiPkgCache *cache)
+{
+	guint32 version = 0;
+	GMappedFile *mfile;
+	g_autoptr(GBytes) bytes = NULL;
+	g_autoptr(GVariant) variant = NULL;
+	LiPkgCachePrivate *priv = GET_PRIVATE (cache);
+
+	if (priv->cpt_cache != NULL) {
+		g_variant_unref (priv->cpt_cache);
+		priv->cpt_cache = NULL;
+	}
+
+	mfile = g_mapped_file_new (priv->cpt_cache_fname, FALSE, NULL);
+	if (mfile == NULL)
+		return;
+	bytes = g_mapped_file_get_bytes (mfile);
+	g_mapped_file_unref (mfile);
+
+	variant = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE ("(ua(sa{sv}))"), bytes, FALSE));
+	g_variant_get_child (variant, 0, "u", &version);
+	if (version != LI_COMPONENT_CACHE_VERSION) {
+		g_debug ("Ignoring component cache with unknown version %u", version);
+		return;
+	}
+
+	priv->cpt_cache = g_variant_get_child_value (variant, 1);
+}
+
 /**
  * li_pkg_cache_update:
  *
@@ -581,11 +1676,13 @@ li_pkg_cache_update (LiPkgCache *cache, GError **error)
 	guint i;
 	GError *tmp_error = NULL;
 	g_autoptr(LiPkgIndex) global_index = NULL;
+	g_autoptr(GHashTable) cpt_entries = NULL;
 	g_autofree gchar *current_arch = NULL;
 	LiPkgCachePrivate *priv = GET_PRIVATE (cache);
 
 	/* create index of available packages */
 	global_index = li_pkg_index_new ();
+	cpt_entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_variant_unref);
 
 	current_arch = li_get_current_arch_h ();
 
@@ -663,6 +1760,7 @@ li_pkg_cache_update (LiPkgCache *cache, GError **error)
 			g_propagate_error (error, tmp_error);
 			return;
 		}
+		li_pkg_cache_prune_shards (re, hashlist);
 
 		/* write repo hints file */
 		dest_repoconf = g_build_filename (li_repo_entry_get_cache_dir (re), "repo", NULL);
@@ -688,6 +1786,7 @@ li_pkg_cache_update (LiPkgCache *cache, GError **error)
 						NULL);
 		g_debug ("Icon cache target set: %s", tmp);
 		li_pkg_cache_update_icon_cache (cache,
+						hashlist,
 						li_repo_entry_get_cache_dir (re),
 						li_repo_entry_get_url (re),
 						tmp,
@@ -723,12 +1822,19 @@ li_pkg_cache_update (LiPkgCache *cache, GError **error)
 			g_propagate_prefixed_error (error, tmp_error, "Unable to save metadata.");
 			return;
 		}
+		li_pkg_cache_add_component_entries (cpt_entries, metad, li_repo_entry_get_appstream_fname (re));
 
 		g_debug ("Loaded index of repository.");
 	}
 
 	/* save global index file */
 	li_pkg_index_save_to_file (global_index, priv->cache_index_fname);
+
+	/* the component cache is only an optimization for front-ends */
+	if (!li_pkg_cache_save_component_cache (cache, cpt_entries, &tmp_error)) {
+		g_warning ("Unable to write component cache: %s", tmp_error->message);
+		g_error_free (tmp_error);
+	}
 }
 
 /**
@@ -756,6 +1862,8 @@ li_pkg_cache_open (LiPkgCache *cache, GError **error)
 		g_propagate_prefixed_error (error, tmp_error, "Unable to load package cache: ");
 		return;
 	}
+
+	li_pkg_cache_load_component_cache (cache);
 }
 
 /**
@@ -853,6 +1961,202 @@ li_pkg_cache_fetch_remote (LiPkgCache *cache, const gchar *pkgid, GError **error
 	return g_strdup (dest_fname);
 }
 
+/**
+ * li_pkg_cache_fetch_remote_batch:
+ * @cache: an instance of #LiPkgCache
+ * @pkids: (element-type utf8): IDs of the packages to download
+ *
+ * Download multiple packages from their remote sources, running
+ * several transfers in parallel.
+ *
+ * Returns: (transfer full) (element-type utf8 utf8): Map of package IDs to the paths of
+ * the downloaded package files, or %NULL on error.
+ */
+GHashTable*
+li_pkg_cache_fetch_remote_batch (LiPkgCache *cache, GPtrArray *pkids, GError **error)
+{
+	guint i;
+	g_autoptr(GPtrArray) transfers = NULL;
+	GHashTable *res = NULL;
+	LiPkgCachePrivate *priv = GET_PRIVATE (cache);
+
+	transfers = g_ptr_array_new_with_free_func ((GDestroyNotify) li_pkg_cache_transfer_free);
+	for (i = 0; i < pkids->len; i++) {
+		LiPkgInfo *pki;
+		g_autofree gchar *tmp = NULL;
+		g_autofree gchar *subdir = NULL;
+		g_autofree gchar *dest_dir = NULL;
+		g_autofree gchar *dest = NULL;
+		const gchar *pkid = (const gchar*) g_ptr_array_index (pkids, i);
+
+		pki = li_pkg_cache_get_pkg_info (cache, pkid);
+		if (pki == NULL) {
+			g_set_error (error,
+					LI_PKG_CACHE_ERROR,
+					LI_PKG_CACHE_ERROR_NOT_FOUND,
+					_("Could not find package matching id '%s'."), pkid);
+			return NULL;
+		}
+
+		/* packages from different repositories may share a file name, so every
+		 * package gets its own directory, named after the escaped package-id */
+		subdir = g_uri_escape_string (pkid, NULL, FALSE);
+		dest_dir = g_build_filename (priv->tmp_dir, subdir, NULL);
+		if (g_mkdir_with_parents (dest_dir, 0755) != 0) {
+			g_set_error (error,
+					LI_PKG_CACHE_ERROR,
+					LI_PKG_CACHE_ERROR_WRITE,
+					_("Unable to create download directory '%s'."), dest_dir);
+			return NULL;
+		}
+
+		tmp = g_path_get_basename (li_pkg_info_get_repo_location (pki));
+		dest = g_build_filename (dest_dir, tmp, NULL);
+		g_ptr_array_add (transfers,
+				 li_pkg_cache_transfer_new (cache, li_pkg_info_get_repo_location (pki), dest, pkid));
+	}
+
+	if (!li_pkg_cache_run_transfers (cache, transfers, error))
+		return NULL;
+
+	res = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	for (i = 0; i < transfers->len; i++) {
+		LiCacheTransfer *transfer = (LiCacheTransfer*) g_ptr_array_index (transfers, i);
+
+		g_debug ("Package '%s' downloaded from remote.", transfer->helper.id);
+		g_hash_table_insert (res,
+				     g_strdup (transfer->helper.id),
+				     g_strdup (transfer->dest));
+	}
+
+	return res;
+}
+
+/**
+ * li_pkg_cache_lookup_translation:
+ * @translations: Map of locales to translated strings
+ *
+ * Returns: The translation for the current locale, or %NULL if
+ * the untranslated string should be used.
+ */
+static const gchar*
+li_pkg_cache_lookup_translation (GVariant *translations)
+{
+	guint i;
+	const gchar *str;
+	const gchar * const *langs;
+
+	langs = g_get_language_names ();
+	for (i = 0; langs[i] != NULL; i++) {
+		if (g_strcmp0 (langs[i], "C") == 0)
+			break;
+		if (g_variant_lookup (translations, langs[i], "&s", &str))
+			return str;
+	}
+
+	return NULL;
+}
+
+/**
+ * li_pkg_cache_localize_component_data:
+ *
+ * Build the component data returned to callers from a cache entry,
+ * using the translated strings for the current locale.
+ *
+ * Returns: (transfer full): The localized data.
+ */
+static GVariant*
+li_pkg_cache_localize_component_data (GVariant *data)
+{
+	GVariantIter iter;
+	GVariantBuilder b;
+	const gchar *key;
+	GVariant *value;
+
+	g_variant_builder_init (&b, G_VARIANT_TYPE_VARDICT);
+	g_variant_iter_init (&iter, data);
+	while (g_variant_iter_next (&iter, "{&sv}", &key, &value)) {
+		const gchar *str = NULL;
+
+		if (g_str_has_suffix (key, "-translations")) {
+			g_variant_unref (value);
+			continue;
+		}
+
+		if ((g_strcmp0 (key, "name") == 0) ||
+		    (g_strcmp0 (key, "summary") == 0) ||
+		    (g_strcmp0 (key, "description") == 0)) {
+			g_autofree gchar *tkey = NULL;
+			g_autoptr(GVariant) translations = NULL;
+
+			tkey = g_strdup_printf ("%s-translations", key);
+			translations = g_variant_lookup_value (data, tkey, G_VARIANT_TYPE ("a{ss}"));
+			if (translations != NULL)
+				str = li_pkg_cache_lookup_translation (translations);
+		}
+
+		if (str != NULL)
+			g_variant_builder_add (&b, "{sv}", key, g_variant_new_string (str));
+		else
+			g_variant_builder_add (&b, "{sv}", key, value);
+		g_variant_unref (value);
+	}
+
+	return g_variant_ref_sink (g_variant_builder_end (&b));
+}
+
+/**
+ * li_pkg_cache_get_component_data:
+ * @pkid: The package-id to look up
+ *
+ * Get the AppStream metadata of an available package, as a dictionary
+ * with the keys "id", "name", "summary", "description", "developer-name",
+ * "origin", "icon" (path to a cached 64x64 icon) and "appstream-file"
+ * (the AppStream XML the data was taken from). Keys without a value
+ * are omitted.
+ *
+ * Name, summary and description are translated to the current locale,
+ * using the translations stored in the binary cache.
+ *
+ * Returns: (transfer full): A %G_VARIANT_TYPE_VARDICT, or %NULL if no
+ * metadata is known for the package.
+ */
+GVariant*
+li_pkg_cache_get_component_data (LiPkgCache *cache, const gchar *pkid)
+{
+	gsize low, high;
+	LiPkgCachePrivate *priv = GET_PRIVATE (cache);
+
+	if (priv->cpt_cache == NULL)
+		return NULL;
+
+	low = 0;
+	high = g_variant_n_children (priv->cpt_cache);
+	while (low < high) {
+		gint res;
+		const gchar *key;
+		gsize mid = low + (high - low) / 2;
+		g_autoptr(GVariant) entry = NULL;
+
+		entry = g_variant_get_child_value (priv->cpt_cache, mid);
+		g_variant_get_child (entry, 0, "&s", &key);
+
+		res = g_strcmp0 (pkid, key);
+		if (res == 0) {
+			g_autoptr(GVariant) data = NULL;
+
+			data = g_variant_get_child_value (entry, 1);
+			return li_pkg_cache_localize_component_data (data);
+		}
+		if (res < 0)
+			high = mid;
+		else
+			low = mid + 1;
+	}
+
+	return NULL;
+}
+
 /**
  * li_pkg_cache_error_quark:
  *
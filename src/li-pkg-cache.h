@@ -82,10 +82,15 @@ void			li_pkg_cache_update (LiPkgCache *cache,
 GPtrArray		*li_pkg_cache_get_packages (LiPkgCache *cache);
 LiPkgInfo		*li_pkg_cache_get_pkg_info (LiPkgCache *cache,
 							const gchar *pkid);
+GVariant		*li_pkg_cache_get_component_data (LiPkgCache *cache,
+								const gchar *pkid);
 
 gchar			*li_pkg_cache_fetch_remote (LiPkgCache *cache,
 							const gchar *pkgid,
 							GError **error);
+GHashTable		*li_pkg_cache_fetch_remote_batch (LiPkgCache *cache,
+								GPtrArray *pkids,
+								GError **error);
 
 G_END_DECLS
 
@@ -87,6 +87,12 @@ li_pkg_index_fetch_values_from_cdata (LiPkgIndex *pkidx, LiConfigData *cdata)
 		li_pkg_info_set_repo_location (pki, str);
 		g_free (str);
 
+		str = li_config_data_get_value (cdata, "Size");
+		if (str != NULL) {
+			li_pkg_info_set_download_size (pki, g_ascii_strtoull (str, NULL, 10));
+			g_free (str);
+		}
+
 		/* mark package as available for installation */
 		li_pkg_info_add_flag (pki, LI_PACKAGE_FLAG_AVAILABLE);
 		g_ptr_array_add (priv->packages, pki);
@@ -117,6 +123,11 @@ li_pkg_index_write_cdata_values (LiPkgIndex *pkidx, LiConfigData *cdata)
 		li_config_data_set_value (cdata, "Requires", li_pkg_info_get_dependencies (pki));
 		li_config_data_set_value (cdata, "SHA256", li_pkg_info_get_checksum_sha256 (pki));
 		li_config_data_set_value (cdata, "Location", li_pkg_info_get_repo_location (pki));
+		if (li_pkg_info_get_download_size (pki) > 0) {
+			g_autofree gchar *size_str = NULL;
+			size_str = g_strdup_printf ("%" G_GUINT64_FORMAT, li_pkg_info_get_download_size (pki));
+			li_config_data_set_value (cdata, "Size", size_str);
+		}
 	}
 }
 
@@ -247,6 +258,20 @@ li_pkg_index_add_package (LiPkgIndex *pkidx, LiPkgInfo *pki)
 	g_ptr_array_add (priv->packages, g_object_ref (pki));
 }
 
+/**
+ * li_pkg_index_remove_package:
+ *
+ * Remove a package which was added with li_pkg_index_add_package().
+ *
+ * Returns: %TRUE if the package was part of the index.
+ */
+gboolean
+li_pkg_index_remove_package (LiPkgIndex *pkidx, LiPkgInfo *pki)
+{
+	LiPkgIndexPrivate *priv = GET_PRIVATE (pkidx);
+	return g_ptr_array_remove (priv->packages, pki);
+}
+
 /**
  * li_pkg_index_class_init:
  **/
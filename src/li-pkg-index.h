@@ -61,6 +61,8 @@ gboolean		li_pkg_index_save_to_file (LiPkgIndex *pkidx,
 GPtrArray		*li_pkg_index_get_packages (LiPkgIndex *pkidx);
 void			li_pkg_index_add_package (LiPkgIndex *pkidx,
 							LiPkgInfo *pki);
+gboolean		li_pkg_index_remove_package (LiPkgIndex *pkidx,
+							LiPkgInfo *pki);
 guint			li_pkg_index_get_packages_count (LiPkgIndex *pkidx);
 
 gchar			*li_pkg_index_get_data (LiPkgIndex *pkidx);
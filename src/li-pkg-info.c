@@ -28,6 +28,7 @@
 #include "li-utils-private.h"
 #include "li-pkg-info.h"
 #include "li-config-data.h"
+#include "li-installed-db.h"
 
 typedef struct _LiPkgInfoPrivate	LiPkgInfoPrivate;
 struct _LiPkgInfoPrivate
@@ -41,6 +42,7 @@ struct _LiPkgInfoPrivate
 	gchar *runtime_uuid;
 	gchar *hash_sha256;
 	gchar *repo_location;
+	guint64 download_size;
 	gchar *cpt_kind;
 	gchar *abi_break_versions;
 
@@ -325,6 +327,10 @@ li_pkg_info_save_changes (LiPkgInfo *pki)
 	ret = li_pkg_info_save_to_file (pki, fname);
 	g_free (fname);
 
+	/* keep the installed-software database in sync */
+	if (ret)
+		li_installed_db_commit_package (pki);
+
 	return ret;
 }
 
@@ -461,9 +467,34 @@ void
 li_pkg_info_set_id (LiPkgInfo *pki, const gchar *id)
 {
 	LiPkgInfoPrivate *priv = GET_PRIVATE (pki);
+	g_free (priv->id);
 	priv->id = g_strdup (id);
 }
 
+/**
+ * li_pkg_info_get_format_version:
+ *
+ * Get the version of the metadata format this package
+ * description was written in.
+ */
+const gchar*
+li_pkg_info_get_format_version (LiPkgInfo *pki)
+{
+	LiPkgInfoPrivate *priv = GET_PRIVATE (pki);
+	return priv->format_version;
+}
+
+/**
+ * li_pkg_info_set_format_version:
+ */
+void
+li_pkg_info_set_format_version (LiPkgInfo *pki, const gchar *version)
+{
+	LiPkgInfoPrivate *priv = GET_PRIVATE (pki);
+	g_free (priv->format_version);
+	priv->format_version = g_strdup (version);
+}
+
 /**
  * li_pkg_info_get_dependencies:
  */
@@ -568,6 +599,32 @@ li_pkg_info_set_checksum_sha256 (LiPkgInfo *pki, const gchar *hash)
 	priv->hash_sha256 = g_strdup (hash);
 }
 
+/**
+ * li_pkg_info_get_download_size:
+ * @pki: An instance of #LiPkgInfo
+ *
+ * The size of the package file referenced by this package-info in bytes,
+ * or 0 if it is unknown.
+ * This is usually used in package-indices.
+ */
+guint64
+li_pkg_info_get_download_size (LiPkgInfo *pki)
+{
+	LiPkgInfoPrivate *priv = GET_PRIVATE (pki);
+	return priv->download_size;
+}
+
+/**
+ * li_pkg_info_set_download_size:
+ * @pki: An instance of #LiPkgInfo
+ */
+void
+li_pkg_info_set_download_size (LiPkgInfo *pki, guint64 size)
+{
+	LiPkgInfoPrivate *priv = GET_PRIVATE (pki);
+	priv->download_size = size;
+}
+
 /**
  * li_pkg_info_get_kind:
  * @pki: An instance of #LiPkgInfo
@@ -144,10 +144,18 @@ const gchar	*li_pkg_info_get_id (LiPkgInfo *pki);
 void		li_pkg_info_set_id (LiPkgInfo *pki,
 					const gchar *id);
 
+const gchar	*li_pkg_info_get_format_version (LiPkgInfo *pki);
+void		li_pkg_info_set_format_version (LiPkgInfo *pki,
+					const gchar *version);
+
 const gchar	*li_pkg_info_get_checksum_sha256 (LiPkgInfo *pki);
 void		li_pkg_info_set_checksum_sha256 (LiPkgInfo *pki,
 					const gchar *hash);
 
+guint64		li_pkg_info_get_download_size (LiPkgInfo *pki);
+void		li_pkg_info_set_download_size (LiPkgInfo *pki,
+					guint64 size);
+
 LiPackageKind	li_pkg_info_get_kind (LiPkgInfo *pki);
 void		li_pkg_info_set_kind (LiPkgInfo *pki,
 					LiPackageKind kind);
@@ -0,0 +1,440 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2016 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2.1 of the license, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * SECTION:li-progress
+ * @short_description: Rate-limit and coalesce progress updates
+ *
+ * Progress sources like downloads report far more often than anyone can
+ * display. A #LiProgressAggregator drops updates which don't change
+ * anything, and only lets one update per item and time window through,
+ * so listeners (and the system bus) aren't flooded.
+ * An update which was held back is emitted once the time window of its
+ * item has passed, from the thread-default main context of the thread
+ * which created the aggregator, so the last state is never lost.
+ * The aggregator is thread-safe.
+ */
+
+#include "config.h"
+#include "li-progress.h"
+
+typedef struct {
+	guint percentage;
+	guint64 bytes_done;
+	guint64 bytes_total;
+
+	gint64 last_emit;	/* time of the last emitted update, 0 if there was none */
+	guint emitted_percentage;
+	gboolean pending;	/* an update was held back */
+
+	gint64 rate_time;	/* time of the last rate sample */
+	guint64 rate_bytes;
+	gdouble rate;		/* smoothed bytes per second */
+} LiProgressItem;
+
+struct _LiProgressAggregator {
+	gint ref_count;	/* the flush source holds a reference */
+	GMutex mutex;
+	gint64 interval;	/* in µs */
+	LiProgressEmitFunc func;
+	gpointer user_data;
+	GHashTable *items;	/* id -> LiProgressItem */
+	LiProgressItem main_item;	/* for the NULL id */
+
+	LiProgressClockFunc clock_func;
+	gpointer clock_data;
+
+	GMainContext *context;	/* for emitting held back updates */
+	GSource *flush_source;
+};
+
+/**
+ * li_progress_monotonic_clock:
+ */
+static gint64
+li_progress_monotonic_clock (gpointer user_data)
+{
+	return g_get_monotonic_time ();
+}
+
+/**
+ * li_progress_aggregator_new:
+ * @interval_ms: Minimum time between two updates for the same item
+ * @func: Function to call to emit an update
+ * @user_data: Data for @func
+ *
+ * Returns: (transfer full): A new #LiProgressAggregator
+ */
+LiProgressAggregator*
+li_progress_aggregator_new (guint interval_ms, LiProgressEmitFunc func, gpointer user_data)
+{
+	LiProgressAggregator *agg;
+
+	agg = g_new0 (LiProgressAggregator, 1);
+	agg->ref_count = 1;
+	g_mutex_init (&agg->mutex);
+	agg->interval = (gint64) interval_ms * 1000;
+	agg->func = func;
+	agg->user_data = user_data;
+	agg->items = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	agg->main_item.emitted_percentage = G_MAXUINT;
+	agg->clock_func = li_progress_monotonic_clock;
+	agg->context = g_main_context_ref_thread_default ();
+
+	return agg;
+}
+
+/**
+ * li_progress_aggregator_set_clock:
+ * @agg: An instance of #LiProgressAggregator
+ * @func: Function returning the current time in µs
+ * @user_data: Data for @func
+ *
+ * Replace the monotonic clock the time windows and throughput are
+ * measured with, e.g. to test the aggregator with a fake clock.
+ * Held back updates are still emitted after the time window has passed
+ * in real time, if it has passed on the clock as well.
+ */
+void
+li_progress_aggregator_set_clock (LiProgressAggregator *agg, LiProgressClockFunc func, gpointer user_data)
+{
+	g_mutex_lock (&agg->mutex);
+	agg->clock_func = func;
+	agg->clock_data = user_data;
+	g_mutex_unlock (&agg->mutex);
+}
+
+/**
+ * li_progress_aggregator_unref:
+ */
+static void
+li_progress_aggregator_unref (LiProgressAggregator *agg)
+{
+	if (!g_atomic_int_dec_and_test (&agg->ref_count))
+		return;
+
+	g_main_context_unref (agg->context);
+	g_hash_table_unref (agg->items);
+	g_mutex_clear (&agg->mutex);
+	g_free (agg);
+}
+
+/**
+ * li_progress_aggregator_free:
+ *
+ * Free the aggregator. Held back updates which were not flushed are
+ * dropped, no updates are emitted anymore once this function returns.
+ */
+void
+li_progress_aggregator_free (LiProgressAggregator *agg)
+{
+	if (agg == NULL)
+		return;
+
+	/* the flush source checks whether it was destroyed while holding the lock */
+	g_mutex_lock (&agg->mutex);
+	if (agg->flush_source != NULL) {
+		g_source_destroy (agg->flush_source);
+		g_source_unref (agg->flush_source);
+		agg->flush_source = NULL;
+	}
+	g_mutex_unlock (&agg->mutex);
+
+	li_progress_aggregator_unref (agg);
+}
+
+/**
+ * li_progress_item_update_rate:
+ *
+ * Update the throughput, smoothed over roughly the last few seconds.
+ */
+static void
+li_progress_item_update_rate (LiProgressItem *item, gint64 now)
+{
+	gdouble elapsed;
+	gdouble sample;
+
+	if (item->rate_time == 0 || item->bytes_done < item->rate_bytes) {
+		item->rate_time = now;
+		item->rate_bytes = item->bytes_done;
+		return;
+	}
+
+	elapsed = (now - item->rate_time) / (gdouble) G_USEC_PER_SEC;
+	if (elapsed < 0.1)
+		return;
+
+	sample = (item->bytes_done - item->rate_bytes) / elapsed;
+	if (item->rate == 0)
+		item->rate = sample;
+	else
+		item->rate = 0.7 * item->rate + 0.3 * sample;
+
+	item->rate_time = now;
+	item->rate_bytes = item->bytes_done;
+}
+
+/**
+ * li_progress_aggregator_emit:
+ *
+ * Emit an update. Must be called without holding the lock, unless
+ * we are emitting held back updates from the flush source.
+ */
+static void
+li_progress_aggregator_emit (LiProgressAggregator *agg, const gchar *id, LiProgressItem *snapshot)
+{
+	agg->func (id,
+		   snapshot->percentage,
+		   snapshot->bytes_done,
+		   snapshot->bytes_total,
+		   (guint64) snapshot->rate,
+		   agg->user_data);
+}
+
+static void li_progress_aggregator_schedule_flush (LiProgressAggregator *agg, gint64 now);
+
+/**
+ * li_progress_aggregator_item_due:
+ *
+ * Returns: The time in µs until a held back update of @item may be emitted.
+ */
+static gint64
+li_progress_aggregator_item_due (LiProgressAggregator *agg, LiProgressItem *item, gint64 now)
+{
+	if (item->last_emit == 0)
+		return 0;
+	return MAX (item->last_emit + agg->interval - now, 0);
+}
+
+/**
+ * li_progress_aggregator_emit_due_item:
+ *
+ * Emit the held back update of @item if its time window has passed.
+ * Must be called with the lock held.
+ */
+static void
+li_progress_aggregator_emit_due_item (LiProgressAggregator *agg, const gchar *id, LiProgressItem *item, gint64 now)
+{
+	if (!item->pending)
+		return;
+	if (li_progress_aggregator_item_due (agg, item, now) > 0)
+		return;
+
+	item->last_emit = now;
+	item->emitted_percentage = item->percentage;
+	item->pending = FALSE;
+	li_progress_aggregator_emit (agg, id, item);
+}
+
+/**
+ * li_progress_aggregator_flush_cb:
+ *
+ * Emit the held back updates whose time window has passed (trailing edge).
+ * We emit while holding the lock, so the aggregator can't be freed under us.
+ */
+static gboolean
+li_progress_aggregator_flush_cb (gpointer user_data)
+{
+	LiProgressAggregator *agg = (LiProgressAggregator*) user_data;
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+	gint64 now;
+
+	g_mutex_lock (&agg->mutex);
+	if (g_source_is_destroyed (g_main_current_source ())) {
+		g_mutex_unlock (&agg->mutex);
+		return G_SOURCE_REMOVE;
+	}
+	g_source_unref (agg->flush_source);
+	agg->flush_source = NULL;
+
+	now = agg->clock_func (agg->clock_data);
+	g_hash_table_iter_init (&iter, agg->items);
+	while (g_hash_table_iter_next (&iter, &key, &value))
+		li_progress_aggregator_emit_due_item (agg, (const gchar*) key, (LiProgressItem*) value, now);
+	li_progress_aggregator_emit_due_item (agg, NULL, &agg->main_item, now);
+
+	/* other items might still be waiting */
+	li_progress_aggregator_schedule_flush (agg, now);
+	g_mutex_unlock (&agg->mutex);
+
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * li_progress_aggregator_schedule_flush:
+ *
+ * Make sure held back updates are emitted once the earliest
+ * time window has passed. Must be called with the lock held.
+ */
+static void
+li_progress_aggregator_schedule_flush (LiProgressAggregator *agg, gint64 now)
+{
+	GHashTableIter iter;
+	gpointer value;
+	gint64 due = G_MAXINT64;
+
+	if (agg->flush_source != NULL)
+		return;
+
+	g_hash_table_iter_init (&iter, agg->items);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		LiProgressItem *item = (LiProgressItem*) value;
+		if (item->pending)
+			due = MIN (due, li_progress_aggregator_item_due (agg, item, now));
+	}
+	if (agg->main_item.pending)
+		due = MIN (due, li_progress_aggregator_item_due (agg, &agg->main_item, now));
+	if (due == G_MAXINT64)
+		return;
+
+	/* round up, so the window has passed when we are called */
+	agg->flush_source = g_timeout_source_new ((guint) ((due + 999) / 1000));
+	g_atomic_int_inc (&agg->ref_count);
+	g_source_set_callback (agg->flush_source, li_progress_aggregator_flush_cb,
+			       agg, (GDestroyNotify) li_progress_aggregator_unref);
+	g_source_set_name (agg->flush_source, "[LiProgressAggregator] flush");
+	g_source_attach (agg->flush_source, agg->context);
+}
+
+/**
+ * li_progress_aggregator_update:
+ * @agg: An instance of #LiProgressAggregator
+ * @id: The item the progress belongs to, or %NULL for the overall progress
+ * @percentage: The new percentage
+ * @bytes_done: Number of bytes processed so far, 0 if unknown
+ * @bytes_total: Number of bytes to process, 0 if unknown
+ *
+ * Report new progress. The update is emitted right away if the percentage
+ * changed and the last update of this item is older than the time window.
+ * Reaching 100% is always emitted immediately, other updates are held back
+ * until the time window has passed, the next update or li_progress_aggregator_flush().
+ */
+void
+li_progress_aggregator_update (LiProgressAggregator *agg, const gchar *id, guint percentage, guint64 bytes_done, guint64 bytes_total)
+{
+	LiProgressItem *item;
+	LiProgressItem snapshot;
+	gint64 now;
+	gboolean emit = FALSE;
+
+	if (percentage > 100)
+		percentage = 100;
+
+	g_mutex_lock (&agg->mutex);
+	now = agg->clock_func (agg->clock_data);
+	if (id == NULL) {
+		item = &agg->main_item;
+	} else {
+		item = g_hash_table_lookup (agg->items, id);
+		if (item == NULL) {
+			item = g_new0 (LiProgressItem, 1);
+			item->emitted_percentage = G_MAXUINT;
+			g_hash_table_insert (agg->items, g_strdup (id), item);
+		}
+	}
+
+	item->percentage = percentage;
+	item->bytes_done = bytes_done;
+	item->bytes_total = bytes_total;
+	if (bytes_done > 0)
+		li_progress_item_update_rate (item, now);
+
+	if (percentage != item->emitted_percentage) {
+		if ((percentage == 100) || (li_progress_aggregator_item_due (agg, item, now) == 0))
+			emit = TRUE;
+		else
+			item->pending = TRUE;
+	}
+
+	if (emit) {
+		item->last_emit = now;
+		item->emitted_percentage = percentage;
+		item->pending = FALSE;
+		snapshot = *item;
+	} else if (item->pending) {
+		li_progress_aggregator_schedule_flush (agg, now);
+	}
+	g_mutex_unlock (&agg->mutex);
+
+	if (emit)
+		li_progress_aggregator_emit (agg, id, &snapshot);
+}
+
+/**
+ * li_progress_aggregator_flush:
+ *
+ * Emit all updates which were held back.
+ */
+void
+li_progress_aggregator_flush (LiProgressAggregator *agg)
+{
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+	g_autoptr(GPtrArray) ids = NULL;
+	g_autoptr(GArray) snapshots = NULL;
+	guint i;
+
+	ids = g_ptr_array_new_with_free_func (g_free);
+	snapshots = g_array_new (FALSE, FALSE, sizeof (LiProgressItem));
+
+	g_mutex_lock (&agg->mutex);
+	g_hash_table_iter_init (&iter, agg->items);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		LiProgressItem *item = (LiProgressItem*) value;
+		if (!item->pending)
+			continue;
+		item->pending = FALSE;
+		item->emitted_percentage = item->percentage;
+		g_ptr_array_add (ids, g_strdup ((const gchar*) key));
+		g_array_append_val (snapshots, *item);
+	}
+	if (agg->main_item.pending) {
+		agg->main_item.pending = FALSE;
+		agg->main_item.emitted_percentage = agg->main_item.percentage;
+		g_ptr_array_add (ids, NULL);
+		g_array_append_val (snapshots, agg->main_item);
+	}
+	g_mutex_unlock (&agg->mutex);
+
+	for (i = 0; i < ids->len; i++)
+		li_progress_aggregator_emit (agg,
+					     (const gchar*) g_ptr_array_index (ids, i),
+					     &g_array_index (snapshots, LiProgressItem, i));
+}
+
+/**
+ * li_progress_estimate_eta:
+ * @bytes_done: Number of bytes processed so far
+ * @bytes_total: Number of bytes to process
+ * @rate: Throughput in bytes per second
+ *
+ * Returns: Estimated number of seconds until all bytes are processed,
+ * or 0 if that can not be estimated yet.
+ */
+guint
+li_progress_estimate_eta (guint64 bytes_done, guint64 bytes_total, guint64 rate)
+{
+	if ((rate == 0) || (bytes_done >= bytes_total))
+		return 0;
+	return (guint) MIN ((bytes_total - bytes_done) / rate + 1, G_MAXUINT);
+}
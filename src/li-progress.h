@@ -0,0 +1,86 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2016 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2.1 of the license, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined (__LIMBA_H) && !defined (LI_COMPILATION)
+#error "Only <limba.h> can be included directly."
+#endif
+
+#ifndef __LI_PROGRESS_H
+#define __LI_PROGRESS_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* default time window progress updates are coalesced in */
+#define LI_PROGRESS_DEFAULT_INTERVAL_MS 250
+
+/**
+ * LiProgressEmitFunc:
+ * @id: The ID of the item the progress belongs to, or %NULL for the overall progress
+ * @percentage: Progress percentage
+ * @bytes_done: Number of bytes processed so far, 0 if unknown
+ * @bytes_total: Number of bytes to process, 0 if unknown
+ * @rate: Throughput in bytes per second, 0 if unknown
+ * @user_data: User data
+ *
+ * Called by a #LiProgressAggregator to emit a progress update.
+ */
+typedef void (*LiProgressEmitFunc) (const gchar *id,
+				    guint percentage,
+				    guint64 bytes_done,
+				    guint64 bytes_total,
+				    guint64 rate,
+				    gpointer user_data);
+
+/**
+ * LiProgressClockFunc:
+ * @user_data: User data
+ *
+ * Returns: The current time in µs, on a clock which never goes backwards.
+ */
+typedef gint64 (*LiProgressClockFunc) (gpointer user_data);
+
+typedef struct _LiProgressAggregator LiProgressAggregator;
+
+LiProgressAggregator	*li_progress_aggregator_new (guint interval_ms,
+							LiProgressEmitFunc func,
+							gpointer user_data);
+void			li_progress_aggregator_free (LiProgressAggregator *agg);
+void			li_progress_aggregator_set_clock (LiProgressAggregator *agg,
+							LiProgressClockFunc func,
+							gpointer user_data);
+
+void			li_progress_aggregator_update (LiProgressAggregator *agg,
+							const gchar *id,
+							guint percentage,
+							guint64 bytes_done,
+							guint64 bytes_total);
+void			li_progress_aggregator_flush (LiProgressAggregator *agg);
+
+guint			li_progress_estimate_eta (guint64 bytes_done,
+							guint64 bytes_total,
+							guint64 rate);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (LiProgressAggregator, li_progress_aggregator_free)
+
+G_END_DECLS
+
+#endif /* __LI_PROGRESS_H */
@@ -47,6 +47,12 @@ struct _LiRepoEntryClass
 #define LIMBA_CACHE_DIR "/var/cache/limba/"
 #define APPSTREAM_CACHE_DIR "/var/cache/app-info/"
 
+/* repository format: version 2 splits indices into hash-named shards,
+ * which are listed in the signed index list as "<sha256>\tshard\t<index>\t<key>" */
+#define LI_REPO_FORMAT_VERSION_LINE "Format-Version: 2"
+#define LI_REPO_SHARD_TAG "shard"
+#define LI_REPO_SHARD_COUNT 32
+
 /**
  * LiRepoIndexKinds:
  * @LI_REPO_INDEX_KIND_NONE:		Source entry has no kind (= it is disabled)
@@ -44,6 +44,13 @@
 #include "li-package.h"
 #include "li-package-private.h"
 #include "li-repo-entry.h"
+#include "li-checksum.h"
+
+/* checksums of the index files we published, relative to the repository root */
+#define LI_REPO_CHECKSUM_CACHE_FNAME ".index-checksums"
+
+/* icon sizes we publish, as mandated by the AppStream spec */
+static const gchar *li_repo_icon_sizes[] = { "64x64", "128x128" };
 
 typedef struct _LiRepositoryPrivate	LiRepositoryPrivate;
 struct _LiRepositoryPrivate
@@ -52,12 +59,76 @@ struct _LiRepositoryPrivate
 	GHashTable *asmeta;
 	gchar *repo_path;
 
+	GHashTable *dirty; /* internal names of indices which need to be written */
+	GHashTable *checksums; /* internal name -> LiIndexChecksum */
+	gboolean icons_dirty;
+	GHashTable *new_icons; /* icon files added since the icons were published */
+
 	LiConfigData *rconfig;
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE (LiRepository, li_repository, G_TYPE_OBJECT)
 #define GET_PRIVATE(o) (li_repository_get_instance_private (o))
 
+/**
+ * LiIndexChecksum:
+ *
+ * Cached checksum of a published index file. It is only valid as long
+ * as size and modification time of the file don't change.
+ */
+typedef struct {
+	gchar *checksum;
+	guint64 size;
+	gint64 mtime;
+} LiIndexChecksum;
+
+/**
+ * li_index_checksum_free:
+ */
+static void
+li_index_checksum_free (LiIndexChecksum *ic)
+{
+	g_free (ic->checksum);
+	g_free (ic);
+}
+
+/**
+ * li_repository_load_checksum_cache:
+ *
+ * Load the checksums of the index files we published last time.
+ */
+static void
+li_repository_load_checksum_cache (LiRepository *repo, const gchar *directory)
+{
+	g_autofree gchar *fname = NULL;
+	g_autofree gchar *data = NULL;
+	g_auto(GStrv) lines = NULL;
+	guint i;
+	LiRepositoryPrivate *priv = GET_PRIVATE (repo);
+
+	g_hash_table_remove_all (priv->checksums);
+
+	fname = g_build_filename (directory, LI_REPO_CHECKSUM_CACHE_FNAME, NULL);
+	if (!g_file_get_contents (fname, &data, NULL, NULL))
+		return;
+
+	lines = g_strsplit (data, "\n", -1);
+	for (i = 0; lines[i] != NULL; i++) {
+		g_auto(GStrv) parts = NULL;
+		LiIndexChecksum *ic;
+
+		parts = g_strsplit (lines[i], "\t", 4);
+		if (g_strv_length (parts) != 4)
+			continue;
+
+		ic = g_new0 (LiIndexChecksum, 1);
+		ic->checksum = g_strdup (parts[0]);
+		ic->size = g_ascii_strtoull (parts[2], NULL, 10);
+		ic->mtime = g_ascii_strtoll (parts[3], NULL, 10);
+		g_hash_table_insert (priv->checksums, g_strdup (parts[1]), ic);
+	}
+}
+
 /**
  * li_repository_finalize:
  **/
@@ -70,6 +141,9 @@ li_repository_finalize (GObject *object)
 	g_free (priv->repo_path);
 	g_hash_table_unref (priv->indices);
 	g_hash_table_unref (priv->asmeta);
+	g_hash_table_unref (priv->dirty);
+	g_hash_table_unref (priv->checksums);
+	g_hash_table_unref (priv->new_icons);
 	g_object_unref (priv->rconfig);
 
 	G_OBJECT_CLASS (li_repository_parent_class)->finalize (object);
@@ -85,6 +159,9 @@ li_repository_init (LiRepository *repo)
 
 	priv->indices = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_hash_table_unref);
 	priv->asmeta = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+	priv->dirty = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	priv->checksums = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) li_index_checksum_free);
+	priv->new_icons = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 	priv->rconfig = li_config_data_new ();
 }
 
@@ -282,6 +359,9 @@ li_repository_open (LiRepository *repo, const gchar *directory, GError **error)
 	/* cleanup everything */
 	g_hash_table_remove_all (priv->asmeta);
 	g_hash_table_remove_all (priv->indices);
+	g_hash_table_remove_all (priv->dirty);
+	priv->icons_dirty = FALSE;
+	g_hash_table_remove_all (priv->new_icons);
 	g_object_unref (priv->rconfig);
 	priv->rconfig = li_config_data_new ();
 
@@ -307,6 +387,8 @@ li_repository_open (LiRepository *repo, const gchar *directory, GError **error)
 		return FALSE;
 	}
 
+	li_repository_load_checksum_cache (repo, directory);
+
 	g_free (priv->repo_path);
 	priv->repo_path = g_strdup (directory);
 
@@ -428,162 +510,581 @@ li_repository_sign (LiRepository *repo, const gchar *sigtext, GError **error)
 }
 
 /**
- * LiIndexSaveHelper:
- * 
- * Temporary helper structure, to make saving and hashing indices easier
+ * li_repository_get_index_basename:
+ * @kind: The index kind, or %LI_REPO_INDEX_KIND_NONE for AppStream metadata
  */
-typedef struct {
-	LiRepository *repo;
-	GString *sigtext;
-	LiRepoIndexKinds ikind;
+static const gchar*
+li_repository_get_index_basename (LiRepoIndexKinds kind)
+{
+	if (kind == LI_REPO_INDEX_KIND_COMMON)
+		return "Index.gz";
+	if (kind == LI_REPO_INDEX_KIND_DEVEL)
+		return "Index-Devel.gz";
+	if (kind == LI_REPO_INDEX_KIND_SOURCE)
+		return "Index-Sources.gz";
+	return "Metadata.xml.gz";
+}
+
+/**
+ * li_repository_mark_dirty:
+ * @kind: The index kind, or %LI_REPO_INDEX_KIND_NONE for AppStream metadata
+ *
+ * Mark an index as changed, so it gets written on the next save.
+ */
+static void
+li_repository_mark_dirty (LiRepository *repo, LiRepoIndexKinds kind, const gchar *arch)
+{
+	LiRepositoryPrivate *priv = GET_PRIVATE (repo);
+
+	g_hash_table_add (priv->dirty,
+			  g_build_filename ("indices", arch, li_repository_get_index_basename (kind), NULL));
+}
 
+/**
+ * LiIndexSaveTask:
+ *
+ * One index or metadata file to write and hash. Tasks are processed
+ * in parallel, each one only touches its own data.
+ */
+typedef struct {
+	const gchar *repo_path;
+	gchar *arch;
+	LiRepoIndexKinds ikind; /* LI_REPO_INDEX_KIND_NONE for AppStream metadata */
+	gpointer data; /* LiPkgIndex or AsMetadata */
+	gboolean write; /* FALSE if the file is unchanged and only needs a checksum */
+
+	gchar *internal_name;
+	gchar *checksum;
+	GPtrArray *shards; /* of LiIndexShard, NULL if they need to be written */
 	GError *error;
-} LiIndexSaveHelper;
+} LiIndexSaveTask;
 
 /**
- * li_repository_save_indices_helper:
+ * LiIndexShard:
  *
- * Helper function to save the package-index hashtable on disk
+ * Part of an index, containing all entries whose package name hashes to @key.
+ * Shards are named by their checksum, so clients only need to fetch the ones
+ * which changed.
+ */
+typedef struct {
+	gchar *key;
+	gchar *checksum;
+} LiIndexShard;
+
+/**
+ * li_index_shard_new:
+ */
+static LiIndexShard*
+li_index_shard_new (const gchar *key, const gchar *checksum)
+{
+	LiIndexShard *shard;
+
+	shard = g_new0 (LiIndexShard, 1);
+	shard->key = g_strdup (key);
+	shard->checksum = g_strdup (checksum);
+
+	return shard;
+}
+
+/**
+ * li_index_shard_free:
  */
 static void
-li_repository_save_indices_helper (gchar *arch, LiPkgIndex *index, LiIndexSaveHelper *helper)
+li_index_shard_free (LiIndexShard *shard)
 {
-	g_autofree gchar *fname = NULL;
-	g_autofree gchar *dir = NULL;
-	g_autofree gchar *checksum = NULL;
-	g_autofree gchar *internal_name = NULL;
-	LiRepositoryPrivate *priv = GET_PRIVATE (helper->repo);
+	g_free (shard->key);
+	g_free (shard->checksum);
+	g_free (shard);
+}
 
-	/* don't continue if we already have an error */
-	if (helper->error != NULL)
-		return;
+/**
+ * li_index_shard_cmp:
+ */
+static gint
+li_index_shard_cmp (gconstpointer a, gconstpointer b)
+{
+	LiIndexShard *s1 = *((LiIndexShard**) a);
+	LiIndexShard *s2 = *((LiIndexShard**) b);
+	return g_strcmp0 (s1->key, s2->key);
+}
 
-	dir = g_build_filename (priv->repo_path, "indices", arch, NULL);
-	g_mkdir_with_parents (dir, 0755);
+/**
+ * li_repository_get_shard_key:
+ *
+ * Returns: The shard a package with the given name belongs to.
+ */
+static gchar*
+li_repository_get_shard_key (const gchar *pkgname)
+{
+	return g_strdup_printf ("%02x", g_str_hash (pkgname) % LI_REPO_SHARD_COUNT);
+}
 
-	if (helper->ikind == LI_REPO_INDEX_KIND_COMMON)
-		fname = g_build_filename (dir, "Index.gz", NULL);
-	else if (helper->ikind == LI_REPO_INDEX_KIND_DEVEL)
-		fname = g_build_filename (dir, "Index-Devel.gz", NULL);
-	else if (helper->ikind == LI_REPO_INDEX_KIND_SOURCE)
-		fname = g_build_filename (dir, "Index-Sources.gz", NULL);
-	else
-		g_critical ("Handling unknown repository index type: %i", (gint) helper->ikind);
+/**
+ * li_repository_get_shard_fname:
+ */
+static gchar*
+li_repository_get_shard_fname (const gchar *repo_path, const gchar *arch, const gchar *checksum)
+{
+	g_autofree gchar *basename = NULL;
+
+	basename = g_strdup_printf ("%s.gz", checksum);
+	return g_build_filename (repo_path, "indices", arch, "shards", basename, NULL);
+}
+
+/**
+ * li_index_save_task_free:
+ */
+static void
+li_index_save_task_free (LiIndexSaveTask *task)
+{
+	g_free (task->arch);
+	g_free (task->internal_name);
+	g_free (task->checksum);
+	if (task->shards != NULL)
+		g_ptr_array_unref (task->shards);
+	if (task->error != NULL)
+		g_error_free (task->error);
+	g_free (task);
+}
+
+/**
+ * li_index_save_task_cmp:
+ *
+ * Sort tasks by file name, so the signed checksum list does not depend
+ * on the order tasks were finished in.
+ */
+static gint
+li_index_save_task_cmp (gconstpointer a, gconstpointer b)
+{
+	LiIndexSaveTask *t1 = *((LiIndexSaveTask**) a);
+	LiIndexSaveTask *t2 = *((LiIndexSaveTask**) b);
+	return g_strcmp0 (t1->internal_name, t2->internal_name);
+}
+
+/**
+ * li_repository_save_metadata:
+ *
+ * Write AppStream metadata from a save task.
+ * AppStream's serializer is not thread-safe, so only one
+ * worker may use it at a time.
+ */
+static gboolean
+li_repository_save_metadata (AsMetadata *metad, const gchar *fname, GError **error)
+{
+	static GMutex save_lock;
+	GError *tmp_error = NULL;
+
+	g_mutex_lock (&save_lock);
+	as_metadata_save_collection (metad, fname, AS_FORMAT_KIND_XML, &tmp_error);
+	g_mutex_unlock (&save_lock);
+
+	if (tmp_error != NULL) {
+		g_propagate_error (error, tmp_error);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * li_repository_write_shards:
+ *
+ * Split the index of @task into shards and write the ones which
+ * don't exist yet.
+ */
+static void
+li_repository_write_shards (LiIndexSaveTask *task)
+{
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+	guint i;
+	g_autofree gchar *shard_dir = NULL;
+	g_autoptr(GHashTable) parts = NULL;
 
-	li_pkg_index_save_to_file (index, fname);
+	parts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+	if (task->ikind == LI_REPO_INDEX_KIND_NONE) {
+		GPtrArray *cpts = as_metadata_get_components (AS_METADATA (task->data));
 
-	if (g_str_has_prefix (fname, priv->repo_path)) {
-		internal_name = g_strdup (&fname[strlen (priv->repo_path) + 1]);
+		for (i = 0; i < cpts->len; i++) {
+			AsMetadata *metad;
+			g_autofree gchar *pkgname = NULL;
+			g_autofree gchar *shard_key = NULL;
+			AsComponent *cpt = AS_COMPONENT (g_ptr_array_index (cpts, i));
+
+			pkgname = li_get_pkgname_from_component (cpt);
+			shard_key = li_repository_get_shard_key (pkgname != NULL? pkgname : "");
+
+			metad = g_hash_table_lookup (parts, shard_key);
+			if (metad == NULL) {
+				metad = as_metadata_new ();
+				as_metadata_set_locale (metad, "ALL");
+				as_metadata_set_origin (metad, as_metadata_get_origin (AS_METADATA (task->data)));
+				g_hash_table_insert (parts, g_steal_pointer (&shard_key), metad);
+			}
+			as_metadata_add_component (metad, cpt);
+		}
 	} else {
-		internal_name = g_path_get_basename (fname);
+		GPtrArray *pkgs = li_pkg_index_get_packages (LI_PKG_INDEX (task->data));
+
+		for (i = 0; i < pkgs->len; i++) {
+			LiPkgIndex *index;
+			g_autofree gchar *shard_key = NULL;
+			LiPkgInfo *pki = LI_PKG_INFO (g_ptr_array_index (pkgs, i));
+
+			shard_key = li_repository_get_shard_key (li_pkg_info_get_name (pki));
+			index = g_hash_table_lookup (parts, shard_key);
+			if (index == NULL) {
+				index = li_pkg_index_new ();
+				g_hash_table_insert (parts, g_steal_pointer (&shard_key), index);
+			}
+			li_pkg_index_add_package (index, pki);
+		}
 	}
 
-	checksum = li_compute_checksum_for_file (fname);
-	if (checksum == NULL) {
-		g_set_error (&helper->error,
-			LI_REPOSITORY_ERROR,
-			LI_REPOSITORY_ERROR_SIGN,
-			_("Unable to calculate checksum for: %s"),
-			internal_name);
-		return;
+	task->shards = g_ptr_array_new_with_free_func ((GDestroyNotify) li_index_shard_free);
+	shard_dir = g_build_filename (task->repo_path, "indices", task->arch, "shards", NULL);
+
+	g_hash_table_iter_init (&iter, parts);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		g_autofree gchar *tmp = NULL;
+		g_autofree gchar *tmp_fname = NULL;
+		g_autofree gchar *fname = NULL;
+		g_autofree gchar *checksum = NULL;
+
+		/* the ".gz" suffix makes AppStream compress the data */
+		tmp = g_strdup_printf ("_new-%s-%s", (const gchar*) key, li_repository_get_index_basename (task->ikind));
+		tmp_fname = g_build_filename (shard_dir, tmp, NULL);
+
+		if (task->ikind == LI_REPO_INDEX_KIND_NONE) {
+			if (!li_repository_save_metadata (AS_METADATA (value), tmp_fname, &task->error))
+				return;
+		} else {
+			li_pkg_index_save_to_file (LI_PKG_INDEX (value), tmp_fname);
+		}
+
+		checksum = li_compute_checksum_for_file (tmp_fname);
+		if (checksum == NULL) {
+			g_set_error (&task->error,
+				LI_REPOSITORY_ERROR,
+				LI_REPOSITORY_ERROR_SIGN,
+				_("Unable to calculate checksum for: %s"),
+				tmp_fname);
+			return;
+		}
+
+		/* shards are immutable, an existing one has the same content */
+		fname = li_repository_get_shard_fname (task->repo_path, task->arch, checksum);
+		if (g_file_test (fname, G_FILE_TEST_EXISTS)) {
+			g_remove (tmp_fname);
+		} else if (g_rename (tmp_fname, fname) != 0) {
+			g_set_error (&task->error,
+				LI_REPOSITORY_ERROR,
+				LI_REPOSITORY_ERROR_FAILED,
+				_("Unable to write index shard '%s': %s"),
+				fname,
+				g_strerror (errno));
+			return;
+		}
+
+		g_ptr_array_add (task->shards, li_index_shard_new ((const gchar*) key, checksum));
 	}
 
-	g_string_append_printf (helper->sigtext, "%s\t%s\n", checksum, internal_name);
+	g_ptr_array_sort (task->shards, li_index_shard_cmp);
 }
 
 /**
- * li_repository_save_indices:
+ * li_repository_save_task_run:
+ *
+ * Worker function to save and hash an index or metadata file.
  */
-static gboolean
-li_repository_save_indices (LiRepository *repo, GString *sigtext, LiRepoIndexKinds kind, GError **error)
+static void
+li_repository_save_task_run (LiIndexSaveTask *task, gpointer user_data)
 {
-	LiIndexSaveHelper helper;
-	GHashTable *index_tab;
+	g_autofree gchar *fname = NULL;
+
+	fname = g_build_filename (task->repo_path, task->internal_name, NULL);
+
+	if (!task->write) {
+		/* nothing changed, but we don't know the checksum anymore */
+	} else if (task->ikind == LI_REPO_INDEX_KIND_NONE) {
+		if (!li_repository_save_metadata (AS_METADATA (task->data), fname, &task->error))
+			return;
+	} else {
+		li_pkg_index_save_to_file (LI_PKG_INDEX (task->data), fname);
+	}
+
+	if (task->checksum == NULL) {
+		task->checksum = li_compute_checksum_for_file (fname);
+		if (task->checksum == NULL) {
+			g_set_error (&task->error,
+				LI_REPOSITORY_ERROR,
+				LI_REPOSITORY_ERROR_SIGN,
+				_("Unable to calculate checksum for: %s"),
+				task->internal_name);
+			return;
+		}
+	}
+
+	if (task->shards == NULL)
+		li_repository_write_shards (task);
+}
+
+/**
+ * li_repository_get_cached_shards:
+ *
+ * Get the shards of an unchanged index from the checksum cache.
+ *
+ * Returns: The shards, or %NULL if they need to be written.
+ */
+static GPtrArray*
+li_repository_get_cached_shards (LiRepository *repo, LiIndexSaveTask *task)
+{
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+	gboolean empty;
+	g_autofree gchar *prefix = NULL;
+	g_autoptr(GPtrArray) shards = NULL;
 	LiRepositoryPrivate *priv = GET_PRIVATE (repo);
 
-	index_tab = g_hash_table_lookup (priv->indices,
-					li_repo_index_kind_to_string (kind));
+	if (task->ikind == LI_REPO_INDEX_KIND_NONE)
+		empty = as_metadata_get_components (AS_METADATA (task->data))->len == 0;
+	else
+		empty = li_pkg_index_get_packages_count (LI_PKG_INDEX (task->data)) == 0;
 
-	/* do we have indices of this kind to save? */
-	if (index_tab == NULL)
-		return TRUE;
+	shards = g_ptr_array_new_with_free_func ((GDestroyNotify) li_index_shard_free);
+	prefix = g_strdup_printf ("%s#", task->internal_name);
 
-	helper.repo = repo;
-	helper.sigtext = sigtext;
-	helper.error = NULL;
-	helper.ikind = kind;
+	g_hash_table_iter_init (&iter, priv->checksums);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		g_autofree gchar *fname = NULL;
+		LiIndexChecksum *ic = (LiIndexChecksum*) value;
 
-	g_hash_table_foreach (index_tab,
-				(GHFunc) li_repository_save_indices_helper,
-				&helper);
-	if (helper.error != NULL) {
-		g_propagate_error (error, helper.error);
-		return FALSE;
+		if (!g_str_has_prefix ((const gchar*) key, prefix))
+			continue;
+
+		fname = li_repository_get_shard_fname (priv->repo_path, task->arch, ic->checksum);
+		if (!g_file_test (fname, G_FILE_TEST_EXISTS))
+			return NULL;
+		g_ptr_array_add (shards,
+				 li_index_shard_new ((const gchar*) key + strlen (prefix), ic->checksum));
 	}
 
-	return TRUE;
+	/* the index was written by an older version which didn't create shards */
+	if ((shards->len == 0) && !empty)
+		return NULL;
+
+	g_ptr_array_sort (shards, li_index_shard_cmp);
+	return g_steal_pointer (&shards);
 }
 
 /**
- * li_repository_save_asmeta:
+ * li_repository_add_save_tasks:
  *
- * Helper function to save the AppStream metadata hashtable on disk
+ * Queue a task for every architecture in @tab. Indices which were not
+ * changed since they were last written are not serialized again, and if
+ * the file on disk was not touched either, we reuse its known checksum.
  */
 static void
-li_repository_save_asmeta (gchar *arch, AsMetadata *metad, LiIndexSaveHelper *helper)
+li_repository_add_save_tasks (LiRepository *repo, GPtrArray *tasks, GHashTable *tab, LiRepoIndexKinds kind)
 {
-	g_autofree gchar *fname = NULL;
-	g_autofree gchar *dir = NULL;
-	g_autofree gchar *checksum = NULL;
-	g_autofree gchar *internal_name = NULL;
-	LiRepositoryPrivate *priv = GET_PRIVATE (helper->repo);
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+	LiRepositoryPrivate *priv = GET_PRIVATE (repo);
 
-	/* don't continue if we already have an error */
-	if (helper->error != NULL)
+	/* do we have indices of this kind to save? */
+	if (tab == NULL)
 		return;
 
-	dir = g_build_filename (priv->repo_path, "indices", arch, NULL);
-	g_mkdir_with_parents (dir, 0755);
+	g_hash_table_iter_init (&iter, tab);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		LiIndexSaveTask *task;
+		LiIndexChecksum *ic;
+		GStatBuf st;
+		g_autofree gchar *fname = NULL;
+		g_autofree gchar *shard_dir = NULL;
+
+		task = g_new0 (LiIndexSaveTask, 1);
+		task->repo_path = priv->repo_path;
+		task->arch = g_strdup ((const gchar*) key);
+		task->ikind = kind;
+		task->data = value;
+		task->internal_name = g_build_filename ("indices",
+							task->arch,
+							li_repository_get_index_basename (kind),
+							NULL);
+		g_ptr_array_add (tasks, task);
+
+		/* create directories here, so workers never race for them */
+		shard_dir = g_build_filename (priv->repo_path, "indices", task->arch, "shards", NULL);
+		g_mkdir_with_parents (shard_dir, 0755);
+
+		fname = g_build_filename (priv->repo_path, task->internal_name, NULL);
+		if (g_hash_table_contains (priv->dirty, task->internal_name) || (g_stat (fname, &st) != 0)) {
+			task->write = TRUE;
+			continue;
+		}
 
-	fname = g_build_filename (dir, "Metadata.xml.gz", NULL);
-	as_metadata_save_collection (metad,
-				     fname,
-				     AS_FORMAT_KIND_XML,
-				     &helper->error);
-	if (helper->error != NULL)
-		return;
+		ic = g_hash_table_lookup (priv->checksums, task->internal_name);
+		if ((ic != NULL) && (ic->size == (guint64) st.st_size) && (ic->mtime == (gint64) st.st_mtime)) {
+			task->checksum = g_strdup (ic->checksum);
+			task->shards = li_repository_get_cached_shards (repo, task);
+		}
+	}
+}
 
-	if (g_str_has_prefix (fname, priv->repo_path)) {
-		internal_name = g_strdup (&fname[strlen (priv->repo_path) + 1]);
-	} else {
-		internal_name = g_path_get_basename (fname);
+/**
+ * li_repository_save_checksum_cache:
+ */
+static void
+li_repository_save_checksum_cache (LiRepository *repo, GPtrArray *tasks)
+{
+	guint i, j;
+	g_autoptr(GString) data = NULL;
+	g_autofree gchar *fname = NULL;
+	LiRepositoryPrivate *priv = GET_PRIVATE (repo);
+
+	g_hash_table_remove_all (priv->checksums);
+
+	data = g_string_new ("");
+	for (i = 0; i < tasks->len; i++) {
+		GStatBuf st;
+		LiIndexChecksum *ic;
+		g_autofree gchar *index_fname = NULL;
+		LiIndexSaveTask *task = (LiIndexSaveTask*) g_ptr_array_index (tasks, i);
+
+		index_fname = g_build_filename (priv->repo_path, task->internal_name, NULL);
+		if (g_stat (index_fname, &st) != 0)
+			continue;
+
+		ic = g_new0 (LiIndexChecksum, 1);
+		ic->checksum = g_strdup (task->checksum);
+		ic->size = st.st_size;
+		ic->mtime = st.st_mtime;
+		g_hash_table_insert (priv->checksums, g_strdup (task->internal_name), ic);
+
+		g_string_append_printf (data, "%s\t%s\t%" G_GUINT64_FORMAT "\t%" G_GINT64_FORMAT "\n",
+					ic->checksum,
+					task->internal_name,
+					ic->size,
+					ic->mtime);
+
+		/* shards are stored as "<index>#<key>" */
+		for (j = 0; j < task->shards->len; j++) {
+			g_autofree gchar *shard_fname = NULL;
+			g_autofree gchar *shard_name = NULL;
+			LiIndexShard *shard = (LiIndexShard*) g_ptr_array_index (task->shards, j);
+
+			shard_fname = li_repository_get_shard_fname (priv->repo_path, task->arch, shard->checksum);
+			if (g_stat (shard_fname, &st) != 0)
+				continue;
+
+			shard_name = g_strdup_printf ("%s#%s", task->internal_name, shard->key);
+			ic = g_new0 (LiIndexChecksum, 1);
+			ic->checksum = g_strdup (shard->checksum);
+			ic->size = st.st_size;
+			ic->mtime = st.st_mtime;
+			g_hash_table_insert (priv->checksums, g_strdup (shard_name), ic);
+
+			g_string_append_printf (data, "%s\t%s\t%" G_GUINT64_FORMAT "\t%" G_GINT64_FORMAT "\n",
+						ic->checksum,
+						shard_name,
+						ic->size,
+						ic->mtime);
+		}
 	}
 
-	checksum = li_compute_checksum_for_file (fname);
-	if (checksum == NULL) {
-		g_set_error (&helper->error,
-			LI_REPOSITORY_ERROR,
-			LI_REPOSITORY_ERROR_SIGN,
-			_("Unable to calculate checksum for: %s"),
-			internal_name);
-		return;
+	/* the cache is just an optimization, we can live without it */
+	fname = g_build_filename (priv->repo_path, LI_REPO_CHECKSUM_CACHE_FNAME, NULL);
+	if (!g_file_set_contents (fname, data->str, data->len, NULL))
+		g_warning ("Unable to write index checksum cache.");
+}
+
+/**
+ * li_repository_prune_shards:
+ *
+ * Remove shards which are not referenced by any index anymore.
+ * Shards of the previously published generation are kept, so clients
+ * which still have the old signed index list can finish their update.
+ * This needs to run before the checksum cache is replaced.
+ */
+static void
+li_repository_prune_shards (LiRepository *repo, GPtrArray *tasks)
+{
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+	guint i, j;
+	g_autoptr(GHashTable) known = NULL;
+	g_autoptr(GHashTable) dirs = NULL;
+	LiRepositoryPrivate *priv = GET_PRIVATE (repo);
+
+	known = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	dirs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	for (i = 0; i < tasks->len; i++) {
+		LiIndexSaveTask *task = (LiIndexSaveTask*) g_ptr_array_index (tasks, i);
+
+		g_hash_table_add (dirs, g_build_filename (priv->repo_path, "indices", task->arch, "shards", NULL));
+		for (j = 0; j < task->shards->len; j++) {
+			LiIndexShard *shard = (LiIndexShard*) g_ptr_array_index (task->shards, j);
+			g_hash_table_add (known, li_repository_get_shard_fname (priv->repo_path, task->arch, shard->checksum));
+		}
+	}
+
+	/* the checksum cache still describes the previous generation */
+	g_hash_table_iter_init (&iter, priv->checksums);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		g_auto(GStrv) parts = NULL;
+		g_autofree gchar *index_dir = NULL;
+		g_autofree gchar *basename = NULL;
+		LiIndexChecksum *ic = (LiIndexChecksum*) value;
+
+		/* shards are stored as "<index>#<key>" */
+		parts = g_strsplit ((const gchar*) key, "#", 2);
+		if (g_strv_length (parts) != 2)
+			continue;
+		index_dir = g_path_get_dirname (parts[0]);
+		basename = g_strdup_printf ("%s.gz", ic->checksum);
+		g_hash_table_add (known, g_build_filename (priv->repo_path, index_dir, "shards", basename, NULL));
 	}
 
-	g_string_append_printf (helper->sigtext, "%s\t%s\n", checksum, internal_name);
+	g_hash_table_iter_init (&iter, dirs);
+	while (g_hash_table_iter_next (&iter, &key, NULL)) {
+		g_autoptr(GPtrArray) files = NULL;
+
+		files = li_utils_find_files ((const gchar*) key, FALSE);
+		if (files == NULL)
+			continue;
+		for (j = 0; j < files->len; j++) {
+			const gchar *fname = (const gchar*) g_ptr_array_index (files, j);
+			if (!g_hash_table_contains (known, fname))
+				g_remove (fname);
+		}
+	}
 }
 
+static gboolean li_repository_publish_new_icons (LiRepository *repo, GError **error);
+
 /**
  * li_repository_save:
  *
  * Save the repository metadata and sign it.
+ * Only indices which were changed are written again. Icons of new packages
+ * are published as well, so the icon lists can be covered by the signature.
  */
 gboolean
 li_repository_save (LiRepository *repo, GError **error)
 {
 	gchar *dir;
+	guint i, j;
+	guint pending = 0;
+	g_autofree gchar *sig_fname = NULL;
+	GThreadPool *pool;
 	GError *tmp_error = NULL;
 	g_autoptr(GString) sigtext = NULL;
-	LiIndexSaveHelper helper;
+	g_autoptr(GPtrArray) tasks = NULL;
 	LiRepositoryPrivate *priv = GET_PRIVATE (repo);
 
 	/* ensure the basic directory structure is present */
@@ -603,33 +1104,96 @@ li_repository_save (LiRepository *repo, GError **error)
 	g_mkdir_with_parents (dir, 0755);
 	g_free (dir);
 
-	/* prepare variable to store checksums */
-	sigtext = g_string_new ("");
+	/* collect indices and AppStream metadata of all architectures */
+	tasks = g_ptr_array_new_with_free_func ((GDestroyNotify) li_index_save_task_free);
+	li_repository_add_save_tasks (repo, tasks,
+					g_hash_table_lookup (priv->indices, li_repo_index_kind_to_string (LI_REPO_INDEX_KIND_COMMON)),
+					LI_REPO_INDEX_KIND_COMMON);
+	li_repository_add_save_tasks (repo, tasks,
+					g_hash_table_lookup (priv->indices, li_repo_index_kind_to_string (LI_REPO_INDEX_KIND_DEVEL)),
+					LI_REPO_INDEX_KIND_DEVEL);
+	li_repository_add_save_tasks (repo, tasks, priv->asmeta, LI_REPO_INDEX_KIND_NONE);
+
+	/* nothing changed and the repository was signed already? */
+	sig_fname = g_build_filename (priv->repo_path, "indices", "Indices.gpg", NULL);
+	for (i = 0; i < tasks->len; i++) {
+		LiIndexSaveTask *task = (LiIndexSaveTask*) g_ptr_array_index (tasks, i);
+		if (task->write || (task->shards == NULL))
+			pending++;
+	}
+	/* the icon lists are covered by the signature too */
+	if (priv->icons_dirty)
+		pending++;
+	if ((pending == 0) && g_file_test (sig_fname, G_FILE_TEST_EXISTS)) {
+		g_debug ("Repository indices are unchanged, not saving them.");
+		return TRUE;
+	}
 
-	/* save indices */
-	li_repository_save_indices (repo, sigtext, LI_REPO_INDEX_KIND_COMMON, &tmp_error);
+	/* serialize, compress and hash changed indices in parallel (AppStream metadata is serialized one at a time) */
+	pool = g_thread_pool_new ((GFunc) li_repository_save_task_run,
+				  NULL,
+				  g_get_num_processors (),
+				  TRUE,
+				  &tmp_error);
 	if (tmp_error != NULL) {
 		g_propagate_error (error, tmp_error);
 		return FALSE;
 	}
-	li_repository_save_indices (repo, sigtext, LI_REPO_INDEX_KIND_DEVEL, &tmp_error);
+	for (i = 0; i < tasks->len; i++) {
+		LiIndexSaveTask *task = (LiIndexSaveTask*) g_ptr_array_index (tasks, i);
+		if ((task->checksum == NULL) || (task->shards == NULL))
+			g_thread_pool_push (pool, task, NULL);
+	}
+	/* wait for all tasks to complete */
+	g_thread_pool_free (pool, FALSE, TRUE);
+
+	/* join the checksums in a stable order, clients which don't know about
+	 * shards just ignore the additional lines */
+	g_ptr_array_sort (tasks, li_index_save_task_cmp);
+	sigtext = g_string_new (LI_REPO_FORMAT_VERSION_LINE "\n");
+	for (i = 0; i < tasks->len; i++) {
+		LiIndexSaveTask *task = (LiIndexSaveTask*) g_ptr_array_index (tasks, i);
+
+		if (task->error != NULL) {
+			g_propagate_error (error, task->error);
+			task->error = NULL;
+			return FALSE;
+		}
+		g_string_append_printf (sigtext, "%s\t%s\n", task->checksum, task->internal_name);
+		for (j = 0; j < task->shards->len; j++) {
+			LiIndexShard *shard = (LiIndexShard*) g_ptr_array_index (task->shards, j);
+			g_string_append_printf (sigtext, "%s\t%s\t%s\t%s\n",
+						shard->checksum,
+						LI_REPO_SHARD_TAG,
+						task->internal_name,
+						shard->key);
+		}
+	}
+
+	/* publish new icons, so we can add the checksums of their lists */
+	li_repository_publish_new_icons (repo, &tmp_error);
 	if (tmp_error != NULL) {
 		g_propagate_error (error, tmp_error);
 		return FALSE;
 	}
-
-	/* save AppStream metadata */
-	helper.repo = repo;
-	helper.sigtext = sigtext;
-	helper.error = NULL;
-	helper.ikind = LI_REPO_INDEX_KIND_NONE;
-
-	g_hash_table_foreach (priv->asmeta,
-				(GHFunc) li_repository_save_asmeta,
-				&helper);
-	if (helper.error != NULL) {
-		g_propagate_error (error, helper.error);
-		return FALSE;
+	for (i = 0; i < G_N_ELEMENTS (li_repo_icon_sizes); i++) {
+		g_autofree gchar *list_name = NULL;
+		g_autofree gchar *list_fname = NULL;
+		g_autofree gchar *list_hash = NULL;
+
+		list_name = g_strdup_printf ("icons_%s.list", li_repo_icon_sizes[i]);
+		list_fname = g_build_filename (priv->repo_path, "indices", list_name, NULL);
+		if (!g_file_test (list_fname, G_FILE_TEST_EXISTS))
+			continue;
+		list_hash = li_compute_checksum_for_file (list_fname);
+		if (list_hash == NULL) {
+			g_set_error (error,
+					LI_REPOSITORY_ERROR,
+					LI_REPOSITORY_ERROR_FAILED,
+					_("Unable to compute checksum of icon list '%s'."), list_name);
+			return FALSE;
+		}
+		g_string_append_printf (sigtext, "%s\tindices/%s\n", list_hash, list_name);
 	}
 
 	/* now sign the package */
@@ -639,61 +1203,98 @@ li_repository_save (LiRepository *repo, GError **error)
 		return FALSE;
 	}
 
+	li_repository_prune_shards (repo, tasks);
+	li_repository_save_checksum_cache (repo, tasks);
+	g_hash_table_remove_all (priv->dirty);
+
 	return TRUE;
 }
 
 /**
- * li_repository_add_package:
+ * LiRepoAddTask:
+ *
+ * A package file which is being added to the repository.
  */
-gboolean
-li_repository_add_package (LiRepository *repo, const gchar *pkg_fname, GError **error)
-{
-	GError *tmp_error = NULL;
-	g_autoptr(LiPackage) pkg = NULL;
-	LiPkgInfo *pki;
-	const gchar *pkgname;
-	const gchar *pkgversion;
-	const gchar *pkgarch;
-	gchar *tmp;
-	gunichar c;
-	guint i;
-	g_autofree gchar *dest_path = NULL;
-	g_autofree gchar *icon_dir = NULL;
-	g_autofree gchar *hash = NULL;
+typedef struct {
+	gchar *fname;
+	LiPackage *pkg;
+	gchar *dest_path; /* location in the pool, relative to the repository root */
+	gchar *icon_dir;
+	GPtrArray *icon_files; /* icons this task has created */
+
+	/* where the package was registered, so we can undo it */
 	LiPkgIndex *index;
 	AsMetadata *metad;
-	LiPackageKind kind;
-	LiRepositoryPrivate *priv = GET_PRIVATE (repo);
+	AsComponent *cpt;
+	gboolean placed;
 
-	pkg = li_package_new ();
-	li_package_open_file (pkg, pkg_fname, &tmp_error);
-	if (tmp_error != NULL) {
-		g_propagate_error (error, tmp_error);
-		return FALSE;
-	}
+	GError *error;
+} LiRepoAddTask;
 
-	if (li_package_has_embedded_packages (pkg)) {
-		/* We do not support packages with embedded other packages in repositories.
-		 * Allowing it would needlessly duplicate data, and would also confuse the
-		 * dependency resolver. Embedded dependencies are really just for package-only
-		 * distribution.
-		 * We can also not just splt out embedded package copies, since that would break
-		 * the packages signature and make it invalid.
-		 */
-		g_set_error (error,
-			LI_REPOSITORY_ERROR,
-			LI_REPOSITORY_ERROR_EMBEDDED_COPY,
-			_("The package contains embedded dependencies. Packages with that property are not allowed in repositories, please add dependencies separately."));
-		return FALSE;
-	}
+/**
+ * LiRepoAddBatch:
+ *
+ * Shared state of the workers preparing packages for a batch import.
+ */
+typedef struct {
+	const gchar *repo_path;
+	gboolean extract_icons;
+
+	GMutex lock;
+	GCond cond;
+	GHashTable *icon_names; /* names whose icons are currently extracted */
+} LiRepoAddBatch;
+
+/**
+ * li_repo_add_task_new:
+ *
+ * Create a new task. The #LiPackage is created right away, since its
+ * initialization is not thread-safe.
+ */
+static LiRepoAddTask*
+li_repo_add_task_new (const gchar *fname)
+{
+	LiRepoAddTask *task;
 
-	pki = li_package_get_info (pkg);
+	task = g_new0 (LiRepoAddTask, 1);
+	task->fname = g_strdup (fname);
+	task->pkg = li_package_new ();
+
+	return task;
+}
+
+/**
+ * li_repo_add_task_free:
+ */
+static void
+li_repo_add_task_free (LiRepoAddTask *task)
+{
+	g_free (task->fname);
+	g_object_unref (task->pkg);
+	g_free (task->dest_path);
+	g_free (task->icon_dir);
+	if (task->icon_files != NULL)
+		g_ptr_array_unref (task->icon_files);
+	if (task->error != NULL)
+		g_error_free (task->error);
+	g_free (task);
+}
+
+/**
+ * li_repository_get_pool_path:
+ *
+ * Returns: The location of a package in the pool, relative to the repository root.
+ */
+static gchar*
+li_repository_get_pool_path (LiPkgInfo *pki)
+{
+	const gchar *pkgname;
+	gchar *tmp;
+	gunichar c;
+	guint i;
+	gchar *dest_path;
 
-	/* build destination path and directory */
 	pkgname = li_pkg_info_get_name (pki);
-	pkgversion = li_pkg_info_get_version (pki);
-	pkgarch = li_pkg_info_get_architecture (pki);
-	kind = li_pkg_info_get_kind (pki);
 	tmp = g_str_to_ascii (pkgname, NULL);
 
 	for (i = 0; tmp[i] != '\0'; i++) {
@@ -707,19 +1308,56 @@ li_repository_add_package (LiRepository *repo, const gchar *pkg_fname, GError **
 	dest_path = g_strdup_printf ("pool/%c/%s-%s_%s.ipk",
 					c,
 					pkgname,
-					pkgversion,
-					pkgarch);
-	tmp = g_strdup_printf ("%s/pool/%c/", priv->repo_path, c);
-	g_mkdir_with_parents (tmp, 0755);
-	g_free (tmp);
+					li_pkg_info_get_version (pki),
+					li_pkg_info_get_architecture (pki));
+	return dest_path;
+}
 
-	li_pkg_info_set_repo_location (pki, dest_path);
+/**
+ * li_repository_prepare_package:
+ *
+ * Open a package, check whether it can be added and hash it.
+ * This doesn't modify the #LiRepository, so it can run on multiple packages in parallel.
+ */
+static gboolean
+li_repository_prepare_package (const gchar *repo_path, LiRepoAddTask *task)
+{
+	LiPkgInfo *pki;
+	GStatBuf st;
+	g_autofree gchar *hash = NULL;
+	g_autofree gchar *tmp = NULL;
+	GError *tmp_error = NULL;
 
-	/* check if we can copy the file */
-	tmp = g_build_filename (priv->repo_path, dest_path, NULL);
+	li_package_open_file (task->pkg, task->fname, &tmp_error);
+	if (tmp_error != NULL) {
+		g_propagate_error (&task->error, tmp_error);
+		return FALSE;
+	}
+
+	if (li_package_has_embedded_packages (task->pkg)) {
+		/* We do not support packages with embedded other packages in repositories.
+		 * Allowing it would needlessly duplicate data, and would also confuse the
+		 * dependency resolver. Embedded dependencies are really just for package-only
+		 * distribution.
+		 * We can also not just splt out embedded package copies, since that would break
+		 * the packages signature and make it invalid.
+		 */
+		g_set_error (&task->error,
+			LI_REPOSITORY_ERROR,
+			LI_REPOSITORY_ERROR_EMBEDDED_COPY,
+			_("The package contains embedded dependencies. Packages with that property are not allowed in repositories, please add dependencies separately."));
+		return FALSE;
+	}
+
+	pki = li_package_get_info (task->pkg);
+
+	task->dest_path = li_repository_get_pool_path (pki);
+	li_pkg_info_set_repo_location (pki, task->dest_path);
+
+	/* check if we can add the file */
+	tmp = g_build_filename (repo_path, task->dest_path, NULL);
 	if (g_file_test (tmp, G_FILE_TEST_EXISTS)) {
-		g_free (tmp);
-		g_set_error (error,
+		g_set_error (&task->error,
 				LI_REPOSITORY_ERROR,
 				LI_REPOSITORY_ERROR_FAILED,
 				_("A package with the same name and version has already been installed into this repository."));
@@ -727,56 +1365,278 @@ li_repository_add_package (LiRepository *repo, const gchar *pkg_fname, GError **
 	}
 
 	/* calculate secure checksum to verify the integrity of this package later */
-	hash = li_compute_checksum_for_file (pkg_fname);
+	hash = li_compute_checksum_for_file (task->fname);
 	li_pkg_info_set_checksum_sha256 (pki, hash);
 
-	/* extract the icons */
-	icon_dir = g_build_filename (priv->repo_path,
+	/* clients use the size to report download progress in bytes */
+	if (g_stat (task->fname, &st) == 0)
+		li_pkg_info_set_download_size (pki, st.st_size);
+
+	return TRUE;
+}
+
+/**
+ * li_repository_extract_package_icons:
+ * @batch: The batch this package belongs to, or %NULL if it is added on its own
+ *
+ * Extract the icons of a prepared package into the repository.
+ * This can run on multiple packages in parallel.
+ */
+static gboolean
+li_repository_extract_package_icons (const gchar *repo_path, LiRepoAddTask *task, LiRepoAddBatch *batch)
+{
+	LiPkgInfo *pki;
+	guint i;
+	g_autofree gchar *icon_name = NULL;
+	g_autoptr(GPtrArray) new_icons = NULL;
+	GError *tmp_error = NULL;
+
+	pki = li_package_get_info (task->pkg);
+	task->icon_dir = g_build_filename (repo_path,
 					"assets",
 					li_pkg_info_get_name (pki),
 					"icons",
 					NULL);
-	li_package_extract_appstream_icons (pkg, icon_dir, &tmp_error);
+	task->icon_files = g_ptr_array_new_with_free_func (g_free);
+	icon_name = g_strdup_printf ("%s-%s.png",
+				li_pkg_info_get_name (pki),
+				li_pkg_info_get_version (pki));
+
+	/* packages of the same name (e.g. for different architectures) share their icon directory */
+	if (batch != NULL) {
+		g_mutex_lock (&batch->lock);
+		while (g_hash_table_contains (batch->icon_names, li_pkg_info_get_name (pki)))
+			g_cond_wait (&batch->cond, &batch->lock);
+		g_hash_table_add (batch->icon_names, g_strdup (li_pkg_info_get_name (pki)));
+		g_mutex_unlock (&batch->lock);
+	}
+
+	/* another architecture of this version might have the same icons already,
+	 * we must only remove the ones we add if this package is rolled back */
+	new_icons = g_ptr_array_new_with_free_func (g_free);
+	for (i = 0; i < G_N_ELEMENTS (li_repo_icon_sizes); i++) {
+		gchar *fname = g_build_filename (task->icon_dir, li_repo_icon_sizes[i], icon_name, NULL);
+		if (g_file_test (fname, G_FILE_TEST_EXISTS))
+			g_free (fname);
+		else
+			g_ptr_array_add (new_icons, fname);
+	}
+
+	li_package_extract_appstream_icons (task->pkg, task->icon_dir, &tmp_error);
+
+	/* also record icons of a failed extraction, so they can be removed */
+	for (i = 0; i < new_icons->len; i++) {
+		const gchar *fname = (const gchar*) g_ptr_array_index (new_icons, i);
+		if (g_file_test (fname, G_FILE_TEST_EXISTS))
+			g_ptr_array_add (task->icon_files, g_strdup (fname));
+	}
+
+	if (batch != NULL) {
+		g_mutex_lock (&batch->lock);
+		g_hash_table_remove (batch->icon_names, li_pkg_info_get_name (pki));
+		g_cond_broadcast (&batch->cond);
+		g_mutex_unlock (&batch->lock);
+	}
+
 	if (tmp_error != NULL) {
-		g_free (tmp);
-		g_propagate_error (error, tmp_error);
+		g_propagate_error (&task->error, tmp_error);
 		return FALSE;
 	}
 
-	/* now copy the file */
-	li_copy_file (pkg_fname, tmp, &tmp_error);
-	if (tmp_error != NULL) {
-		g_free (tmp);
-		g_propagate_error (error, tmp_error);
+	return TRUE;
+}
+
+/**
+ * li_repository_prepare_package_worker:
+ */
+static void
+li_repository_prepare_package_worker (LiRepoAddTask *task, LiRepoAddBatch *batch)
+{
+	if (batch->extract_icons)
+		li_repository_extract_package_icons (batch->repo_path, task, batch);
+	else
+		li_repository_prepare_package (batch->repo_path, task);
+}
+
+/**
+ * li_repository_run_batch:
+ *
+ * Run the current step of the batch on all tasks, in parallel.
+ */
+static gboolean
+li_repository_run_batch (LiRepoAddBatch *batch, GPtrArray *tasks, GError **error)
+{
+	guint i;
+	GThreadPool *pool;
+
+	pool = g_thread_pool_new ((GFunc) li_repository_prepare_package_worker,
+				  batch,
+				  g_get_num_processors (),
+				  TRUE,
+				  error);
+	if (pool == NULL)
 		return FALSE;
+
+	for (i = 0; i < tasks->len; i++)
+		g_thread_pool_push (pool, g_ptr_array_index (tasks, i), NULL);
+
+	/* wait for all tasks to complete */
+	g_thread_pool_free (pool, FALSE, TRUE);
+
+	return TRUE;
+}
+
+/**
+ * li_repository_remove_package_icons:
+ *
+ * Undo li_repository_extract_package_icons().
+ */
+static void
+li_repository_remove_package_icons (LiRepoAddTask *task)
+{
+	guint i;
+
+	if (task->icon_files == NULL)
+		return;
+
+	for (i = 0; i < task->icon_files->len; i++) {
+		g_autofree gchar *dir = NULL;
+		const gchar *fname = (const gchar*) g_ptr_array_index (task->icon_files, i);
+
+		g_remove (fname);
+		/* drop directories we might have created, this fails if they are still in use */
+		dir = g_path_get_dirname (fname);
+		g_rmdir (dir);
+	}
+	g_ptr_array_set_size (task->icon_files, 0);
+
+	if (g_rmdir (task->icon_dir) == 0) {
+		g_autofree gchar *dir = g_path_get_dirname (task->icon_dir);
+		g_rmdir (dir);
+	}
+}
+
+/**
+ * li_repository_unregister_package:
+ *
+ * Undo li_repository_register_package() and remove the
+ * icons of the package.
+ */
+static void
+li_repository_unregister_package (LiRepository *repo, LiRepoAddTask *task)
+{
+	LiRepositoryPrivate *priv = GET_PRIVATE (repo);
+
+	if (task->index != NULL) {
+		li_pkg_index_remove_package (task->index, li_package_get_info (task->pkg));
+		task->index = NULL;
+	}
+	if (task->metad != NULL) {
+		g_ptr_array_remove (as_metadata_get_components (task->metad), task->cpt);
+		task->metad = NULL;
+		task->cpt = NULL;
+	}
+	if (task->placed) {
+		g_autofree gchar *dest_fname = NULL;
+
+		dest_fname = g_build_filename (priv->repo_path, task->dest_path, NULL);
+		g_remove (dest_fname);
+		task->placed = FALSE;
+	}
+
+	if (task->icon_files != NULL) {
+		guint i;
+		for (i = 0; i < task->icon_files->len; i++)
+			g_hash_table_remove (priv->new_icons, g_ptr_array_index (task->icon_files, i));
+	}
+	li_repository_remove_package_icons (task);
+}
+
+/**
+ * li_repository_register_package:
+ *
+ * Place a prepared package in the pool and add it to the indices.
+ */
+static gboolean
+li_repository_register_package (LiRepository *repo, LiRepoAddTask *task, GError **error)
+{
+	LiPkgInfo *pki;
+	const gchar *pkgarch;
+	g_autofree gchar *dest_fname = NULL;
+	g_autofree gchar *dest_dir = NULL;
+	LiPkgIndex *index;
+	AsMetadata *metad;
+	GError *tmp_error = NULL;
+	LiRepositoryPrivate *priv = GET_PRIVATE (repo);
+
+	pki = li_package_get_info (task->pkg);
+	pkgarch = li_pkg_info_get_architecture (pki);
+
+	dest_fname = g_build_filename (priv->repo_path, task->dest_path, NULL);
+	dest_dir = g_path_get_dirname (dest_fname);
+	g_mkdir_with_parents (dest_dir, 0755);
+
+	/* now put the file into the pool. We don't hardlink it, the source file belongs
+	 * to the caller and might be modified later, which would alter the pool as well */
+	if (!li_reflink_file (task->fname, dest_fname)) {
+		if (!li_copy_file (task->fname, dest_fname, &tmp_error)) {
+			g_remove (dest_fname);
+			g_propagate_error (error, tmp_error);
+			return FALSE;
+		}
+	}
+	task->placed = TRUE;
+
+	/* remember the icons, so only they need to be published */
+	if (task->icon_dir != NULL) {
+		guint i;
+		g_autofree gchar *icon_name = NULL;
+
+		icon_name = g_strdup_printf ("%s-%s.png",
+					li_pkg_info_get_name (pki),
+					li_pkg_info_get_version (pki));
+		for (i = 0; i < G_N_ELEMENTS (li_repo_icon_sizes); i++) {
+			gchar *icon_fname = g_build_filename (task->icon_dir, li_repo_icon_sizes[i], icon_name, NULL);
+			if (g_file_test (icon_fname, G_FILE_TEST_EXISTS)) {
+				g_hash_table_add (priv->new_icons, icon_fname);
+				priv->icons_dirty = TRUE;
+			} else {
+				g_free (icon_fname);
+			}
+		}
 	}
-	g_free (tmp);
 
 	/* add to indices */
-	if (li_pkg_info_get_kind (pki) == LI_PACKAGE_KIND_DEVEL)
+	if (li_pkg_info_get_kind (pki) == LI_PACKAGE_KIND_DEVEL) {
 		index = li_repository_get_index (repo, LI_REPO_INDEX_KIND_DEVEL, pkgarch);
-	else
+		li_repository_mark_dirty (repo, LI_REPO_INDEX_KIND_DEVEL, pkgarch);
+	} else {
 		index = li_repository_get_index (repo, LI_REPO_INDEX_KIND_COMMON, pkgarch);
+		li_repository_mark_dirty (repo, LI_REPO_INDEX_KIND_COMMON, pkgarch);
+	}
 	li_pkg_index_add_package (index, pki);
+	task->index = index;
 
 	/* don't add to AppStream index, development packages don't belong there */
-	if (kind != LI_PACKAGE_KIND_DEVEL) {
+	if (li_pkg_info_get_kind (pki) != LI_PACKAGE_KIND_DEVEL) {
 		g_autoptr(AsBundle) bundle = NULL;
 		AsComponent *cpt;
 
-		cpt = li_package_get_appstream_cpt (pkg);
+		cpt = li_package_get_appstream_cpt (task->pkg);
 		/* set an icon name */
-		if (g_file_test (icon_dir, G_FILE_TEST_EXISTS)) {
+		if (g_file_test (task->icon_dir, G_FILE_TEST_EXISTS)) {
 			g_autoptr(AsIcon) icon = NULL;
-			tmp = g_strdup_printf ("%s-%s.png",
+			g_autofree gchar *icon_name = NULL;
+
+			icon_name = g_strdup_printf ("%s-%s.png",
 						li_pkg_info_get_name (pki),
 						li_pkg_info_get_version (pki));
 			/* TODO: Determine which sizes we exported, and set that information correctly */
 			icon = as_icon_new ();
 			as_icon_set_kind (icon, AS_ICON_KIND_CACHED);
-			as_icon_set_name (icon, tmp);
+			as_icon_set_name (icon, icon_name);
 			as_component_add_icon (cpt, icon);
-			g_free (tmp);
+			priv->icons_dirty = TRUE;
 		}
 
 		/* set a unique AppStream bundle name */
@@ -789,11 +1649,146 @@ li_repository_add_package (LiRepository *repo, const gchar *pkg_fname, GError **
 
 		metad = li_repository_get_asmeta (repo, pkgarch);
 		as_metadata_add_component (metad, cpt);
+		task->metad = metad;
+		task->cpt = cpt;
+		li_repository_mark_dirty (repo, LI_REPO_INDEX_KIND_NONE, pkgarch);
 	}
 
 	return TRUE;
 }
 
+/**
+ * li_repository_add_package:
+ */
+gboolean
+li_repository_add_package (LiRepository *repo, const gchar *pkg_fname, GError **error)
+{
+	LiRepoAddTask *task;
+	gboolean ret = FALSE;
+	LiRepositoryPrivate *priv = GET_PRIVATE (repo);
+
+	task = li_repo_add_task_new (pkg_fname);
+	if (!li_repository_prepare_package (priv->repo_path, task) ||
+	    !li_repository_extract_package_icons (priv->repo_path, task, NULL)) {
+		li_repository_remove_package_icons (task);
+		g_propagate_error (error, task->error);
+		task->error = NULL;
+		goto out;
+	}
+
+	ret = li_repository_register_package (repo, task, error);
+	if (!ret)
+		li_repository_unregister_package (repo, task);
+
+out:
+	li_repo_add_task_free (task);
+	return ret;
+}
+
+/**
+ * li_repository_add_packages:
+ * @repo: An instance of #LiRepository
+ * @pkg_fnames: (element-type utf8): Package files to add
+ * @error: A #GError
+ *
+ * Add many packages to the repository at once. Packages are opened, hashed
+ * and have their icons extracted in parallel. Icons are only extracted once
+ * all packages have been checked. If any package can not be added, none of
+ * them are placed in the pool or added to the indices.
+ * You need to call li_repository_save() afterwards, as with li_repository_add_package().
+ */
+gboolean
+li_repository_add_packages (LiRepository *repo, GPtrArray *pkg_fnames, GError **error)
+{
+	guint i;
+	gboolean ret = FALSE;
+	LiRepoAddBatch batch;
+	g_autoptr(GPtrArray) tasks = NULL;
+	g_autoptr(GHashTable) dest_paths = NULL;
+	LiRepositoryPrivate *priv = GET_PRIVATE (repo);
+
+	tasks = g_ptr_array_new_with_free_func ((GDestroyNotify) li_repo_add_task_free);
+	for (i = 0; i < pkg_fnames->len; i++)
+		g_ptr_array_add (tasks, li_repo_add_task_new ((const gchar*) g_ptr_array_index (pkg_fnames, i)));
+
+	batch.repo_path = priv->repo_path;
+	batch.extract_icons = FALSE;
+	g_mutex_init (&batch.lock);
+	g_cond_init (&batch.cond);
+	batch.icon_names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	if (!li_repository_run_batch (&batch, tasks, error))
+		goto out;
+
+	/* check all packages before we touch the repository */
+	dest_paths = g_hash_table_new (g_str_hash, g_str_equal);
+	for (i = 0; i < tasks->len; i++) {
+		g_autofree gchar *basename = NULL;
+		LiRepoAddTask *task = (LiRepoAddTask*) g_ptr_array_index (tasks, i);
+
+		basename = g_path_get_basename (task->fname);
+		if (task->error != NULL) {
+			g_propagate_prefixed_error (error, task->error, "%s: ", basename);
+			task->error = NULL;
+			goto out;
+		}
+		if (g_hash_table_contains (dest_paths, task->dest_path)) {
+			g_set_error (error,
+					LI_REPOSITORY_ERROR,
+					LI_REPOSITORY_ERROR_FAILED,
+					_("%s: A package with the same name and version is already part of this batch."),
+					basename);
+			goto out;
+		}
+		g_hash_table_add (dest_paths, task->dest_path);
+	}
+
+	/* the whole batch is valid, extract the icons now */
+	batch.extract_icons = TRUE;
+	if (!li_repository_run_batch (&batch, tasks, error))
+		goto out;
+	for (i = 0; i < tasks->len; i++) {
+		g_autofree gchar *basename = NULL;
+		LiRepoAddTask *task = (LiRepoAddTask*) g_ptr_array_index (tasks, i);
+
+		if (task->error != NULL) {
+			guint j;
+
+			basename = g_path_get_basename (task->fname);
+			g_propagate_prefixed_error (error, task->error, "%s: ", basename);
+			task->error = NULL;
+
+			/* don't leave icons of a batch we didn't add behind */
+			for (j = 0; j < tasks->len; j++)
+				li_repository_remove_package_icons ((LiRepoAddTask*) g_ptr_array_index (tasks, j));
+			goto out;
+		}
+	}
+
+	/* add packages in the order we got them, to get stable indices */
+	for (i = 0; i < tasks->len; i++) {
+		LiRepoAddTask *task = (LiRepoAddTask*) g_ptr_array_index (tasks, i);
+
+		if (!li_repository_register_package (repo, task, error)) {
+			guint j;
+
+			/* leave the repository as it was before, all icons were extracted already */
+			for (j = 0; j < tasks->len; j++)
+				li_repository_unregister_package (repo, (LiRepoAddTask*) g_ptr_array_index (tasks, j));
+			goto out;
+		}
+	}
+
+	ret = TRUE;
+
+out:
+	g_hash_table_unref (batch.icon_names);
+	g_cond_clear (&batch.cond);
+	g_mutex_clear (&batch.lock);
+
+	return ret;
+}
+
 /**
  * li_repository_find_icons:
  */
@@ -868,10 +1863,139 @@ out:
 }
 
 /**
- * li_repository_create_icon_tarball:
+ * li_repository_icon_path_cmp:
+ */
+static gint
+li_repository_icon_path_cmp (gconstpointer a, gconstpointer b)
+{
+	return g_strcmp0 (*((const gchar**) a), *((const gchar**) b));
+}
+
+/**
+ * li_repository_publish_icons:
+ * @list: Icon list to update, maps icon names to checksums
+ *
+ * Store icons by their checksum in the repository and add them to
+ * the icon list, so clients only need to fetch the icons which actually changed.
+ */
+static gboolean
+li_repository_publish_icons (LiRepository *repo, const gchar *icon_size, GPtrArray *files, GHashTable *list, GError **error)
+{
+	guint i;
+	g_autoptr(GPtrArray) checksums = NULL;
+	GError *tmp_error = NULL;
+	LiRepositoryPrivate *priv = GET_PRIVATE (repo);
+
+	checksums = li_checksum_compute_for_files (files);
+
+	for (i = 0; i < files->len; i++) {
+		const gchar *hash;
+		g_autofree gchar *prefix = NULL;
+		g_autofree gchar *dest_dir = NULL;
+		g_autofree gchar *dest_fname = NULL;
+		g_autofree gchar *tmp = NULL;
+		const gchar *fname = (const gchar *) g_ptr_array_index (files, i);
+
+		hash = (const gchar *) g_ptr_array_index (checksums, i);
+		if (hash == NULL) {
+			g_warning ("Could not read icon '%s'. Skipping it.", fname);
+			continue;
+		}
+
+		prefix = g_strndup (hash, 2);
+		dest_dir = g_build_filename (priv->repo_path, "icons", icon_size, prefix, NULL);
+		tmp = g_strdup_printf ("%s.png", hash);
+		dest_fname = g_build_filename (dest_dir, tmp, NULL);
+
+		/* identical icons are stored only once */
+		if (!g_file_test (dest_fname, G_FILE_TEST_EXISTS)) {
+			g_mkdir_with_parents (dest_dir, 0755);
+			if (!li_link_or_copy_file (fname, dest_fname, &tmp_error)) {
+				g_propagate_error (error, tmp_error);
+				return FALSE;
+			}
+		}
+
+		g_hash_table_insert (list, g_path_get_basename (fname), g_strdup (hash));
+	}
+
+	return TRUE;
+}
+
+/**
+ * li_repository_read_icon_list:
+ *
+ * Returns: The icon list as written by li_repository_write_icon_list(),
+ * or %NULL if it could not be read.
+ */
+static GHashTable*
+li_repository_read_icon_list (const gchar *list_fname)
+{
+	guint i;
+	GHashTable *list;
+	g_autofree gchar *data = NULL;
+	g_auto(GStrv) lines = NULL;
+
+	if (!g_file_get_contents (list_fname, &data, NULL, NULL))
+		return NULL;
+
+	list = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	lines = g_strsplit (data, "\n", -1);
+	for (i = 0; lines[i] != NULL; i++) {
+		g_auto(GStrv) parts = NULL;
+
+		if (lines[i][0] == '\0')
+			continue;
+		parts = g_strsplit (lines[i], "\t", 2);
+		if (g_strv_length (parts) != 2) {
+			g_hash_table_unref (list);
+			return NULL;
+		}
+		g_hash_table_insert (list, g_strdup (parts[1]), g_strdup (parts[0]));
+	}
+
+	return list;
+}
+
+/**
+ * li_repository_write_icon_list:
+ *
+ * Write the icon list, sorted by icon name.
+ */
+static gboolean
+li_repository_write_icon_list (const gchar *list_fname, GHashTable *list, GError **error)
+{
+	guint i;
+	g_autoptr(GString) data = NULL;
+	g_autoptr(GPtrArray) names = NULL;
+	GHashTableIter iter;
+	gpointer key;
+
+	names = g_ptr_array_sized_new (g_hash_table_size (list));
+	g_hash_table_iter_init (&iter, list);
+	while (g_hash_table_iter_next (&iter, &key, NULL))
+		g_ptr_array_add (names, key);
+	g_ptr_array_sort (names, li_repository_icon_path_cmp);
+
+	data = g_string_new ("");
+	for (i = 0; i < names->len; i++) {
+		const gchar *name = (const gchar*) g_ptr_array_index (names, i);
+		g_string_append_printf (data, "%s\t%s\n", (const gchar*) g_hash_table_lookup (list, name), name);
+	}
+
+	return g_file_set_contents (list_fname, data->str, data->len, error);
+}
+
+/**
+ * li_repository_write_icon_tarball:
+ * @old_fname: (allow-none): Tarball to take all icons from which are not in @files
+ *
+ * Write the icons tarball for clients which can't use the icon list.
+ * With an old tarball, its icons are copied over instead of looking
+ * for all icons in the repository again.
  */
 static gboolean
-li_repository_create_icon_tarball (LiRepository *repo, const gchar *icon_size, GError **error)
+li_repository_write_icon_tarball (const gchar *tarball_fname, const gchar *old_fname, GPtrArray *files, GError **error)
 {
 	struct archive *a;
 	struct archive_entry *entry;
@@ -880,31 +2004,64 @@ li_repository_create_icon_tarball (LiRepository *repo, const gchar *icon_size, G
 	int len;
 	int fd;
 	guint i;
-	g_autoptr(GPtrArray) files = NULL;
-	g_autofree gchar *tarball_fname = NULL;
-	gchar *tmp;
-	GError *tmp_error = NULL;
-	LiRepositoryPrivate *priv = GET_PRIVATE (repo);
+	gboolean ret = TRUE;
+	g_autofree gchar *tmp_fname = NULL;
+	g_autoptr(GHashTable) names = NULL;
 
-	files = li_repository_find_icons (priv->repo_path, icon_size, &tmp_error);
-	if (tmp_error != NULL) {
-		g_propagate_error (error, tmp_error);
+	names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	for (i = 0; i < files->len; i++)
+		g_hash_table_add (names, g_path_get_basename ((const gchar *) g_ptr_array_index (files, i)));
+
+	tmp_fname = g_strdup_printf ("%s.new", tarball_fname);
+	a = archive_write_new ();
+	archive_write_add_filter_gzip (a);
+	archive_write_set_format_pax_restricted (a);
+	if (archive_write_open_filename (a, tmp_fname) != ARCHIVE_OK) {
+		g_set_error (error,
+				LI_REPOSITORY_ERROR,
+				LI_REPOSITORY_ERROR_FAILED,
+				_("Unable to write icon tarball '%s': %s"),
+				tarball_fname,
+				archive_error_string (a));
+		archive_write_free (a);
 		return FALSE;
 	}
 
-	if (files == NULL)
-		return TRUE;
+	if (old_fname != NULL) {
+		struct archive *ar;
+		struct archive_entry *e;
+		const void *block;
+		size_t size;
+		off_t offset;
+
+		ar = archive_read_new ();
+		archive_read_support_filter_gzip (ar);
+		archive_read_support_format_tar (ar);
+		if (archive_read_open_filename (ar, old_fname, sizeof (buff)) != ARCHIVE_OK) {
+			g_set_error (error,
+					LI_REPOSITORY_ERROR,
+					LI_REPOSITORY_ERROR_FAILED,
+					_("Unable to read icon tarball '%s': %s"),
+					old_fname,
+					archive_error_string (ar));
+			ret = FALSE;
+		}
 
-	tmp = g_strdup_printf ("icons_%s.tar.gz", icon_size);
-	tarball_fname = g_build_filename (priv->repo_path, "indices", tmp, NULL);
-	g_free (tmp);
+		while (ret && (archive_read_next_header (ar, &e) == ARCHIVE_OK)) {
+			/* replaced icons are added again below */
+			if (g_hash_table_contains (names, archive_entry_pathname (e)))
+				continue;
 
-	a = archive_write_new ();
-	archive_write_add_filter_gzip (a);
-	archive_write_set_format_pax_restricted (a);
-	archive_write_open_filename (a, tarball_fname);
+			archive_write_header (a, e);
+			while (archive_read_data_block (ar, &block, &size, &offset) == ARCHIVE_OK)
+				archive_write_data (a, block, size);
+		}
 
-	for (i = 0; i < files->len; i++) {
+		archive_read_close (ar);
+		archive_read_free (ar);
+	}
+
+	for (i = 0; ret && (i < files->len); i++) {
 		gchar *ar_fname;
 		const gchar *fname = (const gchar *) g_ptr_array_index (files, i);
 
@@ -937,31 +2094,153 @@ li_repository_create_icon_tarball (LiRepository *repo, const gchar *icon_size, G
 	archive_write_close(a);
 	archive_write_free(a);
 
+	if (!ret) {
+		g_remove (tmp_fname);
+		return FALSE;
+	}
+	if (g_rename (tmp_fname, tarball_fname) != 0) {
+		g_set_error (error,
+				LI_REPOSITORY_ERROR,
+				LI_REPOSITORY_ERROR_FAILED,
+				_("Unable to write icon tarball '%s': %s"),
+				tarball_fname,
+				g_strerror (errno));
+		g_remove (tmp_fname);
+		return FALSE;
+	}
+
 	return TRUE;
 }
 
 /**
- * li_repository_create_icon_tarballs:
+ * li_repository_create_icon_tarball:
+ * @rebuild: %TRUE to publish all icons of the repository again
+ *
+ * Publish the icons of the given size. Unless we rebuild everything, only
+ * the icons which were added since they were last published are hashed,
+ * and added to the existing icon list and tarball.
  */
-gboolean
-li_repository_create_icon_tarballs (LiRepository *repo, GError **error)
+static gboolean
+li_repository_create_icon_tarball (LiRepository *repo, const gchar *icon_size, gboolean rebuild, GError **error)
 {
-	gboolean ret;
+	GHashTableIter iter;
+	gpointer key;
+	g_autoptr(GPtrArray) files = NULL;
+	g_autoptr(GHashTable) list = NULL;
+	g_autofree gchar *tarball_fname = NULL;
+	g_autofree gchar *list_fname = NULL;
+	gchar *tmp;
 	GError *tmp_error = NULL;
+	LiRepositoryPrivate *priv = GET_PRIVATE (repo);
 
-	ret = li_repository_create_icon_tarball (repo, "64x64", &tmp_error);
-	if (tmp_error != NULL) {
+	tmp = g_strdup_printf ("icons_%s.tar.gz", icon_size);
+	tarball_fname = g_build_filename (priv->repo_path, "indices", tmp, NULL);
+	g_free (tmp);
+	tmp = g_strdup_printf ("icons_%s.list", icon_size);
+	list_fname = g_build_filename (priv->repo_path, "indices", tmp, NULL);
+	g_free (tmp);
+
+	/* we can only add to what has been published completely before */
+	if (!rebuild) {
+		if (g_file_test (tarball_fname, G_FILE_TEST_EXISTS))
+			list = li_repository_read_icon_list (list_fname);
+		if (list == NULL)
+			rebuild = TRUE;
+	}
+
+	if (rebuild) {
+		files = li_repository_find_icons (priv->repo_path, icon_size, &tmp_error);
+		if (tmp_error != NULL) {
+			g_propagate_error (error, tmp_error);
+			return FALSE;
+		}
+		if (files == NULL)
+			return TRUE;
+		list = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	} else {
+		files = g_ptr_array_new_with_free_func (g_free);
+		g_hash_table_iter_init (&iter, priv->new_icons);
+		while (g_hash_table_iter_next (&iter, &key, NULL)) {
+			g_autofree gchar *dir = NULL;
+			g_autofree gchar *size = NULL;
+
+			/* icons live in assets/<name>/icons/<size>/ */
+			dir = g_path_get_dirname ((const gchar*) key);
+			size = g_path_get_basename (dir);
+			if (g_strcmp0 (size, icon_size) == 0)
+				g_ptr_array_add (files, g_strdup ((const gchar*) key));
+		}
+		if (files->len == 0)
+			return TRUE;
+	}
+	g_ptr_array_sort (files, li_repository_icon_path_cmp);
+
+	if (!li_repository_publish_icons (repo, icon_size, files, list, &tmp_error)) {
+		g_propagate_error (error, tmp_error);
+		return FALSE;
+	}
+	if (!li_repository_write_icon_list (list_fname, list, &tmp_error)) {
 		g_propagate_error (error, tmp_error);
 		return FALSE;
 	}
 
-	ret = li_repository_create_icon_tarball (repo, "128x128", &tmp_error) || ret;
-	if (tmp_error != NULL) {
+	/* the tarball is still needed by clients which can't use the icon list */
+	if (!li_repository_write_icon_tarball (tarball_fname,
+						rebuild? NULL : tarball_fname,
+						files,
+						&tmp_error)) {
 		g_propagate_error (error, tmp_error);
 		return FALSE;
 	}
 
-	return ret;
+	return TRUE;
+}
+
+/**
+ * li_repository_publish_icons_all_sizes:
+ */
+static gboolean
+li_repository_publish_icons_all_sizes (LiRepository *repo, gboolean rebuild, GError **error)
+{
+	guint i;
+	GError *tmp_error = NULL;
+	LiRepositoryPrivate *priv = GET_PRIVATE (repo);
+
+	for (i = 0; i < G_N_ELEMENTS (li_repo_icon_sizes); i++) {
+		li_repository_create_icon_tarball (repo, li_repo_icon_sizes[i], rebuild, &tmp_error);
+		if (tmp_error != NULL) {
+			g_propagate_error (error, tmp_error);
+			return FALSE;
+		}
+	}
+	g_hash_table_remove_all (priv->new_icons);
+	priv->icons_dirty = FALSE;
+
+	return TRUE;
+}
+
+/**
+ * li_repository_publish_new_icons:
+ *
+ * Publish the icons which were added since the last time.
+ */
+static gboolean
+li_repository_publish_new_icons (LiRepository *repo, GError **error)
+{
+	return li_repository_publish_icons_all_sizes (repo, FALSE, error);
+}
+
+/**
+ * li_repository_create_icon_tarballs:
+ *
+ * Publish all icons of the repository again, rebuilding the icon
+ * lists and tarballs from scratch.
+ * li_repository_save() only adds new icons to them.
+ */
+gboolean
+li_repository_create_icon_tarballs (LiRepository *repo, GError **error)
+{
+	return li_repository_publish_icons_all_sizes (repo, TRUE, error);
 }
 
 /**
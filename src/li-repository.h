@@ -81,6 +81,9 @@ gboolean		li_repository_save (LiRepository *repo,
 gboolean		li_repository_add_package (LiRepository *repo,
 							const gchar *pkg_fname,
 							GError **error);
+gboolean		li_repository_add_packages (LiRepository *repo,
+							GPtrArray *pkg_fnames,
+							GError **error);
 
 gboolean		li_repository_create_icon_tarballs (LiRepository *repo,
 								GError **error);
@@ -35,8 +35,16 @@
 #include <sys/utsname.h>
 #include <sys/capability.h>
 #include <sys/prctl.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <linux/nsfs.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <glib/gstdio.h>
 
 #include "li-utils.h"
+#include "li-utils-private.h"
 
 /**
  * SECTION:li-run
@@ -45,7 +53,14 @@
  * @include: limba.h
  */
 
-#define REQUIRED_CAPS (CAP_TO_MASK(CAP_SYS_ADMIN))
+#define REQUIRED_CAPS (CAP_TO_MASK(CAP_SYS_ADMIN) | CAP_TO_MASK(CAP_SYS_CHROOT))
+
+/* name of the process keeping a cached environment alive */
+#define NS_KEEPER_NAME "limba-nskeeper"
+/* time in seconds after which unused cached environments are dropped */
+#define NS_KEEPER_TIMEOUT (15 * 60)
+/* root-owned directory holding the records of cached environments */
+#define NS_CACHE_ROOT "/run/limba"
 
 typedef enum {
   BIND_READONLY = (1<<0),
@@ -53,6 +68,82 @@ typedef enum {
   BIND_DEVICES = (1<<2),
 } bind_option_t;
 
+/* file descriptor trace events are written to, or -1 if tracing is disabled */
+static int trace_fd = -1;
+
+/* state of the environment cache, set up by li_run_env_cache_prepare() */
+static int ns_record_fd = -1; /* root-owned record, opened while we were privileged */
+static int ns_fd = -1; /* validated mount namespace of the cached environment */
+static pid_t ns_keeper_pid = 0;
+static gchar *ns_record_fname = NULL;
+static gchar *ns_stamp = NULL;
+
+/**
+ * li_run_trace_init:
+ *
+ * Enable tracing of the launch phases, if the LIMBA_TRACE environment
+ * variable is set. It may contain the name of a file to append the trace
+ * events to, or "stderr".
+ * This needs to be called before entering a new environment, and after
+ * dropping root privileges.
+ */
+void
+li_run_trace_init (void)
+{
+	const gchar *target;
+
+	target = g_getenv ("LIMBA_TRACE");
+	if ((target == NULL) || (*target == '\0'))
+		return;
+
+	if ((g_strcmp0 (target, "1") == 0) || (g_strcmp0 (target, "stderr") == 0))
+		trace_fd = fcntl (STDERR_FILENO, F_DUPFD_CLOEXEC, 3);
+	else
+		trace_fd = open (target, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+	if (trace_fd < 0)
+		g_printerr ("Unable to open trace output '%s': %s\n", target, strerror (errno));
+}
+
+/**
+ * li_run_trace_begin:
+ *
+ * Returns: The start time of a new phase, to be passed to li_run_trace_end().
+ */
+gint64
+li_run_trace_begin (void)
+{
+	if (trace_fd < 0)
+		return 0;
+	return g_get_monotonic_time ();
+}
+
+/**
+ * li_run_trace_end:
+ * @phase: The name of the phase
+ * @start: The time returned by li_run_trace_begin()
+ *
+ * Record a completed phase. Every phase is written as one line, containing
+ * a complete event in Chrome's trace-event format.
+ */
+void
+li_run_trace_end (const gchar *phase, gint64 start)
+{
+	gint64 now;
+	g_autofree gchar *line = NULL;
+
+	if ((trace_fd < 0) || (start == 0))
+		return;
+
+	now = g_get_monotonic_time ();
+	line = g_strdup_printf ("{\"name\":\"%s\",\"cat\":\"limba\",\"ph\":\"X\",\"ts\":%" G_GINT64_FORMAT ",\"dur\":%" G_GINT64_FORMAT ",\"pid\":%d,\"tid\":%d}\n",
+				phase, start, now - start, getpid (), getpid ());
+
+	/* a single write, so events of parallel launches don't get mixed up */
+	if (write (trace_fd, line, strlen (line)) < 0)
+		g_debug ("Unable to write trace event: %s", strerror (errno));
+}
+
 /**
  * pivot_root:
  *
@@ -236,11 +327,13 @@ li_run_env_setup_with_root (const gchar *root_fs)
 	gchar *fname = NULL;
 	uid_t uid;
 	int mount_count;
+	gint64 trace_start;
 	g_autofree gchar *newroot = NULL;
 	g_autofree gchar *approot_dir = NULL;
 
 	/* perform some preparation before we can mount the app */
 	g_debug ("creating new namespace");
+	trace_start = li_run_trace_begin ();
 	res = unshare (CLONE_NEWNS);
 	if (res != 0) {
 		g_printerr ("Failed to create new namespace: %s\n", strerror(errno));
@@ -254,7 +347,9 @@ li_run_env_setup_with_root (const gchar *root_fs)
 		g_printerr ("Failed to make / slave: %s\n", strerror(errno));
 		return NULL;
 	}
+	li_run_trace_end ("unshare", trace_start);
 
+	trace_start = li_run_trace_begin ();
 	uid = getuid ();
 	newroot = g_strdup_printf ("/run/user/%d/.limba-root", uid);
 	if (g_mkdir_with_parents (newroot, 0755) != 0) {
@@ -267,8 +362,10 @@ li_run_env_setup_with_root (const gchar *root_fs)
 		g_printerr ("Failed to mount tmpfs.\n");
 		return NULL;
 	}
+	li_run_trace_end ("tmpfs", trace_start);
 
 	/* build & bindmount the root filesystem */
+	trace_start = li_run_trace_begin ();
 	if (mkdir_and_bindmount (newroot, root_fs, "/sbin", FALSE) != 0)
 		return NULL;
 	if (mkdir_and_bindmount (newroot, root_fs, "/bin", FALSE) != 0)
@@ -335,8 +432,10 @@ li_run_env_setup_with_root (const gchar *root_fs)
 		return NULL;
 	}
 	g_free (fname);
+	li_run_trace_end ("bind-mounts", trace_start);
 
 	/* the place where we will mount the application data to */
+	trace_start = li_run_trace_begin ();
 	approot_dir = g_build_filename (newroot, "app", NULL);
 	if (g_mkdir_with_parents (approot_dir, 0755) != 0) {
 		g_printerr ("Unable to create /app dir.\n");
@@ -367,6 +466,7 @@ li_run_env_setup_with_root (const gchar *root_fs)
 		g_error ("Failed to make prefix namespace private");
 		goto error_out;
 	}
+	li_run_trace_end ("approot", trace_start);
 
 	return g_strdup (newroot);
 
@@ -402,7 +502,10 @@ li_run_env_setup (void)
 gboolean
 li_run_env_enter (const gchar *newroot)
 {
+	gint64 trace_start;
+
 	/* now move into the application's private environment */
+	trace_start = li_run_trace_begin ();
 	chdir (newroot);
 	if (pivot_root (newroot, ".oldroot") != 0) {
 		g_printerr ("pivot_root failed: %s\n", strerror(errno));
@@ -420,15 +523,18 @@ li_run_env_enter (const gchar *newroot)
 		g_printerr ("unmount oldroot failed: %s\n", strerror (errno));
 		return FALSE;
 	}
+	li_run_trace_end ("pivot-root", trace_start);
 
 	return TRUE;
 }
 
 /**
- * update_env_var_list:
+ * li_run_env_prepend_path:
+ *
+ * Prepend @item to the colon-separated list in environment variable @var.
  */
-static void
-update_env_var_list (const gchar *var, const gchar *item)
+void
+li_run_env_prepend_path (const gchar *var, const gchar *item)
 {
 	const gchar *env;
 	gchar *value;
@@ -456,13 +562,380 @@ li_run_env_set_path_variables (void)
 	g_autofree gchar *ma_lib_path = NULL;
 
 	/* add generic library path */
-	update_env_var_list ("LD_LIBRARY_PATH", LI_SW_ROOT_PREFIX "/lib");
+	li_run_env_prepend_path ("LD_LIBRARY_PATH", LI_SW_ROOT_PREFIX "/lib");
 
 	/* add multiarch library path for compatibility reasons */
 	triplet = li_get_arch_triplet ();
 	ma_lib_path = g_build_filename (LI_SW_ROOT_PREFIX, "lib", triplet, NULL);
-	update_env_var_list ("LD_LIBRARY_PATH", ma_lib_path);
+	li_run_env_prepend_path ("LD_LIBRARY_PATH", ma_lib_path);
 
 	/* add generic binary directory to PATH */
-	update_env_var_list ("PATH", LI_SW_ROOT_PREFIX "/bin");
+	li_run_env_prepend_path ("PATH", LI_SW_ROOT_PREFIX "/bin");
+}
+
+/**
+ * li_run_ns_ensure_dir:
+ *
+ * Create a directory for the environment cache, and make sure
+ * nobody but root can modify it.
+ */
+static gboolean
+li_run_ns_ensure_dir (const gchar *path)
+{
+	struct stat buf;
+
+	if ((mkdir (path, 0755) != 0) && (errno != EEXIST))
+		return FALSE;
+	if (lstat (path, &buf) != 0)
+		return FALSE;
+
+	return S_ISDIR (buf.st_mode) && (buf.st_uid == 0) && ((buf.st_mode & (S_IWGRP | S_IWOTH)) == 0);
+}
+
+/**
+ * li_run_ns_get_inode:
+ *
+ * Returns: The inode of the namespace @fd refers to, or 0 on error.
+ */
+static ino_t
+li_run_ns_get_inode (int fd)
+{
+	struct stat buf;
+
+	if (fstat (fd, &buf) != 0)
+		return 0;
+	return buf.st_ino;
+}
+
+/**
+ * li_run_ns_owned_by_our_userns:
+ *
+ * Check that the namespace @fd refers to belongs to our user namespace.
+ * Unprivileged users can only create mount namespaces inside of new user
+ * namespaces, so this ensures the namespace was set up by a privileged
+ * process, and not prepared by someone else.
+ */
+static gboolean
+li_run_ns_owned_by_our_userns (int fd)
+{
+	int userns_fd;
+	int self_fd;
+	gboolean ret;
+
+	userns_fd = ioctl (fd, NS_GET_USERNS);
+	if (userns_fd < 0)
+		return FALSE;
+	self_fd = open ("/proc/self/ns/user", O_RDONLY | O_CLOEXEC);
+	if (self_fd < 0) {
+		close (userns_fd);
+		return FALSE;
+	}
+
+	ret = li_run_ns_get_inode (userns_fd) == li_run_ns_get_inode (self_fd);
+	close (userns_fd);
+	close (self_fd);
+
+	return ret;
+}
+
+/**
+ * li_run_ns_record_parse:
+ *
+ * Parse a record of a cached environment, which has the format
+ * "<keeper-pid> <namespace-inode> <last-use> <stamp>".
+ */
+static gboolean
+li_run_ns_record_parse (const gchar *data, pid_t *pid, guint64 *ns_ino, gint64 *last_use, gchar **stamp)
+{
+	g_auto(GStrv) parts = NULL;
+	g_autofree gchar *tmp = NULL;
+
+	tmp = g_strstrip (g_strdup (data));
+	parts = g_strsplit (tmp, " ", 4);
+	if (g_strv_length (parts) != 4)
+		return FALSE;
+
+	*pid = (pid_t) g_ascii_strtoll (parts[0], NULL, 10);
+	*ns_ino = g_ascii_strtoull (parts[1], NULL, 10);
+	*last_use = g_ascii_strtoll (parts[2], NULL, 10);
+	if ((*pid <= 0) || (*ns_ino == 0))
+		return FALSE;
+	if (stamp != NULL)
+		*stamp = g_strdup (parts[3]);
+
+	return TRUE;
+}
+
+/**
+ * li_run_ns_record_write:
+ *
+ * Replace the record of the cached environment.
+ */
+static gboolean
+li_run_ns_record_write (pid_t pid, guint64 ns_ino, const gchar *stamp)
+{
+	g_autofree gchar *data = NULL;
+	gssize len;
+
+	data = g_strdup_printf ("%d %" G_GUINT64_FORMAT " %" G_GINT64_FORMAT " %s\n",
+				pid, ns_ino, (gint64) time (NULL), stamp);
+	len = strlen (data);
+
+	if (ftruncate (ns_record_fd, 0) != 0)
+		return FALSE;
+	return pwrite (ns_record_fd, data, len, 0) == len;
+}
+
+/**
+ * li_run_env_cache_prepare:
+ * @key: Identifier of the environment, e.g. the software ID
+ *
+ * Open the record of the cached environment for @key, and validate
+ * the environment it points to. The records are kept in a root-owned
+ * directory, so this needs to be called while we still have root
+ * privileges, before li_run_acquire_caps().
+ * A namespace is only accepted if it still belongs to the keeper process
+ * we forked when caching it, and if it was created in our user namespace.
+ */
+void
+li_run_env_cache_prepare (const gchar *key)
+{
+	int fd;
+	struct stat buf;
+	gchar data[512];
+	gssize len;
+	pid_t pid;
+	guint64 ns_ino;
+	gint64 last_use;
+	g_autofree gchar *hash = NULL;
+	g_autofree gchar *ns_dir = NULL;
+	g_autofree gchar *user_dir = NULL;
+	g_autofree gchar *ns_path = NULL;
+	g_autofree gchar *stamp = NULL;
+
+	if (geteuid () != 0) {
+		g_debug ("Not caching environments, we are not privileged.");
+		return;
+	}
+
+	ns_dir = g_build_filename (NS_CACHE_ROOT, "ns", NULL);
+	user_dir = g_strdup_printf ("%s/%d", ns_dir, getuid ());
+	if (!li_run_ns_ensure_dir (NS_CACHE_ROOT) ||
+	    !li_run_ns_ensure_dir (ns_dir) ||
+	    !li_run_ns_ensure_dir (user_dir)) {
+		g_debug ("Unable to create namespace cache directory, or it is not safe to use.");
+		return;
+	}
+
+	hash = g_compute_checksum_for_string (G_CHECKSUM_SHA1, key, -1);
+	ns_record_fname = g_build_filename (user_dir, hash, NULL);
+
+	fd = open (ns_record_fname, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return;
+	if ((fstat (fd, &buf) != 0) || !S_ISREG (buf.st_mode) || (buf.st_uid != 0) || (buf.st_nlink != 1)) {
+		close (fd);
+		return;
+	}
+	ns_record_fd = fd;
+
+	len = pread (ns_record_fd, data, sizeof (data) - 1, 0);
+	if (len <= 0)
+		return;
+	data[len] = '\0';
+	if (!li_run_ns_record_parse (data, &pid, &ns_ino, &last_use, &stamp))
+		return;
+
+	/* root may open the namespace of the keeper, which is not dumpable */
+	ns_path = g_strdup_printf ("/proc/%d/ns/mnt", pid);
+	fd = open (ns_path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	/* the keeper might have exited, and its PID may have been reused */
+	if ((li_run_ns_get_inode (fd) != ns_ino) || !li_run_ns_owned_by_our_userns (fd)) {
+		g_debug ("Cached environment for %s is not valid anymore.", key);
+		close (fd);
+		return;
+	}
+
+	ns_fd = fd;
+	ns_keeper_pid = pid;
+	ns_stamp = g_steal_pointer (&stamp);
+}
+
+/**
+ * li_run_ns_keeper_main:
+ *
+ * Keep the mount namespace we are in alive until it has not been
+ * used for a while, or until it has been invalidated.
+ */
+static void
+li_run_ns_keeper_main (void)
+{
+	int fd;
+	GError *tmp_error = NULL;
+
+	setsid ();
+	prctl (PR_SET_NAME, NS_KEEPER_NAME, 0, 0, 0);
+
+	if (trace_fd >= 0) {
+		close (trace_fd);
+		trace_fd = -1;
+	}
+	/* only runapp may write the record, and we must not keep other environments alive */
+	close (ns_record_fd);
+	ns_record_fd = -1;
+	if (ns_fd >= 0) {
+		close (ns_fd);
+		ns_fd = -1;
+	}
+
+	fd = open ("/dev/null", O_RDWR);
+	if (fd >= 0) {
+		dup2 (fd, STDIN_FILENO);
+		dup2 (fd, STDOUT_FILENO);
+		dup2 (fd, STDERR_FILENO);
+		if (fd > STDERR_FILENO)
+			close (fd);
+	}
+
+	/* we were forked by the application, so we may have ended up in its
+	 * scope and would keep it alive after the application has exited.
+	 * Move to a scope of our own, before we give up our privileges */
+	li_add_to_new_scope ("limba", "nskeeper", &tmp_error);
+	if (tmp_error != NULL) {
+		g_debug ("Unable to move namespace keeper to its own scope: %s", tmp_error->message);
+		g_clear_error (&tmp_error);
+	}
+
+	/* we don't need any privileges. We stay non-dumpable, so nobody but
+	 * root can attach to us or open our namespace */
+	li_run_drop_caps ();
+
+	while (TRUE) {
+		g_autofree gchar *data = NULL;
+		pid_t pid;
+		guint64 ns_ino;
+		gint64 last_use;
+
+		sleep (60);
+
+		/* stop if our environment was dropped or replaced */
+		if (!g_file_get_contents (ns_record_fname, &data, NULL, NULL))
+			break;
+		if (!li_run_ns_record_parse (data, &pid, &ns_ino, &last_use, NULL))
+			break;
+		if (pid != getpid ())
+			break;
+
+		/* stop if nobody used this environment for a while */
+		if (time (NULL) - last_use > NS_KEEPER_TIMEOUT)
+			break;
+	}
+
+	_exit (0);
+}
+
+/**
+ * li_run_env_cache:
+ * @stamp: A string which changes when the environment needs to be recreated
+ *
+ * Keep the mount namespace of the current environment alive, so
+ * later runs can enter it using li_run_env_enter_cached() instead of
+ * setting up a new environment.
+ * This needs to be called after li_run_env_enter(), while we still
+ * have the privileges to do so, and li_run_env_cache_prepare() must
+ * have been called before.
+ */
+void
+li_run_env_cache (const gchar *stamp)
+{
+	pid_t pid;
+	int fd;
+	guint64 ns_ino;
+	gint64 trace_start;
+
+	if (ns_record_fd < 0)
+		return;
+
+	/* the old keeper is not needed anymore */
+	if (ns_keeper_pid > 0)
+		kill (ns_keeper_pid, SIGTERM);
+
+	trace_start = li_run_trace_begin ();
+	fd = open ("/proc/self/ns/mnt", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+	ns_ino = li_run_ns_get_inode (fd);
+	close (fd);
+	if (ns_ino == 0)
+		return;
+
+	/* fork twice, so the keeper is not a child of the application */
+	pid = fork ();
+	if (pid < 0)
+		return;
+
+	if (pid == 0) {
+		pid_t keeper_pid;
+
+		keeper_pid = fork ();
+		if (keeper_pid == 0)
+			li_run_ns_keeper_main ();
+
+		if (keeper_pid > 0) {
+			if (!li_run_ns_record_write (keeper_pid, ns_ino, stamp))
+				kill (keeper_pid, SIGTERM);
+		}
+
+		_exit (0);
+	}
+
+	/* wait until the environment has been registered */
+	waitpid (pid, NULL, 0);
+	li_run_trace_end ("cache-environment", trace_start);
+}
+
+/**
+ * li_run_env_enter_cached:
+ * @stamp: The stamp the environment must have been cached with
+ *
+ * Enter the environment validated by li_run_env_cache_prepare().
+ * If no valid environment is available, nothing is changed.
+ *
+ * Returns: %TRUE if we are now running in the cached environment.
+ */
+gboolean
+li_run_env_enter_cached (const gchar *stamp)
+{
+	guint64 ns_ino;
+	gint64 trace_start;
+
+	if (ns_fd < 0)
+		return FALSE;
+
+	trace_start = li_run_trace_begin ();
+	if (g_strcmp0 (ns_stamp, stamp) != 0) {
+		/* the software, its runtime or its launch data has changed */
+		g_debug ("Cached environment is outdated.");
+		close (ns_fd);
+		ns_fd = -1;
+		return FALSE;
+	}
+
+	ns_ino = li_run_ns_get_inode (ns_fd);
+	if (setns (ns_fd, CLONE_NEWNS) != 0) {
+		g_debug ("Unable to enter cached environment: %s", strerror (errno));
+		return FALSE;
+	}
+	close (ns_fd);
+	ns_fd = -1;
+	chdir ("/");
+
+	/* mark the environment as used */
+	li_run_ns_record_write (ns_keeper_pid, ns_ino, stamp);
+	li_run_trace_end ("setns", trace_start);
+
+	return TRUE;
 }
@@ -25,6 +25,11 @@
 
 G_BEGIN_DECLS
 
+void		li_run_trace_init (void);
+gint64		li_run_trace_begin (void);
+void		li_run_trace_end (const gchar *phase,
+				  gint64 start);
+
 gboolean	li_run_acquire_caps (void);
 gboolean	li_run_drop_caps (void);
 
@@ -32,7 +37,13 @@ gchar		*li_run_env_setup (void);
 gchar		*li_run_env_setup_with_root (const gchar *root_fs);
 gboolean	li_run_env_enter (const gchar *newroot);
 
+void		li_run_env_cache_prepare (const gchar *key);
+void		li_run_env_cache (const gchar *stamp);
+gboolean	li_run_env_enter_cached (const gchar *stamp);
+
 void		li_run_env_set_path_variables (void);
+void		li_run_env_prepend_path (const gchar *var,
+					 const gchar *item);
 
 G_END_DECLS
 
@@ -28,20 +28,29 @@
 
 #include <glib/gi18n-lib.h>
 #include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <stdlib.h>
 
 #include "li-utils.h"
 #include "li-utils-private.h"
 #include "li-config-data.h"
 #include "li-pkg-info.h"
 
+/* runtimes with at least this many members get a flattened tree */
+#define LI_RUNTIME_FLATTEN_MIN_MEMBERS 4
+
 typedef struct _LiRuntimePrivate	LiRuntimePrivate;
 struct _LiRuntimePrivate
 {
 	gchar *fname;
 	gchar *uuid; /* auto-generated */
+	gchar *fingerprint; /* cached, depends on members */
 	GHashTable *members;
 	GHashTable *requirements;
 };
@@ -49,6 +58,20 @@ struct _LiRuntimePrivate
 G_DEFINE_TYPE_WITH_PRIVATE (LiRuntime, li_runtime, G_TYPE_OBJECT)
 #define GET_PRIVATE(o) (li_runtime_get_instance_private (o))
 
+/**
+ * li_runtime_invalidate_keys:
+ *
+ * Drop the cached fingerprint, after the members were changed.
+ */
+static void
+li_runtime_invalidate_keys (LiRuntime *rt)
+{
+	LiRuntimePrivate *priv = GET_PRIVATE (rt);
+
+	g_free (priv->fingerprint);
+	priv->fingerprint = NULL;
+}
+
 /**
  * li_runtime_fetch_values_from_cdata:
  **/
@@ -60,6 +83,7 @@ li_runtime_fetch_values_from_cdata (LiRuntime *rt, LiConfigData *cdata)
 
 	g_hash_table_remove_all (priv->members);
 	g_hash_table_remove_all (priv->requirements);
+	li_runtime_invalidate_keys (rt);
 
 	tmp = li_config_data_get_value (cdata, "Members");
 	if (tmp != NULL) {
@@ -138,6 +162,7 @@ li_runtime_finalize (GObject *object)
 
 	g_free (priv->uuid);
 	g_free (priv->fname);
+	g_free (priv->fingerprint);
 	g_hash_table_unref (priv->requirements);
 	g_hash_table_unref (priv->members);
 
@@ -153,6 +178,7 @@ li_runtime_init (LiRuntime *rt)
 	LiRuntimePrivate *priv = GET_PRIVATE (rt);
 
 	priv->fname = NULL;
+	priv->fingerprint = NULL;
 	priv->uuid = li_get_uuid_string ();
 	priv->requirements = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 	priv->members = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
@@ -263,6 +289,96 @@ li_runtime_get_requirements (LiRuntime *rt)
 	return priv->requirements;
 }
 
+/**
+ * li_runtime_strptr_cmp:
+ */
+static gint
+li_runtime_strptr_cmp (gconstpointer a, gconstpointer b)
+{
+	return g_strcmp0 (*((const gchar**) a), *((const gchar**) b));
+}
+
+/**
+ * li_runtime_fingerprint_for_set:
+ */
+static gchar*
+li_runtime_fingerprint_for_set (GHashTable *ids)
+{
+	g_autofree gchar **strv = NULL;
+	g_autofree gchar *str = NULL;
+	guint len;
+
+	strv = (gchar**) g_hash_table_get_keys_as_array (ids, &len);
+	qsort (strv, len, sizeof (gchar*), li_runtime_strptr_cmp);
+	str = g_strjoinv ("\n", strv);
+
+	return g_compute_checksum_for_string (G_CHECKSUM_SHA256, str, -1);
+}
+
+/**
+ * li_runtime_pkg_is_member_candidate:
+ *
+ * Check if the package can be part of a runtime.
+ */
+static gboolean
+li_runtime_pkg_is_member_candidate (LiPkgInfo *pki)
+{
+	if (li_pkg_info_get_id (pki) == NULL) {
+		g_warning ("Found package without identifier!");
+		return FALSE;
+	}
+
+	/* we can't add system dependencies to a runtime, so filter them out */
+	if (g_str_has_prefix (li_pkg_info_get_name (pki), "foundation:"))
+		return FALSE;
+
+	return TRUE;
+}
+
+/**
+ * li_runtime_get_fingerprint:
+ *
+ * Get a stable identifier for the set of members of this runtime.
+ * Runtimes with identical members have the same fingerprint.
+ *
+ * Returns: The member fingerprint
+ */
+const gchar*
+li_runtime_get_fingerprint (LiRuntime *rt)
+{
+	LiRuntimePrivate *priv = GET_PRIVATE (rt);
+
+	if (priv->fingerprint == NULL)
+		priv->fingerprint = li_runtime_fingerprint_for_set (priv->members);
+	return priv->fingerprint;
+}
+
+/**
+ * li_runtime_compute_fingerprint:
+ * @members: (element-type LiPkgInfo): A list of software as #LiPkgInfo
+ *
+ * Compute the fingerprint a runtime created from @members
+ * with li_runtime_create_with_members() would have.
+ *
+ * Returns: The member fingerprint, free with g_free()
+ */
+gchar*
+li_runtime_compute_fingerprint (GPtrArray *members)
+{
+	guint i;
+	g_autoptr(GHashTable) ids = NULL;
+
+	ids = g_hash_table_new (g_str_hash, g_str_equal);
+	for (i = 0; i < members->len; i++) {
+		LiPkgInfo *pki = LI_PKG_INFO (g_ptr_array_index (members, i));
+
+		if (li_runtime_pkg_is_member_candidate (pki))
+			g_hash_table_add (ids, (gpointer) li_pkg_info_get_id (pki));
+	}
+
+	return li_runtime_fingerprint_for_set (ids);
+}
+
 /**
  * li_runtime_add_package:
  */
@@ -270,6 +386,8 @@ void
 li_runtime_add_package (LiRuntime *rt, LiPkgInfo *pki)
 {
 	LiRuntimePrivate *priv = GET_PRIVATE (rt);
+
+	li_runtime_invalidate_keys (rt);
 	g_hash_table_add (priv->members,
 				g_strdup (li_pkg_info_get_id (pki)));
 	g_hash_table_add (priv->requirements,
@@ -283,11 +401,14 @@ li_runtime_add_package (LiRuntime *rt, LiPkgInfo *pki)
 void
 li_runtime_remove_package (LiRuntime *rt, LiPkgInfo *pki)
 {
+	g_autofree gchar *relation = NULL;
 	LiRuntimePrivate *priv = GET_PRIVATE (rt);
-	g_hash_table_remove (priv->members,
-				g_strdup (li_pkg_info_get_id (pki)));
-	g_hash_table_remove (priv->requirements,
-				li_pkg_info_get_name_relation_string (pki));
+
+	li_runtime_invalidate_keys (rt);
+
+	relation = li_pkg_info_get_name_relation_string (pki);
+	g_hash_table_remove (priv->members, li_pkg_info_get_id (pki));
+	g_hash_table_remove (priv->requirements, relation);
 }
 
 /**
@@ -298,8 +419,10 @@ void
 li_runtime_update_package (LiRuntime *rt, LiPkgInfo *old_pki, LiPkgInfo *new_pki)
 {
 	LiRuntimePrivate *priv = GET_PRIVATE (rt);
-	g_hash_table_remove (priv->members,
-				g_strdup (li_pkg_info_get_id (old_pki)));
+
+	li_runtime_invalidate_keys (rt);
+
+	g_hash_table_remove (priv->members, li_pkg_info_get_id (old_pki));
 	g_hash_table_add (priv->members,
 				g_strdup (li_pkg_info_get_id (new_pki)));
 }
@@ -338,11 +461,366 @@ li_runtime_save (LiRuntime *rt, GError **error)
 	ret = li_config_data_save_to_file (cdata, control_fname, &tmp_error);
 	if (tmp_error != NULL) {
 		g_propagate_error (error, tmp_error);
+		return ret;
+	}
+
+	/* the members might have changed, so we need a new flattened tree.
+	 * We build it right away, a background thread would be killed when a
+	 * short-lived process (like limbacli) exits. The tree is optional, so
+	 * failing to build it is not fatal. */
+	if (!li_runtime_flatten (rt, &tmp_error)) {
+		g_warning ("Unable to flatten runtime '%s': %s", priv->uuid, tmp_error->message);
+		g_error_free (tmp_error);
+	}
+
+	return ret;
+}
+
+/**
+ * li_runtime_get_flat_path:
+ *
+ * Get the path of the flattened tree of this runtime, which merges the data
+ * of all its members into one directory.
+ * Runtimes with identical members share the same tree.
+ * The tree might not exist, e.g. if it is still being built or if
+ * the runtime has only a few members.
+ *
+ * Returns: The path of the flattened tree, free with g_free()
+ */
+gchar*
+li_runtime_get_flat_path (LiRuntime *rt)
+{
+	return g_build_filename (LI_SOFTWARE_ROOT, "runtimes", ".flat", li_runtime_get_fingerprint (rt), NULL);
+}
+
+/**
+ * li_runtime_flatten_tree:
+ *
+ * Merge the directory tree @src into @dest using hardlinks.
+ * Files which already exist in @dest are kept, as if @dest was
+ * an upper overlay layer.
+ */
+static gboolean
+li_runtime_flatten_tree (const gchar *src, const gchar *dest, GError **error)
+{
+	GDir *dir;
+	const gchar *name;
+	gboolean ret = TRUE;
+
+	dir = g_dir_open (src, 0, error);
+	if (dir == NULL)
+		return FALSE;
+
+	while ((name = g_dir_read_name (dir)) != NULL) {
+		struct stat src_buf;
+		struct stat dest_buf;
+		gboolean dest_exists;
+		g_autofree gchar *src_path = NULL;
+		g_autofree gchar *dest_path = NULL;
+
+		src_path = g_build_filename (src, name, NULL);
+		dest_path = g_build_filename (dest, name, NULL);
+		if (lstat (src_path, &src_buf) != 0)
+			continue;
+		dest_exists = lstat (dest_path, &dest_buf) == 0;
+
+		if (S_ISDIR (src_buf.st_mode)) {
+			if (!dest_exists) {
+				if (g_mkdir (dest_path, src_buf.st_mode & 07777) != 0) {
+					g_set_error (error,
+						G_FILE_ERROR,
+						g_file_error_from_errno (errno),
+						_("Could not create directory '%s'. %s"), dest_path, g_strerror (errno));
+					ret = FALSE;
+					break;
+				}
+			} else if (!S_ISDIR (dest_buf.st_mode)) {
+				/* the directory is hidden by a file of another member */
+				continue;
+			}
+
+			if (!li_runtime_flatten_tree (src_path, dest_path, error)) {
+				ret = FALSE;
+				break;
+			}
+		} else if (dest_exists) {
+			continue;
+		} else if (S_ISLNK (src_buf.st_mode)) {
+			g_autofree gchar *target = NULL;
+
+			target = g_file_read_link (src_path, error);
+			if ((target == NULL) || (symlink (target, dest_path) != 0)) {
+				if (target != NULL)
+					g_set_error (error,
+						G_FILE_ERROR,
+						g_file_error_from_errno (errno),
+						_("Could not create symbolic link '%s'. %s"), dest_path, g_strerror (errno));
+				ret = FALSE;
+				break;
+			}
+		} else if (S_ISREG (src_buf.st_mode)) {
+			if (link (src_path, dest_path) == 0)
+				continue;
+
+			/* we can not create hardlinks across filesystems, copy the file instead */
+			if (!li_copy_file (src_path, dest_path, error)) {
+				ret = FALSE;
+				break;
+			}
+			chmod (dest_path, src_buf.st_mode & 07777);
+		}
+	}
+
+	g_dir_close (dir);
+	return ret;
+}
+
+/**
+ * li_runtime_lock_flat_root:
+ * @exclusive: %TRUE to get an exclusive lock
+ *
+ * Lock the directory of flattened trees. Processes building a tree hold
+ * a shared lock from checking whether it exists until it has been renamed
+ * into place, so trees and temporary directories can only be removed while
+ * holding the exclusive lock.
+ * Only the shared lock waits for other processes, the exclusive lock fails
+ * immediately if it is held by someone else.
+ *
+ * Returns: A file descriptor to close to release the lock, or -1
+ */
+gint
+li_runtime_lock_flat_root (gboolean exclusive)
+{
+	gint fd;
+	g_autofree gchar *lock_fname = NULL;
+
+	lock_fname = g_build_filename (LI_SOFTWARE_ROOT, "runtimes", ".flat", ".lock", NULL);
+	fd = open (lock_fname, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -1;
+
+	while (flock (fd, exclusive? LOCK_EX | LOCK_NB : LOCK_SH) != 0) {
+		if (errno != EINTR) {
+			close (fd);
+			return -1;
+		}
 	}
 
+	return fd;
+}
+
+/**
+ * li_runtime_lease_flat_tree:
+ * @flat_dir: A flattened tree, see li_runtime_get_flat_path()
+ *
+ * Mark a flattened tree as being in use, so it is not removed while
+ * it is mounted. The lease is a shared lock on the directory of the tree,
+ * which is held as long as any process has the returned file descriptor
+ * open. The descriptor is inherited across exec(), so the lease covers the
+ * application, its children and a cached environment forked from it.
+ *
+ * Returns: A file descriptor holding the lease, or -1 if the tree does
+ * not exist (anymore) or is being removed.
+ */
+gint
+li_runtime_lease_flat_tree (const gchar *flat_dir)
+{
+	gint fd;
+	struct stat fd_buf;
+	struct stat path_buf;
+
+	fd = open (flat_dir, O_RDONLY | O_DIRECTORY);
+	if (fd < 0)
+		return -1;
+
+	/* don't wait for a removal, the caller can use the unflattened runtime instead */
+	while (flock (fd, LOCK_SH | LOCK_NB) != 0) {
+		if (errno != EINTR) {
+			close (fd);
+			return -1;
+		}
+	}
+
+	/* the tree might have been removed before we got the lock */
+	if ((fstat (fd, &fd_buf) != 0) ||
+	    (stat (flat_dir, &path_buf) != 0) ||
+	    (fd_buf.st_dev != path_buf.st_dev) ||
+	    (fd_buf.st_ino != path_buf.st_ino)) {
+		close (fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/**
+ * li_runtime_remove_flat_tree:
+ * @flat_dir: A flattened tree, see li_runtime_get_flat_path()
+ *
+ * Remove a flattened tree, unless it is leased by a running application
+ * or a cached environment (see li_runtime_lease_flat_tree()).
+ * The caller must hold the exclusive lock of the directory of flattened trees.
+ *
+ * Returns: %TRUE if the tree was removed.
+ */
+gboolean
+li_runtime_remove_flat_tree (const gchar *flat_dir)
+{
+	gint fd;
+	gboolean ret;
+
+	fd = open (flat_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return FALSE;
+
+	while (flock (fd, LOCK_EX | LOCK_NB) != 0) {
+		if (errno != EINTR) {
+			/* still in use */
+			close (fd);
+			return FALSE;
+		}
+	}
+
+	/* we keep the lock until the tree is gone, so nobody can lease it in the meantime */
+	ret = li_delete_dir_recursive (flat_dir);
+	close (fd);
+
 	return ret;
 }
 
+/**
+ * li_runtime_flatten_members:
+ *
+ * Build the flattened tree @flat_dir from the data of the given members.
+ */
+static gboolean
+li_runtime_flatten_members (gchar **member_ids, const gchar *flat_dir, GError **error)
+{
+	guint i;
+	gint lock_fd;
+	g_autofree gchar *flat_root = NULL;
+	g_autofree gchar *tmp_dir = NULL;
+
+	flat_root = g_path_get_dirname (flat_dir);
+	if (g_mkdir_with_parents (flat_root, 0755) != 0) {
+		g_set_error (error,
+			G_FILE_ERROR,
+			G_FILE_ERROR_FAILED,
+			_("Could not create runtime cache directory. %s"), g_strerror (errno));
+		return FALSE;
+	}
+
+	lock_fd = li_runtime_lock_flat_root (FALSE);
+	if (lock_fd < 0) {
+		g_set_error (error,
+			G_FILE_ERROR,
+			g_file_error_from_errno (errno),
+			_("Could not lock runtime cache directory. %s"), g_strerror (errno));
+		return FALSE;
+	}
+
+	/* the tree only depends on the members, so if it exists it is valid.
+	 * We check while holding the lock, as trees are only removed while
+	 * nobody else holds it. */
+	if (g_file_test (flat_dir, G_FILE_TEST_IS_DIR)) {
+		close (lock_fd);
+		return TRUE;
+	}
+
+	tmp_dir = g_strdup_printf ("%s.tmp-XXXXXX", flat_dir);
+	if (g_mkdtemp_full (tmp_dir, 0755) == NULL) {
+		g_set_error (error,
+			G_FILE_ERROR,
+			G_FILE_ERROR_FAILED,
+			_("Could not create runtime cache directory. %s"), g_strerror (errno));
+		close (lock_fd);
+		return FALSE;
+	}
+
+	for (i = 0; member_ids[i] != NULL; i++) {
+		g_autofree gchar *data_dir = NULL;
+
+		data_dir = g_build_filename (LI_SOFTWARE_ROOT, member_ids[i], "data", NULL);
+		if (!g_file_test (data_dir, G_FILE_TEST_IS_DIR))
+			continue;
+		if (!li_runtime_flatten_tree (data_dir, tmp_dir, error))
+			goto fail;
+	}
+
+	/* make the complete tree visible at once */
+	if (g_rename (tmp_dir, flat_dir) != 0) {
+		/* another process might have built the same tree in the meantime */
+		if (g_file_test (flat_dir, G_FILE_TEST_IS_DIR)) {
+			li_delete_dir_recursive (tmp_dir);
+			close (lock_fd);
+			return TRUE;
+		}
+
+		g_set_error (error,
+			G_FILE_ERROR,
+			g_file_error_from_errno (errno),
+			_("Could not create flattened runtime. %s"), g_strerror (errno));
+		goto fail;
+	}
+
+	close (lock_fd);
+	return TRUE;
+
+fail:
+	li_delete_dir_recursive (tmp_dir);
+	close (lock_fd);
+	return FALSE;
+}
+
+/**
+ * li_runtime_dup_member_ids:
+ *
+ * Get the member IDs of this runtime in the order their data is layered,
+ * topmost first. The flattened tree and the overlay mounts of the members
+ * both use this order, so files which exist in multiple members resolve
+ * to the same member either way.
+ *
+ * Returns: (transfer full): A sorted copy of the member IDs of this runtime.
+ */
+gchar**
+li_runtime_dup_member_ids (LiRuntime *rt)
+{
+	guint len;
+	gchar **ids;
+	g_autofree gchar **strv = NULL;
+	LiRuntimePrivate *priv = GET_PRIVATE (rt);
+
+	strv = (gchar**) g_hash_table_get_keys_as_array (priv->members, &len);
+	qsort (strv, len, sizeof (gchar*), li_runtime_strptr_cmp);
+	ids = g_strdupv (strv);
+
+	return ids;
+}
+
+/**
+ * li_runtime_flatten:
+ *
+ * Build the flattened tree of this runtime, see li_runtime_get_flat_path().
+ * Runtimes with only a few members are not flattened.
+ *
+ * Returns: %TRUE on success, or if no tree is needed.
+ */
+gboolean
+li_runtime_flatten (LiRuntime *rt, GError **error)
+{
+	g_auto(GStrv) member_ids = NULL;
+	g_autofree gchar *flat_dir = NULL;
+	LiRuntimePrivate *priv = GET_PRIVATE (rt);
+
+	if (g_hash_table_size (priv->members) < LI_RUNTIME_FLATTEN_MIN_MEMBERS)
+		return TRUE;
+
+	member_ids = li_runtime_dup_member_ids (rt);
+	flat_dir = li_runtime_get_flat_path (rt);
+
+	return li_runtime_flatten_members (member_ids, flat_dir, error);
+}
+
 /**
  * li_runtime_create_with_members:
  * @members: (element-type LiPkgInfo): A list of software as #LiPkgInfo
@@ -365,22 +843,14 @@ li_runtime_create_with_members (GPtrArray *members, GError **error)
 
 	rt = li_runtime_new ();
 	for (i = 0; i < members->len; i++) {
-		const gchar *pkid;
 		LiPkgInfo *pki = LI_PKG_INFO (g_ptr_array_index (members, i));
 
-		pkid = li_pkg_info_get_id (pki);
-		if (pkid == NULL) {
-			g_warning ("Found package without identifier!");
-			continue;
-		}
-
-		/* we can't add system dependencies to a runtime, so filter them out */
-		if (g_str_has_prefix (li_pkg_info_get_name (pki), "foundation:")) {
+		/* filter out packages we can't add to a runtime */
+		if (!li_runtime_pkg_is_member_candidate (pki))
 			continue;
-		}
 
 		/* did we add this already? */
-		if (!g_hash_table_add (dedup, g_strdup (pkid)))
+		if (!g_hash_table_add (dedup, g_strdup (li_pkg_info_get_id (pki))))
 			continue;
 
 		/* register the added member with the runtime */
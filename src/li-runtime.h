@@ -25,7 +25,7 @@
 #ifndef __LI_RUNTIME_H
 #define __LI_RUNTIME_H
 
-#include <glib-object.h>
+#include <gio/gio.h>
 #include "li-pkg-info.h"
 
 G_BEGIN_DECLS
@@ -59,10 +59,21 @@ gboolean		li_runtime_load_by_uuid (LiRuntime *rt,
 gboolean		li_runtime_save (LiRuntime *rt,
 					 GError **error);
 
+gchar			*li_runtime_get_flat_path (LiRuntime *rt);
+gboolean		li_runtime_flatten (LiRuntime *rt,
+					 GError **error);
+gint			li_runtime_lock_flat_root (gboolean exclusive);
+gint			li_runtime_lease_flat_tree (const gchar *flat_dir);
+gboolean		li_runtime_remove_flat_tree (const gchar *flat_dir);
+
+gchar			**li_runtime_dup_member_ids (LiRuntime *rt);
+
 const gchar		*li_runtime_get_uuid (LiRuntime *rt);
+const gchar		*li_runtime_get_fingerprint (LiRuntime *rt);
 
 LiRuntime		*li_runtime_create_with_members (GPtrArray *members,
 							 GError **error);
+gchar			*li_runtime_compute_fingerprint (GPtrArray *members);
 
 GHashTable		*li_runtime_get_requirements (LiRuntime *rt);
 GHashTable		*li_runtime_get_members (LiRuntime *rt);
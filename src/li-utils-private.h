@@ -38,6 +38,11 @@ gchar			*li_str_replace (const gchar* str,
 gboolean		li_copy_file (const gchar *source,
 					const gchar *destination,
 					GError **error);
+gboolean		li_reflink_file (const gchar *source,
+					const gchar *destination);
+gboolean		li_link_or_copy_file (const gchar *source,
+						const gchar *destination,
+						GError **error);
 gboolean		li_delete_dir_recursive (const gchar* dirname);
 GPtrArray		*li_utils_find_files_matching (const gchar* dir,
 							const gchar* pattern,
@@ -56,6 +61,11 @@ gchar			*li_get_pkgname_from_component (AsComponent *cpt);
 void			li_add_to_new_scope (const gchar *domain,
 						const gchar *idname,
 						GError **error);
+gint			li_add_to_new_scope_async (const gchar *domain,
+						const gchar *idname,
+						GSpawnChildSetupFunc child_setup,
+						gpointer user_data);
+void			li_add_to_new_scope_finish (gint fd);
 
 gchar			*li_env_get_user_fullname (void);
 gchar			*li_env_get_user_email (void);
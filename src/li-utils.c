@@ -20,12 +20,14 @@
 
 #include "li-utils.h"
 #include "li-utils-private.h"
+#include "li-checksum.h"
 
 #include <config.h>
 #include <glib.h>
 #include <glib-object.h>
 #include <gio/gio.h>
 #include <glib/gstdio.h>
+#include <glib-unix.h>
 #include <glib/gi18n-lib.h>
 #include <uuid/uuid.h>
 #include <appstream.h>
@@ -33,6 +35,11 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/utsname.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <errno.h>
 #include "li-systemd-dbus.h"
 
@@ -96,6 +103,67 @@ li_copy_file (const gchar *source, const gchar *destination, GError **error)
 	return TRUE;
 }
 
+/**
+ * li_reflink_file:
+ *
+ * Create @destination as a copy-on-write clone of @source.
+ * This only works on filesystems supporting it, e.g. Btrfs or XFS.
+ *
+ * Returns: %TRUE if the file was cloned.
+ */
+gboolean
+li_reflink_file (const gchar *source, const gchar *destination)
+{
+	int sfd;
+	int dfd;
+	struct stat sb;
+	gboolean ret = FALSE;
+
+	sfd = open (source, O_RDONLY | O_CLOEXEC);
+	if (sfd < 0)
+		return FALSE;
+	if (fstat (sfd, &sb) != 0) {
+		close (sfd);
+		return FALSE;
+	}
+
+	dfd = open (destination, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, sb.st_mode & 0777);
+	if (dfd < 0) {
+		close (sfd);
+		return FALSE;
+	}
+
+	if (ioctl (dfd, FICLONE, sfd) == 0)
+		ret = TRUE;
+
+	close (dfd);
+	close (sfd);
+	if (!ret)
+		g_remove (destination);
+
+	return ret;
+}
+
+/**
+ * li_link_or_copy_file:
+ *
+ * Place a file which will never be modified at @destination, without
+ * duplicating its data if possible. We clone the file, hardlink it, and
+ * only copy it if both fail (e.g. because source and destination are on
+ * different filesystems).
+ * @destination must not exist.
+ */
+gboolean
+li_link_or_copy_file (const gchar *source, const gchar *destination, GError **error)
+{
+	if (li_reflink_file (source, destination))
+		return TRUE;
+	if (link (source, destination) == 0)
+		return TRUE;
+
+	return li_copy_file (source, destination, error);
+}
+
 /**
  * li_delete_dir_recursive:
  * @dirname: Directory to remove
@@ -320,30 +388,7 @@ li_str_replace (const gchar *str, const gchar *old, const gchar *new)
 gchar*
 li_compute_checksum_for_file (const gchar *fname)
 {
-	const GChecksumType cstype = G_CHECKSUM_SHA256;
-	g_autoptr(GChecksum) cs;
-	guchar data[4096] = {0};
-	size_t size = 0;
-	FILE *input;
-	const gchar *sum;
-
-	cs = g_checksum_new (cstype);
-	input = fopen (fname, "rb");
-
-	/* return NULL if we were unable to open the file */
-	if (input == NULL)
-		return NULL;
-
-	/* build the checksum */
-	do {
-		size = read (fileno (input), (void*) data, (gsize) 4096);
-		g_checksum_update (cs, data, size);
-	} while (size == 4096);
-
-	fclose (input);
-	sum = g_checksum_get_string (cs);
-
-	return g_strdup (sum);
+	return li_checksum_compute_for_file (fname);
 }
 
 /**
@@ -844,12 +889,112 @@ li_sd_job_removed_cb (LiSdManager *sdmgr, guint32 id, gchar *job, gchar *unit, g
 }
 
 /**
- * li_add_to_new_scope:
+ * li_add_pid_to_delegated_cgroup:
  *
- * Add the current process to a new scope (cgroup).
+ * Move @pid to a new cgroup next to the cgroup of the current process,
+ * in case we run in a cgroup v2 subtree which was delegated to us.
  */
-void
-li_add_to_new_scope (const gchar *domain, const gchar *idname, GError **error)
+static gboolean
+li_add_pid_to_delegated_cgroup (const gchar *cgname, guint32 pid, GError **error)
+{
+	int fd;
+	gssize len;
+	guint i;
+	const gchar *own_cg = NULL;
+	g_autofree gchar *data = NULL;
+	g_autofree gchar *parent_dir = NULL;
+	g_autofree gchar *cg_dir = NULL;
+	g_autofree gchar *procs_fname = NULL;
+	g_auto(GStrv) lines = NULL;
+
+	/* we only support the unified hierarchy */
+	if (!g_file_test ("/sys/fs/cgroup/cgroup.controllers", G_FILE_TEST_EXISTS)) {
+		g_set_error (error,
+				G_IO_ERROR,
+				G_IO_ERROR_NOT_SUPPORTED,
+				"No cgroup v2 hierarchy found.");
+		return FALSE;
+	}
+
+	if (!g_file_get_contents ("/proc/self/cgroup", &data, NULL, error))
+		return FALSE;
+	lines = g_strsplit (data, "\n", -1);
+	for (i = 0; lines[i] != NULL; i++) {
+		if (g_str_has_prefix (lines[i], "0::")) {
+			own_cg = lines[i] + 3;
+			break;
+		}
+	}
+	if (own_cg == NULL) {
+		g_set_error (error,
+				G_FILE_ERROR,
+				G_FILE_ERROR_NOENT,
+				"Unable to determine the cgroup of this process.");
+		return FALSE;
+	}
+
+	/* we can only create new cgroups if the parent has been delegated to us */
+	cg_dir = g_build_filename ("/sys/fs/cgroup", own_cg, NULL);
+	parent_dir = g_path_get_dirname (cg_dir);
+	if (access (parent_dir, W_OK) != 0) {
+		g_set_error (error,
+				G_IO_ERROR,
+				G_IO_ERROR_NOT_SUPPORTED,
+				"The cgroup '%s' was not delegated to us.", parent_dir);
+		return FALSE;
+	}
+
+	g_free (cg_dir);
+	cg_dir = g_build_filename (parent_dir, cgname, NULL);
+	if ((g_mkdir (cg_dir, 0755) != 0) && (errno != EEXIST)) {
+		g_set_error (error,
+				G_FILE_ERROR,
+				g_file_error_from_errno (errno),
+				"Unable to create cgroup: %s", g_strerror (errno));
+		return FALSE;
+	}
+
+	/* this must be a plain write, cgroupfs doesn't allow us to rename files.
+	 * The kernel only validates the move when the pid is written, so even
+	 * with write access to the directory, the write itself may fail (e.g. if
+	 * we lack permissions on the common ancestor of both cgroups) */
+	procs_fname = g_build_filename (cg_dir, "cgroup.procs", NULL);
+	fd = open (procs_fname, O_WRONLY | O_CLOEXEC);
+	if (fd < 0) {
+		g_set_error (error,
+				G_FILE_ERROR,
+				g_file_error_from_errno (errno),
+				"Unable to move process to cgroup: %s", g_strerror (errno));
+		g_rmdir (cg_dir);
+		return FALSE;
+	}
+	g_free (data);
+	data = g_strdup_printf ("%u", pid);
+	do {
+		len = write (fd, data, strlen (data));
+	} while ((len < 0) && (errno == EINTR));
+	if (len != (gssize) strlen (data)) {
+		g_set_error (error,
+				G_FILE_ERROR,
+				len < 0? g_file_error_from_errno (errno) : G_FILE_ERROR_IO,
+				"Unable to move process to cgroup: %s",
+				len < 0? g_strerror (errno) : "Short write");
+		close (fd);
+		g_rmdir (cg_dir);
+		return FALSE;
+	}
+	close (fd);
+
+	return TRUE;
+}
+
+/**
+ * li_add_pid_to_new_scope:
+ *
+ * Add the process @pid to a new scope (cgroup).
+ */
+static void
+li_add_pid_to_new_scope (const gchar *domain, const gchar *idname, guint32 pid, GError **error)
 {
 	GDBusConnection *conn = NULL;
 	LiSdManager *sdmgr = NULL;
@@ -861,7 +1006,6 @@ li_add_to_new_scope (const gchar *domain, const gchar *idname, GError **error)
 	GVariantBuilder builder;
 	GVariant *properties = NULL;
 	GVariant *aux = NULL;
-	guint32 pid;
 	GError *tmp_error = NULL;
 	struct SdJobData data;
 
@@ -874,10 +1018,19 @@ li_add_to_new_scope (const gchar *domain, const gchar *idname, GError **error)
 	} else {
 		sd_path = g_strdup_printf ("/run/user/%d/systemd/private", getuid ());
 	}
-	if (!g_file_test (sd_path, G_FILE_TEST_EXISTS))
+	if (!g_file_test (sd_path, G_FILE_TEST_EXISTS)) {
+		/* no systemd, but we might still be able to manage our own cgroups */
+		cgname = g_strdup_printf ("%s-%s-%d.scope", domain, idname, pid);
+		if (!li_add_pid_to_delegated_cgroup (cgname, pid, &tmp_error)) {
+			if (g_error_matches (tmp_error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED)) {
+				g_debug ("Not adding process to a new scope: %s", tmp_error->message);
+				g_error_free (tmp_error);
+			} else {
+				g_propagate_error (error, tmp_error);
+			}
+		}
 		goto out;
-
-	pid = getpid ();
+	}
 
 	main_loop = g_main_loop_new (NULL, FALSE);
 
@@ -945,3 +1098,110 @@ out:
 	if (conn)
 		g_object_unref (conn);
 }
+
+/**
+ * li_add_to_new_scope:
+ *
+ * Add the current process to a new scope (cgroup).
+ */
+void
+li_add_to_new_scope (const gchar *domain, const gchar *idname, GError **error)
+{
+	li_add_pid_to_new_scope (domain, idname, getpid (), error);
+}
+
+/**
+ * li_add_to_new_scope_async:
+ * @domain: The scope domain, e.g. "app"
+ * @idname: The name of the scope
+ * @child_setup: (nullable): Function to run in the helper process before it does anything else
+ * @user_data: Data for @child_setup
+ *
+ * Add the current process to a new scope (cgroup) without waiting for
+ * systemd to complete this request.
+ * The scope is created by a helper process, so the current process can
+ * continue to set things up in the meantime. Errors are printed by the helper.
+ *
+ * Child processes which are forked before the helper has finished remain
+ * in the old cgroup, so li_add_to_new_scope_finish() must be called before
+ * the current process forks anything that belongs into the scope, and
+ * before it exec()s the application.
+ *
+ * Returns: A file descriptor to pass to li_add_to_new_scope_finish(), or -1
+ */
+gint
+li_add_to_new_scope_async (const gchar *domain, const gchar *idname, GSpawnChildSetupFunc child_setup, gpointer user_data)
+{
+	pid_t pid;
+	guint32 target_pid;
+	gint fds[2];
+
+	target_pid = getpid ();
+
+	/* the helper holds the write end of the pipe until it exits, so we can wait for it */
+	if (!g_unix_open_pipe (fds, FD_CLOEXEC, NULL)) {
+		g_warning ("Unable to create scope helper: %s", g_strerror (errno));
+		return -1;
+	}
+
+	/* fork twice, so the helper is not a child of the current process */
+	pid = fork ();
+	if (pid < 0) {
+		g_warning ("Unable to create scope helper: %s", g_strerror (errno));
+		close (fds[0]);
+		close (fds[1]);
+		return -1;
+	}
+
+	if (pid == 0) {
+		pid_t helper_pid;
+
+		close (fds[0]);
+		helper_pid = fork ();
+		if (helper_pid == 0) {
+			GError *tmp_error = NULL;
+
+			if (child_setup != NULL)
+				child_setup (user_data);
+
+			li_add_pid_to_new_scope (domain, idname, target_pid, &tmp_error);
+			if (tmp_error != NULL) {
+				g_printerr ("Could not add process to new scope. %s\n", tmp_error->message);
+				g_error_free (tmp_error);
+				_exit (1);
+			}
+			_exit (0);
+		}
+
+		_exit (helper_pid < 0 ? 1 : 0);
+	}
+
+	close (fds[1]);
+	waitpid (pid, NULL, 0);
+
+	return fds[0];
+}
+
+/**
+ * li_add_to_new_scope_finish:
+ * @fd: The file descriptor returned by li_add_to_new_scope_async()
+ *
+ * Wait for the helper started by li_add_to_new_scope_async() to finish,
+ * so the current process is in its new scope (if it could be created)
+ * when this function returns.
+ */
+void
+li_add_to_new_scope_finish (gint fd)
+{
+	gchar c;
+	gssize len;
+
+	if (fd < 0)
+		return;
+
+	/* we get EOF once the helper has exited */
+	do {
+		len = read (fd, &c, 1);
+	} while ((len > 0) || ((len < 0) && (errno == EINTR)));
+	close (fd);
+}
@@ -19,10 +19,16 @@
  */
 
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "limba.h"
 
 #include "li-config-data.h"
+#include "li-checksum.h"
+#include "li-runtime.h"
+#include "li-progress.h"
 
 static gchar *datadir = NULL;
 
@@ -138,6 +144,271 @@ test_versions () {
 	g_assert (li_compare_versions ("3.0.rc2", "3.0.0") == -1);
 }
 
+void
+test_checksums ()
+{
+	gchar *str;
+	g_autofree gchar *fname1 = NULL;
+	g_autofree gchar *fname2 = NULL;
+	g_autoptr(GPtrArray) fnames = NULL;
+	g_autoptr(GPtrArray) checksums = NULL;
+
+	str = li_checksum_compute_for_data ((const guint8*) "abc", 3);
+	g_assert_cmpstr (str, ==, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+	g_free (str);
+
+	fname1 = g_build_filename (datadir, "lidatafile.test", NULL);
+	str = li_checksum_compute_for_file (fname1);
+	g_assert_cmpstr (str, ==, "24904630964beb0fe4fb51d3d5253724c885b98bf6821fbc16f6716aac1438dd");
+	g_free (str);
+
+	fname2 = g_build_filename (datadir, "xfile1.bin", NULL);
+	fnames = g_ptr_array_new ();
+	g_ptr_array_add (fnames, fname2);
+	g_ptr_array_add (fnames, "/nonexistent");
+	g_ptr_array_add (fnames, fname1);
+
+	checksums = li_checksum_compute_for_files (fnames);
+	g_assert_cmpint (checksums->len, ==, 3);
+	g_assert_cmpstr (g_ptr_array_index (checksums, 0), ==, "29bbe86907ec2edcbe335aee83cc15bf45edfdda83d27061c12ba36fe88fd8dc");
+	g_assert (g_ptr_array_index (checksums, 1) == NULL);
+	g_assert_cmpstr (g_ptr_array_index (checksums, 2), ==, "24904630964beb0fe4fb51d3d5253724c885b98bf6821fbc16f6716aac1438dd");
+}
+
+void
+test_checksum_backends ()
+{
+	guint i, j;
+	gint fd;
+	gsize big_len;
+	g_autofree guint8 *big = NULL;
+	g_autofree gchar *big_fname = NULL;
+	g_autofree gchar *default_backend = NULL;
+	g_autofree gchar *data = NULL;
+	GError *error = NULL;
+	const gchar *backends[] = { "generic", "sha-ni" };
+	/* lengths around the padding boundary, and one spanning many blocks */
+	const struct {
+		gsize len;
+		const gchar *checksum;
+	} vectors[] = {
+		{ 55, "9f4390f8d30c2dd92ec9f095b65e2b9ae9b0a925a5258e241c9f1e910f734318" },
+		{ 56, "b35439a4ac6f0948b6d6f9e3c6af0f5f590ce20f1bde7090ef7970686ec6738a" },
+		{ 63, "7d3e74a05d7db15bce4ad9ec0658ea98e3f06eeecf16b4c6fff2da457ddc2f34" },
+		{ 64, "ffe054fe7ae0cb6dc65c3af9b61d5209f439851db43d0ba5997337df154668eb" },
+		{ 65, "635361c48bb9eab14198e76ea8ab7f1a41685d6ad62aa9146d301d4f17eb0ae0" },
+		{ 1000, "41edece42d63e8d9bf515a9ba6932e1c20cbc9f5a5d134645adb5db1b9737ea3" }
+	};
+
+	data = g_strnfill (1000, 'a');
+
+	/* a file larger than the chunks files are read in */
+	big_len = 8 * 1024 * 1024 + 65;
+	big = g_malloc (big_len);
+	for (i = 0; i < big_len; i++)
+		big[i] = (guint8) (i % 251);
+	fd = g_file_open_tmp ("li-checksum-XXXXXX", &big_fname, &error);
+	g_assert_no_error (error);
+	close (fd);
+	g_file_set_contents (big_fname, (const gchar*) big, big_len, &error);
+	g_assert_no_error (error);
+
+	default_backend = g_strdup (li_checksum_get_backend_name ());
+	g_assert (!li_checksum_set_backend ("nonexistent"));
+
+	for (i = 0; i < G_N_ELEMENTS (backends); i++) {
+		gchar *str;
+
+		if (!li_checksum_set_backend (backends[i])) {
+			g_debug ("SHA-256 backend '%s' is not supported here, skipping it.", backends[i]);
+			continue;
+		}
+		g_assert_cmpstr (li_checksum_get_backend_name (), ==, backends[i]);
+
+		for (j = 0; j < G_N_ELEMENTS (vectors); j++) {
+			str = li_checksum_compute_for_data ((const guint8*) data, vectors[j].len);
+			g_assert_cmpstr (str, ==, vectors[j].checksum);
+			g_free (str);
+		}
+
+		str = li_checksum_compute_for_file (big_fname);
+		g_assert_cmpstr (str, ==, "e8c9d1a16bd635a5625da7173989b4cb2d0fc7d8216f3631d8c2cfd04a6a4816");
+		g_free (str);
+	}
+
+	g_assert (li_checksum_set_backend (default_backend));
+	g_remove (big_fname);
+}
+
+static LiPkgInfo*
+test_new_pkg_info (const gchar *name, const gchar *version)
+{
+	LiPkgInfo *pki;
+
+	pki = li_pkg_info_new ();
+	li_pkg_info_set_name (pki, name);
+	li_pkg_info_set_version (pki, version);
+	return pki;
+}
+
+void
+test_runtime_fingerprint ()
+{
+	g_autoptr(LiPkgInfo) libfoo = NULL;
+	g_autoptr(LiPkgInfo) libbar = NULL;
+	g_autoptr(LiPkgInfo) libbar_new = NULL;
+	g_autoptr(LiPkgInfo) libc = NULL;
+	g_autoptr(GPtrArray) members1 = NULL;
+	g_autoptr(GPtrArray) members2 = NULL;
+	g_autoptr(LiRuntime) rt = NULL;
+	g_autofree gchar *fpr1 = NULL;
+	g_autofree gchar *fpr2 = NULL;
+	g_autofree gchar *fpr3 = NULL;
+
+	libfoo = test_new_pkg_info ("libfoo", "1.0");
+	libbar = test_new_pkg_info ("libbar", "2.0");
+	libbar_new = test_new_pkg_info ("libbar", "2.1");
+	libc = test_new_pkg_info ("foundation:libc6", "2.19");
+
+	/* the order of members and system dependencies don't matter */
+	members1 = g_ptr_array_new ();
+	g_ptr_array_add (members1, libfoo);
+	g_ptr_array_add (members1, libbar);
+	g_ptr_array_add (members1, libc);
+
+	members2 = g_ptr_array_new ();
+	g_ptr_array_add (members2, libbar);
+	g_ptr_array_add (members2, libfoo);
+
+	fpr1 = li_runtime_compute_fingerprint (members1);
+	fpr2 = li_runtime_compute_fingerprint (members2);
+	g_assert_cmpstr (fpr1, ==, fpr2);
+
+	/* a runtime with these members has to be considered equal */
+	rt = li_runtime_new ();
+	li_runtime_add_package (rt, libfoo);
+	li_runtime_add_package (rt, libbar);
+	g_assert_cmpstr (li_runtime_get_fingerprint (rt), ==, fpr1);
+
+	/* different members make a different runtime */
+	g_ptr_array_remove (members2, libbar);
+	g_ptr_array_add (members2, libbar_new);
+	fpr3 = li_runtime_compute_fingerprint (members2);
+	g_assert_cmpstr (fpr3, !=, fpr1);
+
+	/* an upgraded runtime can be merged with a new one for the same members,
+	 * even though it was created for other requirements */
+	li_runtime_update_package (rt, libbar, libbar_new);
+	g_assert_cmpstr (li_runtime_get_fingerprint (rt), ==, fpr3);
+}
+
+typedef struct {
+	guint count;
+	guint last_percentage;
+	guint64 last_bytes_done;
+	guint64 last_bytes_total;
+	guint64 last_rate;
+} ProgressRecord;
+
+static void
+test_progress_record_cb (const gchar *id, guint percentage, guint64 bytes_done, guint64 bytes_total, guint64 rate, gpointer user_data)
+{
+	ProgressRecord *rec = &((ProgressRecord*) user_data)[id == NULL? 0 : 1];
+
+	rec->count++;
+	rec->last_percentage = percentage;
+	rec->last_bytes_done = bytes_done;
+	rec->last_bytes_total = bytes_total;
+	rec->last_rate = rate;
+}
+
+static gint64
+test_progress_clock_cb (gpointer user_data)
+{
+	return *((gint64*) user_data);
+}
+
+static gboolean
+test_progress_timeout_cb (gpointer user_data)
+{
+	*((gboolean*) user_data) = TRUE;
+	return G_SOURCE_REMOVE;
+}
+
+void
+test_progress_aggregator ()
+{
+	ProgressRecord rec[2];
+	gint64 now;
+	gboolean timed_out = FALSE;
+	guint timeout_id;
+	g_autoptr(LiProgressAggregator) agg = NULL;
+
+	memset (rec, 0, sizeof (rec));
+
+	/* all times are taken from our own clock, only the trailing
+	 * edge needs the (real) time window to pass as well */
+	now = G_USEC_PER_SEC;
+	agg = li_progress_aggregator_new (50, test_progress_record_cb, rec);
+	li_progress_aggregator_set_clock (agg, test_progress_clock_cb, &now);
+
+	/* the first update is emitted right away */
+	li_progress_aggregator_update (agg, NULL, 10, 100, 1000);
+	g_assert_cmpint (rec[0].count, ==, 1);
+	g_assert_cmpint (rec[0].last_percentage, ==, 10);
+
+	/* updates within the window are coalesced */
+	now += 10 * 1000;
+	li_progress_aggregator_update (agg, NULL, 20, 200, 1000);
+	li_progress_aggregator_update (agg, NULL, 30, 300, 1000);
+	g_assert_cmpint (rec[0].count, ==, 1);
+
+	/* items are tracked independently, and unchanged values are dropped */
+	li_progress_aggregator_update (agg, "foobar/1.0", 50, 0, 0);
+	li_progress_aggregator_update (agg, "foobar/1.0", 50, 0, 0);
+	g_assert_cmpint (rec[1].count, ==, 1);
+
+	/* held back updates are emitted with their latest values */
+	li_progress_aggregator_flush (agg);
+	g_assert_cmpint (rec[0].count, ==, 2);
+	g_assert_cmpint (rec[0].last_percentage, ==, 30);
+	g_assert_cmpint (rec[0].last_bytes_done, ==, 300);
+	g_assert_cmpint (rec[0].last_bytes_total, ==, 1000);
+	g_assert_cmpint (rec[1].count, ==, 1);
+
+	/* after the window, updates pass again, with the throughput since the first one */
+	now = 2 * G_USEC_PER_SEC;
+	li_progress_aggregator_update (agg, NULL, 40, 1100, 1000);
+	g_assert_cmpint (rec[0].count, ==, 3);
+	g_assert_cmpint (rec[0].last_rate, ==, 1000);
+
+	/* a held back update is emitted once its window has passed, without further updates */
+	now += 10 * 1000;
+	li_progress_aggregator_update (agg, NULL, 50, 1200, 1000);
+	g_assert_cmpint (rec[0].count, ==, 3);
+	now += 100 * 1000;
+
+	timeout_id = g_timeout_add_seconds (10, test_progress_timeout_cb, &timed_out);
+	while ((rec[0].count < 4) && !timed_out)
+		g_main_context_iteration (NULL, TRUE);
+	g_assert (!timed_out);
+	g_source_remove (timeout_id);
+	g_assert_cmpint (rec[0].count, ==, 4);
+	g_assert_cmpint (rec[0].last_percentage, ==, 50);
+
+	/* completion is never held back */
+	now += 10 * 1000;
+	li_progress_aggregator_update (agg, NULL, 100, 1000, 1000);
+	g_assert_cmpint (rec[0].count, ==, 5);
+	g_assert_cmpint (rec[0].last_percentage, ==, 100);
+	li_progress_aggregator_flush (agg);
+	g_assert_cmpint (rec[0].count, ==, 5);
+
+	g_assert_cmpint (li_progress_estimate_eta (500, 1500, 100), ==, 11);
+	g_assert_cmpint (li_progress_estimate_eta (1500, 1500, 100), ==, 0);
+	g_assert_cmpint (li_progress_estimate_eta (500, 1500, 0), ==, 0);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -162,6 +433,10 @@ main (int argc, char **argv)
 	g_test_add_func ("/Limba/ConfigData", test_configdata);
 	g_test_add_func ("/Limba/PackageIndex", test_pkgindex);
 	g_test_add_func ("/Limba/CompareVersions", test_versions);
+	g_test_add_func ("/Limba/Checksums", test_checksums);
+	g_test_add_func ("/Limba/ChecksumBackends", test_checksum_backends);
+	g_test_add_func ("/Limba/RuntimeFingerprint", test_runtime_fingerprint);
+	g_test_add_func ("/Limba/ProgressAggregator", test_progress_aggregator);
 
 	ret = g_test_run ();
 	g_free (datadir);
@@ -24,6 +24,7 @@
 
 #include "li-keyring.h"
 #include "li-pkg-cache.h"
+#include "li-installed-db.h"
 #include "li-utils-private.h"
 
 static gchar *datadir = NULL;
@@ -50,6 +51,21 @@ test_remove_software ()
 	g_object_unref (mgr);
 }
 
+static void
+test_installer_progress_details_cb (LiInstaller *inst, guint percentage, guint64 bytes_done, guint64 bytes_total, guint64 rate, guint eta, guint *last_percentage)
+{
+	guint expected;
+
+	/* the overall progress is weighted by the bytes every step has to process */
+	g_assert_cmpint (bytes_total, >, 0);
+	g_assert_cmpint (bytes_done, <=, bytes_total);
+	expected = (guint) ((bytes_done * 100 + bytes_total / 2) / bytes_total);
+	g_assert_cmpint (ABS ((gint) percentage - (gint) expected), <=, 1);
+
+	g_assert_cmpint (percentage, >=, *last_percentage);
+	*last_percentage = percentage;
+}
+
 void
 test_installer_simple ()
 {
@@ -59,6 +75,7 @@ test_installer_simple ()
 	g_autofree gchar *fname_lib = NULL;
 	g_autofree gchar *gpg_key_fname = NULL;
 	LiTrustLevel tlevel;
+	guint last_percentage = 0;
 	GError *error = NULL;
 
 	fname_app = g_build_filename (datadir, "foobar.ipk", NULL);
@@ -106,8 +123,11 @@ test_installer_simple ()
 	g_assert_no_error (error);
 	g_assert (tlevel == LI_TRUST_LEVEL_MEDIUM);
 
+	g_signal_connect (inst, "progress-details",
+			  G_CALLBACK (test_installer_progress_details_cb), &last_percentage);
 	li_installer_install (inst, &error);
 	g_assert_no_error (error);
+	g_assert_cmpint (last_percentage, ==, 100);
 
 	g_object_unref (inst);
 }
@@ -146,6 +166,50 @@ test_manager ()
 	g_object_unref (mgr);
 }
 
+void
+test_installed_db ()
+{
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+	GHashTable *scanned;
+	GHashTable *loaded;
+	g_autoptr(LiInstalledDb) db_scan = NULL;
+	g_autoptr(LiInstalledDb) db_load = NULL;
+	GError *error = NULL;
+
+	/* scan the software root and write the database */
+	db_scan = li_installed_db_new ();
+	li_installed_db_rescan (db_scan, &error);
+	g_assert_no_error (error);
+	li_installed_db_save (db_scan, &error);
+	g_assert_no_error (error);
+
+	/* the database is still valid, so this loads it instead of scanning */
+	db_load = li_installed_db_new ();
+	li_installed_db_open (db_load, &error);
+	g_assert_no_error (error);
+
+	scanned = li_installed_db_get_packages (db_scan);
+	loaded = li_installed_db_get_packages (db_load);
+	g_assert_cmpint (g_hash_table_size (scanned), >, 0);
+	g_assert_cmpint (g_hash_table_size (loaded), ==, g_hash_table_size (scanned));
+
+	g_hash_table_iter_init (&iter, scanned);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		LiPkgInfo *pki_scan = LI_PKG_INFO (value);
+		LiPkgInfo *pki_load;
+
+		pki_load = g_hash_table_lookup (loaded, key);
+		g_assert (pki_load != NULL);
+		g_assert_cmpstr (li_pkg_info_get_id (pki_load), ==, li_pkg_info_get_id (pki_scan));
+		g_assert_cmpstr (li_pkg_info_get_format_version (pki_load), ==, li_pkg_info_get_format_version (pki_scan));
+		g_assert_cmpint (li_pkg_info_get_flags (pki_load), ==, li_pkg_info_get_flags (pki_scan));
+		g_assert_cmpstr (li_pkg_info_get_version (pki_load), ==, li_pkg_info_get_version (pki_scan));
+		g_assert_cmpstr (li_pkg_info_get_dependencies (pki_load), ==, li_pkg_info_get_dependencies (pki_scan));
+	}
+}
+
 void
 test_install_remove ()
 {
@@ -161,6 +225,9 @@ test_install_remove ()
 	/* test with manager if we can read required data */
 	test_manager ();
 
+	/* the installed-software database has to match the software root */
+	test_installed_db ();
+
 	/* uninstall once again */
 	test_remove_software ();
 }
@@ -196,6 +263,251 @@ test_repository ()
 	g_object_unref (repo);
 }
 
+void
+test_repository_import ()
+{
+	g_autofree gchar *rdir = NULL;
+	g_autofree gchar *pool_dir = NULL;
+	g_autofree gchar *assets_dir = NULL;
+	g_autofree gchar *fname_app = NULL;
+	g_autofree gchar *fname_lib = NULL;
+	g_autofree gchar *fname_bad = NULL;
+	g_autoptr(GPtrArray) fnames = NULL;
+	g_autoptr(GPtrArray) pool_files = NULL;
+	g_autoptr(GPtrArray) asset_files = NULL;
+	g_autoptr(LiRepository) repo = NULL;
+	GError *error = NULL;
+
+	rdir = li_utils_get_tmp_dir ("repo");
+	pool_dir = g_build_filename (rdir, "pool", NULL);
+	assets_dir = g_build_filename (rdir, "assets", NULL);
+	fname_app = g_build_filename (datadir, "foobar.ipk", NULL);
+	fname_lib = g_build_filename (datadir, "libfoo.ipk", NULL);
+	fname_bad = g_build_filename (datadir, "lidatafile.test", NULL);
+
+	repo = li_repository_new ();
+	li_repository_open (repo, rdir, &error);
+	g_assert_no_error (error);
+
+	/* one broken package, nothing may be added */
+	fnames = g_ptr_array_new ();
+	g_ptr_array_add (fnames, fname_app);
+	g_ptr_array_add (fnames, fname_bad);
+	g_ptr_array_add (fnames, fname_lib);
+	g_assert (!li_repository_add_packages (repo, fnames, &error));
+	g_assert (error != NULL);
+	g_clear_error (&error);
+
+	pool_files = li_utils_find_files (pool_dir, TRUE);
+	g_assert (pool_files == NULL || pool_files->len == 0);
+
+	/* the same package twice in a batch is rejected as a whole too */
+	g_ptr_array_set_size (fnames, 0);
+	g_ptr_array_add (fnames, fname_lib);
+	g_ptr_array_add (fnames, fname_lib);
+	g_assert (!li_repository_add_packages (repo, fnames, &error));
+	g_assert_error (error, LI_REPOSITORY_ERROR, LI_REPOSITORY_ERROR_FAILED);
+	g_clear_error (&error);
+
+	/* no icons of rejected packages may be left behind */
+	asset_files = li_utils_find_files (assets_dir, TRUE);
+	g_assert (asset_files == NULL || asset_files->len == 0);
+
+	/* nothing was registered, so all packages can be added now */
+	g_ptr_array_set_size (fnames, 0);
+	g_ptr_array_add (fnames, fname_app);
+	g_ptr_array_add (fnames, fname_lib);
+	li_repository_add_packages (repo, fnames, &error);
+	g_assert_no_error (error);
+
+	/* ...but only once */
+	li_repository_add_package (repo, fname_app, &error);
+	g_assert_error (error, LI_REPOSITORY_ERROR, LI_REPOSITORY_ERROR_FAILED);
+	g_clear_error (&error);
+
+	li_repository_save (repo, &error);
+	g_assert_no_error (error);
+
+	li_delete_dir_recursive (rdir);
+}
+
+/**
+ * test_load_index_shards:
+ *
+ * Merge the shards of all package indices, as listed in the checksum cache
+ * of the repository, into @index.
+ */
+static void
+test_load_index_shards (const gchar *rdir, LiPkgIndex *index)
+{
+	guint i;
+	g_autofree gchar *fname = NULL;
+	g_autofree gchar *data = NULL;
+	g_auto(GStrv) lines = NULL;
+	GError *error = NULL;
+
+	fname = g_build_filename (rdir, ".index-checksums", NULL);
+	g_file_get_contents (fname, &data, NULL, &error);
+	g_assert_no_error (error);
+
+	lines = g_strsplit (data, "\n", -1);
+	for (i = 0; lines[i] != NULL; i++) {
+		g_auto(GStrv) parts = NULL;
+		g_auto(GStrv) name = NULL;
+		g_autofree gchar *index_dir = NULL;
+		g_autofree gchar *basename = NULL;
+		g_autofree gchar *shard_fname = NULL;
+		g_autoptr(GFile) file = NULL;
+
+		parts = g_strsplit (lines[i], "\t", 4);
+		if (g_strv_length (parts) != 4)
+			continue;
+		name = g_strsplit (parts[1], "#", 2);
+		if ((g_strv_length (name) != 2) || !g_str_has_suffix (name[0], "/Index.gz"))
+			continue;
+
+		index_dir = g_path_get_dirname (name[0]);
+		basename = g_strdup_printf ("%s.gz", parts[0]);
+		shard_fname = g_build_filename (rdir, index_dir, "shards", basename, NULL);
+		g_assert (g_file_test (shard_fname, G_FILE_TEST_IS_REGULAR));
+
+		file = g_file_new_for_path (shard_fname);
+		li_pkg_index_load_file (index, file, &error);
+		g_assert_no_error (error);
+	}
+}
+
+/**
+ * test_load_full_indices:
+ */
+static void
+test_load_full_indices (const gchar *rdir, LiPkgIndex *index)
+{
+	guint i;
+	g_autofree gchar *indices_dir = NULL;
+	g_autoptr(GPtrArray) files = NULL;
+	GError *error = NULL;
+
+	indices_dir = g_build_filename (rdir, "indices", NULL);
+	files = li_utils_find_files_matching (indices_dir, "Index.gz", TRUE);
+	g_assert (files != NULL);
+	g_assert_cmpint (files->len, >, 0);
+
+	for (i = 0; i < files->len; i++) {
+		g_autoptr(GFile) file = NULL;
+
+		file = g_file_new_for_path ((const gchar*) g_ptr_array_index (files, i));
+		li_pkg_index_load_file (index, file, &error);
+		g_assert_no_error (error);
+	}
+}
+
+/**
+ * test_assert_same_packages:
+ */
+static void
+test_assert_same_packages (LiPkgIndex *idx1, LiPkgIndex *idx2)
+{
+	guint i;
+	GPtrArray *pkgs;
+
+	g_assert_cmpint (li_pkg_index_get_packages_count (idx1), ==, li_pkg_index_get_packages_count (idx2));
+
+	pkgs = li_pkg_index_get_packages (idx1);
+	for (i = 0; i < pkgs->len; i++) {
+		guint j;
+		gboolean found = FALSE;
+		GPtrArray *other = li_pkg_index_get_packages (idx2);
+		LiPkgInfo *pki = LI_PKG_INFO (g_ptr_array_index (pkgs, i));
+
+		for (j = 0; j < other->len; j++) {
+			LiPkgInfo *pki2 = LI_PKG_INFO (g_ptr_array_index (other, j));
+			if (g_strcmp0 (li_pkg_info_get_id (pki), li_pkg_info_get_id (pki2)) == 0) {
+				g_assert_cmpstr (li_pkg_info_get_checksum_sha256 (pki), ==, li_pkg_info_get_checksum_sha256 (pki2));
+				found = TRUE;
+				break;
+			}
+		}
+		g_assert (found);
+	}
+}
+
+
+void
+test_repository_incremental ()
+{
+	g_autofree gchar *rdir = NULL;
+	g_autofree gchar *sig_fname = NULL;
+	g_autofree gchar *sig1 = NULL;
+	g_autofree gchar *sig2 = NULL;
+	g_autofree gchar *sig3 = NULL;
+	g_autofree gchar *fname_app = NULL;
+	g_autofree gchar *fname_lib = NULL;
+	g_autoptr(LiRepository) repo = NULL;
+	g_autoptr(LiPkgIndex) shard_index = NULL;
+	g_autoptr(LiPkgIndex) full_index = NULL;
+	GError *error = NULL;
+
+	rdir = li_utils_get_tmp_dir ("repo");
+	sig_fname = g_build_filename (rdir, "indices", "Indices.gpg", NULL);
+	fname_app = g_build_filename (datadir, "foobar.ipk", NULL);
+	fname_lib = g_build_filename (datadir, "libfoo.ipk", NULL);
+
+	repo = li_repository_new ();
+	li_repository_open (repo, rdir, &error);
+	g_assert_no_error (error);
+
+	li_repository_add_package (repo, fname_lib, &error);
+	g_assert_no_error (error);
+	li_repository_save (repo, &error);
+	g_assert_no_error (error);
+	g_file_get_contents (sig_fname, &sig1, NULL, &error);
+	g_assert_no_error (error);
+
+	/* nothing is dirty, so nothing is written or signed again */
+	li_repository_save (repo, &error);
+	g_assert_no_error (error);
+	g_file_get_contents (sig_fname, &sig2, NULL, &error);
+	g_assert_no_error (error);
+	g_assert_cmpstr (sig1, ==, sig2);
+
+	/* a reopened repository knows its indices are unchanged, too */
+	g_object_unref (repo);
+	repo = li_repository_new ();
+	li_repository_open (repo, rdir, &error);
+	g_assert_no_error (error);
+	li_repository_save (repo, &error);
+	g_assert_no_error (error);
+	g_free (sig2);
+	g_file_get_contents (sig_fname, &sig2, NULL, &error);
+	g_assert_no_error (error);
+	g_assert_cmpstr (sig1, ==, sig2);
+
+	/* adding a package marks the index dirty */
+	li_repository_add_package (repo, fname_app, &error);
+	g_assert_no_error (error);
+	li_repository_save (repo, &error);
+	g_assert_no_error (error);
+	g_file_get_contents (sig_fname, &sig3, NULL, &error);
+	g_assert_no_error (error);
+	g_assert_cmpstr (sig1, !=, sig3);
+
+	/* merging the shards has to yield the complete indices */
+	shard_index = li_pkg_index_new ();
+	test_load_index_shards (rdir, shard_index);
+	full_index = li_pkg_index_new ();
+	test_load_full_indices (rdir, full_index);
+	g_assert_cmpint (li_pkg_index_get_packages_count (full_index), ==, 2);
+	test_assert_same_packages (full_index, shard_index);
+	test_assert_same_packages (shard_index, full_index);
+
+	/* rebuilding the icon data on demand works on a published repository */
+	li_repository_create_icon_tarballs (repo, &error);
+	g_assert_no_error (error);
+
+	li_delete_dir_recursive (rdir);
+}
+
 void
 test_install_from_repo ()
 {
@@ -239,12 +551,47 @@ test_pkg_cache_setup ()
 	g_object_unref (cache);
 }
 
+void
+test_pkg_cache_components ()
+{
+	const gchar *cid = NULL;
+	const gchar *name = NULL;
+	g_autoptr(LiPkgCache) cache = NULL;
+	g_autoptr(GVariant) data = NULL;
+	g_autoptr(GVariant) translations = NULL;
+	GError *error = NULL;
+
+	cache = li_pkg_cache_new ();
+	li_pkg_cache_open (cache, &error);
+	g_assert_no_error (error);
+
+	/* unknown packages have no metadata */
+	g_assert (li_pkg_cache_get_component_data (cache, "nonexistent/1.0") == NULL);
+	g_assert (li_pkg_cache_get_component_data (cache, "") == NULL);
+
+	/* the sample repository ships AppStream metadata for foobar */
+	data = li_pkg_cache_get_component_data (cache, "foobar/1.0");
+	g_assert (data != NULL);
+	g_assert (g_variant_is_of_type (data, G_VARIANT_TYPE_VARDICT));
+	g_assert (g_variant_lookup (data, "id", "&s", &cid));
+	g_assert (cid != NULL && cid[0] != '\0');
+	g_assert (g_variant_lookup (data, "name", "&s", &name));
+	g_assert (name != NULL && name[0] != '\0');
+
+	/* translation maps are internal to the cache */
+	translations = g_variant_lookup_value (data, "name-translations", NULL);
+	g_assert (translations == NULL);
+}
+
 void
 test_pkg_cache ()
 {
 	/* set up package cache */
 	test_pkg_cache_setup ();
 
+	/* look up metadata in the component cache */
+	test_pkg_cache_components ();
+
 	/* try to install something from the repository */
 	test_install_from_repo ();
 }
@@ -282,6 +629,8 @@ main (int argc, char **argv)
 
 	g_test_add_func ("/Limba/InstallRemove", test_install_remove);
 	g_test_add_func ("/Limba/Repository", test_repository);
+	g_test_add_func ("/Limba/RepositoryImport", test_repository_import);
+	g_test_add_func ("/Limba/RepositoryIncremental", test_repository_incremental);
 	g_test_add_func ("/Limba/PackageCache", test_pkg_cache);
 
 	ret = g_test_run ();
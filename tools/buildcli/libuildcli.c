@@ -122,16 +122,122 @@ bcli_repo_add_package (const gchar *fname, const gchar *repodir)
 		goto out;
 	}
 
-	li_repository_create_icon_tarballs (repo, &error);
+out:
+	g_free (rdir);
+	g_object_unref (repo);
+	if (error != NULL)
+		g_error_free (error);
+
+	return res;
+}
+
+/**
+ * bcli_fname_cmp:
+ */
+static gint
+bcli_fname_cmp (gconstpointer a, gconstpointer b)
+{
+	return g_strcmp0 (*((const gchar**) a), *((const gchar**) b));
+}
+
+/**
+ * bcli_collect_package_files:
+ *
+ * Add @path to @files, or all IPK files in it if it is a directory.
+ */
+static gboolean
+bcli_collect_package_files (GPtrArray *files, const gchar *path, GError **error)
+{
+	GDir *dir;
+	const gchar *fname;
+	g_autoptr(GPtrArray) dir_files = NULL;
+	guint i;
+
+	if (!g_file_test (path, G_FILE_TEST_IS_DIR)) {
+		g_ptr_array_add (files, g_strdup (path));
+		return TRUE;
+	}
+
+	dir = g_dir_open (path, 0, error);
+	if (dir == NULL)
+		return FALSE;
+
+	dir_files = g_ptr_array_new_with_free_func (g_free);
+	while ((fname = g_dir_read_name (dir)) != NULL) {
+		if (g_str_has_suffix (fname, ".ipk"))
+			g_ptr_array_add (dir_files, g_build_filename (path, fname, NULL));
+	}
+	g_dir_close (dir);
+
+	/* the order of packages in the indices should not depend on the filesystem */
+	g_ptr_array_sort (dir_files, bcli_fname_cmp);
+	for (i = 0; i < dir_files->len; i++)
+		g_ptr_array_add (files, g_strdup (g_ptr_array_index (dir_files, i)));
+
+	return TRUE;
+}
+
+/**
+ * bcli_repo_import_packages:
+ * @args: The packages or package directories to import, followed by the repository directory
+ *
+ * The arguments are in the same order as for "repo-add".
+ */
+static gint
+bcli_repo_import_packages (gchar **args, guint n_args)
+{
+	gint res = 0;
+	guint i;
+	const gchar *repodir;
+	GError *error = NULL;
+	g_autoptr(LiRepository) repo = NULL;
+	g_autoptr(GPtrArray) files = NULL;
+
+	if (n_args < 2) {
+		li_print_stderr (_("You need to specify the packages or directories to import, and the repository."));
+		return 2;
+	}
+	repodir = args[n_args - 1];
+
+	files = g_ptr_array_new_with_free_func (g_free);
+	for (i = 0; i < n_args - 1; i++) {
+		if (!bcli_collect_package_files (files, args[i], &error)) {
+			li_print_stderr (_("Unable to read package directory: %s"), error->message);
+			res = 1;
+			goto out;
+		}
+	}
+	if (files->len == 0) {
+		li_print_stderr (_("No packages found to import."));
+		res = 2;
+		goto out;
+	}
+
+	repo = li_repository_new ();
+	li_repository_open (repo, repodir, &error);
+	if (error != NULL) {
+		li_print_stderr (_("Failed to open repository: %s"), error->message);
+		res = 1;
+		goto out;
+	}
+
+	li_repository_add_packages (repo, files, &error);
 	if (error != NULL) {
-		li_print_stderr (_("Failed to update icon tarball: %s"), error->message);
+		li_print_stderr (_("Failed to add packages: %s"), error->message);
 		res = 1;
 		goto out;
 	}
 
+	li_repository_save (repo, &error);
+	if (error != NULL) {
+		li_print_stderr (_("Failed to save repository indices: %s"), error->message);
+		res = 1;
+		goto out;
+	}
+
+	li_print_stdout (_("Added %u packages to the repository."), files->len);
+
 out:
-	g_free (rdir);
-	g_object_unref (repo);
 	if (error != NULL)
 		g_error_free (error);
 
@@ -258,7 +364,8 @@ libuild_get_summary ()
 	g_string_append_printf (string, "  %s - %s\n", "run [DIRECTORY]", _("Build the software following its build recipe."));
 	g_string_append_printf (string, "  %s - %s\n\n", "run-shell [DIRECTORY]", _("Run an interactive shell in the virtual build environment."));
 	g_string_append_printf (string, "  %s - %s\n", "repo-init [DIRECTORY]", _("Initialize a new repository in DIRECTORY."));
-	g_string_append_printf (string, "  %s - %s\n\n", "repo-add [PKGNAME] [DIRECTORY]", _("Add a package to the repository."));
+	g_string_append_printf (string, "  %s - %s\n", "repo-add [PKGNAME] [DIRECTORY]", _("Add a package to the repository."));
+	g_string_append_printf (string, "  %s - %s\n\n", "repo-import PKGNAME|PKGDIR... DIRECTORY", _("Add many packages, or all packages in a directory, to the repository."));
 	g_string_append_printf (string, "  %s - %s\n", "make-template", _("Create sources for a new package."));
 
 	return g_string_free (string, FALSE);
@@ -343,6 +450,8 @@ main (int argc, char *argv[])
 		exit_code = bcli_repo_init (value1);
 	} else if (g_strcmp0 (command, "repo-add") == 0) {
 		exit_code = bcli_repo_add_package (value1, value2);
+	} else if (g_strcmp0 (command, "repo-import") == 0) {
+		exit_code = bcli_repo_import_packages (&argv[2], argc - 2);
 	} else if (g_strcmp0 (command, "run") == 0) {
 		exit_code = bcli_execute_build (value1, FALSE);
 	} else if (g_strcmp0 (command, "run-shell") == 0) {
@@ -26,6 +26,7 @@
 #include <signal.h>
 #include <stdlib.h>
 #include <limba.h>
+#include "li-pkg-cache.h"
 
 #include "li-console-utils.h"
 
@@ -62,13 +63,21 @@ static gint
 lipa_list_software (void)
 {
 	LiManager *mgr;
+	g_autoptr(LiPkgCache) cache = NULL;
 	g_autoptr(GPtrArray) sw = NULL;
+	g_autoptr(GError) cache_error = NULL;
 	guint i;
 	gint exit_code = 0;
 	GError *error = NULL;
 
 	mgr = li_manager_new ();
 
+	/* the component cache gives us localized names of available software */
+	cache = li_pkg_cache_new ();
+	li_pkg_cache_open (cache, &cache_error);
+	if (cache_error != NULL)
+		g_debug ("Unable to open package cache: %s", cache_error->message);
+
 	sw = li_manager_get_software_list (mgr, &error);
 	if (error != NULL) {
 		li_print_stderr (_("An error occured while fetching the software-list: %s"), error->message);
@@ -78,6 +87,8 @@ lipa_list_software (void)
 
 	for (i = 0; i < sw->len; i++) {
 		gchar *state;
+		const gchar *name = NULL;
+		g_autoptr(GVariant) cpt_data = NULL;
 		LiPkgInfo *pki = LI_PKG_INFO (g_ptr_array_index (sw, i));
 
 		if (li_pkg_info_has_flag (pki, LI_PACKAGE_FLAG_INSTALLED))
@@ -87,10 +98,14 @@ lipa_list_software (void)
 		else
 			state = g_strdup ("?");
 
+		cpt_data = li_pkg_cache_get_component_data (cache, li_pkg_info_get_id (pki));
+		if ((cpt_data == NULL) || !g_variant_lookup (cpt_data, "name", "&s", &name))
+			name = li_pkg_info_get_appname (pki);
+
 		g_print ("[%s]...%s:\t\t%s %s\n",
 				state,
 				li_pkg_info_get_id (pki),
-				li_pkg_info_get_appname (pki),
+				name,
 				li_pkg_info_get_version (pki));
 		g_free (state);
 	}
@@ -24,10 +24,12 @@
 #include <limba.h>
 #include <li-utils-private.h>
 #include <li-run.h>
+#include <li-launch-desc.h>
 
 #include <sys/mount.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -36,12 +38,65 @@
 
 #include <gio/gio.h>
 
+/* start time of the current launch phase */
+static gint64 phase_start = 0;
+
+/**
+ * phase_done:
+ *
+ * Record the time spent in a launch phase, if tracing is enabled.
+ */
+static void
+phase_done (const gchar *phase)
+{
+	li_run_trace_end (phase, phase_start);
+	phase_start = li_run_trace_begin ();
+}
+
+/**
+ * get_desc_lowerdirs:
+ *
+ * Get the overlay layers to mount from the launch descriptor.
+ * We prefer the flattened runtime, so we don't stack lots of layers.
+ */
+static const gchar*
+get_desc_lowerdirs (LiLaunchDesc *desc)
+{
+	if ((desc->flat_lowerdirs != NULL) && (g_strcmp0 (g_getenv ("LIMBA_FLAT_RUNTIME"), "0") != 0))
+		return desc->flat_lowerdirs;
+	return desc->lowerdirs;
+}
+
+/**
+ * lease_flat_runtime:
+ *
+ * Keep the flattened runtime we are about to use from being removed.
+ * The lease is inherited by the application and by a cached environment,
+ * so it is never released explicitly. If the tree is going away, we use
+ * the layers of the runtime members instead.
+ */
+static void
+lease_flat_runtime (LiLaunchDesc *desc)
+{
+	if ((desc == NULL) || (desc->flat_lowerdirs == NULL))
+		return;
+	if (get_desc_lowerdirs (desc) != desc->flat_lowerdirs)
+		return;
+
+	if (li_runtime_lease_flat_tree (desc->flat_dir) < 0) {
+		g_debug ("Not using flattened runtime '%s': It is being removed.", desc->flat_dir);
+		g_free (desc->flat_lowerdirs);
+		desc->flat_lowerdirs = NULL;
+	}
+}
+
 /**
  * mount_app_bundle:
  * @pkgid: A software identifier ("name/version")
+ * @desc: The precompiled launch descriptor of the software, or %NULL
  */
 static int
-mount_app_bundle (const gchar *pkgid)
+mount_app_bundle (const gchar *pkgid, LiLaunchDesc *desc)
 {
 	int res = 0;
 	gchar *main_data_path = NULL;
@@ -53,6 +108,8 @@ mount_app_bundle (const gchar *pkgid)
 	LiPkgInfo *pki = NULL;
 	g_autofree gchar *newroot = NULL;
 	g_autofree gchar *approot_dir = NULL;
+	gint64 trace_start;
+	guint layers;
 	GError *error = NULL;
 
 	newroot = li_run_env_setup ();
@@ -62,6 +119,14 @@ mount_app_bundle (const gchar *pkgid)
 	}
 	approot_dir = g_build_filename (newroot, "app", NULL);
 
+	trace_start = li_run_trace_begin ();
+	lowerdirs = g_string_new ("");
+	if (desc != NULL) {
+		/* we already know everything, no need to load any metadata */
+		g_string_append_printf (lowerdirs, "%s:", get_desc_lowerdirs (desc));
+		goto mount;
+	}
+
 	/* check if the software exists */
 	main_data_path = g_build_filename (LI_SOFTWARE_ROOT, pkgid, "data", NULL);
 	fname = g_build_filename (LI_SOFTWARE_ROOT, pkgid, "control", NULL);
@@ -88,7 +153,6 @@ mount_app_bundle (const gchar *pkgid)
 		goto out;
 	}
 
-	lowerdirs = g_string_new ("");
 	if (g_strcmp0 (runtime_uuid, "None") != 0) {
 		/* mount the desired runtime */
 		g_autoptr(LiRuntime) rt = NULL;
@@ -103,7 +167,8 @@ mount_app_bundle (const gchar *pkgid)
 			goto out;
 		}
 
-		rt_members = (gchar**) g_hash_table_get_keys_as_array (li_runtime_get_members (rt), NULL);
+		/* same order as in the flattened tree */
+		rt_members = li_runtime_dup_member_ids (rt);
 
 		/* build our lowerdir directive */
 		for (i = 0; rt_members[i] != NULL; i++) {
@@ -111,17 +176,27 @@ mount_app_bundle (const gchar *pkgid)
 		}
 
 		/* cleanup */
-		g_free (rt_members);
+		g_strfreev (rt_members);
 	}
 
 	/* append main data path */
 	g_string_append_printf (lowerdirs, "%s:", main_data_path);
 
+mount:
+	li_run_trace_end ("load-metadata", trace_start);
+
 	/* safeguard against the case where only one path is set for lowerdir.
 	 * OFS doesn't like that, so we always set the root path as source too.
 	 * This also terminates the lowerdir parameter. */
 	g_string_append_printf (lowerdirs, "%s", approot_dir);
 
+	trace_start = li_run_trace_begin ();
+	for (tmp = lowerdirs->str, layers = 1; *tmp != '\0'; tmp++) {
+		if (*tmp == ':')
+			layers++;
+	}
+	g_debug ("Mounting application with %u layers", layers);
+
 	tmp = g_strdup_printf ("lowerdir=%s", lowerdirs->str);
 	res = mount ("overlay", approot_dir,
 				 "overlay", MS_MGC_VAL | MS_RDONLY | MS_NOSUID, tmp);
@@ -131,6 +206,37 @@ mount_app_bundle (const gchar *pkgid)
 		res = 1;
 		goto out;
 	}
+	li_run_trace_end ("overlay-mount", trace_start);
+
+	/* make the dynamic linker use the cache of this software, so it doesn't need to search for libraries */
+	if ((desc != NULL) && (desc->ld_cache != NULL)) {
+		int cache_fd;
+		struct stat cache_buf;
+		g_autofree gchar *ld_cache_target = NULL;
+		g_autofree gchar *ld_cache_source = NULL;
+
+		/* check the file we actually mount, it might have been replaced since the descriptor was loaded */
+		cache_fd = open (desc->ld_cache, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+		if ((cache_fd < 0) ||
+		    (fstat (cache_fd, &cache_buf) != 0) ||
+		    !S_ISREG (cache_buf.st_mode) ||
+		    (cache_buf.st_uid != 0) ||
+		    ((cache_buf.st_mode & (S_IWGRP | S_IWOTH)) != 0)) {
+			g_debug ("Not using linker cache '%s': It is not owned by root, or writable by others.", desc->ld_cache);
+			g_free (desc->ld_cache);
+			desc->ld_cache = NULL;
+		} else {
+			ld_cache_source = g_strdup_printf ("/proc/self/fd/%i", cache_fd);
+			ld_cache_target = g_build_filename (newroot, "etc", "ld.so.cache", NULL);
+			if (mount (ld_cache_source, ld_cache_target, NULL, MS_BIND, NULL) != 0) {
+				g_debug ("Unable to use linker cache: %s", strerror (errno));
+				g_free (desc->ld_cache);
+				desc->ld_cache = NULL;
+			}
+		}
+		if (cache_fd >= 0)
+			close (cache_fd);
+	}
 
 	if (!li_run_env_enter (newroot)) {
 		res = 3;
@@ -150,6 +256,79 @@ out:
 	return res;
 }
 
+/**
+ * append_file_stamp:
+ *
+ * Add the identity and modification time of @fname to @str.
+ */
+static void
+append_file_stamp (GString *str, const gchar *what, const gchar *fname)
+{
+	struct stat buf;
+
+	if ((fname == NULL) || (stat (fname, &buf) != 0)) {
+		g_string_append_printf (str, "%s:none\n", what);
+		return;
+	}
+
+	g_string_append_printf (str, "%s:%s:%lu.%lu:%ld.%09ld\n",
+				what, fname,
+				(gulong) buf.st_dev, (gulong) buf.st_ino,
+				(long) buf.st_mtim.tv_sec, (long) buf.st_mtim.tv_nsec);
+}
+
+/**
+ * get_bundle_stamp:
+ * @pkgid: A software identifier ("name/version")
+ * @desc: The launch descriptor of the software, or %NULL
+ *
+ * Get a string which changes whenever the environment of the
+ * software bundle needs to be recreated, because anything which
+ * influences its mounts has changed.
+ */
+static gchar*
+get_bundle_stamp (const gchar *pkgid, LiLaunchDesc *desc)
+{
+	g_autoptr(GString) str = NULL;
+	g_autofree gchar *fname = NULL;
+
+	str = g_string_new ("");
+
+	fname = g_build_filename (LI_SOFTWARE_ROOT, pkgid, "control", NULL);
+	append_file_stamp (str, "control", fname);
+	append_file_stamp (str, "runtimes", LI_SOFTWARE_ROOT "/runtimes");
+	g_free (fname);
+	fname = g_build_filename (LI_SOFTWARE_ROOT, pkgid, LI_LAUNCH_DESC_FNAME, NULL);
+	append_file_stamp (str, "descriptor", fname);
+
+	if (desc != NULL) {
+		g_auto(GStrv) layers = NULL;
+		guint i;
+
+		/* the layers we mount, and the state of the flattened runtime */
+		g_string_append_printf (str, "lowerdirs:%s\n", get_desc_lowerdirs (desc));
+		layers = g_strsplit (get_desc_lowerdirs (desc), ":", -1);
+		for (i = 0; layers[i] != NULL; i++)
+			append_file_stamp (str, "layer", layers[i]);
+
+		append_file_stamp (str, "ldcache", desc->ld_cache);
+	}
+
+	return g_compute_checksum_for_string (G_CHECKSUM_SHA256, str->str, str->len);
+}
+
+/**
+ * scope_helper_setup:
+ *
+ * The scope helper doesn't need any of our privileges.
+ */
+static void
+scope_helper_setup (gpointer user_data)
+{
+	if (!li_run_drop_caps ())
+		_exit (1);
+}
+
 /**
  * main:
  */
@@ -160,18 +339,37 @@ main (gint argc, gchar *argv[])
 	g_autofree gchar *swname = NULL;
 	g_autofree gchar *scope_name = NULL;
 	g_autofree gchar *executable = NULL;
+	g_autofree gchar *stamp = NULL;
+	g_autoptr(LiLaunchDesc) desc = NULL;
+	const gchar *scope_mode;
+	gint scope_fd = -1;
+	gint64 launch_start;
 	struct utsname uts_data;
 	g_auto(GStrv) strv = NULL;
 	gchar **child_argv = NULL;
 	guint i;
 	GError *error = NULL;
 
+	launch_start = g_get_monotonic_time ();
+
+	/* the records of cached environments can only be opened while we are root */
+	if ((argc > 1) && (g_getenv ("LIMBA_FAST_LAUNCH") != NULL)) {
+		g_auto(GStrv) key_parts = g_strsplit (argv[1], ":", 2);
+		if (key_parts[0] != NULL)
+			li_run_env_cache_prepare (key_parts[0]);
+	}
+
 	/* ensue we have required capabilities, and drop all the ones we don't need */
 	if (!li_run_acquire_caps ()) {
 		g_printerr ("This program needs the suid bit to be set to function correctly.\n");
 		return 3;
 	}
 
+	/* we can only open the trace output after dropping root privileges */
+	li_run_trace_init ();
+	li_run_trace_end ("acquire-caps", launch_start);
+	phase_start = li_run_trace_begin ();
+
 	if (argc <= 1) {
 		fprintf (stderr, "No application-id was specified.\n");
 		return 1;
@@ -193,10 +391,38 @@ main (gint argc, gchar *argv[])
 	/* get the bundle name */
 	swname = g_strdup (strv[0]);
 
-	/* create our environment */
-	ret = mount_app_bundle (swname);
-	if (ret > 0)
-		goto error;
+	/* place this process in a new cgroup. Unless requested otherwise, talking to
+	 * systemd happens in a helper while we set up the environment, as it can take
+	 * quite a while. We wait for the helper before exec()ing the application, so
+	 * the application and all its children are placed in the new scope. */
+	scope_name = li_str_replace (swname, "/", "");
+	scope_mode = g_getenv ("LIMBA_SCOPE");
+	if ((g_strcmp0 (scope_mode, "none") != 0) && (g_strcmp0 (scope_mode, "sync") != 0))
+		scope_fd = li_add_to_new_scope_async ("app", scope_name, scope_helper_setup, NULL);
+	phase_done ("init");
+
+	/* use the precompiled launch descriptor, if we have a valid one */
+	desc = li_launch_desc_load (swname);
+	lease_flat_runtime (desc);
+	phase_done ("load-descriptor");
+
+	/* reuse an environment we created earlier, if fast-launch was requested */
+	if (g_getenv ("LIMBA_FAST_LAUNCH") != NULL)
+		stamp = get_bundle_stamp (swname, desc);
+
+	if ((stamp != NULL) && li_run_env_enter_cached (stamp)) {
+		g_debug ("Using cached environment for %s", swname);
+	} else {
+		/* create our environment */
+		ret = mount_app_bundle (swname, desc);
+		if (ret > 0)
+			goto error;
+
+		/* keep it around for the next launch */
+		if (stamp != NULL)
+			li_run_env_cache (stamp);
+	}
+	phase_done ("setup-environment");
 
 	/* Now we have everything we need CAP_SYS_ADMIN for, so drop that capability */
 	if (!li_run_drop_caps ()) {
@@ -204,15 +430,19 @@ main (gint argc, gchar *argv[])
 		ret = 3;
 		goto error;
 	}
+	phase_done ("drop-caps");
 
-	/* place this process in a new cgroup */
-	scope_name = li_str_replace (swname, "/", "");
-	li_add_to_new_scope ("app", scope_name, &error);
-	if (error != NULL) {
-		fprintf (stderr, "Could not add process to new scope. %s\n", error->message);
-		g_error_free (error);
-		goto error;
+	if (g_strcmp0 (scope_mode, "none") == 0) {
+		g_debug ("Not creating a new scope.");
+	} else if (g_strcmp0 (scope_mode, "sync") == 0) {
+		li_add_to_new_scope ("app", scope_name, &error);
+		if (error != NULL) {
+			fprintf (stderr, "Could not add process to new scope. %s\n", error->message);
+			g_error_free (error);
+			goto error;
+		}
 	}
+	phase_done ("scope");
 
 	/* determine which command we should execute */
 	if (g_strcmp0 (strv[1], "sh") == 0) {
@@ -224,7 +454,10 @@ main (gint argc, gchar *argv[])
 	}
 
 	/* set LD_LIBRARY_PATH and PATH */
-	li_run_env_set_path_variables ();
+	if (desc != NULL)
+		li_launch_desc_apply_env (desc);
+	else
+		li_run_env_set_path_variables ();
 
 	child_argv = malloc ((argc) * sizeof (char *));
 	if (child_argv == NULL) {
@@ -246,9 +479,17 @@ main (gint argc, gchar *argv[])
 		child_argv[i] = argv[i+1];
 	}
 	child_argv[i++] = NULL;
+	phase_done ("prepare-exec");
+
+	/* the application must not start before it was moved to its scope */
+	li_add_to_new_scope_finish (scope_fd);
+	scope_fd = -1;
+	phase_done ("scope-wait");
+	li_run_trace_end ("runapp", launch_start);
 
 	return execv (executable, child_argv);
 
 error:
+	li_add_to_new_scope_finish (scope_fd);
 	return ret;
 }